@@ -0,0 +1,20 @@
+# toolchain for cross-compiling to aarch64 linux. the resulting binaries are
+# run by ctest under qemu-user, using the toolchain's sysroot for the dynamic
+# loader and libraries
+
+set(CMAKE_SYSTEM_NAME Linux)
+set(CMAKE_SYSTEM_PROCESSOR aarch64)
+
+set(CMAKE_C_COMPILER aarch64-linux-gnu-gcc)
+set(CMAKE_CXX_COMPILER aarch64-linux-gnu-g++)
+
+if(NOT AARCH64_SYSROOT)
+  set(AARCH64_SYSROOT /usr/aarch64-linux-gnu)
+endif()
+
+set(CMAKE_FIND_ROOT_PATH ${AARCH64_SYSROOT})
+set(CMAKE_FIND_ROOT_PATH_MODE_PROGRAM NEVER)
+set(CMAKE_FIND_ROOT_PATH_MODE_LIBRARY ONLY)
+set(CMAKE_FIND_ROOT_PATH_MODE_INCLUDE ONLY)
+
+set(CMAKE_CROSSCOMPILING_EMULATOR qemu-aarch64 -L ${AARCH64_SYSROOT})
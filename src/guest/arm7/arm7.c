@@ -11,13 +11,16 @@
 #include "jit/frontend/armv3/armv3_guest.h"
 #include "jit/ir/ir.h"
 #include "jit/jit.h"
+#include "jit/jit_profile.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
-#else
-#include "jit/backend/interp/interp_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
 #endif
+#include "jit/backend/interp/interp_backend.h"
 
 struct arm7 {
   struct device;
@@ -204,6 +207,7 @@ static struct jit_guest *arm7_guest_create(struct arm7 *arm) {
   guest->membase = arm7_base(arm->dc->mem);
   guest->mem = arm->dc->mem;
   guest->lookup = &arm7_lookup;
+  guest->lookup_reg = &arm7_lookup_reg;
   guest->r8 = &arm7_read8;
   guest->r16 = &arm7_read16;
   guest->r32 = &arm7_read32;
@@ -235,21 +239,48 @@ static int arm7_init(struct device *dev) {
   arm->frontend = armv3_frontend_create(arm->guest);
 #if ARCH_X64
   DEFINE_JIT_CODE_BUFFER(arm7_code);
-  arm->backend = x64_backend_create(arm->guest, arm7_code, sizeof(arm7_code));
-#else
-  arm->backend = interp_backend_create(arm->guest, arm->frontend);
+  if (!OPTION_jit_interp) {
+    arm->backend = x64_backend_create(arm->guest, arm7_code, sizeof(arm7_code));
+  }
+#elif ARCH_A64
+  DEFINE_JIT_CODE_BUFFER(arm7_code);
+  if (!OPTION_jit_interp) {
+    arm->backend = a64_backend_create(arm->guest, arm7_code, sizeof(arm7_code));
+  }
 #endif
-  arm->jit = jit_create("arm7", arm->frontend, arm->backend);
+  if (!arm->backend) {
+    arm->backend = interp_backend_create(arm->guest, arm->frontend);
+  }
+  arm->jit =
+      jit_create("arm7", arm->frontend, arm->backend, OPTION_jit_arm7_passes);
 
   return 1;
 }
 
 #ifdef HAVE_IMGUI
 void arm7_debug_menu(struct arm7 *arm) {
+  struct jit *jit = arm->jit;
+
   if (igBeginMainMenuBar()) {
     if (igBeginMenu("ARM7", 1)) {
       if (igMenuItem("clear cache", NULL, 0, 1)) {
-        jit_invalidate_code(arm->jit);
+        jit_invalidate_code(jit);
+      }
+
+      if (!jit->profile_code) {
+        if (igMenuItem("start profiling code", NULL, 0, 1)) {
+          jit->profile_code = 1;
+          jit_invalidate_code(jit);
+        }
+      } else {
+        if (igMenuItem("stop profiling code", NULL, 1, 1)) {
+          jit->profile_code = 0;
+          jit_invalidate_code(jit);
+        }
+      }
+
+      if (igMenuItem("block profile", NULL, jit->profile->show_menu, 1)) {
+        jit->profile->show_menu = !jit->profile->show_menu;
       }
 
       igEndMenu();
@@ -257,6 +288,10 @@ void arm7_debug_menu(struct arm7 *arm) {
 
     igEndMainMenuBar();
   }
+
+  if (jit->profile->show_menu) {
+    jit_profile_debug_menu(jit->profile);
+  }
 }
 #endif
 
@@ -230,10 +230,22 @@ static void holly_g2_dma(struct holly *hl, int ch) {
 static void holly_update_interrupts(struct holly *hl) {
   struct sh4 *sh4 = hl->dc->sh4;
 
+  /* the two highest bits of SB_ISTNRM indicate the OR'ed result of all of the
+     bits in SB_ISTEXT and SB_ISTERR, respectively. they're kept up to date
+     here so the register can be read directly, without a callback */
+  uint32_t istnrm = *hl->SB_ISTNRM & 0x3fffffff;
+  *hl->SB_ISTNRM = istnrm;
+  if (*hl->SB_ISTEXT) {
+    *hl->SB_ISTNRM |= 0x40000000;
+  }
+  if (*hl->SB_ISTERR) {
+    *hl->SB_ISTNRM |= 0x80000000;
+  }
+
   /* trigger the respective level-encoded interrupt on the sh4 interrupt
      controller */
   {
-    if ((*hl->SB_ISTNRM & *hl->SB_IML6NRM) ||
+    if ((istnrm & *hl->SB_IML6NRM) ||
         (*hl->SB_ISTERR & *hl->SB_IML6ERR) ||
         (*hl->SB_ISTEXT & *hl->SB_IML6EXT)) {
       sh4_raise_interrupt(sh4, SH4_INT_IRL_9);
@@ -243,7 +255,7 @@ static void holly_update_interrupts(struct holly *hl) {
   }
 
   {
-    if ((*hl->SB_ISTNRM & *hl->SB_IML4NRM) ||
+    if ((istnrm & *hl->SB_IML4NRM) ||
         (*hl->SB_ISTERR & *hl->SB_IML4ERR) ||
         (*hl->SB_ISTEXT & *hl->SB_IML4EXT)) {
       sh4_raise_interrupt(sh4, SH4_INT_IRL_11);
@@ -253,7 +265,7 @@ static void holly_update_interrupts(struct holly *hl) {
   }
 
   {
-    if ((*hl->SB_ISTNRM & *hl->SB_IML2NRM) ||
+    if ((istnrm & *hl->SB_IML2NRM) ||
         (*hl->SB_ISTERR & *hl->SB_IML2ERR) ||
         (*hl->SB_ISTEXT & *hl->SB_IML2EXT)) {
       sh4_raise_interrupt(sh4, SH4_INT_IRL_13);
@@ -278,6 +290,12 @@ static uint32_t *holly_interrupt_status(struct holly *hl,
 }
 
 static int holly_init(struct device *dev) {
+  struct holly *hl = (struct holly *)dev;
+  struct dreamcast *dc = hl->dc;
+
+  sh4_map_regs(dc->mem, SH4_HOLLY_REG_BEGIN, NUM_HOLLY_REGS, hl->reg,
+               holly_cb);
+
   return 1;
 }
 
@@ -416,24 +434,10 @@ REG_W32(holly_cb, SB_SFRES) {
   LOG_FATAL("software reset through SB_SFRES unsupported");
 }
 
-REG_R32(holly_cb, SB_ISTNRM) {
-  struct holly *hl = dc->holly;
-  /* note that the two highest bits indicate the OR'ed result of all of the
-     bits in SB_ISTEXT and SB_ISTERR, respectively, and writes to these two
-     bits are ignored */
-  uint32_t v = *hl->SB_ISTNRM & 0x3fffffff;
-  if (*hl->SB_ISTEXT) {
-    v |= 0x40000000;
-  }
-  if (*hl->SB_ISTERR) {
-    v |= 0x80000000;
-  }
-  return v;
-}
-
 REG_W32(holly_cb, SB_ISTNRM) {
   struct holly *hl = dc->holly;
-  /* writing a 1 clears the interrupt */
+  /* writing a 1 clears the interrupt. writes to the two highest bits are
+     ignored, they're recomputed by holly_update_interrupts */
   *hl->SB_ISTNRM &= ~value;
   holly_update_interrupts(hl);
 }
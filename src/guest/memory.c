@@ -45,10 +45,27 @@
 #define MEM_PAGE_SHIFT MEM_OFFSET_BITS
 #define MEM_OFFSET_MASK ((1 << MEM_OFFSET_BITS) - 1)
 
+#define MEM_MAX_REG_FILES 8
+
+/* a device's register file, mapped to an mmio area. registers without a read
+   callback hold their current value in the backing store, and may be read
+   directly from it */
+struct reg_file {
+  uint32_t begin;
+  int num_regs;
+  uint32_t *regs;
+  const struct reg_cb *cbs;
+};
+
 /* address spaces provide different views of the same physical memory */
 struct address_space {
   uint8_t *base;
 
+  /* mask stripping the address bits which create mirrors of each area */
+  uint32_t mirror_mask;
+  struct reg_file reg_files[MEM_MAX_REG_FILES];
+  int num_reg_files;
+
   /* page table */
   uint8_t *ptrs[MEM_MAX_PAGES];
   mmio_read_cb read[MEM_MAX_PAGES];
@@ -126,6 +143,8 @@ enum {
 #define DEFINE_ADDRESS_SPACE(space)             \
   define_lookup_ex(space);                      \
   define_lookup(space);                         \
+  define_map_regs(space);                       \
+  define_lookup_reg(space);                     \
   define_memcpy(space);                         \
   define_memcpy_to_host(space);                 \
   define_memcpy_to_guest(space);                \
@@ -170,6 +189,43 @@ enum {
     space##_lookup_ex(mem, addr, userdata, ptr, read, write, NULL, NULL); \
   }
 
+#define define_map_regs(space)                                           \
+  void space##_map_regs(struct memory *mem, uint32_t begin, int num_regs, \
+                        uint32_t *regs, const struct reg_cb *cbs) {       \
+    struct address_space *as = &mem->space;                               \
+    CHECK_LT(as->num_reg_files, MEM_MAX_REG_FILES);                       \
+    struct reg_file *file = &as->reg_files[as->num_reg_files++];          \
+    file->begin = begin;                                                  \
+    file->num_regs = num_regs;                                            \
+    file->regs = regs;                                                    \
+    file->cbs = cbs;                                                      \
+  }
+
+#define define_lookup_reg(space)                                              \
+  uint8_t *space##_lookup_reg(struct memory *mem, uint32_t addr) {            \
+    struct address_space *as = &mem->space;                                   \
+    uint32_t phys = addr & as->mirror_mask;                                   \
+    int page = addr >> MEM_PAGE_SHIFT;                                        \
+    /* make sure the mirror is routed to the same handler as the register */ \
+    if (as->ptrs[page] ||                                                     \
+        as->read[page] != as->read[phys >> MEM_PAGE_SHIFT]) {                 \
+      return NULL;                                                            \
+    }                                                                         \
+    for (int i = 0; i < as->num_reg_files; i++) {                             \
+      struct reg_file *file = &as->reg_files[i];                              \
+      uint32_t n = (phys - file->begin) >> 2;                                 \
+      if (phys < file->begin || n >= (uint32_t)file->num_regs) {              \
+        continue;                                                             \
+      }                                                                       \
+      /* sub-word offsets don't map to the low bits of the register */       \
+      if ((phys & 0x3) || file->cbs[n].read) {                                \
+        return NULL;                                                          \
+      }                                                                       \
+      return (uint8_t *)&file->regs[n];                                       \
+    }                                                                         \
+    return NULL;                                                              \
+  }
+
 #define define_memcpy(space)                                                   \
   void space##_memcpy(struct memory *mem, uint32_t dst, uint32_t src,          \
                       int size) {                                              \
@@ -360,6 +416,8 @@ static void as_map(struct memory *mem, struct address_space *space,
 }
 
 static int as_init(struct address_space *space) {
+  space->mirror_mask = 0xffffffff;
+
   /* bind default handler */
   for (int i = 0; i < MEM_MAX_PAGES; i++) {
     space->read[i] = (mmio_read_cb)&mem_unhandled_read;
@@ -460,6 +518,8 @@ int sh4_init(struct memory *mem) {
     return 0;
   }
 
+  space->mirror_mask = SH4_ADDR_MASK;
+
   /* note, p0-p3 map to the entire external address space, while p4 only maps to
      the external regions in between the gaps in its own internal regions. these
      gaps map to areas 1-3 (0xe4000000-0xefffffff) and 6-7 (0xf8000000-
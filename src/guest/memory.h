@@ -6,6 +6,7 @@
 
 struct dreamcast;
 struct memory;
+struct reg_cb;
 
 /*
  * mmio callbacks and helpers
@@ -36,7 +37,10 @@ typedef void (*mmio_write_string_cb)(void *, uint32_t, const uint8_t *, int);
                       int size);                                           \
   void space##_lookup(struct memory *mem, uint32_t addr, void **userdata,  \
                       uint8_t **ptr, mmio_read_cb *read,                   \
-                      mmio_write_cb *write);
+                      mmio_write_cb *write);                               \
+  void space##_map_regs(struct memory *mem, uint32_t begin, int num_regs,  \
+                        uint32_t *regs, const struct reg_cb *cbs);         \
+  uint8_t *space##_lookup_reg(struct memory *mem, uint32_t addr);
 
 DECLARE_ADDRESS_SPACE(sh4)
 DECLARE_ADDRESS_SPACE(arm7)
@@ -332,6 +332,8 @@ static int pvr_init(struct device *dev) {
 
   pvr->vram = mem_vram(dc->mem, 0x0);
 
+  sh4_map_regs(dc->mem, SH4_PVR_REG_BEGIN, PVR_NUM_REGS, pvr->reg, pvr_cb);
+
   /* configure initial vsync interval */
   pvr_reconfigure_spg(pvr);
 
@@ -9,13 +9,16 @@
 #include "jit/frontend/sh4/sh4_frontend.h"
 #include "jit/frontend/sh4/sh4_guest.h"
 #include "jit/jit.h"
+#include "jit/jit_profile.h"
+#include "options.h"
 #include "stats.h"
 
 #if ARCH_X64
 #include "jit/backend/x64/x64_backend.h"
-#else
-#include "jit/backend/interp/interp_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
 #endif
+#include "jit/backend/interp/interp_backend.h"
 
 /* callbacks to service sh4_reg_read / sh4_reg_write calls */
 struct reg_cb sh4_cb[SH4_NUM_REGS];
@@ -189,6 +192,7 @@ static struct jit_guest *sh4_guest_create(struct sh4 *sh4) {
   guest->membase = sh4_base(sh4->dc->mem);
   guest->mem = sh4->dc->mem;
   guest->lookup = &sh4_lookup;
+  guest->lookup_reg = &sh4_lookup_reg;
   guest->r8 = &sh4_read8;
   guest->r16 = &sh4_read16;
   guest->r32 = &sh4_read32;
@@ -225,11 +229,20 @@ static int sh4_init(struct device *dev) {
   sh4->frontend = sh4_frontend_create(sh4->guest);
 #if ARCH_X64
   DEFINE_JIT_CODE_BUFFER(sh4_code);
-  sh4->backend = x64_backend_create(sh4->guest, sh4_code, sizeof(sh4_code));
-#else
-  sh4->backend = interp_backend_create(sh4->guest, sh4->frontend);
+  if (!OPTION_jit_interp) {
+    sh4->backend = x64_backend_create(sh4->guest, sh4_code, sizeof(sh4_code));
+  }
+#elif ARCH_A64
+  DEFINE_JIT_CODE_BUFFER(sh4_code);
+  if (!OPTION_jit_interp) {
+    sh4->backend = a64_backend_create(sh4->guest, sh4_code, sizeof(sh4_code));
+  }
 #endif
-  sh4->jit = jit_create("sh4", sh4->frontend, sh4->backend);
+  if (!sh4->backend) {
+    sh4->backend = interp_backend_create(sh4->guest, sh4->frontend);
+  }
+  sh4->jit =
+      jit_create("sh4", sh4->frontend, sh4->backend, OPTION_jit_sh4_passes);
 
   return 1;
 }
@@ -300,6 +313,22 @@ void sh4_debug_menu(struct sh4 *sh4) {
         }
       }
 
+      if (!jit->profile_code) {
+        if (igMenuItem("start profiling code", NULL, 0, 1)) {
+          jit->profile_code = 1;
+          jit_invalidate_code(jit);
+        }
+      } else {
+        if (igMenuItem("stop profiling code", NULL, 1, 1)) {
+          jit->profile_code = 0;
+          jit_invalidate_code(jit);
+        }
+      }
+
+      if (igMenuItem("block profile", NULL, jit->profile->show_menu, 1)) {
+        jit->profile->show_menu = !jit->profile->show_menu;
+      }
+
       if (igMenuItem("log reg access", NULL, sh4->log_regs, 1)) {
         sh4->log_regs = !sh4->log_regs;
       }
@@ -317,6 +346,10 @@ void sh4_debug_menu(struct sh4 *sh4) {
   if (sh4->tmu_stats) {
     sh4_tmu_debug_menu(sh4);
   }
+
+  if (jit->profile->show_menu) {
+    jit_profile_debug_menu(jit->profile);
+  }
 }
 #endif
 
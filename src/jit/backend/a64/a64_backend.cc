@@ -0,0 +1,956 @@
+#include "jit/backend/a64/a64_local.h"
+#include <aarch64/disasm-aarch64.h>
+#include <stdexcept>
+
+extern "C" {
+#include "core/exception_handler.h"
+#include "core/memory.h"
+#include "jit/backend/a64/a64_backend.h"
+#include "jit/backend/a64/a64_disassembler.h"
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_backend.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+/*
+ * a64 register layout
+ */
+
+/* clang-format off */
+const Register arg0 = x0;
+const Register arg1 = x1;
+const Register arg2 = x2;
+const Register arg3 = x3;
+const Register tmp0 = x9;
+const Register tmp1 = x10;
+const Register guestctx = x28;
+const Register guestmem = x27;
+const VRegister vtmp = v0;
+
+/* x16 / x17 (ip0 / ip1) and v31 are used as scratch registers by the macro
+   assembler, and x18 is reserved by some platforms. only the bottom 64 bits of
+   v8-v15 are callee-saved, so they're left alone entirely */
+const struct jit_register a64_registers[] = {
+    {"x0",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x0},
+    {"x1",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x1},
+    {"x2",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x2},
+    {"x3",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x3},
+    {"x4",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x4},
+    {"x5",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x5},
+    {"x6",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x6},
+    {"x7",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x7},
+    {"x8",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x8},
+    {"x9",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x9},
+    {"x10", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x10},
+    {"x11", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x11},
+    {"x12", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x12},
+    {"x13", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x13},
+    {"x14", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x14},
+    {"x15", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x15},
+    {"x16", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x16},
+    {"x17", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x17},
+    {"x18", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_I64,                (const void *)&x18},
+    {"x19", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x19},
+    {"x20", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x20},
+    {"x21", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x21},
+    {"x22", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x22},
+    {"x23", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x23},
+    {"x24", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x24},
+    {"x25", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x25},
+    {"x26", JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x26},
+    {"x27", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x27},
+    {"x28", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x28},
+    {"x29", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x29},
+    {"x30", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_I64,                (const void *)&x30},
+    {"v0",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v0},
+    {"v1",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v1},
+    {"v2",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v2},
+    {"v3",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v3},
+    {"v4",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v4},
+    {"v5",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v5},
+    {"v6",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v6},
+    {"v7",  JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v7},
+    {"v8",  JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v8},
+    {"v9",  JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v9},
+    {"v10", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v10},
+    {"v11", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v11},
+    {"v12", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v12},
+    {"v13", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v13},
+    {"v14", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v14},
+    {"v15", JIT_RESERVED | JIT_CALLEE_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v15},
+    {"v16", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v16},
+    {"v17", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v17},
+    {"v18", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v18},
+    {"v19", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v19},
+    {"v20", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v20},
+    {"v21", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v21},
+    {"v22", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v22},
+    {"v23", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v23},
+    {"v24", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v24},
+    {"v25", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v25},
+    {"v26", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v26},
+    {"v27", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v27},
+    {"v28", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v28},
+    {"v29", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v29},
+    {"v30", JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v30},
+    {"v31", JIT_RESERVED | JIT_CALLER_SAVE | JIT_REG_F64 | JIT_REG_V128, (const void *)&v31},
+};
+
+const int a64_num_registers = ARRAY_SIZE(a64_registers);
+/* clang-format on */
+
+/* the virtual counter, used for profiling in place of rdtsc */
+static const SystemRegister a64_cntvct_el0 = static_cast<SystemRegister>(
+    ((0x1 << SysO0_offset) | (0x3 << SysOp1_offset) | (0xe << CRn_offset) |
+     (0x0 << CRm_offset) | (0x2 << SysOp2_offset)) >>
+    ImmSystemRegister_offset);
+
+Register a64_backend_reg(struct a64_backend *backend,
+                         const struct ir_value *v) {
+  CHECK(v->reg >= 0 && v->reg < a64_num_registers);
+  const CPURegister *reg = (const CPURegister *)a64_registers[v->reg].data;
+  CHECK(reg->IsRegister());
+
+  /* values narrower than 64-bits are kept zero-extended in the w registers */
+  switch (v->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+      return Register::GetWRegFromCode(reg->GetCode());
+    case VALUE_I64:
+      return Register::GetXRegFromCode(reg->GetCode());
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+VRegister a64_backend_vreg(struct a64_backend *backend,
+                           const struct ir_value *v) {
+  CHECK(v->reg >= 0 && v->reg < a64_num_registers);
+  const CPURegister *reg = (const CPURegister *)a64_registers[v->reg].data;
+  CHECK(reg->IsVRegister());
+
+  switch (v->type) {
+    case VALUE_F32:
+      return VRegister::GetSRegFromCode(reg->GetCode());
+    case VALUE_F64:
+      return VRegister::GetDRegFromCode(reg->GetCode());
+    case VALUE_V128:
+      return VRegister(reg->GetCode(), kFormat4S);
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+/* unlike x64, there's no red zone below the stack pointer on a64. the stack
+   pointer is moved down before saving the registers, keeping it 16-byte
+   aligned */
+static int a64_backend_regs_size(struct a64_backend *backend, int mask) {
+  int size = 0;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    size += (r->flags & JIT_REG_I64) ? 8 : 16;
+  }
+
+  return ALIGN_UP(size, 16);
+}
+
+int a64_backend_push_regs(struct a64_backend *backend, int mask) {
+  int size = a64_backend_regs_size(backend, mask);
+  int offset = 0;
+
+  auto &e = *backend->codegen;
+
+  e.Sub(sp, sp, size);
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    const CPURegister *reg = (const CPURegister *)r->data;
+
+    if (r->flags & JIT_REG_I64) {
+      e.Str(Register::GetXRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 8;
+    } else {
+      e.Str(VRegister::GetQRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 16;
+    }
+  }
+
+  return size;
+}
+
+void a64_backend_pop_regs(struct a64_backend *backend, int mask) {
+  int size = a64_backend_regs_size(backend, mask);
+  int offset = 0;
+
+  auto &e = *backend->codegen;
+
+  for (int i = 0; i < a64_num_registers; i++) {
+    const struct jit_register *r = &a64_registers[i];
+
+    if ((r->flags & mask) != mask) {
+      continue;
+    }
+
+    const CPURegister *reg = (const CPURegister *)r->data;
+
+    if (r->flags & JIT_REG_I64) {
+      e.Ldr(Register::GetXRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 8;
+    } else {
+      e.Ldr(VRegister::GetQRegFromCode(reg->GetCode()), MemOperand(sp, offset));
+      offset += 16;
+    }
+  }
+
+  e.Add(sp, sp, size);
+}
+
+void a64_backend_load_mem(struct a64_backend *backend,
+                          const struct ir_value *dst, const MemOperand &src) {
+  auto &e = *backend->codegen;
+
+  switch (dst->type) {
+    case VALUE_I8:
+      e.Ldrb(a64_backend_reg(backend, dst), src);
+      break;
+    case VALUE_I16:
+      e.Ldrh(a64_backend_reg(backend, dst), src);
+      break;
+    case VALUE_I32:
+    case VALUE_I64:
+      e.Ldr(a64_backend_reg(backend, dst), src);
+      break;
+    case VALUE_F32:
+    case VALUE_F64:
+      e.Ldr(a64_backend_vreg(backend, dst), src);
+      break;
+    case VALUE_V128: {
+      VRegister vd = a64_backend_vreg(backend, dst);
+      e.Ldr(VRegister::GetQRegFromCode(vd.GetCode()), src);
+    } break;
+    default:
+      LOG_FATAL("unexpected load result type");
+      break;
+  }
+}
+
+void a64_backend_store_mem(struct a64_backend *backend, const MemOperand &dst,
+                           const struct ir_value *src) {
+  auto &e = *backend->codegen;
+
+  if (ir_is_constant(src)) {
+    /* there's no store immediate, the constant is first materialized in a
+       scratch register */
+    switch (src->type) {
+      case VALUE_I8:
+        e.Mov(tmp0.W(), (uint32_t)src->i8 & 0xff);
+        e.Strb(tmp0.W(), dst);
+        break;
+      case VALUE_I16:
+        e.Mov(tmp0.W(), (uint32_t)src->i16 & 0xffff);
+        e.Strh(tmp0.W(), dst);
+        break;
+      case VALUE_I32:
+      case VALUE_F32:
+        e.Mov(tmp0.W(), (uint32_t)src->i32);
+        e.Str(tmp0.W(), dst);
+        break;
+      case VALUE_I64:
+      case VALUE_F64:
+        e.Mov(tmp0, (uint64_t)src->i64);
+        e.Str(tmp0, dst);
+        break;
+      default:
+        LOG_FATAL("unexpected value type");
+        break;
+    }
+    return;
+  }
+
+  switch (src->type) {
+    case VALUE_I8:
+      e.Strb(a64_backend_reg(backend, src), dst);
+      break;
+    case VALUE_I16:
+      e.Strh(a64_backend_reg(backend, src), dst);
+      break;
+    case VALUE_I32:
+    case VALUE_I64:
+      e.Str(a64_backend_reg(backend, src), dst);
+      break;
+    case VALUE_F32:
+    case VALUE_F64:
+      e.Str(a64_backend_vreg(backend, src), dst);
+      break;
+    case VALUE_V128: {
+      VRegister vs = a64_backend_vreg(backend, src);
+      e.Str(VRegister::GetQRegFromCode(vs.GetCode()), dst);
+    } break;
+    default:
+      LOG_FATAL("unexpected store value type");
+      break;
+  }
+}
+
+void a64_backend_mov_value(struct a64_backend *backend, const Register &dst,
+                           const struct ir_value *v) {
+  auto &e = *backend->codegen;
+
+  if (ir_is_constant(v)) {
+    if (v->type == VALUE_I64) {
+      e.Mov(dst.X(), (uint64_t)v->i64);
+    } else {
+      e.Mov(dst.W(), (uint32_t)ir_zext_constant(v));
+    }
+    return;
+  }
+
+  if (v->type == VALUE_I64) {
+    e.Mov(dst.X(), a64_backend_reg(backend, v));
+  } else {
+    e.Mov(dst.W(), a64_backend_reg(backend, v));
+  }
+}
+
+/* operations on 8 and 16-bit values are performed on the full w register,
+   truncate their results to maintain the zero-extended invariant */
+void a64_backend_zext_result(struct a64_backend *backend, const Register &rd,
+                             enum ir_type type) {
+  auto &e = *backend->codegen;
+
+  switch (type) {
+    case VALUE_I8:
+      e.Uxtb(rd.W(), rd.W());
+      break;
+    case VALUE_I16:
+      e.Uxth(rd.W(), rd.W());
+      break;
+    default:
+      break;
+  }
+}
+
+/* raw branches to absolute addresses, used to reach the thunks. the offsets
+   are calculated inside of the exact assembly scope, after any pending pools
+   have been emitted */
+static int64_t a64_backend_branch_offset(MacroAssembler &e,
+                                         const void *target) {
+  intptr_t offset = (intptr_t)target - e.GetCursorAddress<intptr_t>();
+  CHECK_EQ(offset & 3, 0);
+  return offset >> 2;
+}
+
+void a64_backend_call(struct a64_backend *backend, const void *fn) {
+  auto &e = *backend->codegen;
+
+  {
+    vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+    int64_t offset = a64_backend_branch_offset(e, fn);
+
+    if (vixl::IsInt26(offset)) {
+      e.bl(offset);
+      return;
+    }
+  }
+
+  /* host functions may be out of range of bl when the code buffer isn't
+     placed near the text segment */
+  e.Mov(tmp0, (uint64_t)fn);
+  e.Blr(tmp0);
+}
+
+void a64_backend_jmp(struct a64_backend *backend, const void *addr) {
+  auto &e = *backend->codegen;
+
+  vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+  int64_t offset = a64_backend_branch_offset(e, addr);
+  CHECK(vixl::IsInt26(offset));
+  e.b(offset);
+}
+
+/* conditional branches have a range of +-1 MB, which is why the code buffer
+   is limited to 1 MB in size, see DEFINE_JIT_CODE_BUFFER */
+void a64_backend_jmp_cond(struct a64_backend *backend, Condition cond,
+                          const void *addr) {
+  auto &e = *backend->codegen;
+
+  vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+  int64_t offset = a64_backend_branch_offset(e, addr);
+  CHECK(vixl::IsInt19(offset));
+  e.b(offset, cond);
+}
+
+Label *a64_backend_block_label(struct a64_backend *backend,
+                               struct ir_block *block) {
+  struct a64_block_labels *labels = (struct a64_block_labels *)block->tag;
+  return &labels->block;
+}
+
+/* defer an instruction's slow path to the cold section, keeping it out of the
+   hot code. the emitter is responsible for branching to the path's cold label,
+   and for binding the resume label the path jumps back to when done. if the
+   cold section is full, NULL is returned and the slow path must be emitted
+   inline instead. see x64_backend_defer_cold for which paths aren't
+   deferred */
+struct a64_cold_path *a64_backend_defer_cold(
+    struct a64_backend *backend, struct ir_instr *instr,
+    void (*emit)(struct a64_backend *, MacroAssembler &, struct ir *,
+                 struct ir_instr *)) {
+  if (backend->num_cold_paths >= A64_MAX_COLD_PATHS) {
+    return NULL;
+  }
+
+  struct a64_cold_path *path = &backend->cold_paths[backend->num_cold_paths++];
+  path->emit = emit;
+  path->instr = instr;
+  path->cold = new Label();
+  path->resume = new Label();
+
+  return path;
+}
+
+static void a64_backend_emit_thunks(struct a64_backend *backend) {
+  auto &e = *backend->codegen;
+
+  /* the exception handler resumes execution in these thunks with the mmio
+     handler to call in tmp0 and the address to return to in the link
+     register, see a64_backend_handle_exception */
+  {
+    for (int i = 0; i < 32; i++) {
+      backend->load_thunk[i] = e.GetCursorAddress<void *>();
+
+      /* the zero register can't be the destination of an emitted load */
+      if (i == 31) {
+        e.Brk(0);
+        continue;
+      }
+
+      Register dst = Register::GetXRegFromCode(i);
+
+      /* save caller-saved registers that our code uses, the link register
+         and the mask to apply to the result */
+      int save_mask = JIT_ALLOCATE | JIT_CALLER_SAVE;
+      a64_backend_push_regs(backend, save_mask);
+      e.Stp(tmp1, lr, MemOperand(sp, -16, PreIndex));
+
+      /* call the mmio handler */
+      e.Blr(tmp0);
+
+      /* restore caller-saved registers */
+      e.Ldp(tmp1, lr, MemOperand(sp, 16, PostIndex));
+      a64_backend_pop_regs(backend, save_mask);
+
+      /* save mmio handler result. narrow results are masked to maintain the
+         zero-extended invariant, the upper bits of the returned register
+         are unspecified by the abi */
+      e.And(dst, x0, tmp1);
+
+      /* return to jit code */
+      e.Ret();
+    }
+  }
+
+  {
+    backend->store_thunk = e.GetCursorAddress<void *>();
+
+    /* save caller-saved registers that our code uses and the link register */
+    int save_mask = JIT_ALLOCATE | JIT_CALLER_SAVE;
+    a64_backend_push_regs(backend, save_mask);
+    e.Stp(tmp1, lr, MemOperand(sp, -16, PreIndex));
+
+    /* call the mmio handler */
+    e.Blr(tmp0);
+
+    /* restore caller-saved registers */
+    e.Ldp(tmp1, lr, MemOperand(sp, 16, PostIndex));
+    a64_backend_pop_regs(backend, save_mask);
+
+    /* return to jit code */
+    e.Ret();
+  }
+}
+
+static int a64_backend_handle_exception(struct jit_backend *base,
+                                        struct exception_state *ex) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  struct jit_guest *guest = backend->base.guest;
+
+  const uint32_t *data = (const uint32_t *)ex->thread_state.pc;
+
+  /* figure out the guest address that was being accessed */
+  const uint8_t *fault_addr = (const uint8_t *)ex->fault_addr;
+  const uint8_t *protected_start =
+      (const uint8_t *)ex->thread_state.r[guestmem.GetCode()];
+  uint32_t guest_addr = (uint32_t)(fault_addr - protected_start);
+
+  /* ensure it was an mmio address that caused the exception */
+  uint8_t *ptr;
+  guest->lookup(guest->mem, guest_addr, NULL, &ptr, NULL, NULL);
+
+  if (ptr) {
+    return 0;
+  }
+
+  /* it's assumed a fastmem ldr / str has triggered the exception */
+  struct a64_ldst ldst;
+  if (!a64_decode_ldst(data, &ldst) || ldst.rn != (int)guestmem.GetCode()) {
+    return 0;
+  }
+
+  /* instead of handling the mmio callback from inside of the exception
+     handler, force pc to the beginning of a thunk which will invoke the
+     callback once the exception handler has exited. this frees the callbacks
+     from any restrictions imposed by an exception handler, and also prevents
+     a possible recursive exception
+
+     the link register is set to the next instruction after the current
+     ldr / str. compiled code never has a live value in it, as it's clobbered
+     by each call */
+  ex->thread_state.r30 = ex->thread_state.pc + 4;
+
+  if (ldst.is_load) {
+    /* prep argument registers (memory object, guest_addr) for read function */
+    ex->thread_state.r[arg0.GetCode()] = (uint64_t)guest->mem;
+    ex->thread_state.r[arg1.GetCode()] = (uint64_t)guest_addr;
+
+    /* prep function call address and result mask for thunk */
+    switch (ldst.operand_size) {
+      case 1:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->r8;
+        ex->thread_state.r[tmp1.GetCode()] = 0xff;
+        break;
+      case 2:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->r16;
+        ex->thread_state.r[tmp1.GetCode()] = 0xffff;
+        break;
+      case 4:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->r32;
+        ex->thread_state.r[tmp1.GetCode()] = 0xffffffff;
+        break;
+      case 8:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->r64;
+        ex->thread_state.r[tmp1.GetCode()] = UINT64_MAX;
+        break;
+    }
+
+    /* resume execution in the thunk once the exception handler exits */
+    ex->thread_state.pc = (uint64_t)backend->load_thunk[ldst.rt];
+  } else {
+    /* prep argument registers (memory object, guest_addr, value) for write
+       function. register 31 is the zero register for str */
+    ex->thread_state.r[arg0.GetCode()] = (uint64_t)guest->mem;
+    ex->thread_state.r[arg1.GetCode()] = (uint64_t)guest_addr;
+    ex->thread_state.r[arg2.GetCode()] =
+        ldst.rt == 31 ? 0 : ex->thread_state.r[ldst.rt];
+
+    /* prep function call address for thunk */
+    switch (ldst.operand_size) {
+      case 1:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w8;
+        break;
+      case 2:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w16;
+        break;
+      case 4:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w32;
+        break;
+      case 8:
+        ex->thread_state.r[tmp0.GetCode()] = (uint64_t)guest->w64;
+        break;
+    }
+
+    /* resume execution in the thunk once the exception handler exits */
+    ex->thread_state.pc = (uint64_t)backend->store_thunk;
+  }
+
+  return 1;
+}
+
+static void a64_backend_dump_code(struct jit_backend *base, const uint8_t *addr,
+                                  int size, FILE *output) {
+  Decoder decoder;
+  Disassembler disasm;
+  decoder.AppendVisitor(&disasm);
+
+  fprintf(output, "#==--------------------------------------------------==#\n");
+  fprintf(output, "# a64\n");
+  fprintf(output, "#==--------------------------------------------------==#\n");
+
+  for (int i = 0; i < size; i += kInstructionSize) {
+    const Instruction *instr = (const Instruction *)(addr + i);
+    decoder.Decode(instr);
+    fprintf(output, "# 0x%08x  %s\n", i, disasm.GetOutput());
+  }
+}
+
+void a64_backend_emit_branch(struct a64_backend *backend, struct ir *ir,
+                             const ir_value *target) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  Label *block_label = NULL;
+  int dispatch_type = 0;
+
+  /* update guest pc */
+  if (target) {
+    if (ir_is_constant(target)) {
+      if (target->type == VALUE_BLOCK) {
+        block_label = a64_backend_block_label(backend, target->blk);
+
+        struct ir_value *addr = ir_get_meta(ir, target->blk, IR_META_ADDR);
+        e.Mov(tmp0.W(), (uint32_t)addr->i32);
+        e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+        dispatch_type = 0;
+      } else {
+        uint32_t addr = target->i32;
+        e.Mov(tmp0.W(), addr);
+        e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+        dispatch_type = 1;
+      }
+    } else {
+      Register addr = a64_backend_reg(backend, target);
+      e.Str(addr, MemOperand(guestctx, guest->offset_pc));
+      dispatch_type = 3;
+    }
+  } else {
+    dispatch_type = 2;
+  }
+
+  /* jump directly to the block / to dispatch */
+  switch (dispatch_type) {
+    case 0:
+      e.B(block_label);
+      break;
+    case 1:
+      a64_backend_call(backend, backend->dispatch_static);
+      break;
+    case 2:
+      a64_backend_jmp(backend, backend->dispatch_dynamic);
+      break;
+    case 3:
+      a64_dispatch_emit_inline_cache(backend);
+      break;
+  }
+}
+
+static void a64_backend_emit_epilog(struct a64_backend *backend, struct ir *ir,
+                                    struct ir_block *block) {
+  /* if the block didn't branch to another address, return to dispatch */
+  struct ir_instr *last_instr =
+      list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (last_instr->op != OP_BRANCH && last_instr->op != OP_BRANCH_COND) {
+    a64_backend_emit_branch(backend, ir, NULL);
+  }
+}
+
+static void a64_backend_emit_prolog(struct a64_backend *backend, struct ir *ir,
+                                    struct ir_block *block) {
+  struct jit_guest *guest = backend->base.guest;
+
+  auto &e = *backend->codegen;
+
+  /* count number of instrs / cycles in the block */
+  int num_instrs = 0;
+  int num_cycles = 0;
+
+  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+    if (instr->op == OP_SOURCE_INFO) {
+      num_instrs += 1;
+      num_cycles += instr->arg[1]->i32;
+    }
+  }
+
+  /* only yield at the entry block and at the top of loops. this bounds the
+     time spent without yielding to a single pass through the ir, while
+     leaving the context unobservable between the other blocks */
+  if (ir_is_yield_point(ir, block)) {
+    /* yield control once remaining cycles are executed */
+    e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+    e.Cmp(tmp0.W(), 0);
+    a64_backend_jmp_cond(backend, lt, backend->dispatch_exit);
+
+    /* yield control to any pending interrupts */
+    e.Ldr(tmp0, MemOperand(guestctx, guest->offset_interrupts));
+    e.Cmp(tmp0, 0);
+    a64_backend_jmp_cond(backend, ne, backend->dispatch_interrupt);
+  }
+
+  /* update debug run counts */
+  e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+  e.Sub(tmp0.W(), tmp0.W(), num_cycles);
+  e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_cycles));
+  e.Ldr(tmp0.W(), MemOperand(guestctx, guest->offset_instrs));
+  e.Add(tmp0.W(), tmp0.W(), num_instrs);
+  e.Str(tmp0.W(), MemOperand(guestctx, guest->offset_instrs));
+
+  /* update profile counters. the argument registers are free to use as
+     scratch, nothing is live in them between instructions */
+  struct ir_value *profile = ir_get_meta(ir, block, IR_META_PROFILE);
+
+  if (profile) {
+    struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+
+    if (block == head) {
+      /* attribute the host time elapsed since the last block was entered to
+         it, and make this block the last one entered */
+      e.Mrs(x0, a64_cntvct_el0);
+      e.Mov(x1, (uint64_t)&backend->prof);
+      e.Ldr(x2, MemOperand(x1, offsetof(struct a64_profile, last_tick)));
+      e.Sub(x2, x0, x2);
+      e.Str(x0, MemOperand(x1, offsetof(struct a64_profile, last_tick)));
+      e.Ldr(x0, MemOperand(x1, offsetof(struct a64_profile, last_entry)));
+      e.Ldr(x3, MemOperand(x0, offsetof(struct jit_profile_entry, num_ticks)));
+      e.Add(x3, x3, x2);
+      e.Str(x3, MemOperand(x0, offsetof(struct jit_profile_entry, num_ticks)));
+      e.Mov(x0, (uint64_t)profile->i64);
+      e.Str(x0, MemOperand(x1, offsetof(struct a64_profile, last_entry)));
+      e.Ldr(x3, MemOperand(x0, offsetof(struct jit_profile_entry, num_execs)));
+      e.Add(x3, x3, 1);
+      e.Str(x3, MemOperand(x0, offsetof(struct jit_profile_entry, num_execs)));
+    } else {
+      e.Mov(x0, (uint64_t)profile->i64);
+    }
+
+    e.Ldr(x3, MemOperand(x0, offsetof(struct jit_profile_entry, num_cycles)));
+    e.Add(x3, x3, num_cycles);
+    e.Str(x3, MemOperand(x0, offsetof(struct jit_profile_entry, num_cycles)));
+  }
+}
+
+static void a64_backend_emit(struct a64_backend *backend, struct ir *ir,
+                             jit_emit_cb emit_cb, void *emit_data) {
+  auto &e = *backend->codegen;
+
+  CHECK_LT(ir->locals_size, A64_STACK_SIZE);
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    int first = 1;
+    uint8_t *block_addr = e.GetCursorAddress<uint8_t *>();
+
+    /* label each block for local branches */
+    e.Bind(a64_backend_block_label(backend, block));
+
+    a64_backend_emit_prolog(backend, ir, block);
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      /* call emit callback for each guest block / instruction enabling users
+         to map each to their corresponding host address */
+      if (emit_cb && instr->op == OP_SOURCE_INFO) {
+        uint32_t guest_addr = instr->arg[0]->i32;
+
+        if (first) {
+          emit_cb(emit_data, JIT_EMIT_BLOCK, guest_addr, block_addr);
+          first = 0;
+        }
+
+        uint8_t *instr_addr = e.GetCursorAddress<uint8_t *>();
+        emit_cb(emit_data, JIT_EMIT_INSTR, guest_addr, instr_addr);
+      }
+
+      struct jit_emitter *emitter = &a64_emitters[instr->op];
+      a64_emit_cb emit = (a64_emit_cb)emitter->func;
+      CHECK_NOTNULL(emit);
+      emit(backend, e, ir, instr);
+    }
+
+    a64_backend_emit_epilog(backend, ir, block);
+  }
+
+  /* emit the slow paths after all of the hot code, so the hot code is packed
+     as densely as possible */
+  if (emit_cb) {
+    emit_cb(emit_data, JIT_EMIT_COLD, 0, e.GetCursorAddress<uint8_t *>());
+  }
+
+  for (int i = 0; i < backend->num_cold_paths; i++) {
+    struct a64_cold_path *path = &backend->cold_paths[i];
+
+    e.Bind(path->cold);
+    path->emit(backend, e, ir, path->instr);
+    e.B(path->resume);
+  }
+
+  e.FinalizeCode();
+}
+
+/* the code buffer after the thunks is split into equally sized regions, with
+   any remainder going to the last region */
+static int a64_backend_region_begin(struct a64_backend *backend, int region) {
+  return A64_THUNK_SIZE + region * backend->region_size;
+}
+
+static int a64_backend_region_size(struct a64_backend *backend, int region) {
+  if (region == A64_NUM_REGIONS - 1) {
+    return backend->code_size - a64_backend_region_begin(backend, region);
+  }
+  return backend->region_size;
+}
+
+static int a64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
+                                     uint8_t **addr, int *size,
+                                     jit_emit_cb emit_cb, void *emit_data) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  int res = 1;
+  uint8_t *code = backend->code + backend->code_offset;
+
+  /* the assembler's labels are bound to offsets in its own buffer, so a new
+     assembler is created for each call, spanning from the current offset to
+     the end of the current region */
+  int region_end = a64_backend_region_begin(backend, backend->curr_region) +
+                   a64_backend_region_size(backend, backend->curr_region);
+
+  MacroAssembler e(code, region_end - backend->code_offset,
+                   PositionDependentCode);
+  backend->codegen = &e;
+  backend->num_cold_paths = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    block->tag = (intptr_t) new a64_block_labels();
+  }
+
+  /* try to generate the a64 code. if the region overflows let the jit know so
+     it can evict the next region and try again */
+  try {
+    a64_backend_emit(backend, ir, emit_cb, emit_data);
+  } catch (const std::runtime_error &) {
+    res = 0;
+  }
+
+  int emitted = (int)e.GetSizeOfCodeGenerated();
+
+  /* the buffer's labels must be released while the assembler is alive */
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    delete (struct a64_block_labels *)block->tag;
+    block->tag = 0;
+  }
+
+  for (int i = 0; i < backend->num_cold_paths; i++) {
+    delete backend->cold_paths[i].cold;
+    delete backend->cold_paths[i].resume;
+  }
+
+  /* on overflow, the partially emitted code is left for the next region to
+     overwrite */
+  if (res) {
+    backend->code_offset += emitted;
+    CPU::EnsureIAndDCacheCoherency(code, emitted);
+  }
+
+  backend->codegen = NULL;
+
+  /* return code address */
+  *addr = code;
+  *size = emitted;
+
+  return res;
+}
+
+static void a64_backend_next_region(struct jit_backend *base, uint8_t **addr,
+                                    int *size) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  backend->curr_region = (backend->curr_region + 1) % A64_NUM_REGIONS;
+
+  int begin = a64_backend_region_begin(backend, backend->curr_region);
+  backend->code_offset = begin;
+
+  *addr = backend->code + begin;
+  *size = a64_backend_region_size(backend, backend->curr_region);
+}
+
+static void a64_backend_reset(struct jit_backend *base) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  /* avoid reemitting thunks by just resetting the offset to a safe spot after
+     the thunks */
+  backend->curr_region = 0;
+  backend->code_offset = A64_THUNK_SIZE;
+}
+
+static void a64_backend_destroy(struct jit_backend *base) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  a64_dispatch_shutdown(backend);
+
+  free(backend);
+}
+
+struct jit_backend *a64_backend_create(struct jit_guest *guest, void *code,
+                                       int code_size) {
+  struct a64_backend *backend =
+      (struct a64_backend *)calloc(1, sizeof(struct a64_backend));
+
+  backend->base.guest = guest;
+  backend->base.destroy = &a64_backend_destroy;
+
+  /* compile interface */
+  backend->base.registers = a64_registers;
+  backend->base.num_registers = ARRAY_SIZE(a64_registers);
+  backend->base.emitters = a64_emitters;
+  backend->base.num_emitters = ARRAY_SIZE(a64_emitters);
+  backend->base.reset = &a64_backend_reset;
+  backend->base.next_region = &a64_backend_next_region;
+  backend->base.assemble_code = &a64_backend_assemble_code;
+  backend->base.dump_code = &a64_backend_dump_code;
+  backend->base.handle_exception = &a64_backend_handle_exception;
+
+  /* dispatch interface */
+  backend->base.run_code = &a64_dispatch_run_code;
+  backend->base.lookup_code = &a64_dispatch_lookup_code;
+  backend->base.cache_code = &a64_dispatch_cache_code;
+  backend->base.invalidate_code = &a64_dispatch_invalidate_code;
+  backend->base.patch_edge = &a64_dispatch_patch_edge;
+  backend->base.restore_edge = &a64_dispatch_restore_edge;
+
+  /* setup codegen buffer. conditional branches to the thunks can only reach
+     1 MB */
+  CHECK_LE(code_size, 0x100000);
+
+  int r = protect_pages(code, code_size, ACC_READWRITEEXEC);
+  CHECK(r);
+
+  backend->code = (uint8_t *)code;
+  backend->code_size = code_size;
+  backend->region_size = (code_size - A64_THUNK_SIZE) / A64_NUM_REGIONS;
+  backend->prof.last_entry = &backend->prof.idle;
+
+  /* emit initial thunks */
+  {
+    MacroAssembler e(backend->code, A64_THUNK_SIZE, PositionDependentCode);
+    backend->codegen = &e;
+
+    a64_dispatch_init(backend);
+    a64_dispatch_emit_thunks(backend);
+    a64_backend_emit_thunks(backend);
+
+    e.FinalizeCode();
+    CHECK_LT(e.GetSizeOfCodeGenerated(), A64_THUNK_SIZE);
+    CPU::EnsureIAndDCacheCoherency(backend->code,
+                                                  A64_THUNK_SIZE);
+
+    backend->codegen = NULL;
+  }
+
+  a64_backend_reset(&backend->base);
+
+  return &backend->base;
+}
@@ -0,0 +1,23 @@
+#include "jit/backend/a64/a64_disassembler.h"
+
+int a64_decode_ldst(const uint32_t *data, struct a64_ldst *ldst) {
+  uint32_t instr = *data;
+
+  /* test for the integer LDR / STR (register offset) encoding
+     size 111 0 00 opc 1 Rm option S 10 Rn Rt
+
+     the backend only emits these for fastmem accesses, the signed and
+     prefetch variants aren't expected */
+  if ((instr & 0x3fe00c00) != 0x38200800 &&
+      (instr & 0x3fe00c00) != 0x38600800) {
+    return 0;
+  }
+
+  ldst->is_load = (instr >> 22) & 1;
+  ldst->operand_size = 1 << (instr >> 30);
+  ldst->rt = instr & 0x1f;
+  ldst->rn = (instr >> 5) & 0x1f;
+  ldst->rm = (instr >> 16) & 0x1f;
+
+  return 1;
+}
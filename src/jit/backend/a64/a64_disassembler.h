@@ -0,0 +1,16 @@
+#ifndef A64_DISASSEMBLER_H
+#define A64_DISASSEMBLER_H
+
+#include <stdint.h>
+
+struct a64_ldst {
+  int is_load;
+  int operand_size;
+  int rt;
+  int rn;
+  int rm;
+};
+
+int a64_decode_ldst(const uint32_t *data, struct a64_ldst *ldst);
+
+#endif
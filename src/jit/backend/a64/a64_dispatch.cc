@@ -0,0 +1,370 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "core/core.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+/* log out pc each time dispatch is entered for debugging */
+#define LOG_DISPATCH_EVERY_N 0
+
+/* controls if edges are added and managed between static branches. the first
+   time each branch is hit, its destination block will be dynamically looked
+   up. if this is enabled, an edge will be added between the two blocks, and
+   the branch will be patched to directly jmp to the destination block,
+   avoiding the need for redundant lookups */
+#define LINK_STATIC_BRANCHES !LOG_DISPATCH_EVERY_N
+
+static inline void **a64_dispatch_code_ptr(struct a64_backend *backend,
+                                           uint32_t addr) {
+  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+}
+
+#if LOG_DISPATCH_EVERY_N
+static void a64_dispatch_log(struct a64_ctx *ctx) {
+  static uint64_t num;
+
+  if ((num++ % LOG_DISPATCH_EVERY_N) == 0) {
+    LOG_INFO("a64_log_dispatch 0x%08x", ctx->pc);
+  }
+}
+#endif
+
+/* inline caches are emitted for dynamic branches. initially, the cache just
+   calls the inline dispatch thunk, which links the cache to the current
+   destination block the same way a static branch is linked:
+
+   bl dispatch_inline
+   (padding)
+   miss:
+   (inline dispatch cache lookup)
+
+   once linked, the cache compares the guest pc against the destination
+   block's address, jumping directly to it when it matches:
+
+   ldr w9, [x28, #offset_pc]
+   movz w10, #addr_lo
+   movk w10, #addr_hi, lsl #16
+   cmp w9, w10
+   b.ne miss
+   b dst
+   miss:
+   (inline dispatch cache lookup)
+
+   the sequence is encoded with raw instructions to guarantee the patched
+   sequence has a fixed size, and its first instruction is used to tell linked
+   inline caches apart from linked static branches
+
+   like the x64 backend's, the cache is monomorphic. it stays linked to the
+   first destination until that block is invalidated, every other destination
+   takes the inline lookup */
+static int a64_dispatch_is_bl_to(uint32_t instr, const uint32_t *ptr,
+                                 const void *target) {
+  if ((instr & 0xfc000000) != 0x94000000) {
+    return 0;
+  }
+
+  /* sign extend the 26-bit instruction offset */
+  int32_t offset = (int32_t)(instr << 6) >> 6;
+  return ptr + offset == target;
+}
+
+static int a64_dispatch_is_inline_cache(struct a64_backend *backend,
+                                        void *code) {
+  uint32_t *ptr = (uint32_t *)code;
+
+  if (*ptr == backend->inline_cache_ldr) {
+    return 1;
+  }
+
+  /* unlinked caches call the inline dispatch thunk */
+  return a64_dispatch_is_bl_to(*ptr, ptr, backend->dispatch_inline);
+}
+
+/* pad with nops up to the next 32-byte boundary, the code buffer is page
+   aligned */
+static void a64_dispatch_align(MacroAssembler &e) {
+  while (e.GetCursorAddress<uintptr_t>() & 31) {
+    e.Nop();
+  }
+}
+
+static int64_t a64_dispatch_branch_offset(MacroAssembler &e,
+                                          const void *target) {
+  intptr_t offset = (intptr_t)target - e.GetCursorAddress<intptr_t>();
+  return offset >> 2;
+}
+
+void a64_dispatch_restore_edge(struct jit_backend *base, void *code,
+                               uint32_t dst) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  MacroAssembler e((vixl::byte *)code, kInstructionSize, PositionDependentCode);
+
+  {
+    vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+
+    if (a64_dispatch_is_inline_cache(backend, code)) {
+      e.bl(a64_dispatch_branch_offset(e, backend->dispatch_inline));
+    } else {
+      e.bl(a64_dispatch_branch_offset(e, backend->dispatch_static));
+    }
+  }
+
+  e.FinalizeCode();
+  CPU::EnsureIAndDCacheCoherency(code, kInstructionSize);
+}
+
+void a64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst,
+                             uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  struct jit_guest *guest = backend->base.guest;
+
+  MacroAssembler e((vixl::byte *)code, A64_INLINE_CACHE_SIZE,
+                   PositionDependentCode);
+  int size = kInstructionSize;
+
+  if (a64_dispatch_is_inline_cache(backend, code)) {
+    size = A64_INLINE_CACHE_SIZE;
+
+    vixl::ExactAssemblyScope scope(&e, A64_INLINE_CACHE_SIZE);
+    e.ldr(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+    e.movz(tmp1.W(), addr & 0xffff, 0);
+    e.movk(tmp1.W(), addr >> 16, 16);
+    e.cmp(tmp0.W(), tmp1.W());
+    e.b(2, ne);
+    e.b(a64_dispatch_branch_offset(e, dst));
+  } else {
+    vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+    e.b(a64_dispatch_branch_offset(e, dst));
+  }
+
+  e.FinalizeCode();
+  CPU::EnsureIAndDCacheCoherency(code, size);
+}
+
+void a64_dispatch_emit_inline_cache(struct a64_backend *backend) {
+  auto &e = *backend->codegen;
+
+  /* the guest pc has already been written to the context */
+  {
+    vixl::ExactAssemblyScope scope(&e, A64_INLINE_CACHE_SIZE);
+
+    e.bl(a64_dispatch_branch_offset(e, backend->dispatch_inline));
+
+    for (int i = 1; i < A64_INLINE_CACHE_SIZE / (int)kInstructionSize; i++) {
+      e.nop();
+    }
+  }
+
+  /* on a miss, look up the destination block inline. having an indirect br
+     per-callsite, as opposed to them all sharing the one in the dynamic
+     dispatch thunk, gives the host's branch predictor a chance to predict
+     each one */
+  a64_dispatch_emit_lookup(backend);
+}
+
+void a64_dispatch_emit_lookup(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  /* invasively look into the jit's cache. the masked address is scaled up to
+     the size of a cache entry, which requires each block to begin on at least
+     a one-byte boundary */
+  e.Mov(tmp0, (uint64_t)backend->cache);
+  e.Ldr(tmp1.W(), MemOperand(guestctx, guest->offset_pc));
+  e.And(tmp1.W(), tmp1.W(), backend->cache_mask);
+  e.Add(tmp0, tmp0, Operand(tmp1, LSL, 3 - backend->cache_shift));
+  e.Ldr(tmp0, MemOperand(tmp0));
+  e.Br(tmp0);
+}
+
+void a64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  *entry = backend->dispatch_compile;
+}
+
+void a64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
+                             void *code) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  CHECK_EQ(*entry, backend->dispatch_compile);
+  *entry = code;
+}
+
+void *a64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+  void **entry = a64_dispatch_code_ptr(backend, addr);
+  return *entry;
+}
+
+void a64_dispatch_run_code(struct jit_backend *base, int cycles) {
+  struct a64_backend *backend = container_of(base, struct a64_backend, base);
+
+  /* don't attribute the time spent between runs to the last block run */
+  backend->prof.last_entry = &backend->prof.idle;
+
+  backend->dispatch_enter(cycles);
+}
+
+void a64_dispatch_emit_thunks(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
+  auto &e = *backend->codegen;
+  int stack_offset = 0;
+
+  /* emit dispatch thunks */
+  {
+    /* called after a dynamic branch instruction stores the next pc to the
+       context. looks up the host block for it jumps to it */
+    a64_dispatch_align(e);
+
+    backend->dispatch_dynamic = e.GetCursorAddress<void *>();
+
+#if LOG_DISPATCH_EVERY_N
+    e.Mov(arg0, guestctx);
+    a64_backend_call(backend, (void *)&a64_dispatch_log);
+#endif
+
+    a64_dispatch_emit_lookup(backend);
+  }
+
+  {
+    /* called after a static branch instruction stores the next pc to the
+       context. the thunk calls jit_add_edge which adds an edge between the
+       calling block and the branch destination block, and then falls through
+       to the above dynamic branch thunk. on the second run through this code
+       jit_add_edge will call a64_dispatch_patch_edge, patching the caller to
+       directly jump to the destination block */
+    a64_dispatch_align(e);
+
+    backend->dispatch_static = e.GetCursorAddress<void *>();
+
+#if LINK_STATIC_BRANCHES
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Sub(arg1, lr, kInstructionSize);
+    e.Ldr(arg2.W(), MemOperand(guestctx, guest->offset_pc));
+    a64_backend_call(backend, (void *)guest->link_code);
+#endif
+    a64_backend_jmp(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* called by an unlinked inline cache after a dynamic branch stores the
+       next pc to the context. like the static branch thunk, this links the
+       cache to the destination block, see a64_dispatch_patch_edge */
+    a64_dispatch_align(e);
+
+    backend->dispatch_inline = e.GetCursorAddress<void *>();
+
+#if LINK_STATIC_BRANCHES
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Sub(arg1, lr, kInstructionSize);
+    e.Ldr(arg2.W(), MemOperand(guestctx, guest->offset_pc));
+    a64_backend_call(backend, (void *)guest->link_code);
+#endif
+    a64_backend_jmp(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* default cache entry for all blocks. compiles the desired pc before
+       jumping to the block through the dynamic dispatch thunk */
+    a64_dispatch_align(e);
+
+    backend->dispatch_compile = e.GetCursorAddress<void *>();
+
+    e.Mov(arg0, (uint64_t)guest->data);
+    e.Ldr(arg1.W(), MemOperand(guestctx, guest->offset_pc));
+    a64_backend_call(backend, (void *)guest->compile_code);
+    a64_backend_jmp(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* processes the pending interrupt request, and then jumps to the new pc
+       through the dynamic dispatch thunk */
+    a64_dispatch_align(e);
+
+    backend->dispatch_interrupt = e.GetCursorAddress<void *>();
+
+    e.Mov(arg0, (uint64_t)guest->data);
+    a64_backend_call(backend, (void *)guest->check_interrupts);
+    a64_backend_jmp(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* entry point to the compiled a64 code. sets up the stack frame, sets up
+       fixed registers (context and memory base) and then jumps to the current
+       pc through the dynamic dispatch thunk */
+    a64_dispatch_align(e);
+
+    backend->dispatch_enter = e.GetCursorAddress<void (*)(int)>();
+
+    /* create stack frame, the link register is saved with the other
+       callee-saved registers. the stack is kept 16-byte aligned */
+    a64_backend_push_regs(backend, JIT_CALLEE_SAVE);
+    stack_offset = ALIGN_UP(A64_STACK_SIZE, 16);
+    e.Sub(sp, sp, stack_offset);
+
+    /* assign fixed registers */
+    e.Mov(guestctx, (uint64_t)guest->ctx);
+    e.Mov(guestmem, (uint64_t)guest->membase);
+
+    /* reset run state */
+    e.Str(arg0.W(), MemOperand(guestctx, guest->offset_cycles));
+    e.Str(wzr, MemOperand(guestctx, guest->offset_instrs));
+
+    a64_backend_jmp(backend, backend->dispatch_dynamic);
+  }
+
+  {
+    /* exit point for the compiled a64 code, tears down the stack frame and
+       returns */
+    a64_dispatch_align(e);
+
+    backend->dispatch_exit = e.GetCursorAddress<void *>();
+
+    /* destroy stack frame */
+    e.Add(sp, sp, stack_offset);
+    a64_backend_pop_regs(backend, JIT_CALLEE_SAVE);
+
+    e.Ret();
+  }
+
+  /* reset cache entries to point to the new compile thunk */
+  for (int i = 0; i < backend->cache_size; i++) {
+    backend->cache[i] = backend->dispatch_compile;
+  }
+}
+
+void a64_dispatch_shutdown(struct a64_backend *backend) {
+  free(backend->cache);
+}
+
+void a64_dispatch_init(struct a64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+
+  /* initialize code cache, one entry per possible block begin */
+  backend->cache_mask = guest->addr_mask;
+  backend->cache_shift = ctz32(guest->addr_mask);
+  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache = (void **)malloc(backend->cache_size * sizeof(void *));
+
+  /* the pc is loaded with a scaled 12-bit immediate offset by linked inline
+     caches, and cache entries are indexed by shifting the masked address */
+  CHECK(guest->offset_pc % 4 == 0 && guest->offset_pc < 16384);
+  CHECK_LE(backend->cache_shift, 3);
+
+  /* encode the first instruction of a linked inline cache, used to identify
+     them when restoring edges */
+  MacroAssembler e((vixl::byte *)&backend->inline_cache_ldr, kInstructionSize,
+                   PositionDependentCode);
+  {
+    vixl::ExactAssemblyScope scope(&e, kInstructionSize);
+    e.ldr(tmp0.W(), MemOperand(guestctx, guest->offset_pc));
+  }
+  e.FinalizeCode();
+}
@@ -0,0 +1,1081 @@
+#include "jit/backend/a64/a64_local.h"
+
+extern "C" {
+#include "jit/ir/ir.h"
+#include "jit/jit.h"
+#include "jit/jit_guest.h"
+}
+
+using namespace vixl::aarch64;
+
+#define EMITTER(op, constraints)                                             \
+  void a64_emit_##op(struct a64_backend *, MacroAssembler &, struct ir *,    \
+                     struct ir_instr *);                                     \
+  static struct _a64_##op##_init {                                           \
+    _a64_##op##_init() {                                                     \
+      a64_emitters[OP_##op] = {(void *)&a64_emit_##op, constraints};         \
+    }                                                                        \
+  } a64_##op##_init;                                                         \
+  void a64_emit_##op(struct a64_backend *backend, MacroAssembler &e,         \
+                     struct ir *ir, struct ir_instr *instr)
+
+#define CONSTRAINTS(result_flags, ...) \
+  result_flags, {                      \
+    __VA_ARGS__                        \
+  }
+
+#define RES instr->result
+#define ARG0 instr->arg[0]
+#define ARG1 instr->arg[1]
+#define ARG2 instr->arg[2]
+#define ARG3 instr->arg[3]
+
+#define RES_REG a64_backend_reg(backend, RES)
+#define ARG0_REG a64_backend_reg(backend, ARG0)
+#define ARG1_REG a64_backend_reg(backend, ARG1)
+#define ARG2_REG a64_backend_reg(backend, ARG2)
+#define ARG3_REG a64_backend_reg(backend, ARG3)
+
+#define RES_VREG a64_backend_vreg(backend, RES)
+#define ARG0_VREG a64_backend_vreg(backend, ARG0)
+#define ARG1_VREG a64_backend_vreg(backend, ARG1)
+#define ARG2_VREG a64_backend_vreg(backend, ARG2)
+#define ARG3_VREG a64_backend_vreg(backend, ARG3)
+
+/* unlike x64, every arithmetic instruction has a separate destination, so the
+   result is never required to share a register with arg0 */
+enum {
+  NONE = 0,
+  REG_I64 = JIT_REG_I64,
+  REG_F64 = JIT_REG_F64,
+  REG_V128 = JIT_REG_V128,
+  REG_ALL = REG_I64 | REG_F64 | REG_V128,
+  IMM_I32 = JIT_IMM_I32,
+  IMM_I64 = JIT_IMM_I64,
+  IMM_F32 = JIT_IMM_F32,
+  IMM_F64 = JIT_IMM_F64,
+  IMM_BLK = JIT_IMM_BLK,
+  IMM_ALL = IMM_I32 | IMM_I64 | IMM_F32 | IMM_F64 | IMM_BLK,
+  VAL_I64 = REG_I64 | IMM_I64,
+  VAL_ALL = REG_ALL | IMM_ALL,
+  OPT = JIT_OPTIONAL,
+  OPT_I64 = OPT | VAL_I64,
+};
+
+struct jit_emitter a64_emitters[IR_NUM_OPS];
+
+/*
+ * compare fusion
+ *
+ * a compare immediately followed by a branch_cond / select which is its only
+ * user doesn't materialize its result. the compare only sets the host flags,
+ * which the user consumes directly with a b.cond / csel. see
+ * compare_fusion_pass.c for the pass setting this up
+ */
+static int a64_is_fused_cmp(struct ir_instr *cmp) {
+  struct ir_instr *next = list_next_entry(cmp, struct ir_instr, it);
+  struct ir_value *result = cmp->result;
+
+  if (!next || (next->op != OP_BRANCH_COND && next->op != OP_SELECT) ||
+      next->arg[2] != result) {
+    return 0;
+  }
+
+  if (list_first_entry(&result->uses, struct ir_use, it) !=
+      list_last_entry(&result->uses, struct ir_use, it)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+static struct ir_instr *a64_fused_cmp(struct ir_instr *instr) {
+  struct ir_value *cond = instr->arg[2];
+
+  if (ir_is_constant(cond) || !a64_is_fused_cmp(cond->def)) {
+    return NULL;
+  }
+
+  return cond->def;
+}
+
+static Condition a64_cmp_cond(struct ir_instr *cmp) {
+  enum ir_cmp type = (enum ir_cmp)cmp->arg[2]->i32;
+
+  /* fcmp sets nzcv to 0011 for unordered operands. for the conditions below,
+     this makes eq, ge and gt false and ne, le and lt true, matching the
+     results of the x64 backend */
+  if (cmp->op == OP_FCMP) {
+    switch (type) {
+      case CMP_EQ:
+        return eq;
+      case CMP_NE:
+        return ne;
+      case CMP_SGE:
+        return ge;
+      case CMP_SGT:
+        return gt;
+      case CMP_SLE:
+        return le;
+      case CMP_SLT:
+        return lt;
+      default:
+        LOG_FATAL("unexpected comparison type");
+    }
+  }
+
+  switch (type) {
+    case CMP_EQ:
+      return eq;
+    case CMP_NE:
+      return ne;
+    case CMP_SGE:
+      return ge;
+    case CMP_SGT:
+      return gt;
+    case CMP_UGE:
+      return hs;
+    case CMP_UGT:
+      return hi;
+    case CMP_SLE:
+      return le;
+    case CMP_SLT:
+      return lt;
+    case CMP_ULE:
+      return ls;
+    case CMP_ULT:
+      return lo;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+static int a64_is_signed_cmp(enum ir_cmp type) {
+  return type == CMP_SGE || type == CMP_SGT || type == CMP_SLE ||
+         type == CMP_SLT;
+}
+
+/* fastmem accesses of floating point values are routed through tmp0, so a
+   fault decodes as an integer ldr / str which the mmio thunks can handle */
+static void a64_emit_load_fast(struct a64_backend *backend, MacroAssembler &e,
+                               const struct ir_value *dst,
+                               const MemOperand &src) {
+  switch (dst->type) {
+    case VALUE_F32:
+      e.Ldr(tmp0.W(), src);
+      e.Fmov(a64_backend_vreg(backend, dst), tmp0.W());
+      break;
+    case VALUE_F64:
+      e.Ldr(tmp0, src);
+      e.Fmov(a64_backend_vreg(backend, dst), tmp0);
+      break;
+    default:
+      a64_backend_load_mem(backend, dst, src);
+      break;
+  }
+}
+
+static void a64_emit_store_fast(struct a64_backend *backend, MacroAssembler &e,
+                                const MemOperand &dst,
+                                const struct ir_value *src) {
+  if (ir_is_constant(src)) {
+    a64_backend_store_mem(backend, dst, src);
+    return;
+  }
+
+  switch (src->type) {
+    case VALUE_F32:
+      e.Fmov(tmp0.W(), a64_backend_vreg(backend, src));
+      e.Str(tmp0.W(), dst);
+      break;
+    case VALUE_F64:
+      e.Fmov(tmp0, a64_backend_vreg(backend, src));
+      e.Str(tmp0, dst);
+      break;
+    default:
+      a64_backend_store_mem(backend, dst, src);
+      break;
+  }
+}
+
+EMITTER(SOURCE_INFO, CONSTRAINTS(NONE, IMM_I32, IMM_I32)) {}
+
+EMITTER(FALLBACK, CONSTRAINTS(NONE, IMM_I64, IMM_I32, IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  void *fallback = (void *)ARG0->i64;
+  uint32_t addr = ARG1->i32;
+  uint32_t raw_instr = ARG2->i32;
+
+  e.Mov(arg0, (uint64_t)guest);
+  e.Mov(arg1.W(), addr);
+  e.Mov(arg2.W(), raw_instr);
+  a64_backend_call(backend, fallback);
+}
+
+EMITTER(LOAD_HOST, CONSTRAINTS(REG_ALL, REG_I64)) {
+  struct ir_value *dst = RES;
+  Register src = ARG0_REG;
+
+  a64_backend_load_mem(backend, dst, MemOperand(src));
+}
+
+EMITTER(STORE_HOST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
+  Register dst = ARG0_REG;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(dst), data);
+}
+
+EMITTER(LOAD_GUEST, CONSTRAINTS(REG_ALL, REG_I64 | IMM_I32)) {
+  struct jit_guest *guest = backend->base.guest;
+  struct ir_value *addr = ARG0;
+
+  if (ir_is_constant(addr)) {
+    /* peel away one layer of abstraction and directly access the backing
+       memory or directly invoke the callback when the address is constant */
+    void *userdata;
+    uint8_t *ptr;
+    mem_read_cb read;
+    guest->lookup(guest->mem, addr->i32, &userdata, &ptr, &read, NULL);
+
+    if (ptr) {
+      e.Mov(tmp1, (uint64_t)ptr);
+      a64_backend_load_mem(backend, RES, MemOperand(tmp1));
+    } else {
+      Register dst = RES_REG;
+      int data_size = ir_type_size(RES->type);
+      uint32_t data_mask = (1 << (data_size * 8)) - 1;
+
+      e.Mov(arg0, (uint64_t)userdata);
+      e.Mov(arg1.W(), (uint32_t)addr->i32);
+      e.Mov(arg2.W(), data_mask);
+      a64_backend_call(backend, (void *)read);
+      e.Mov(dst, Register(0, dst.GetSizeInBits()));
+      a64_backend_zext_result(backend, dst, RES->type);
+    }
+  } else {
+    Register dst = RES_REG;
+    Register ra = a64_backend_reg(backend, addr);
+
+    void *fn = nullptr;
+    switch (RES->type) {
+      case VALUE_I8:
+        fn = (void *)guest->r8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->r16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->r32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->r64;
+        break;
+      default:
+        LOG_FATAL("unexpected load result type");
+        break;
+    }
+
+    e.Mov(arg0, (uint64_t)guest->mem);
+    e.Mov(arg1.W(), ra.W());
+    a64_backend_call(backend, fn);
+
+    /* the upper bits of narrow return values are unspecified by the abi */
+    e.Mov(dst, Register(0, dst.GetSizeInBits()));
+    a64_backend_zext_result(backend, dst, RES->type);
+  }
+}
+
+EMITTER(STORE_GUEST, CONSTRAINTS(NONE, REG_I64 | IMM_I32, VAL_ALL)) {
+  struct jit_guest *guest = backend->base.guest;
+  struct ir_value *addr = ARG0;
+  struct ir_value *data = ARG1;
+
+  if (ir_is_constant(addr)) {
+    /* peel away one layer of abstraction and directly access the backing
+       memory or directly invoke the callback when the address is constant */
+    void *userdata;
+    uint8_t *ptr;
+    mem_write_cb write;
+    guest->lookup(guest->mem, addr->i32, &userdata, &ptr, NULL, &write);
+
+    if (ptr) {
+      /* tmp0 is used to materialize constant data */
+      e.Mov(tmp1, (uint64_t)ptr);
+      a64_backend_store_mem(backend, MemOperand(tmp1), data);
+    } else {
+      int data_size = ir_type_size(data->type);
+      uint32_t data_mask = (1 << (data_size * 8)) - 1;
+
+      e.Mov(arg0, (uint64_t)userdata);
+      e.Mov(arg1.W(), (uint32_t)addr->i32);
+      a64_backend_mov_value(backend, arg2, data);
+      e.Mov(arg3.W(), data_mask);
+      a64_backend_call(backend, (void *)write);
+    }
+  } else {
+    Register ra = a64_backend_reg(backend, addr);
+
+    void *fn = nullptr;
+    switch (data->type) {
+      case VALUE_I8:
+        fn = (void *)guest->w8;
+        break;
+      case VALUE_I16:
+        fn = (void *)guest->w16;
+        break;
+      case VALUE_I32:
+        fn = (void *)guest->w32;
+        break;
+      case VALUE_I64:
+        fn = (void *)guest->w64;
+        break;
+      default:
+        LOG_FATAL("unexpected store value type");
+        break;
+    }
+
+    e.Mov(arg0, (uint64_t)guest->mem);
+    e.Mov(arg1.W(), ra.W());
+    a64_backend_mov_value(backend, arg2, data);
+    a64_backend_call(backend, fn);
+  }
+}
+
+EMITTER(LOAD_FAST, CONSTRAINTS(REG_ALL, REG_I64)) {
+  struct ir_value *dst = RES;
+  Register addr = ARG0_REG;
+
+  a64_emit_load_fast(backend, e, dst, MemOperand(guestmem, addr.W(), UXTW));
+}
+
+EMITTER(STORE_FAST, CONSTRAINTS(NONE, REG_I64, VAL_ALL)) {
+  Register addr = ARG0_REG;
+  struct ir_value *data = ARG1;
+
+  a64_emit_store_fast(backend, e, MemOperand(guestmem, addr.W(), UXTW), data);
+}
+
+EMITTER(LOAD_CONTEXT, CONSTRAINTS(REG_ALL, IMM_I32)) {
+  struct ir_value *dst = RES;
+  int offset = ARG0->i32;
+
+  a64_backend_load_mem(backend, dst, MemOperand(guestctx, offset));
+}
+
+EMITTER(STORE_CONTEXT, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
+  int offset = ARG0->i32;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(guestctx, offset), data);
+}
+
+EMITTER(LOAD_LOCAL, CONSTRAINTS(REG_ALL, IMM_I32)) {
+  struct ir_value *dst = RES;
+  int offset = A64_STACK_LOCALS + ARG0->i32;
+
+  a64_backend_load_mem(backend, dst, MemOperand(sp, offset));
+}
+
+EMITTER(STORE_LOCAL, CONSTRAINTS(NONE, IMM_I32, VAL_ALL)) {
+  int offset = A64_STACK_LOCALS + ARG0->i32;
+  struct ir_value *data = ARG1;
+
+  a64_backend_store_mem(backend, MemOperand(sp, offset), data);
+}
+
+EMITTER(FTOI, CONSTRAINTS(REG_I64, REG_F64)) {
+  Register rd = RES_REG;
+  VRegister ra = ARG0_VREG;
+
+  switch (RES->type) {
+    case VALUE_I32:
+      /* fcvtzs saturates underflows to INT32_MIN and overflows to INT32_MAX
+         as OP_FTOI requires, but converts NaN to 0. for parity with the x64
+         backend, NaN is converted to INT32_MIN */
+      e.Fcvtzs(rd, ra);
+      e.Fcmp(ra, ra);
+      e.Mov(tmp0.W(), INT32_MIN);
+      e.Csel(rd, tmp0.W(), rd, vs);
+      break;
+    default:
+      LOG_FATAL("unexpected result type");
+      break;
+  }
+}
+
+EMITTER(ITOF, CONSTRAINTS(REG_F64, REG_I64)) {
+  VRegister rd = RES_VREG;
+  Register ra = ARG0_REG;
+
+  switch (RES->type) {
+    case VALUE_F32:
+      CHECK_EQ(ARG0->type, VALUE_I32);
+      e.Scvtf(rd, ra);
+      break;
+    case VALUE_F64:
+      CHECK_EQ(ARG0->type, VALUE_I64);
+      e.Scvtf(rd, ra);
+      break;
+    default:
+      LOG_FATAL("unexpected result type");
+      break;
+  }
+}
+
+EMITTER(SEXT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  switch (ARG0->type) {
+    case VALUE_I8:
+      e.Sxtb(rd, ra);
+      break;
+    case VALUE_I16:
+      e.Sxth(rd, ra);
+      break;
+    case VALUE_I32:
+      e.Sxtw(rd, ra);
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+  }
+
+  /* a narrow result must still be zero-extended in its register */
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(ZEXT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  /* narrow values are already zero-extended in their register, and writes to
+     a w register zero the upper 32-bits of the x register */
+  if (rd.GetCode() == ra.GetCode()) {
+    return;
+  }
+
+  e.Mov(rd.W(), ra.W());
+}
+
+EMITTER(TRUNC, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  /* unlike x64, the truncation is performed even when the registers are the
+     same, the high order bits must be cleared for the zero-extended values
+     to remain valid */
+  switch (RES->type) {
+    case VALUE_I8:
+      e.Uxtb(rd, ra.W());
+      break;
+    case VALUE_I16:
+      e.Uxth(rd, ra.W());
+      break;
+    case VALUE_I32:
+      e.Mov(rd, ra.W());
+      break;
+    default:
+      LOG_FATAL("unexpected value type");
+  }
+}
+
+EMITTER(FEXT, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fcvt(rd, ra);
+}
+
+EMITTER(FTRUNC, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fcvt(rd, ra);
+}
+
+EMITTER(SELECT, CONSTRAINTS(REG_I64, REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register t = ARG0_REG;
+  Register f = ARG1_REG;
+
+  struct ir_instr *cmp = a64_fused_cmp(instr);
+
+  if (cmp) {
+    e.Csel(rd, t, f, a64_cmp_cond(cmp));
+    return;
+  }
+
+  Register cond = ARG2_REG;
+  e.Cmp(cond, 0);
+  e.Csel(rd, t, f, ne);
+}
+
+EMITTER(CMP, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32, IMM_I32)) {
+  Register ra = ARG0_REG;
+  enum ir_cmp type = (enum ir_cmp)ARG2->i32;
+
+  /* narrow values are zero-extended in their registers, which is fine for
+     equality and unsigned comparisons. signed comparisons need them sign
+     extended first */
+  int sext = a64_is_signed_cmp(type) &&
+             (ARG0->type == VALUE_I8 || ARG0->type == VALUE_I16);
+
+  if (sext) {
+    if (ARG0->type == VALUE_I8) {
+      e.Sxtb(tmp0.W(), ra);
+    } else {
+      e.Sxth(tmp0.W(), ra);
+    }
+    ra = tmp0.W();
+  }
+
+  if (ir_is_constant(ARG1)) {
+    if (sext) {
+      int32_t imm = ARG0->type == VALUE_I8 ? ARG1->i8 : ARG1->i16;
+      e.Cmp(ra, imm);
+    } else {
+      e.Cmp(ra, ir_zext_constant(ARG1));
+    }
+  } else {
+    Register rb = ARG1_REG;
+
+    if (sext) {
+      if (ARG1->type == VALUE_I8) {
+        e.Sxtb(tmp1.W(), rb);
+      } else {
+        e.Sxth(tmp1.W(), rb);
+      }
+      rb = tmp1.W();
+    }
+
+    e.Cmp(ra, rb);
+  }
+
+  /* the user consumes the flags directly */
+  if (a64_is_fused_cmp(instr)) {
+    return;
+  }
+
+  Register rd = RES_REG;
+  e.Cset(rd, a64_cmp_cond(instr));
+}
+
+EMITTER(FCMP, CONSTRAINTS(REG_I64, REG_F64, REG_F64, IMM_I32)) {
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fcmp(ra, rb);
+
+  /* the user consumes the flags directly */
+  if (a64_is_fused_cmp(instr)) {
+    return;
+  }
+
+  Register rd = RES_REG;
+  e.Cset(rd, a64_cmp_cond(instr));
+}
+
+EMITTER(ADD, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Add(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Add(rd, ra, rb);
+  }
+
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(SUB, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Sub(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Sub(rd, ra, rb);
+  }
+
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(SMUL, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Mul(rd, ra, rb);
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(UMUL, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Mul(rd, ra, rb);
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(DIV, CONSTRAINTS(NONE)) {
+  LOG_FATAL("unsupported");
+}
+
+EMITTER(NEG, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Neg(rd, ra);
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(ABS, CONSTRAINTS(NONE)) {
+  LOG_FATAL("unsupported");
+}
+
+EMITTER(FADD, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fadd(rd, ra, rb);
+}
+
+EMITTER(FSUB, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fsub(rd, ra, rb);
+}
+
+EMITTER(FMUL, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fmul(rd, ra, rb);
+}
+
+EMITTER(FDIV, CONSTRAINTS(REG_F64, REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fdiv(rd, ra, rb);
+}
+
+EMITTER(FNEG, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fneg(rd, ra);
+}
+
+EMITTER(FABS, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fabs(rd, ra);
+}
+
+EMITTER(SQRT, CONSTRAINTS(REG_F64, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Fsqrt(rd, ra);
+}
+
+EMITTER(VBROADCAST, CONSTRAINTS(REG_V128, REG_F64)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+
+  e.Dup(rd.V4S(), ra.V4S(), 0);
+}
+
+EMITTER(VSPLAT, CONSTRAINTS(REG_V128, REG_V128, IMM_I32)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  int lane = ARG1->i32;
+
+  e.Dup(rd.V4S(), ra.V4S(), lane);
+}
+
+EMITTER(VADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fadd(rd.V4S(), ra.V4S(), rb.V4S());
+}
+
+EMITTER(VDOT, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  /* sum the products pairwise, then the two pairs. this matches the order
+     dpps adds them in, and leaves the upper lanes of the result zeroed */
+  e.Fmul(vtmp.V4S(), ra.V4S(), rb.V4S());
+  e.Faddp(vtmp.V4S(), vtmp.V4S(), vtmp.V4S());
+  e.Faddp(rd.S(), vtmp.V2S());
+}
+
+EMITTER(VMUL, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+
+  e.Fmul(rd.V4S(), ra.V4S(), rb.V4S());
+}
+
+EMITTER(VMADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128, REG_V128)) {
+  VRegister rd = RES_VREG;
+  VRegister ra = ARG0_VREG;
+  VRegister rb = ARG1_VREG;
+  VRegister rc = ARG2_VREG;
+
+  /* fmla accumulates into its destination, which must start out as the
+     addend without clobbering either multiplicand */
+  if (rd.Is(rc)) {
+    e.Fmla(rd.V4S(), ra.V4S(), rb.V4S());
+  } else if (rd.Is(ra) || rd.Is(rb)) {
+    e.Mov(vtmp.V16B(), rc.V16B());
+    e.Fmla(vtmp.V4S(), ra.V4S(), rb.V4S());
+    e.Mov(rd.V16B(), vtmp.V16B());
+  } else {
+    e.Mov(rd.V16B(), rc.V16B());
+    e.Fmla(rd.V4S(), ra.V4S(), rb.V4S());
+  }
+}
+
+EMITTER(AND, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.And(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.And(rd, ra, rb);
+  }
+}
+
+EMITTER(OR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Orr(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Orr(rd, ra, rb);
+  }
+}
+
+EMITTER(XOR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    e.Eor(rd, ra, ir_zext_constant(ARG1));
+  } else {
+    Register rb = ARG1_REG;
+    e.Eor(rd, ra, rb);
+  }
+}
+
+EMITTER(NOT, CONSTRAINTS(REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  e.Mvn(rd, ra);
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+/* variable shifts take the amount modulo the register size, which for narrow
+   values is 32 like x64. the amount register is used at the width of the
+   value being shifted */
+static Register a64_shift_amount(const Register &rd, const Register &rb) {
+  return rd.Is64Bits() ? rb.X() : rb.W();
+}
+
+EMITTER(SHL, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    int n = (int)ir_zext_constant(ARG1) & (rd.GetSizeInBits() - 1);
+    e.Lsl(rd, ra, n);
+  } else {
+    Register rb = ARG1_REG;
+    e.Lsl(rd, ra, a64_shift_amount(rd, rb));
+  }
+
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(ASHR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  /* narrow values must be sign-extended to shift in their sign bit */
+  if (RES->type == VALUE_I8) {
+    e.Sxtb(tmp0.W(), ra);
+    ra = tmp0.W();
+  } else if (RES->type == VALUE_I16) {
+    e.Sxth(tmp0.W(), ra);
+    ra = tmp0.W();
+  }
+
+  if (ir_is_constant(ARG1)) {
+    int n = (int)ir_zext_constant(ARG1) & (rd.GetSizeInBits() - 1);
+    e.Asr(rd, ra, n);
+  } else {
+    Register rb = ARG1_REG;
+    e.Asr(rd, ra, a64_shift_amount(rd, rb));
+  }
+
+  a64_backend_zext_result(backend, rd, RES->type);
+}
+
+EMITTER(LSHR, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+
+  if (ir_is_constant(ARG1)) {
+    int n = (int)ir_zext_constant(ARG1) & (rd.GetSizeInBits() - 1);
+    e.Lsr(rd, ra, n);
+  } else {
+    Register rb = ARG1_REG;
+    e.Lsr(rd, ra, a64_shift_amount(rd, rb));
+  }
+}
+
+EMITTER(ASHD, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+  CHECK_EQ(RES->type, VALUE_I32);
+
+  Label shr, end;
+
+  /* check if we're shifting left or right */
+  e.Tbnz(rb, 31, &shr);
+
+  /* perform shift left */
+  e.Lsl(rd, ra, rb);
+  e.B(&end);
+
+  /* perform right shift. a shift amount of 0 after negating means the right
+     shift overflowed, shifting in the sign bit entirely */
+  e.Bind(&shr);
+  e.Neg(tmp0.W(), rb);
+  e.Ands(tmp0.W(), tmp0.W(), 0x1f);
+  e.Mov(tmp1.W(), 31);
+  e.Csel(tmp0.W(), tmp1.W(), tmp0.W(), eq);
+  e.Asr(rd, ra, tmp0.W());
+
+  /* shift is done */
+  e.Bind(&end);
+}
+
+EMITTER(LSHD, CONSTRAINTS(REG_I64, REG_I64, REG_I64)) {
+  Register rd = RES_REG;
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+  CHECK_EQ(RES->type, VALUE_I32);
+
+  Label shr, end;
+
+  /* check if we're shifting left or right */
+  e.Tbnz(rb, 31, &shr);
+
+  /* perform shift left */
+  e.Lsl(rd, ra, rb);
+  e.B(&end);
+
+  /* perform right shift. a shift amount of 0 after negating means the right
+     shift overflowed, clearing the result */
+  e.Bind(&shr);
+  e.Neg(tmp0.W(), rb);
+  e.Ands(tmp0.W(), tmp0.W(), 0x1f);
+  e.Lsr(rd, ra, tmp0.W());
+  e.Csel(rd, wzr, rd, eq);
+
+  /* shift is done */
+  e.Bind(&end);
+}
+
+EMITTER(BRANCH, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK)) {
+  a64_backend_emit_branch(backend, ir, ARG0);
+}
+
+EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
+                                 REG_I64 | IMM_I32 | IMM_BLK, REG_I64)) {
+  Label next;
+  struct ir_instr *cmp = a64_fused_cmp(instr);
+
+  if (cmp) {
+    e.B(&next, InvertCondition(a64_cmp_cond(cmp)));
+  } else {
+    Register cond = ARG2_REG;
+    e.Cbz(cond, &next);
+  }
+  a64_backend_emit_branch(backend, ir, ARG0);
+  e.Bind(&next);
+  a64_backend_emit_branch(backend, ir, ARG1);
+}
+
+EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
+  if (ARG1) {
+    a64_backend_mov_value(backend, arg0, ARG1);
+  }
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg1, ARG2);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    void *addr = (void *)ARG0->i64;
+    a64_backend_call(backend, addr);
+  } else {
+    Register addr = ARG0_REG;
+    e.Blr(addr);
+  }
+}
+
+static void a64_emit_call_cond_body(struct a64_backend *backend,
+                                    MacroAssembler &e, struct ir *ir,
+                                    struct ir_instr *instr) {
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg0, ARG2);
+  }
+  if (ARG3) {
+    a64_backend_mov_value(backend, arg1, ARG3);
+  }
+
+  if (ir_is_constant(ARG0)) {
+    void *addr = (void *)ARG0->i64;
+    a64_backend_call(backend, addr);
+  } else {
+    Register addr = ARG0_REG;
+    e.Blr(addr);
+  }
+}
+
+EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
+  Register cond = ARG1_REG;
+
+  /* the condition rarely holds (e.g. a block becoming hot), move the call
+     out of line */
+  struct a64_cold_path *path =
+      a64_backend_defer_cold(backend, instr, &a64_emit_call_cond_body);
+
+  if (path) {
+    e.Cbnz(cond, path->cold);
+    e.Bind(path->resume);
+  } else {
+    Label skip;
+    e.Cbz(cond, &skip);
+    a64_emit_call_cond_body(backend, e, ir, instr);
+    e.Bind(&skip);
+  }
+}
+
+EMITTER(DEBUG_BREAK, CONSTRAINTS(NONE)) {
+  e.Brk(0);
+}
+
+static void debug_log(uint64_t a, uint64_t b, uint64_t c) {
+  LOG_INFO("DEBUG_LOG a=0x%" PRIx64 " b=0x%" PRIx64 " c=0x%" PRIx64, a, b, c);
+}
+
+EMITTER(DEBUG_LOG, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
+  a64_backend_mov_value(backend, arg0, ARG0);
+  if (ARG1) {
+    a64_backend_mov_value(backend, arg1, ARG1);
+  }
+  if (ARG2) {
+    a64_backend_mov_value(backend, arg2, ARG2);
+  }
+  a64_backend_call(backend, (void *)&debug_log);
+}
+
+static void a64_emit_assert_body(struct a64_backend *backend,
+                                 MacroAssembler &e, struct ir *ir,
+                                 struct ir_instr *instr) {
+  e.Brk(0);
+}
+
+EMITTER(ASSERT_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Cmp(ra, rb);
+
+  /* failed asserts trap, move the trap out of line */
+  struct a64_cold_path *path =
+      a64_backend_defer_cold(backend, instr, &a64_emit_assert_body);
+
+  if (path) {
+    e.B(path->cold, ne);
+    e.Bind(path->resume);
+  } else {
+    Label skip;
+    e.B(&skip, eq);
+    a64_emit_assert_body(backend, e, ir, instr);
+    e.Bind(&skip);
+  }
+}
+
+EMITTER(ASSERT_LT, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
+  Register ra = ARG0_REG;
+  Register rb = ARG1_REG;
+
+  e.Cmp(ra, rb);
+
+  struct a64_cold_path *path =
+      a64_backend_defer_cold(backend, instr, &a64_emit_assert_body);
+
+  if (path) {
+    e.B(path->cold, ge);
+    e.Bind(path->resume);
+  } else {
+    Label skip;
+    e.B(&skip, lt);
+    a64_emit_assert_body(backend, e, ir, instr);
+    e.Bind(&skip);
+  }
+}
+
+EMITTER(COPY, CONSTRAINTS(REG_ALL, VAL_ALL)) {
+  if (ir_is_float(RES->type) || ir_is_vector(RES->type)) {
+    VRegister rd = RES_VREG;
+
+    if (ir_is_constant(ARG0)) {
+      /* copy constant into reg. the constant is moved through tmp0, as the
+         macro assembler's fmov would place it in a literal pool */
+      if (ARG0->type == VALUE_F32) {
+        e.Mov(tmp0.W(), *(uint32_t *)&ARG0->f32);
+        e.Fmov(rd, tmp0.W());
+      } else {
+        e.Mov(tmp0, *(uint64_t *)&ARG0->f64);
+        e.Fmov(rd, tmp0);
+      }
+    } else {
+      /* copy reg to reg */
+      VRegister rn = ARG0_VREG;
+      e.Mov(rd.V16B(), rn.V16B());
+    }
+  } else {
+    Register rd = RES_REG;
+
+    /* copy constant or reg into reg */
+    a64_backend_mov_value(backend, rd, ARG0);
+  }
+}
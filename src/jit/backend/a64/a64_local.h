@@ -0,0 +1,152 @@
+#ifndef A64_LOCAL_H
+#define A64_LOCAL_H
+
+#include <inttypes.h>
+#include <aarch64/cpu-aarch64.h>
+#include <aarch64/macro-assembler-aarch64.h>
+
+extern "C" {
+#include "jit/jit_backend.h"
+#include "jit/jit_profile.h"
+}
+
+/* slow paths deferred by the emitters to the cold section, which is emitted
+   after the hot code of every block in the ir */
+#define A64_MAX_COLD_PATHS 256
+
+struct a64_cold_path {
+  void (*emit)(struct a64_backend *, vixl::aarch64::MacroAssembler &,
+               struct ir *, struct ir_instr *);
+  struct ir_instr *instr;
+  vixl::aarch64::Label *cold;
+  vixl::aarch64::Label *resume;
+};
+
+/* labels for each ir block, stashed in the block's tag while emitting */
+struct a64_block_labels {
+  vixl::aarch64::Label block;
+};
+
+/* used by compiled code to attribute host time to blocks when profiling, see
+   a64_backend_emit_prolog */
+struct a64_profile {
+  uint64_t last_tick;
+  struct jit_profile_entry *last_entry;
+
+  /* time spent outside of profiled blocks */
+  struct jit_profile_entry idle;
+};
+
+struct a64_backend {
+  struct jit_backend base;
+
+  /* code cache */
+  uint32_t cache_mask;
+  int cache_shift;
+  int cache_size;
+  void **cache;
+
+  /* codegen state. the assembler only lives for the duration of each call to
+     assemble_code, emitting to the code buffer at code_offset */
+  vixl::aarch64::MacroAssembler *codegen;
+  uint8_t *code;
+  int code_size;
+  int code_offset;
+  int region_size;
+  int curr_region;
+  void *dispatch_dynamic;
+  void *dispatch_static;
+  void *dispatch_inline;
+  void *dispatch_compile;
+  void *dispatch_interrupt;
+  void (*dispatch_enter)(int32_t);
+  void *dispatch_exit;
+  void *load_thunk[32];
+  void *store_thunk;
+  struct a64_profile prof;
+  struct a64_cold_path cold_paths[A64_MAX_COLD_PATHS];
+  int num_cold_paths;
+
+  /* first instruction of a linked inline cache, see a64_dispatch.cc */
+  uint32_t inline_cache_ldr;
+};
+
+/*
+ * backend functionality used by emitters
+ */
+#define A64_THUNK_SIZE 8192
+#define A64_NUM_REGIONS 8
+#define A64_INLINE_CACHE_SIZE 24
+#define A64_STACK_SIZE 1024
+#define A64_STACK_LOCALS 0
+
+struct ir_value;
+
+extern const vixl::aarch64::Register arg0;
+extern const vixl::aarch64::Register arg1;
+extern const vixl::aarch64::Register arg2;
+extern const vixl::aarch64::Register arg3;
+extern const vixl::aarch64::Register tmp0;
+extern const vixl::aarch64::Register tmp1;
+extern const vixl::aarch64::Register guestctx;
+extern const vixl::aarch64::Register guestmem;
+extern const vixl::aarch64::VRegister vtmp;
+
+vixl::aarch64::Register a64_backend_reg(struct a64_backend *backend,
+                                        const struct ir_value *v);
+vixl::aarch64::VRegister a64_backend_vreg(struct a64_backend *backend,
+                                          const struct ir_value *v);
+int a64_backend_push_regs(struct a64_backend *backend, int mask);
+void a64_backend_pop_regs(struct a64_backend *backend, int mask);
+void a64_backend_load_mem(struct a64_backend *backend,
+                          const struct ir_value *dst,
+                          const vixl::aarch64::MemOperand &src);
+void a64_backend_store_mem(struct a64_backend *backend,
+                           const vixl::aarch64::MemOperand &dst,
+                           const struct ir_value *src);
+void a64_backend_mov_value(struct a64_backend *backend,
+                           const vixl::aarch64::Register &dst,
+                           const struct ir_value *v);
+void a64_backend_zext_result(struct a64_backend *backend,
+                             const vixl::aarch64::Register &rd,
+                             enum ir_type type);
+void a64_backend_call(struct a64_backend *backend, const void *fn);
+void a64_backend_jmp(struct a64_backend *backend, const void *addr);
+void a64_backend_jmp_cond(struct a64_backend *backend,
+                          vixl::aarch64::Condition cond, const void *addr);
+vixl::aarch64::Label *a64_backend_block_label(struct a64_backend *backend,
+                                              struct ir_block *block);
+struct a64_cold_path *a64_backend_defer_cold(
+    struct a64_backend *backend, struct ir_instr *instr,
+    void (*emit)(struct a64_backend *, vixl::aarch64::MacroAssembler &,
+                 struct ir *, struct ir_instr *));
+void a64_backend_emit_branch(struct a64_backend *backend, struct ir *ir,
+                             const ir_value *target);
+
+/*
+ * dispatch
+ */
+void a64_dispatch_init(struct a64_backend *backend);
+void a64_dispatch_shutdown(struct a64_backend *backend);
+void a64_dispatch_emit_thunks(struct a64_backend *backend);
+void a64_dispatch_emit_lookup(struct a64_backend *backend);
+void a64_dispatch_emit_inline_cache(struct a64_backend *backend);
+void a64_dispatch_run_code(struct jit_backend *base, int cycles);
+void *a64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr);
+void a64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
+                             void *code);
+void a64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
+void a64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst,
+                             uint32_t addr);
+void a64_dispatch_restore_edge(struct jit_backend *base, void *code,
+                               uint32_t dst);
+
+/*
+ * emitters
+ */
+typedef void (*a64_emit_cb)(struct a64_backend *,
+                            vixl::aarch64::MacroAssembler &, struct ir *,
+                            struct ir_instr *);
+extern struct jit_emitter a64_emitters[IR_NUM_OPS];
+
+#endif
@@ -1,47 +1,290 @@
 #include <stdlib.h>
+#include "core/core.h"
 #include "jit/jit.h"
 #include "jit/jit_backend.h"
 #include "jit/jit_frontend.h"
 #include "jit/jit_guest.h"
 
+/* rather than decoding each instruction every time it's executed, blocks are
+   decoded once into an array of records holding each instruction's fallback,
+   which are then cached by guest address like compiled code. the records are
+   dispatched with computed goto where the compiler supports it.
+
+   the interpreter never makes fastmem stores, so the jit's page watches don't
+   catch writes to the guest code. instead, each block keeps a copy of the code
+   it was decoded from, which is compared against guest memory on entry */
+#if COMPILER_MSVC
+#define INTERP_THREADED 0
+#else
+#define INTERP_THREADED 1
+#endif
+
+#define INTERP_CODE_SIZE 0x400000
+#define INTERP_NUM_REGIONS 8
+
+enum {
+  /* execute the instruction, continuing on to the next record only if the
+     instruction fell through to it */
+  INTERP_EXEC,
+  /* execute the final instruction in the block */
+  INTERP_EXEC_LAST,
+  INTERP_NUM_OPS,
+};
+
+struct interp_instr {
+  jit_fallback fallback;
+  uint32_t addr;
+  uint32_t data;
+  int op;
+};
+
+struct interp_block {
+  int num_cycles;
+  int num_instrs;
+
+  /* host memory backing the guest code and a copy of it from when the block
+     was decoded. src is NULL for code not directly backed by host memory, in
+     which case each instruction's data is read back through the guest */
+  const uint8_t *src;
+  uint8_t *copy;
+  int size;
+
+  struct interp_instr instrs[];
+};
+
 struct interp_backend {
   struct jit_backend;
 
   /* used to resolve the fallback handler for each instruction */
   struct jit_frontend *frontend;
+
+  /* decoded block cache, indexed by guest address. empty entries haven't been
+     decoded yet */
+  uint32_t cache_mask;
+  int cache_shift;
+  int cache_size;
+  struct interp_block **cache;
+
+  /* decoded blocks are written to the code buffer, which is split into regions
+     and evicted the same as compiled code */
+  uint8_t *code;
+  int code_offset;
+  int region_size;
+  int curr_region;
 };
 
+static inline struct interp_block **interp_backend_code_ptr(
+    struct interp_backend *backend, uint32_t addr) {
+  return &backend->cache[(addr & backend->cache_mask) >> backend->cache_shift];
+}
+
+static void interp_backend_invalidate_code(struct jit_backend *base,
+                                           uint32_t addr) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  struct interp_block **entry = interp_backend_code_ptr(backend, addr);
+  *entry = NULL;
+}
+
+static void interp_backend_cache_code(struct jit_backend *base, uint32_t addr,
+                                      void *code) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  struct interp_block **entry = interp_backend_code_ptr(backend, addr);
+  CHECK_EQ(*entry, NULL);
+  *entry = code;
+}
+
+static void *interp_backend_lookup_code(struct jit_backend *base,
+                                        uint32_t addr) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  struct interp_block **entry = interp_backend_code_ptr(backend, addr);
+  return *entry;
+}
+
+static int interp_backend_block_stale(struct interp_backend *backend,
+                                      struct interp_block *block) {
+  if (block->src) {
+    return memcmp(block->src, block->copy, block->size) != 0;
+  }
+
+  struct jit_guest *guest = backend->guest;
+
+  for (int i = 0; i < block->num_instrs; i++) {
+    struct interp_instr *instr = &block->instrs[i];
+
+    if (guest->r32(guest->mem, instr->addr) != instr->data) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
 static void interp_backend_run_code(struct jit_backend *base, int cycles) {
   struct interp_backend *backend = (struct interp_backend *)base;
-  struct jit_frontend *frontend = backend->frontend;
   struct jit_guest *guest = backend->guest;
   uint8_t *ctx = guest->ctx;
   uint32_t *pc = (uint32_t *)(ctx + guest->offset_pc);
   int32_t *run_cycles = (int32_t *)(ctx + guest->offset_cycles);
   int32_t *ran_instrs = (int32_t *)(ctx + guest->offset_instrs);
+  uint64_t *interrupts = (uint64_t *)(ctx + guest->offset_interrupts);
+
+#if INTERP_THREADED
+  static const void *handlers[INTERP_NUM_OPS] = {
+      [INTERP_EXEC] = &&INTERP_EXEC, [INTERP_EXEC_LAST] = &&INTERP_EXEC_LAST,
+  };
+#define HANDLER(op) op:
+#define DISPATCH() goto *handlers[instr->op]
+#else
+#define HANDLER(op) case op:
+#define DISPATCH() goto dispatch
+#endif
 
   *run_cycles = cycles;
   *ran_instrs = 0;
 
-  while (*run_cycles > 0) {
-    int RUN_SLICE = MIN(*run_cycles, 64);
-    int cycles = 0;
-    int instrs = 0;
+  /* yield once the remaining cycles are executed, the same as compiled code
+     does on entering each block */
+  while (*run_cycles >= 0) {
+    /* yield control to any pending interrupts */
+    if (*interrupts) {
+      guest->check_interrupts(guest->data);
+    }
+
+    uint32_t addr = *pc;
+    struct interp_block **entry = interp_backend_code_ptr(backend, addr);
+    struct interp_block *block = *entry;
+
+    /* decode the block again if the guest code was written to */
+    if (block && interp_backend_block_stale(backend, block)) {
+      *entry = block = NULL;
+    }
+
+    if (!block) {
+      guest->compile_code(guest->data, addr);
+      continue;
+    }
 
-    do {
-      uint32_t addr = *pc;
-      uint32_t data = guest->r32(guest->mem, addr);
-      const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
-      def->fallback(guest, addr, data);
-      cycles += def->cycles;
-      instrs += 1;
-    } while (cycles < RUN_SLICE);
+    *run_cycles -= block->num_cycles;
+    *ran_instrs += block->num_instrs;
 
-    *run_cycles -= cycles;
-    *ran_instrs += instrs;
+    struct interp_instr *instr = block->instrs;
 
-    guest->check_interrupts(guest->data);
+#if INTERP_THREADED
+    DISPATCH();
+#else
+  dispatch:
+    switch (instr->op) {
+#endif
+    HANDLER(INTERP_EXEC) {
+      instr->fallback(guest, instr->addr, instr->data);
+      instr++;
+
+      /* leave the block early if the instruction didn't fall through, e.g. it
+         raised an exception, or it branched over its delay slot */
+      if (*pc != instr->addr) {
+        continue;
+      }
+
+      DISPATCH();
+    }
+
+    HANDLER(INTERP_EXEC_LAST) {
+      instr->fallback(guest, instr->addr, instr->data);
+      continue;
+    }
+#if !INTERP_THREADED
+    }
+#endif
   }
+
+#undef HANDLER
+#undef DISPATCH
+}
+
+static int interp_backend_region_begin(struct interp_backend *backend,
+                                       int region) {
+  return region * backend->region_size;
+}
+
+static int interp_backend_decode_code(struct jit_backend *base, uint32_t addr,
+                                      int size, uint8_t **code,
+                                      int *code_size) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+  struct jit_frontend *frontend = backend->frontend;
+  struct jit_guest *guest = backend->guest;
+
+  /* only compare the code in place if it's contiguous in host memory */
+  uint8_t *src = NULL;
+
+  if (guest->lookup) {
+    uint8_t *last = NULL;
+    guest->lookup(guest->mem, addr, NULL, &src, NULL, NULL);
+    guest->lookup(guest->mem, addr + size - 1, NULL, &last, NULL, NULL);
+
+    if (!src || last != src + size - 1) {
+      src = NULL;
+    }
+  }
+
+  int num_instrs = size / frontend->instr_size;
+  int instrs_size = sizeof(struct interp_block) +
+                    num_instrs * sizeof(struct interp_instr);
+  int block_size = instrs_size + (src ? size : 0);
+  block_size = ALIGN_UP(block_size, (int)sizeof(void *));
+
+  /* fail if the block doesn't fit in what's left of the current region */
+  int region_end =
+      interp_backend_region_begin(backend, backend->curr_region) +
+      backend->region_size;
+
+  if (backend->code_offset + block_size > region_end) {
+    return 0;
+  }
+
+  struct interp_block *block =
+      (struct interp_block *)(backend->code + backend->code_offset);
+  block->num_cycles = 0;
+  block->num_instrs = num_instrs;
+  block->src = src;
+  block->copy = src ? (uint8_t *)block + instrs_size : NULL;
+  block->size = size;
+
+  if (src) {
+    memcpy(block->copy, src, size);
+  }
+
+  for (int i = 0; i < num_instrs; i++) {
+    struct interp_instr *instr = &block->instrs[i];
+    uint32_t instr_addr = addr + i * frontend->instr_size;
+    uint32_t data = guest->r32(guest->mem, instr_addr);
+    const struct jit_opdef *def = frontend->lookup_op(frontend, &data);
+
+    instr->fallback = def->fallback;
+    instr->addr = instr_addr;
+    instr->data = data;
+    instr->op = i == num_instrs - 1 ? INTERP_EXEC_LAST : INTERP_EXEC;
+
+    block->num_cycles += def->cycles;
+  }
+
+  *code = (uint8_t *)block;
+  *code_size = block_size;
+
+  backend->code_offset += block_size;
+
+  return 1;
+}
+
+static void interp_backend_next_region(struct jit_backend *base,
+                                       uint8_t **addr, int *size) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  backend->curr_region = (backend->curr_region + 1) % INTERP_NUM_REGIONS;
+  backend->code_offset =
+      interp_backend_region_begin(backend, backend->curr_region);
+
+  *addr = backend->code + backend->code_offset;
+  *size = backend->region_size;
 }
 
 static int interp_backend_handle_exception(struct jit_backend *base,
@@ -53,11 +296,18 @@ static void interp_backend_dump_code(struct jit_backend *base,
                                      const uint8_t *addr, int size,
                                      FILE *output) {}
 
-static void interp_backend_reset(struct jit_backend *base) {}
+static void interp_backend_reset(struct jit_backend *base) {
+  struct interp_backend *backend = (struct interp_backend *)base;
+
+  backend->curr_region = 0;
+  backend->code_offset = 0;
+}
 
 static void interp_backend_destroy(struct jit_backend *base) {
   struct interp_backend *backend = (struct interp_backend *)base;
 
+  free(backend->code);
+  free(backend->cache);
   free(backend);
 }
 
@@ -73,17 +323,29 @@ struct jit_backend *interp_backend_create(struct jit_guest *guest,
   backend->registers = NULL;
   backend->num_registers = 0;
   backend->reset = &interp_backend_reset;
+  backend->next_region = &interp_backend_next_region;
   backend->assemble_code = NULL;
   backend->dump_code = &interp_backend_dump_code;
   backend->handle_exception = &interp_backend_handle_exception;
+  backend->decode_code = &interp_backend_decode_code;
 
   /* dispatch interface */
   backend->run_code = &interp_backend_run_code;
-  backend->lookup_code = NULL;
-  backend->cache_code = NULL;
-  backend->invalidate_code = NULL;
+  backend->lookup_code = &interp_backend_lookup_code;
+  backend->cache_code = &interp_backend_cache_code;
+  backend->invalidate_code = &interp_backend_invalidate_code;
   backend->patch_edge = NULL;
   backend->restore_edge = NULL;
 
+  /* setup decoded block cache */
+  backend->cache_mask = guest->addr_mask;
+  backend->cache_shift = ctz32(guest->addr_mask);
+  backend->cache_size = (backend->cache_mask >> backend->cache_shift) + 1;
+  backend->cache = calloc(backend->cache_size, sizeof(struct interp_block *));
+
+  /* setup code buffer */
+  backend->code = malloc(INTERP_CODE_SIZE);
+  backend->region_size = INTERP_CODE_SIZE / INTERP_NUM_REGIONS;
+
   return (struct jit_backend *)backend;
 }
@@ -356,6 +356,42 @@ void x64_backend_block_label(char *name, size_t size, struct ir_block *block) {
   snprintf(name, size, ".%p", block);
 }
 
+void x64_backend_cold_label(char *name, size_t size, struct ir_instr *instr) {
+  snprintf(name, size, ".%p.cold", instr);
+}
+
+void x64_backend_resume_label(char *name, size_t size, struct ir_instr *instr) {
+  snprintf(name, size, ".%p.resume", instr);
+}
+
+/* defer an instruction's slow path to the cold section, keeping it out of the
+   hot code. the emitter is responsible for branching to the path's cold label,
+   and for defining the resume label the path jumps back to when done. if the
+   cold section is full, 0 is returned and the slow path must be emitted
+   inline instead.
+
+   note, the cold section is the tail of each compiled block rather than a
+   separate area of the code buffer, so it only keeps a block's own hot code
+   contiguous. paths which already leave the block aren't deferred: the cycle
+   and interrupt checks branch straight to the shared dispatch thunks, and
+   fastmem faults are handled by the exception handler. non-fastmem guest
+   accesses always call out to the memory interface, having no fast path to
+   split from */
+int x64_backend_defer_cold(struct x64_backend *backend, struct ir_instr *instr,
+                           void (*emit)(struct x64_backend *,
+                                        Xbyak::CodeGenerator &, struct ir *,
+                                        struct ir_instr *)) {
+  if (backend->num_cold_paths >= X64_MAX_COLD_PATHS) {
+    return 0;
+  }
+
+  struct x64_cold_path *path = &backend->cold_paths[backend->num_cold_paths++];
+  path->emit = emit;
+  path->instr = instr;
+
+  return 1;
+}
+
 static void x64_backend_emit_thunks(struct x64_backend *backend) {
   auto &e = *backend->codegen;
 
@@ -579,7 +615,8 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
   if (target) {
     if (ir_is_constant(target)) {
       if (target->type == VALUE_BLOCK) {
-        x64_backend_block_label(block_label, sizeof(block_label), target->blk);
+        x64_backend_block_label(block_label, sizeof(block_label),
+                                target->blk);
 
         struct ir_value *addr = ir_get_meta(ir, target->blk, IR_META_ADDR);
         e.mov(e.dword[guestctx + guest->offset_pc], addr->i32);
@@ -592,7 +629,7 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
     } else {
       Xbyak::Reg addr = x64_backend_reg(backend, target);
       e.mov(e.dword[guestctx + guest->offset_pc], addr);
-      dispatch_type = 2;
+      dispatch_type = 3;
     }
   } else {
     dispatch_type = 2;
@@ -609,6 +646,9 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
     case 2:
       e.jmp(backend->dispatch_dynamic);
       break;
+    case 3:
+      x64_dispatch_emit_inline_cache(backend);
+      break;
   }
 }
 
@@ -642,19 +682,54 @@ static void x64_backend_emit_prolog(struct x64_backend *backend, struct ir *ir,
     }
   }
 
-  /* yield control once remaining cycles are executed */
-  e.mov(e.eax, e.dword[guestctx + guest->offset_cycles]);
-  e.test(e.eax, e.eax);
-  e.js(backend->dispatch_exit);
-
-  /* yield control to any pending interrupts */
-  e.mov(e.rax, e.qword[guestctx + guest->offset_interrupts]);
-  e.test(e.rax, e.rax);
-  e.jnz(backend->dispatch_interrupt);
+  /* only yield at the entry block and at the top of loops. this bounds the
+     time spent without yielding to a single pass through the ir, while
+     leaving the context unobservable between the other blocks */
+  if (ir_is_yield_point(ir, block)) {
+    /* yield control once remaining cycles are executed */
+    e.mov(e.eax, e.dword[guestctx + guest->offset_cycles]);
+    e.test(e.eax, e.eax);
+    e.js(backend->dispatch_exit);
+
+    /* yield control to any pending interrupts */
+    e.mov(e.rax, e.qword[guestctx + guest->offset_interrupts]);
+    e.test(e.rax, e.rax);
+    e.jnz(backend->dispatch_interrupt);
+  }
 
   /* update debug run counts */
   e.sub(e.dword[guestctx + guest->offset_cycles], num_cycles);
   e.add(e.dword[guestctx + guest->offset_instrs], num_instrs);
+
+  /* update profile counters */
+  struct ir_value *profile = ir_get_meta(ir, block, IR_META_PROFILE);
+
+  if (profile) {
+    struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+
+    if (block == head) {
+      /* attribute the host time elapsed since the last block was entered to
+         it, and make this block the last one entered */
+      e.rdtsc();
+      e.shl(e.rdx, 32);
+      e.or_(e.rax, e.rdx);
+      e.mov(e.rcx, (uint64_t)&backend->prof);
+      e.mov(e.rdx, e.rax);
+      e.sub(e.rdx, e.qword[e.rcx + offsetof(struct x64_profile, last_tick)]);
+      e.mov(e.qword[e.rcx + offsetof(struct x64_profile, last_tick)], e.rax);
+      e.mov(e.rax, e.qword[e.rcx + offsetof(struct x64_profile, last_entry)]);
+      e.add(e.qword[e.rax + offsetof(struct jit_profile_entry, num_ticks)],
+            e.rdx);
+      e.mov(e.rax, profile->i64);
+      e.mov(e.qword[e.rcx + offsetof(struct x64_profile, last_entry)], e.rax);
+      e.inc(e.qword[e.rax + offsetof(struct jit_profile_entry, num_execs)]);
+    } else {
+      e.mov(e.rax, profile->i64);
+    }
+
+    e.add(e.qword[e.rax + offsetof(struct jit_profile_entry, num_cycles)],
+          num_cycles);
+  }
 }
 
 static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
@@ -663,6 +738,8 @@ static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
 
   CHECK_LT(ir->locals_size, X64_STACK_SIZE);
 
+  backend->num_cold_paths = 0;
+
   e.inLocalLabel();
 
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
@@ -700,9 +777,42 @@ static void x64_backend_emit(struct x64_backend *backend, struct ir *ir,
     x64_backend_emit_epilog(backend, ir, block);
   }
 
+  /* emit the slow paths after all of the block's hot code, so the hot code
+     is packed as densely as possible */
+  if (emit_cb) {
+    emit_cb(emit_data, JIT_EMIT_COLD, 0, e.getCurr<uint8_t *>());
+  }
+
+  for (int i = 0; i < backend->num_cold_paths; i++) {
+    struct x64_cold_path *path = &backend->cold_paths[i];
+
+    char cold_label[128];
+    x64_backend_cold_label(cold_label, sizeof(cold_label), path->instr);
+    e.L(cold_label);
+
+    path->emit(backend, e, ir, path->instr);
+
+    char resume_label[128];
+    x64_backend_resume_label(resume_label, sizeof(resume_label), path->instr);
+    e.jmp(resume_label, Xbyak::CodeGenerator::T_NEAR);
+  }
+
   e.outLocalLabel();
 }
 
+/* the code buffer after the thunks is split into equally sized regions, with
+   any remainder going to the last region */
+static int x64_backend_region_begin(struct x64_backend *backend, int region) {
+  return X64_THUNK_SIZE + region * backend->region_size;
+}
+
+static int x64_backend_region_size(struct x64_backend *backend, int region) {
+  if (region == X64_NUM_REGIONS - 1) {
+    return backend->code_size - x64_backend_region_begin(backend, region);
+  }
+  return backend->region_size;
+}
+
 static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
                                      uint8_t **addr, int *size,
                                      jit_emit_cb emit_cb, void *emit_data) {
@@ -712,8 +822,9 @@ static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
   int res = 1;
   uint8_t *code = e.getCurr<uint8_t *>();
 
-  /* try to generate the x64 code. if the code buffer overflows let the backend
-     know so it can reset the cache and try again */
+  /* try to generate the x64 code. the code generator is bounded to the end of
+     the current region, if it overflows let the jit know so it can evict the
+     next region and try again */
   try {
     x64_backend_emit(backend, ir, emit_cb, emit_data);
   } catch (const Xbyak::Error &e) {
@@ -730,12 +841,36 @@ static int x64_backend_assemble_code(struct jit_backend *base, struct ir *ir,
   return res;
 }
 
+static void x64_backend_set_region(struct x64_backend *backend, int region,
+                                   int offset) {
+  /* bound the code generator to the end of the region */
+  int end =
+      x64_backend_region_begin(backend, region) +
+      x64_backend_region_size(backend, region);
+
+  backend->curr_region = region;
+  backend->codegen->setMaxSize(end);
+  backend->codegen->setSize(offset);
+}
+
+static void x64_backend_next_region(struct jit_backend *base, uint8_t **addr,
+                                    int *size) {
+  struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  int region = (backend->curr_region + 1) % X64_NUM_REGIONS;
+  int begin = x64_backend_region_begin(backend, region);
+  x64_backend_set_region(backend, region, begin);
+
+  *addr = (uint8_t *)backend->codegen->getCode() + begin;
+  *size = x64_backend_region_size(backend, backend->curr_region);
+}
+
 static void x64_backend_reset(struct jit_backend *base) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
   /* avoid reemitting thunks by just resetting the size to a safe spot after
      the thunks */
-  backend->codegen->setSize(X64_THUNK_SIZE);
+  x64_backend_set_region(backend, 0, X64_THUNK_SIZE);
 }
 
 static void x64_backend_destroy(struct jit_backend *base) {
@@ -765,6 +900,7 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   backend->base.emitters = x64_emitters;
   backend->base.num_emitters = ARRAY_SIZE(x64_emitters);
   backend->base.reset = &x64_backend_reset;
+  backend->base.next_region = &x64_backend_next_region;
   backend->base.assemble_code = &x64_backend_assemble_code;
   backend->base.dump_code = &x64_backend_dump_code;
   backend->base.handle_exception = &x64_backend_handle_exception;
@@ -783,10 +919,18 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
 
   int have_avx2 = cpu.has(Xbyak::util::Cpu::tAVX2);
   int have_sse2 = cpu.has(Xbyak::util::Cpu::tSSE2);
+  int have_sse41 = cpu.has(Xbyak::util::Cpu::tSSE41);
+  int have_fma = cpu.has(Xbyak::util::Cpu::tFMA);
   CHECK(have_avx2 || have_sse2, "CPU must support either AVX2 or SSE2");
 
-  backend->codegen = new Xbyak::CodeGenerator(code_size, code);
+  backend->codegen = new x64_codegen(code_size, code);
+  backend->code_size = code_size;
+  backend->region_size = (code_size - X64_THUNK_SIZE) / X64_NUM_REGIONS;
   backend->use_avx = have_avx2;
+  /* fma is vex encoded, only use it alongside the other avx instructions */
+  backend->use_fma = have_avx2 && have_fma;
+  backend->use_sse41 = have_sse41;
+  backend->prof.last_entry = &backend->prof.idle;
 
   /* create disassembler */
   int res = cs_open(CS_ARCH_X86, CS_MODE_64, &backend->capstone_handle);
@@ -799,5 +943,7 @@ struct jit_backend *x64_backend_create(struct jit_guest *guest, void *code,
   x64_backend_emit_constants(backend);
   CHECK_LT(backend->codegen->getSize(), X64_THUNK_SIZE);
 
+  x64_backend_set_region(backend, 0, X64_THUNK_SIZE);
+
   return &backend->base;
 }
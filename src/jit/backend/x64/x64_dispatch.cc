@@ -31,19 +31,113 @@ static void x64_dispatch_log(struct x64_ctx *ctx) {
 }
 #endif
 
+/* inline caches are emitted for dynamic branches. initially, the cache just
+   calls the inline dispatch thunk, which links the cache to the current
+   destination block the same way a static branch is linked:
+
+   call dispatch_inline
+   (padding)
+   miss:
+   (inline dispatch cache lookup)
+
+   once linked, the cache compares the guest pc against the destination
+   block's address, jumping directly to it when it matches:
+
+   cmp dword [guestctx + offset_pc], addr
+   jne miss
+   jmp dst
+   miss:
+   (inline dispatch cache lookup)
+
+   the compare is encoded by hand to guarantee the patched sequence has a
+   fixed size, and its first bytes are used to tell linked inline caches apart
+   from linked static branches
+
+   note, the cache is monomorphic. it stays linked to the first destination
+   until that block is invalidated, and every other destination takes the
+   inline lookup. this keeps the miss path free of relinking, so polymorphic
+   sites (e.g. an rts returning to many callers) don't thrash the cache, but
+   they only ever hit for a single destination. a polymorphic cache would
+   need an edge per entry and a replacement policy, and wasn't worth it over
+   the per-site lookup, which the host predictor already tracks per site */
+static const uint8_t x64_inline_cache_cmp[] = {0x41, 0x81, 0xbe};
+
+static int x64_dispatch_is_inline_cache(struct x64_backend *backend,
+                                        void *code) {
+  uint8_t *ptr = (uint8_t *)code;
+
+  if (!memcmp(ptr, x64_inline_cache_cmp, sizeof(x64_inline_cache_cmp))) {
+    return 1;
+  }
+
+  /* unlinked caches call the inline dispatch thunk */
+  int32_t rel = *(int32_t *)(ptr + 1);
+  return ptr[0] == 0xe8 && ptr + 5 + rel == backend->dispatch_inline;
+}
+
 void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
 
   Xbyak::CodeGenerator e(32, code);
-  e.call(backend->dispatch_static);
+
+  if (x64_dispatch_is_inline_cache(backend, code)) {
+    e.call(backend->dispatch_inline);
+  } else {
+    e.call(backend->dispatch_static);
+  }
 }
 
-void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst) {
+void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst,
+                             uint32_t addr) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
+  struct jit_guest *guest = backend->base.guest;
 
-  Xbyak::CodeGenerator e(32, code);
-  e.jmp(dst);
+  Xbyak::CodeGenerator e(X64_INLINE_CACHE_SIZE, code);
+
+  if (x64_dispatch_is_inline_cache(backend, code)) {
+    e.db(x64_inline_cache_cmp, sizeof(x64_inline_cache_cmp));
+    e.dd(guest->offset_pc);
+    e.dd(addr);
+    e.db(0x0f);
+    e.db(0x85);
+    e.dd(5 /* sizeof jmp instr */);
+    e.jmp(dst, Xbyak::CodeGenerator::T_NEAR);
+    CHECK_EQ(e.getSize(), X64_INLINE_CACHE_SIZE);
+  } else {
+    e.jmp(dst);
+  }
+}
+
+/* emits a monomorphic inline cache, see the description above */
+void x64_dispatch_emit_inline_cache(struct x64_backend *backend) {
+  auto &e = *backend->codegen;
+
+  /* the guest pc has already been written to the context */
+  size_t begin = e.getSize();
+
+  e.call(backend->dispatch_inline);
+
+  while (e.getSize() - begin < X64_INLINE_CACHE_SIZE) {
+    e.nop();
+  }
+
+  /* on a miss, look up the destination block inline. having an indirect jmp
+     per-callsite, as opposed to them all sharing the one in the dynamic
+     dispatch thunk, gives the host's branch predictor a chance to predict
+     each one */
+  x64_dispatch_emit_lookup(backend);
+}
+
+void x64_dispatch_emit_lookup(struct x64_backend *backend) {
+  struct jit_guest *guest = backend->base.guest;
+  auto &e = *backend->codegen;
+
+  /* invasively look into the jit's cache */
+  e.mov(e.rax, (uint64_t)backend->cache);
+  e.mov(e.ecx, e.dword[guestctx + guest->offset_pc]);
+  e.and_(e.ecx, backend->cache_mask);
+  e.jmp(e.qword[e.rax + e.rcx * (sizeof(void *) >> backend->cache_shift)]);
 }
 
 void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr) {
@@ -68,6 +162,10 @@ void *x64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr) {
 
 void x64_dispatch_run_code(struct jit_backend *base, int cycles) {
   struct x64_backend *backend = container_of(base, struct x64_backend, base);
+
+  /* don't attribute the time spent between runs to the last block run */
+  backend->prof.last_entry = &backend->prof.idle;
+
   backend->dispatch_enter(cycles);
 }
 
@@ -90,11 +188,7 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.call(&x64_dispatch_log);
 #endif
 
-    /* invasively look into the jit's cache */
-    e.mov(e.rax, (uint64_t)backend->cache);
-    e.mov(e.ecx, e.dword[guestctx + guest->offset_pc]);
-    e.and_(e.ecx, backend->cache_mask);
-    e.jmp(e.qword[e.rax + e.rcx * (sizeof(void *) >> backend->cache_shift)]);
+    x64_dispatch_emit_lookup(backend);
   }
 
   {
@@ -120,6 +214,26 @@ void x64_dispatch_emit_thunks(struct x64_backend *backend) {
     e.jmp(backend->dispatch_dynamic);
   }
 
+  {
+    /* called by an unlinked inline cache after a dynamic branch stores the
+       next pc to the context. like the static branch thunk, this links the
+       cache to the destination block, see x64_dispatch_patch_edge */
+    e.align(32);
+
+    backend->dispatch_inline = e.getCurr<void *>();
+
+#if LINK_STATIC_BRANCHES
+    e.mov(arg0, (uint64_t)guest->data);
+    e.pop(arg1);
+    e.sub(arg1, 5 /* sizeof call instr */);
+    e.mov(arg2, e.qword[guestctx + guest->offset_pc]);
+    e.call(guest->link_code);
+#else
+    e.pop(arg1);
+#endif
+    e.jmp(backend->dispatch_dynamic);
+  }
+
   {
     /* default cache entry for all blocks. compiles the desired pc before
        jumping to the block through the dynamic dispatch thunk */
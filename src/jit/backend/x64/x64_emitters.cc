@@ -61,6 +61,233 @@ enum {
 
 struct jit_emitter x64_emitters[IR_NUM_OPS];
 
+/*
+ * compare fusion
+ *
+ * a compare immediately followed by a branch_cond / select which is its only
+ * user doesn't materialize its result. the compare only sets the host flags,
+ * which the user consumes directly with a jcc / cmovcc. see
+ * compare_fusion_pass.c for the pass setting this up
+ */
+enum x64_cond {
+  X64_COND_E,
+  X64_COND_NE,
+  X64_COND_GE,
+  X64_COND_G,
+  X64_COND_AE,
+  X64_COND_A,
+  X64_COND_LE,
+  X64_COND_L,
+  X64_COND_BE,
+  X64_COND_B,
+  /* only used for fcmp eq / ne, which also need to check the parity flag for
+     unordered operands */
+  X64_COND_FE,
+  X64_COND_FNE,
+};
+
+static int x64_is_fused_cmp(struct ir_instr *cmp) {
+  struct ir_instr *next = list_next_entry(cmp, struct ir_instr, it);
+  struct ir_value *result = cmp->result;
+
+  if (!next || (next->op != OP_BRANCH_COND && next->op != OP_SELECT) ||
+      next->arg[2] != result) {
+    return 0;
+  }
+
+  if (list_first_entry(&result->uses, struct ir_use, it) !=
+      list_last_entry(&result->uses, struct ir_use, it)) {
+    return 0;
+  }
+
+  /* see x64_emit_fused_select */
+  enum ir_cmp type = (enum ir_cmp)cmp->arg[2]->i32;
+
+  if (next->op == OP_SELECT && cmp->op == OP_FCMP &&
+      (type == CMP_EQ || type == CMP_NE)) {
+    return 0;
+  }
+
+  return 1;
+}
+
+static struct ir_instr *x64_fused_cmp(struct ir_instr *instr) {
+  struct ir_value *cond = instr->arg[2];
+
+  if (ir_is_constant(cond) || !x64_is_fused_cmp(cond->def)) {
+    return NULL;
+  }
+
+  return cond->def;
+}
+
+static enum x64_cond x64_cmp_cond(struct ir_instr *cmp) {
+  enum ir_cmp type = (enum ir_cmp)cmp->arg[2]->i32;
+
+  /* ucomiss / ucomisd set the flags like an unsigned compare, with all of zf,
+     pf and cf set for unordered operands */
+  if (cmp->op == OP_FCMP) {
+    switch (type) {
+      case CMP_EQ:
+        return X64_COND_FE;
+      case CMP_NE:
+        return X64_COND_FNE;
+      case CMP_SGE:
+        return X64_COND_AE;
+      case CMP_SGT:
+        return X64_COND_A;
+      case CMP_SLE:
+        return X64_COND_BE;
+      case CMP_SLT:
+        return X64_COND_B;
+      default:
+        LOG_FATAL("unexpected comparison type");
+    }
+  }
+
+  switch (type) {
+    case CMP_EQ:
+      return X64_COND_E;
+    case CMP_NE:
+      return X64_COND_NE;
+    case CMP_SGE:
+      return X64_COND_GE;
+    case CMP_SGT:
+      return X64_COND_G;
+    case CMP_UGE:
+      return X64_COND_AE;
+    case CMP_UGT:
+      return X64_COND_A;
+    case CMP_SLE:
+      return X64_COND_LE;
+    case CMP_SLT:
+      return X64_COND_L;
+    case CMP_ULE:
+      return X64_COND_BE;
+    case CMP_ULT:
+      return X64_COND_B;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+static enum x64_cond x64_invert_cond(enum x64_cond cond) {
+  switch (cond) {
+    case X64_COND_E:
+      return X64_COND_NE;
+    case X64_COND_NE:
+      return X64_COND_E;
+    case X64_COND_GE:
+      return X64_COND_L;
+    case X64_COND_G:
+      return X64_COND_LE;
+    case X64_COND_AE:
+      return X64_COND_B;
+    case X64_COND_A:
+      return X64_COND_BE;
+    case X64_COND_LE:
+      return X64_COND_G;
+    case X64_COND_L:
+      return X64_COND_GE;
+    case X64_COND_BE:
+      return X64_COND_A;
+    case X64_COND_B:
+      return X64_COND_AE;
+    case X64_COND_FE:
+      return X64_COND_FNE;
+    case X64_COND_FNE:
+      return X64_COND_FE;
+    default:
+      LOG_FATAL("unexpected condition");
+  }
+}
+
+static void x64_emit_jcc(Xbyak::CodeGenerator &e, enum x64_cond cond,
+                         Xbyak::Label &label) {
+  switch (cond) {
+    case X64_COND_E:
+      e.je(label);
+      break;
+    case X64_COND_NE:
+      e.jne(label);
+      break;
+    case X64_COND_GE:
+      e.jge(label);
+      break;
+    case X64_COND_G:
+      e.jg(label);
+      break;
+    case X64_COND_AE:
+      e.jae(label);
+      break;
+    case X64_COND_A:
+      e.ja(label);
+      break;
+    case X64_COND_LE:
+      e.jle(label);
+      break;
+    case X64_COND_L:
+      e.jl(label);
+      break;
+    case X64_COND_BE:
+      e.jbe(label);
+      break;
+    case X64_COND_B:
+      e.jb(label);
+      break;
+    case X64_COND_FE: {
+      /* equal and ordered */
+      Xbyak::Label skip;
+      e.jp(skip);
+      e.je(label);
+      e.L(skip);
+    } break;
+    case X64_COND_FNE:
+      /* not equal or unordered */
+      e.jp(label);
+      e.jne(label);
+      break;
+  }
+}
+
+static void x64_emit_cmovcc(Xbyak::CodeGenerator &e, enum x64_cond cond,
+                            const Xbyak::Reg &rd, const Xbyak::Reg &rs) {
+  switch (cond) {
+    case X64_COND_E:
+      e.cmove(rd, rs);
+      break;
+    case X64_COND_NE:
+      e.cmovne(rd, rs);
+      break;
+    case X64_COND_GE:
+      e.cmovge(rd, rs);
+      break;
+    case X64_COND_G:
+      e.cmovg(rd, rs);
+      break;
+    case X64_COND_AE:
+      e.cmovae(rd, rs);
+      break;
+    case X64_COND_A:
+      e.cmova(rd, rs);
+      break;
+    case X64_COND_LE:
+      e.cmovle(rd, rs);
+      break;
+    case X64_COND_L:
+      e.cmovl(rd, rs);
+      break;
+    case X64_COND_BE:
+      e.cmovbe(rd, rs);
+      break;
+    case X64_COND_B:
+      e.cmovb(rd, rs);
+      break;
+    default:
+      LOG_FATAL("unexpected condition");
+  }
+}
+
 EMITTER(SOURCE_INFO, CONSTRAINTS(NONE, IMM_I32, IMM_I32)) {
 #if 0
   /* encode the guest address of each instruction in the generated code for
@@ -392,6 +619,18 @@ EMITTER(SELECT, CONSTRAINTS(REG_I64, REG_I64, REG_I64, REG_I64)) {
   CHECK_GE(rd.getBit(), 32);
   Xbyak::Reg32e rd_32e(rd.getIdx(), rd.getBit());
 
+  struct ir_instr *cmp = x64_fused_cmp(instr);
+
+  if (cmp) {
+    enum x64_cond cc = x64_cmp_cond(cmp);
+
+    if (rd_32e != t) {
+      x64_emit_cmovcc(e, cc, rd_32e, t);
+    }
+    x64_emit_cmovcc(e, x64_invert_cond(cc), rd_32e, f);
+    return;
+  }
+
   e.test(cond, cond);
   if (rd_32e != t) {
     e.cmovnz(rd_32e, t);
@@ -410,6 +649,11 @@ EMITTER(CMP, CONSTRAINTS(REG_I64, REG_I64, REG_I64 | IMM_I32, IMM_I32)) {
     e.cmp(ra, rb);
   }
 
+  /* the user consumes the flags directly */
+  if (x64_is_fused_cmp(instr)) {
+    return;
+  }
+
   enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
   switch (cmp) {
     case CMP_EQ:
@@ -458,6 +702,11 @@ EMITTER(FCMP, CONSTRAINTS(REG_I64, REG_F64, REG_F64, IMM_I32)) {
     e.ucomisd(ra, rb);
   }
 
+  /* the user consumes the flags directly */
+  if (x64_is_fused_cmp(instr)) {
+    return;
+  }
+
   enum ir_cmp cmp = (enum ir_cmp)ARG2->i32;
   switch (cmp) {
     case CMP_EQ:
@@ -738,6 +987,21 @@ EMITTER(VBROADCAST, CONSTRAINTS(REG_V128, REG_F64)) {
   }
 }
 
+EMITTER(VSPLAT, CONSTRAINTS(REG_V128, REG_V128, IMM_I32)) {
+  Xbyak::Xmm rd = RES_XMM;
+  Xbyak::Xmm ra = ARG0_XMM;
+  uint8_t shuf = ARG1->i32 * 0x55;
+
+  if (X64_USE_AVX) {
+    e.vpermilps(rd, ra, shuf);
+  } else {
+    if (rd != ra) {
+      e.movaps(rd, ra);
+    }
+    e.shufps(rd, rd, shuf);
+  }
+}
+
 EMITTER(VADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
   Xbyak::Xmm rd = RES_XMM;
   Xbyak::Xmm ra = ARG0_XMM;
@@ -760,13 +1024,22 @@ EMITTER(VDOT, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
 
   if (X64_USE_AVX) {
     e.vdpps(rd, ra, rb, 0b11110001);
+  } else if (X64_USE_SSE41) {
+    if (rd != ra) {
+      e.movaps(rd, ra);
+    }
+    e.dpps(rd, rb, 0b11110001);
   } else {
+    /* sum the products pairwise, then the two pairs */
     if (rd != ra) {
       e.movaps(rd, ra);
     }
     e.mulps(rd, rb);
-    e.haddps(rd, rd);
-    e.haddps(rd, rd);
+    e.movaps(e.xmm0, rd);
+    e.shufps(e.xmm0, e.xmm0, 0b10110001);
+    e.addps(rd, e.xmm0);
+    e.movhlps(e.xmm0, rd);
+    e.addss(rd, e.xmm0);
   }
 }
 
@@ -785,6 +1058,33 @@ EMITTER(VMUL, CONSTRAINTS(REG_V128, REG_V128, REG_V128)) {
   }
 }
 
+EMITTER(VMADD, CONSTRAINTS(REG_V128, REG_V128, REG_V128, REG_V128)) {
+  Xbyak::Xmm rd = RES_XMM;
+  Xbyak::Xmm ra = ARG0_XMM;
+  Xbyak::Xmm rb = ARG1_XMM;
+  Xbyak::Xmm rc = ARG2_XMM;
+
+  /* the result register is only ever shared with arg0 */
+  if (X64_USE_FMA) {
+    if (rd == ra) {
+      e.vfmadd213ps(rd, rb, rc);
+    } else {
+      e.vmovaps(rd, rc);
+      e.vfmadd231ps(rd, ra, rb);
+    }
+  } else if (X64_USE_AVX) {
+    e.vmulps(e.xmm0, ra, rb);
+    e.vaddps(rd, e.xmm0, rc);
+  } else {
+    e.movaps(e.xmm0, ra);
+    e.mulps(e.xmm0, rb);
+    if (rd != rc) {
+      e.movaps(rd, rc);
+    }
+    e.addps(rd, e.xmm0);
+  }
+}
+
 EMITTER(AND, CONSTRAINTS(REG_ARG0, REG_I64, REG_I64 | IMM_I32)) {
   Xbyak::Reg rd = RES_REG;
 
@@ -936,10 +1236,16 @@ EMITTER(BRANCH_COND, CONSTRAINTS(NONE, REG_I64 | IMM_I32 | IMM_BLK,
                                  REG_I64 | IMM_I32 | IMM_BLK, REG_I64)) {
   struct jit_guest *guest = backend->base.guest;
 
-  Xbyak::Reg cond = ARG2_REG;
   Xbyak::Label next;
-  e.test(cond, cond);
-  e.jz(next);
+  struct ir_instr *cmp = x64_fused_cmp(instr);
+
+  if (cmp) {
+    x64_emit_jcc(e, x64_invert_cond(x64_cmp_cond(cmp)), next);
+  } else {
+    Xbyak::Reg cond = ARG2_REG;
+    e.test(cond, cond);
+    e.jz(next);
+  }
   x64_backend_emit_branch(backend, ir, ARG0);
   e.L(next);
   x64_backend_emit_branch(backend, ir, ARG1);
@@ -962,15 +1268,9 @@ EMITTER(CALL, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
   }
 }
 
-EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
-  e.inLocalLabel();
-
-  Xbyak::Reg cond = ARG1_REG;
-
-  e.test(cond, cond);
-
-  e.jz(".skip");
-
+static void x64_emit_call_cond_body(struct x64_backend *backend,
+                                    Xbyak::CodeGenerator &e, struct ir *ir,
+                                    struct ir_instr *instr) {
   if (ARG2) {
     x64_backend_mov_value(backend, arg0, ARG2);
   }
@@ -985,10 +1285,30 @@ EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
     const Xbyak::Reg addr = ARG0_REG;
     e.call(addr);
   }
+}
 
-  e.L(".skip");
+EMITTER(CALL_COND, CONSTRAINTS(NONE, VAL_I64, VAL_I64, OPT_I64, OPT_I64)) {
+  Xbyak::Reg cond = ARG1_REG;
 
-  e.outLocalLabel();
+  e.test(cond, cond);
+
+  /* the condition rarely holds (e.g. a block becoming hot), move the call
+     out of line */
+  if (x64_backend_defer_cold(backend, instr, &x64_emit_call_cond_body)) {
+    char cold_label[128];
+    x64_backend_cold_label(cold_label, sizeof(cold_label), instr);
+    e.jnz(cold_label, Xbyak::CodeGenerator::T_NEAR);
+
+    char resume_label[128];
+    x64_backend_resume_label(resume_label, sizeof(resume_label), instr);
+    e.L(resume_label);
+  } else {
+    e.inLocalLabel();
+    e.jz(".skip");
+    x64_emit_call_cond_body(backend, e, ir, instr);
+    e.L(".skip");
+    e.outLocalLabel();
+  }
 }
 
 EMITTER(DEBUG_BREAK, CONSTRAINTS(NONE)) {
@@ -1006,28 +1326,57 @@ EMITTER(DEBUG_LOG, CONSTRAINTS(NONE, VAL_I64, OPT_I64, OPT_I64)) {
   e.call(debug_log);
 }
 
+static void x64_emit_assert_body(struct x64_backend *backend,
+                                 Xbyak::CodeGenerator &e, struct ir *ir,
+                                 struct ir_instr *instr) {
+  e.db(0xcc);
+}
+
 EMITTER(ASSERT_EQ, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
   Xbyak::Reg ra = ARG0_REG;
   Xbyak::Reg rb = ARG1_REG;
 
-  e.inLocalLabel();
   e.cmp(ra, rb);
-  e.je(".skip");
-  e.db(0xcc);
-  e.L(".skip");
-  e.outLocalLabel();
+
+  /* failed asserts trap, move the trap out of line */
+  if (x64_backend_defer_cold(backend, instr, &x64_emit_assert_body)) {
+    char cold_label[128];
+    x64_backend_cold_label(cold_label, sizeof(cold_label), instr);
+    e.jne(cold_label, Xbyak::CodeGenerator::T_NEAR);
+
+    char resume_label[128];
+    x64_backend_resume_label(resume_label, sizeof(resume_label), instr);
+    e.L(resume_label);
+  } else {
+    e.inLocalLabel();
+    e.je(".skip");
+    x64_emit_assert_body(backend, e, ir, instr);
+    e.L(".skip");
+    e.outLocalLabel();
+  }
 }
 
 EMITTER(ASSERT_LT, CONSTRAINTS(NONE, REG_I64, REG_I64)) {
   Xbyak::Reg ra = ARG0_REG;
   Xbyak::Reg rb = ARG1_REG;
 
-  e.inLocalLabel();
   e.cmp(ra, rb);
-  e.jl(".skip");
-  e.db(0xcc);
-  e.L(".skip");
-  e.outLocalLabel();
+
+  if (x64_backend_defer_cold(backend, instr, &x64_emit_assert_body)) {
+    char cold_label[128];
+    x64_backend_cold_label(cold_label, sizeof(cold_label), instr);
+    e.jge(cold_label, Xbyak::CodeGenerator::T_NEAR);
+
+    char resume_label[128];
+    x64_backend_resume_label(resume_label, sizeof(resume_label), instr);
+    e.L(resume_label);
+  } else {
+    e.inLocalLabel();
+    e.jl(".skip");
+    x64_emit_assert_body(backend, e, ir, instr);
+    e.L(".skip");
+    e.outLocalLabel();
+  }
 }
 
 EMITTER(COPY, CONSTRAINTS(REG_ALL, VAL_ALL)) {
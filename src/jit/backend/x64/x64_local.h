@@ -10,6 +10,7 @@
 
 extern "C" {
 #include "jit/jit_backend.h"
+#include "jit/jit_profile.h"
 }
 
 enum xmm_constant {
@@ -22,6 +23,37 @@ enum xmm_constant {
   NUM_XMM_CONST,
 };
 
+/* code generator whose buffer can be bounded to the end of the current code
+   region, making emission fail before any code in the next region is
+   overwritten */
+struct x64_codegen : public Xbyak::CodeGenerator {
+  x64_codegen(size_t size, void *code) : Xbyak::CodeGenerator(size, code) {}
+
+  void setMaxSize(size_t size) {
+    maxSize_ = size;
+  }
+};
+
+/* slow paths deferred by the emitters to the cold section, which is emitted
+   at the end of the compiled block, after the hot code of every ir block */
+#define X64_MAX_COLD_PATHS 256
+
+struct x64_cold_path {
+  void (*emit)(struct x64_backend *, Xbyak::CodeGenerator &, struct ir *,
+               struct ir_instr *);
+  struct ir_instr *instr;
+};
+
+/* used by compiled code to attribute host time to blocks when profiling, see
+   x64_backend_emit_prolog */
+struct x64_profile {
+  uint64_t last_tick;
+  struct jit_profile_entry *last_entry;
+
+  /* time spent outside of profiled blocks */
+  struct jit_profile_entry idle;
+};
+
 struct x64_backend {
   struct jit_backend base;
 
@@ -32,17 +64,26 @@ struct x64_backend {
   void **cache;
 
   /* codegen state */
-  Xbyak::CodeGenerator *codegen;
+  struct x64_codegen *codegen;
+  int code_size;
+  int region_size;
+  int curr_region;
   int use_avx;
+  int use_fma;
+  int use_sse41;
   Xbyak::Label xmm_const[NUM_XMM_CONST];
   void *dispatch_dynamic;
   void *dispatch_static;
+  void *dispatch_inline;
   void *dispatch_compile;
   void *dispatch_interrupt;
   void (*dispatch_enter)(int32_t);
   void *dispatch_exit;
   void (*load_thunk[16])();
   void (*store_thunk)();
+  struct x64_profile prof;
+  struct x64_cold_path cold_paths[X64_MAX_COLD_PATHS];
+  int num_cold_paths;
 
   /* debug stats */
   csh capstone_handle;
@@ -52,6 +93,8 @@ struct x64_backend {
  * backend functionality used by emitters
  */
 #define X64_THUNK_SIZE 8192
+#define X64_NUM_REGIONS 8
+#define X64_INLINE_CACHE_SIZE 22
 #define X64_STACK_SIZE 1024
 
 #if PLATFORM_WINDOWS
@@ -63,6 +106,8 @@ struct x64_backend {
 #define X64_STACK_LOCALS (X64_STACK_SHADOW_SPACE + 8)
 
 #define X64_USE_AVX backend->use_avx
+#define X64_USE_FMA backend->use_fma
+#define X64_USE_SSE41 backend->use_sse41
 
 struct ir_value;
 
@@ -92,6 +137,12 @@ void x64_backend_mov_value(struct x64_backend *backend, const Xbyak::Reg &dst,
 const Xbyak::Address x64_backend_xmm_constant(struct x64_backend *backend,
                                               enum xmm_constant c);
 void x64_backend_block_label(char *name, size_t size, struct ir_block *block);
+void x64_backend_cold_label(char *name, size_t size, struct ir_instr *instr);
+void x64_backend_resume_label(char *name, size_t size, struct ir_instr *instr);
+int x64_backend_defer_cold(struct x64_backend *backend, struct ir_instr *instr,
+                           void (*emit)(struct x64_backend *,
+                                        Xbyak::CodeGenerator &, struct ir *,
+                                        struct ir_instr *));
 void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
                              const ir_value *target);
 
@@ -101,12 +152,15 @@ void x64_backend_emit_branch(struct x64_backend *backend, struct ir *ir,
 void x64_dispatch_init(struct x64_backend *backend);
 void x64_dispatch_shutdown(struct x64_backend *backend);
 void x64_dispatch_emit_thunks(struct x64_backend *backend);
+void x64_dispatch_emit_lookup(struct x64_backend *backend);
+void x64_dispatch_emit_inline_cache(struct x64_backend *backend);
 void x64_dispatch_run_code(struct jit_backend *base, int cycles);
 void *x64_dispatch_lookup_code(struct jit_backend *base, uint32_t addr);
 void x64_dispatch_cache_code(struct jit_backend *base, uint32_t addr,
                              void *code);
 void x64_dispatch_invalidate_code(struct jit_backend *base, uint32_t addr);
-void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst);
+void x64_dispatch_patch_edge(struct jit_backend *base, void *code, void *dst,
+                             uint32_t addr);
 void x64_dispatch_restore_edge(struct jit_backend *base, void *code,
                                uint32_t dst);
 
@@ -106,6 +106,7 @@ struct jit_frontend *armv3_frontend_create(struct jit_guest *guest) {
   frontend->translate_code = &armv3_frontend_translate_code;
   frontend->dump_code = &armv3_frontend_dump_code;
   frontend->lookup_op = &armv3_frontend_lookup_op;
+  frontend->instr_size = 4;
 
   return (struct jit_frontend *)frontend;
 }
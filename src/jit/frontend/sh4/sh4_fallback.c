@@ -38,6 +38,11 @@ static inline int32_t vmul_f32_el(int32_t a, int32_t b) {
   return *(int32_t *)&r;
 }
 
+static inline int32_t vmadd_f32_el(int32_t a, int32_t b, int32_t c) {
+  float r = *(float *)&a * *(float *)&b + *(float *)&c;
+  return *(int32_t *)&r;
+}
+
 static inline float vdot_f32(int32_t *a, int32_t *b) {
   return *(float *)&a[0] * *(float *)&b[0] + *(float *)&a[1] * *(float *)&b[1] +
          *(float *)&a[2] * *(float *)&b[2] + *(float *)&a[3] * *(float *)&b[3];
@@ -300,6 +305,7 @@ typedef int32_t int128_t[4];
 #define FRSQRT_F32(a)                (1.0f / sqrtf(a))
 
 #define VBROADCAST_F32(a)            {*(int32_t *)&(a), *(int32_t *)&(a), *(int32_t *)&(a), *(int32_t *)&(a)}
+#define VSPLAT_F32(a, lane)          {(a)[lane], (a)[lane], (a)[lane], (a)[lane]}
 #define VADD_F32(a, b)               {vadd_f32_el((a)[0], (b)[0]), \
                                       vadd_f32_el((a)[1], (b)[1]), \
                                       vadd_f32_el((a)[2], (b)[2]), \
@@ -309,6 +315,10 @@ typedef int32_t int128_t[4];
                                       vmul_f32_el((a)[2], (b)[2]), \
                                       vmul_f32_el((a)[3], (b)[3])}
 #define VDOT_F32(a, b)               vdot_f32(a, b)
+#define VMADD_F32(a, b, c)           {vmadd_f32_el((a)[0], (b)[0], (c)[0]), \
+                                      vmadd_f32_el((a)[1], (b)[1], (c)[1]), \
+                                      vmadd_f32_el((a)[2], (b)[2], (c)[2]), \
+                                      vmadd_f32_el((a)[3], (b)[3], (c)[3])}
 
 #define AND_I8(a, b)                 ((a) & (b))
 #define AND_I16                      AND_I8
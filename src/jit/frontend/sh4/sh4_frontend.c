@@ -88,6 +88,49 @@ static int sh4_frontend_is_idle_loop(struct sh4_frontend *frontend,
   return idle_loop;
 }
 
+static void sh4_frontend_emit_loop(struct sh4_frontend *frontend,
+                                   struct ir *ir, struct ir_block *header,
+                                   uint32_t begin_addr) {
+  int is_loop = 0;
+
+  /* point branches back to the start of the block at its header, instead of
+     going through dispatch on each iteration */
+  for (struct ir_block *block = header; block;
+       block = list_next_entry(block, struct ir_block, it)) {
+    struct ir_instr *term =
+        list_last_entry(&block->instrs, struct ir_instr, it);
+
+    if (!term || (term->op != OP_BRANCH && term->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = term->arg[i];
+
+      if (!target || !ir_is_constant(target) || target->type != VALUE_I32 ||
+          (uint32_t)target->i32 != begin_addr) {
+        continue;
+      }
+
+      ir_set_arg(ir, term, i, ir_alloc_block_ref(ir, header));
+      is_loop = 1;
+    }
+  }
+
+  if (!is_loop) {
+    return;
+  }
+
+  /* enter the loop through a preheader, giving loop-invariant code somewhere
+     to be hoisted to */
+  struct ir_block *prev = list_prev_entry(header, struct ir_block, it);
+  struct ir_block *preheader = ir_insert_block(ir, prev);
+  ir_set_current_block(ir, preheader);
+  ir_branch(ir, ir_alloc_block_ref(ir, header));
+
+  ir_set_meta(ir, header, IR_META_ADDR, ir_alloc_i32(ir, begin_addr));
+}
+
 static void sh4_frontend_dump_code(struct jit_frontend *base,
                                    uint32_t begin_addr, int size,
                                    FILE *output) {
@@ -267,6 +310,10 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
     }
   }
 
+  /* emit blocks which branch back to their own start (e.g. copy, fill and
+     checksum loops) as an actual loop */
+  sh4_frontend_emit_loop(frontend, ir, block, begin_addr);
+
   /* if the block makes optimizations based on the fpscr state, assert that the
      run-time fpscr state matches the compile-time state */
   if (use_fpscr) {
@@ -289,6 +336,14 @@ static void sh4_frontend_translate_code(struct jit_frontend *base,
   }
 }
 
+static uint32_t sh4_frontend_compile_flags(struct jit_frontend *base) {
+  struct sh4_frontend *frontend = (struct sh4_frontend *)base;
+  struct sh4_guest *guest = (struct sh4_guest *)frontend->guest;
+  struct sh4_context *ctx = (struct sh4_context *)guest->ctx;
+
+  return ctx->fpscr & (PR_MASK | SZ_MASK);
+}
+
 static void sh4_frontend_analyze_code(struct jit_frontend *base,
                                       uint32_t begin_addr, int *size) {
   struct sh4_frontend *frontend = (struct sh4_frontend *)base;
@@ -334,7 +389,9 @@ struct jit_frontend *sh4_frontend_create(struct jit_guest *guest) {
   frontend->analyze_code = &sh4_frontend_analyze_code;
   frontend->translate_code = &sh4_frontend_translate_code;
   frontend->dump_code = &sh4_frontend_dump_code;
+  frontend->compile_flags = &sh4_frontend_compile_flags;
   frontend->lookup_op = &sh4_frontend_lookup_op;
+  frontend->instr_size = 2;
 
   return (struct jit_frontend *)frontend;
 }
@@ -348,9 +348,11 @@ static void store_fpscr(struct sh4_guest *guest, struct ir *ir,
 #define FRSQRT_F32(a)                FDIV_F32(ir_alloc_f32(ir, 1.0f), FSQRT_F32(a))
 
 #define VBROADCAST_F32(a)            ir_vbroadcast(ir, a)
+#define VSPLAT_F32(a, lane)          ir_vsplat(ir, a, lane)
 #define VADD_F32(a, b)               ir_vadd(ir, a, b, VALUE_F32)
 #define VMUL_F32(a, b)               ir_vmul(ir, a, b, VALUE_F32)
 #define VDOT_F32(a, b)               ir_vdot(ir, a, b, VALUE_F32)
+#define VMADD_F32(a, b, c)           ir_vmadd(ir, a, b, c, VALUE_F32)
 
 #define AND_I8(a, b)                 ir_and(ir, a, b)
 #define AND_I16                      AND_I8
@@ -2,6 +2,7 @@
 #include <stdio.h>
 #include "jit/ir/ir.h"
 #include "core/core.h"
+#include "jit/ir/ir_arena.h"
 
 const struct ir_opdef ir_opdefs[IR_NUM_OPS] = {
 #define IR_OP(name, flags) {#name, flags},
@@ -9,17 +10,19 @@ const struct ir_opdef ir_opdefs[IR_NUM_OPS] = {
 };
 
 const char *ir_meta_names[IR_NUM_META] = {
-    "addr", "cycles",
+    "addr", "cycles", "profile",
 };
 
 static void *ir_calloc(struct ir *ir, int size) {
-  CHECK_LE(ir->used + size, ir->capacity);
-  uint8_t *ptr = ir->buffer + ir->used;
+  void *ptr = ir_arena_alloc(ir->arena, size);
   memset(ptr, 0, size);
-  ir->used += size;
   return ptr;
 }
 
+static void ir_free(struct ir *ir, void *ptr, int size) {
+  ir_arena_free(ir->arena, ptr, size);
+}
+
 static struct ir_block *ir_alloc_block(struct ir *ir) {
   struct ir_block *block = ir_calloc(ir, sizeof(struct ir_block));
   return block;
@@ -127,14 +130,110 @@ struct ir_block *ir_split_block(struct ir *ir, struct ir_instr *before) {
   return new_block;
 }
 
+void ir_merge_blocks(struct ir *ir, struct ir_block *block,
+                     struct ir_block *next) {
+  /* move each instruction from next to the end of block */
+  struct ir_instr *after = list_last_entry(&block->instrs, struct ir_instr, it);
+
+  list_for_each_entry_safe(instr, &next->instrs, struct ir_instr, it) {
+    list_remove_entry(&next->instrs, instr, it);
+
+    list_add_after_entry(&block->instrs, after, instr, it);
+    instr->block = block;
+
+    after = instr;
+  }
+
+  /* next is now empty, remove it from the block list */
+  list_remove_entry(&ir->blocks, next, it);
+}
+
 void ir_remove_block(struct ir *ir, struct ir_block *block) {
-  /* remove all instructions */
-  list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+  /* remove all instructions, in reverse so each instruction's users are
+     removed before it, letting its result be freed */
+  list_for_each_entry_safe_reverse(instr, &block->instrs, struct ir_instr, it) {
     ir_remove_instr(ir, instr);
   }
 
+  /* remove all edges to and from the block */
+  list_for_each_entry_safe(edge, &block->outgoing, struct ir_edge, it) {
+    ir_remove_edge(ir, block, edge->dst);
+  }
+
+  list_for_each_entry_safe(edge, &block->incoming, struct ir_edge, it) {
+    ir_remove_edge(ir, edge->src, block);
+  }
+
+  /* remove any meta data keyed by the block, the memory may be reused for
+     another block */
+  for (int kind = 0; kind < IR_NUM_META; kind++) {
+    struct list *bkt = hash_bkt(ir->meta[kind], block);
+
+    list_for_each_entry_safe(meta, bkt, struct ir_meta, it) {
+      if (meta->key == block) {
+        hash_del(bkt, &meta->it);
+        ir_free(ir, meta, sizeof(struct ir_meta));
+      }
+    }
+  }
+
   /* remove from block list */
   list_remove_entry(&ir->blocks, block, it);
+
+  ir_free(ir, block, sizeof(struct ir_block));
+}
+
+void ir_remove_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst) {
+  list_for_each_entry_safe(edge, &src->outgoing, struct ir_edge, it) {
+    if (edge->dst == dst) {
+      list_remove(&src->outgoing, &edge->it);
+      ir_free(ir, edge, sizeof(struct ir_edge));
+      break;
+    }
+  }
+
+  list_for_each_entry_safe(edge, &dst->incoming, struct ir_edge, it) {
+    if (edge->src == src) {
+      list_remove(&dst->incoming, &edge->it);
+      ir_free(ir, edge, sizeof(struct ir_edge));
+      break;
+    }
+  }
+}
+
+int ir_is_yield_point(struct ir *ir, const struct ir_block *block) {
+  if (block == list_first_entry(&ir->blocks, struct ir_block, it)) {
+    return 1;
+  }
+
+  /* every cycle in the ir contains at least one branch to a block at or before
+     the branch itself in the block list, yielding on these bounds the time
+     spent in the ir without yielding */
+  int found = 0;
+
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    found |= blk == block;
+
+    if (!found) {
+      continue;
+    }
+
+    struct ir_instr *term = list_last_entry(&blk->instrs, struct ir_instr, it);
+
+    if (!term || (term->op != OP_BRANCH && term->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = term->arg[i];
+
+      if (target && target->type == VALUE_BLOCK && target->blk == block) {
+        return 1;
+      }
+    }
+  }
+
+  return 0;
 }
 
 void ir_add_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst) {
@@ -201,6 +300,23 @@ void ir_remove_instr(struct ir *ir, struct ir_instr *instr) {
   /* remove from block */
   list_remove(&instr->block->instrs, &instr->it);
   instr->block = NULL;
+
+  /* the result may still be referenced if the instruction was removed before
+     its users, in which case it's only released when the arena is reset */
+  if (instr->result && list_empty(&instr->result->uses)) {
+    ir_free(ir, instr->result, sizeof(struct ir_value));
+  }
+
+  ir_free(ir, instr, sizeof(struct ir_instr));
+}
+
+void ir_move_instr(struct ir *ir, struct ir_instr *instr,
+                   struct ir_block *block, struct ir_instr *after) {
+  list_remove(&instr->block->instrs, &instr->it);
+
+  /* insert at the start of the block if after is NULL */
+  list_add_after_entry(&block->instrs, after, instr, it);
+  instr->block = block;
 }
 
 struct ir_value *ir_alloc_int(struct ir *ir, int64_t c, enum ir_type type) {
@@ -805,6 +921,16 @@ struct ir_value *ir_vbroadcast(struct ir *ir, struct ir_value *a) {
   return instr->result;
 }
 
+struct ir_value *ir_vsplat(struct ir *ir, struct ir_value *a, int lane) {
+  CHECK(ir_is_vector(a->type));
+  CHECK(lane >= 0 && lane < 4);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_VSPLAT, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, ir_alloc_i32(ir, lane));
+  return instr->result;
+}
+
 struct ir_value *ir_vadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type) {
   CHECK(ir_is_vector(a->type) && ir_is_vector(b->type));
@@ -838,6 +964,19 @@ struct ir_value *ir_vdot(struct ir *ir, struct ir_value *a, struct ir_value *b,
   return instr->result;
 }
 
+struct ir_value *ir_vmadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
+                          struct ir_value *c, enum ir_type el_type) {
+  CHECK(ir_is_vector(a->type) && ir_is_vector(b->type) &&
+        ir_is_vector(c->type));
+  CHECK_EQ(el_type, VALUE_F32);
+
+  struct ir_instr *instr = ir_append_instr(ir, OP_VMADD, a->type);
+  ir_set_arg0(ir, instr, a);
+  ir_set_arg1(ir, instr, b);
+  ir_set_arg2(ir, instr, c);
+  return instr->result;
+}
+
 struct ir_value *ir_and(struct ir *ir, struct ir_value *a, struct ir_value *b) {
   CHECK(ir_is_int(a->type) && a->type == b->type);
 
@@ -935,7 +1074,7 @@ struct ir_value *ir_lshd(struct ir *ir, struct ir_value *a,
 }
 
 void ir_branch(struct ir *ir, struct ir_value *dst) {
-  CHECK(dst->type == VALUE_I32);
+  CHECK(dst->type == VALUE_I32 || dst->type == VALUE_BLOCK);
 
   struct ir_instr *instr = ir_append_instr(ir, OP_BRANCH, VALUE_V);
   ir_set_arg0(ir, instr, dst);
@@ -48,6 +48,7 @@ enum ir_cmp {
 enum ir_meta_type {
   IR_META_ADDR,
   IR_META_CYCLES,
+  IR_META_PROFILE,
   IR_NUM_META,
 };
 
@@ -165,10 +166,8 @@ struct ir_insert_point {
 };
 
 struct ir {
-  /* backing memory buffer used by all allocations */
-  uint8_t *buffer;
-  int capacity;
-  int used;
+  /* backing memory used by all allocations */
+  struct ir_arena *arena;
 
   /* current insert point */
   struct ir_insert_point cursor;
@@ -228,6 +227,10 @@ static inline int ir_is_constant(const struct ir_value *v) {
 int ir_read(FILE *input, struct ir *ir);
 void ir_write(struct ir *ir, FILE *output);
 
+/* checks the structural invariants passes rely on, logging the first violation
+   found. returns 0 if the ir is malformed */
+int ir_verify(struct ir *ir);
+
 struct ir_insert_point ir_get_insert_point(struct ir *ir);
 void ir_set_insert_point(struct ir *ir, struct ir_insert_point *point);
 void ir_set_current_block(struct ir *ir, struct ir_block *block);
@@ -236,12 +239,22 @@ void ir_set_current_instr(struct ir *ir, struct ir_instr *instr);
 struct ir_block *ir_insert_block(struct ir *ir, struct ir_block *after);
 struct ir_block *ir_append_block(struct ir *ir);
 struct ir_block *ir_split_block(struct ir *ir, struct ir_instr *before);
+void ir_merge_blocks(struct ir *ir, struct ir_block *block,
+                     struct ir_block *next);
 void ir_remove_block(struct ir *ir, struct ir_block *block);
 void ir_add_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst);
+void ir_remove_edge(struct ir *ir, struct ir_block *src, struct ir_block *dst);
+
+/* the backend only yields control back to the dispatcher when entering the
+   first block, or the target of a backward branch. entering any other block
+   is unobservable outside of the ir */
+int ir_is_yield_point(struct ir *ir, const struct ir_block *block);
 
 struct ir_instr *ir_append_instr(struct ir *ir, enum ir_op op,
                                  enum ir_type result_type);
 void ir_remove_instr(struct ir *ir, struct ir_instr *instr);
+void ir_move_instr(struct ir *ir, struct ir_instr *instr,
+                   struct ir_block *block, struct ir_instr *after);
 
 struct ir_value *ir_alloc_int(struct ir *ir, int64_t c, enum ir_type type);
 struct ir_value *ir_alloc_i8(struct ir *ir, int8_t c);
@@ -375,12 +388,16 @@ struct ir_value *ir_sqrt(struct ir *ir, struct ir_value *a);
 
 /* vector math operators */
 struct ir_value *ir_vbroadcast(struct ir *ir, struct ir_value *a);
+struct ir_value *ir_vsplat(struct ir *ir, struct ir_value *a, int lane);
 struct ir_value *ir_vadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
 struct ir_value *ir_vmul(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
 struct ir_value *ir_vdot(struct ir *ir, struct ir_value *a, struct ir_value *b,
                          enum ir_type el_type);
+/* a * b + c, fused on hosts which support it */
+struct ir_value *ir_vmadd(struct ir *ir, struct ir_value *a, struct ir_value *b,
+                          struct ir_value *c, enum ir_type el_type);
 
 /* bitwise operations */
 struct ir_value *ir_and(struct ir *ir, struct ir_value *a, struct ir_value *b);
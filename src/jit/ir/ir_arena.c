@@ -0,0 +1,134 @@
+#include "jit/ir/ir_arena.h"
+#include "core/core.h"
+
+/* allocations are rounded up to the size class granularity, which is also
+   enough to satisfy the alignment of every ir object */
+#define IR_ARENA_ALIGN 16
+#define IR_ARENA_NUM_CLASSES 32
+#define IR_ARENA_MAX_CLASS_SIZE (IR_ARENA_NUM_CLASSES * IR_ARENA_ALIGN)
+#define IR_ARENA_CHUNK_SIZE (64 * 1024)
+
+struct ir_arena_chunk {
+  struct ir_arena_chunk *next;
+  int used;
+  uint8_t *data;
+};
+
+struct ir_arena_free {
+  struct ir_arena_free *next;
+};
+
+struct ir_arena {
+  /* every chunk allocated by the arena, and the one currently being
+     allocated from. chunks before the current one are full */
+  struct ir_arena_chunk *chunks;
+  struct ir_arena_chunk *curr;
+
+  struct ir_arena_free *freelists[IR_ARENA_NUM_CLASSES];
+
+  struct ir_arena_stats stats;
+};
+
+static int ir_arena_size_class(int size) {
+  return (size - 1) / IR_ARENA_ALIGN;
+}
+
+static struct ir_arena_chunk *ir_arena_alloc_chunk(struct ir_arena *arena) {
+  struct ir_arena_chunk *chunk = calloc(1, sizeof(struct ir_arena_chunk));
+  chunk->data = malloc(IR_ARENA_CHUNK_SIZE);
+
+  arena->stats.reserved += IR_ARENA_CHUNK_SIZE;
+
+  return chunk;
+}
+
+void *ir_arena_alloc(struct ir_arena *arena, int size) {
+  CHECK_GT(size, 0);
+  CHECK_LE(size, IR_ARENA_CHUNK_SIZE);
+
+  size = ALIGN_UP(size, IR_ARENA_ALIGN);
+
+  arena->stats.used += size;
+  arena->stats.peak = MAX(arena->stats.peak, arena->stats.used);
+
+  /* reuse a previously freed object of the same size class if possible */
+  if (size <= IR_ARENA_MAX_CLASS_SIZE) {
+    int cls = ir_arena_size_class(size);
+    struct ir_arena_free *obj = arena->freelists[cls];
+
+    if (obj) {
+      arena->freelists[cls] = obj->next;
+      arena->stats.reused++;
+      return obj;
+    }
+  }
+
+  /* move on to the next chunk once the current one is exhausted, allocating
+     a new one if every chunk is in use */
+  struct ir_arena_chunk *chunk = arena->curr;
+
+  if (chunk->used + size > IR_ARENA_CHUNK_SIZE) {
+    if (!chunk->next) {
+      chunk->next = ir_arena_alloc_chunk(arena);
+    }
+
+    chunk = arena->curr = chunk->next;
+    chunk->used = 0;
+  }
+
+  uint8_t *ptr = chunk->data + chunk->used;
+  chunk->used += size;
+  return ptr;
+}
+
+void ir_arena_free(struct ir_arena *arena, void *ptr, int size) {
+  size = ALIGN_UP(size, IR_ARENA_ALIGN);
+
+  arena->stats.used -= size;
+
+  /* large objects are only released on reset */
+  if (size > IR_ARENA_MAX_CLASS_SIZE) {
+    return;
+  }
+
+  int cls = ir_arena_size_class(size);
+  struct ir_arena_free *obj = ptr;
+  obj->next = arena->freelists[cls];
+  arena->freelists[cls] = obj;
+}
+
+void ir_arena_stats(struct ir_arena *arena, struct ir_arena_stats *stats) {
+  *stats = arena->stats;
+}
+
+void ir_arena_reset(struct ir_arena *arena) {
+  arena->curr = arena->chunks;
+  arena->curr->used = 0;
+
+  memset(arena->freelists, 0, sizeof(arena->freelists));
+
+  arena->stats.used = 0;
+  arena->stats.peak = 0;
+  arena->stats.reused = 0;
+}
+
+void ir_arena_destroy(struct ir_arena *arena) {
+  struct ir_arena_chunk *chunk = arena->chunks;
+
+  while (chunk) {
+    struct ir_arena_chunk *next = chunk->next;
+    free(chunk->data);
+    free(chunk);
+    chunk = next;
+  }
+
+  free(arena);
+}
+
+struct ir_arena *ir_arena_create() {
+  struct ir_arena *arena = calloc(1, sizeof(struct ir_arena));
+
+  arena->chunks = arena->curr = ir_arena_alloc_chunk(arena);
+
+  return arena;
+}
@@ -0,0 +1,33 @@
+#ifndef IR_ARENA_H
+#define IR_ARENA_H
+
+/*
+ * backing memory for an ir unit. memory is bump-allocated from a list of
+ * fixed-size chunks, with freed objects kept on per-size freelists for reuse.
+ * resetting the arena releases every allocation at once while keeping the
+ * chunks around for the next unit. an arena isn't thread-safe, but arenas are
+ * independent of one another, so each thread compiling ir needs its own
+ */
+struct ir_arena;
+
+struct ir_arena_stats {
+  /* bytes currently allocated */
+  int used;
+  /* max bytes allocated at once since the last reset */
+  int peak;
+  /* bytes reserved by the arena's chunks */
+  int reserved;
+  /* allocations satisfied from a freelist since the last reset */
+  int reused;
+};
+
+struct ir_arena *ir_arena_create();
+void ir_arena_destroy(struct ir_arena *arena);
+
+void ir_arena_reset(struct ir_arena *arena);
+void ir_arena_stats(struct ir_arena *arena, struct ir_arena_stats *stats);
+
+void *ir_arena_alloc(struct ir_arena *arena, int size);
+void ir_arena_free(struct ir_arena *arena, void *ptr, int size);
+
+#endif
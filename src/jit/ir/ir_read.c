@@ -27,6 +27,13 @@ struct ir_lexeme {
   enum ir_type ty;
 };
 
+/* labels are keyed by each block / instruction's address */
+struct ir_label {
+  const void *obj;
+  int label;
+  struct list_node it;
+};
+
 struct ir_parser {
   FILE *input;
   struct ir *ir;
@@ -35,7 +42,7 @@ struct ir_parser {
   struct ir_lexeme val;
   struct list refs;
 
-  int *labels;
+  DECLARE_HASHTABLE(labels, 10);
 };
 
 static const char *typenames[] = {"",    "i8",  "i16",  "i32", "i64",
@@ -166,31 +173,54 @@ static void ir_lex_next(struct ir_parser *p) {
 }
 
 static void ir_destroy_parser(struct ir_parser *p) {
-  free(p->labels);
+  for (int i = 0; i < (int)HASH_SIZE(p->labels); i++) {
+    list_for_each_entry_safe(entry, &p->labels[i], struct ir_label, it) {
+      free(entry);
+    }
+  }
 
   list_for_each_entry_safe(ref, &p->refs, struct ir_reference, it) {
     free(ref);
   }
 }
 
+static void ir_insert_label(struct ir_parser *p, const void *obj, int label) {
+  struct ir_label *entry = malloc(sizeof(struct ir_label));
+  entry->obj = obj;
+  entry->label = label;
+  hash_add(hash_bkt(p->labels, obj), &entry->it);
+}
+
+static int ir_get_label(struct ir_parser *p, const void *obj) {
+  struct list *bkt = hash_bkt(p->labels, obj);
+
+  hash_bkt_for_each_entry(entry, bkt, struct ir_label, it) {
+    if (entry->obj == obj) {
+      return entry->label;
+    }
+  }
+
+  return -1;
+}
+
 static void ir_insert_block_label(struct ir_parser *p,
                                   const struct ir_block *block, int label) {
-  p->labels[(uint8_t *)block - p->ir->buffer] = label;
+  ir_insert_label(p, block, label);
 }
 
 static void ir_insert_instr_label(struct ir_parser *p,
                                   const struct ir_instr *instr, int label) {
-  p->labels[(uint8_t *)instr - p->ir->buffer] = label;
+  ir_insert_label(p, instr, label);
 }
 
 static int ir_get_block_label(struct ir_parser *p,
                               const struct ir_block *block) {
-  return p->labels[(uint8_t *)block - p->ir->buffer];
+  return ir_get_label(p, block);
 }
 
 static int ir_get_instr_label(struct ir_parser *p,
                               const struct ir_instr *instr) {
-  return p->labels[(uint8_t *)instr - p->ir->buffer];
+  return ir_get_label(p, instr);
 }
 
 static int ir_resolve_references(struct ir_parser *p) {
@@ -518,11 +548,32 @@ static int ir_parse_block(struct ir_parser *p) {
   return 1;
 }
 
+static void ir_recover_locals(struct ir_parser *p) {
+  /* the size of the locals isn't written out, recover it from the locals
+     referenced so any allocated later don't overlap them */
+  list_for_each_entry(block, &p->ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      if (instr->op != OP_LOAD_LOCAL && instr->op != OP_STORE_LOCAL) {
+        continue;
+      }
+
+      struct ir_value *offset = instr->arg[0];
+      struct ir_value *data = instr->result ? instr->result : instr->arg[1];
+
+      if (!offset || !data || !ir_is_constant(offset)) {
+        continue;
+      }
+
+      int end = offset->i32 + ir_type_size(data->type);
+      p->ir->locals_size = MAX(p->ir->locals_size, end);
+    }
+  }
+}
+
 int ir_read(FILE *input, struct ir *ir) {
   struct ir_parser p = {0};
   p.input = input;
   p.ir = ir;
-  p.labels = malloc(sizeof(int) * ir->capacity);
 
   int res = 1;
 
@@ -536,7 +587,10 @@ int ir_read(FILE *input, struct ir *ir) {
     if (p.tok == TOK_EOF) {
       if (!ir_resolve_references(&p)) {
         res = 0;
+        break;
       }
+
+      ir_recover_locals(&p);
       break;
     }
 
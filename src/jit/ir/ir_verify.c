@@ -0,0 +1,412 @@
+#include <stdarg.h>
+#include "core/core.h"
+#include "jit/ir/ir.h"
+
+/*
+ * structural verification of the ir
+ *
+ * checks the invariants the passes and backends assume hold between passes:
+ *
+ * - each argument's use is linked into the used value's use list, and each
+ *   use in a value's use list refers back to that value
+ * - argument and result types match what the ir builder would have produced
+ * - branches only appear as the final instruction of a block, and only target
+ *   blocks in the same ir
+ * - each value is defined before it's used, by an instruction either earlier
+ *   in the same block or in a block dominating the use
+ */
+
+struct ir_verifier {
+  struct ir *ir;
+
+  /* blocks in list order, and a num_blocks x num_blocks matrix where
+     dom[i * num_blocks + j] is set if block j dominates block i. an extra row
+     is allocated as scratch space while computing the matrix */
+  struct ir_block **blocks;
+  uint8_t *dom;
+  int num_blocks;
+
+  /* current location, used for error reporting */
+  int block_idx;
+  int instr_idx;
+  struct ir_instr *instr;
+};
+
+static int ir_verify_fail(struct ir_verifier *v, const char *fmt, ...) {
+  char msg[256];
+  va_list args;
+  va_start(args, fmt);
+  vsnprintf(msg, sizeof(msg), fmt, args);
+  va_end(args);
+
+  LOG_WARNING("ir_verify block %d instr %d (%s): %s", v->block_idx,
+              v->instr_idx, ir_opdefs[v->instr->op].name, msg);
+
+  return 0;
+}
+
+#define VERIFY(v, cond, ...)                 \
+  do {                                       \
+    if (!(cond)) {                           \
+      return ir_verify_fail(v, __VA_ARGS__); \
+    }                                        \
+  } while (0)
+
+static int ir_verify_block_idx(struct ir_verifier *v,
+                               const struct ir_block *block) {
+  for (int i = 0; i < v->num_blocks; i++) {
+    if (v->blocks[i] == block) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+static void ir_verify_dominators(struct ir_verifier *v) {
+  int n = v->num_blocks;
+
+  /* the entry block is only dominated by itself, every other block starts
+     off dominated by every block */
+  memset(v->dom, 1, n * n);
+  memset(v->dom, 0, n);
+  v->dom[0] = 1;
+
+  int changed = 1;
+
+  while (changed) {
+    changed = 0;
+
+    for (int i = 1; i < n; i++) {
+      uint8_t *dom = &v->dom[i * n];
+      int num_preds = 0;
+
+      /* dom(b) = {b} U intersection of dom(p) for each predecessor p */
+      uint8_t *next = &v->dom[n * n];
+      memset(next, 1, n);
+
+      for (int j = 0; j < n; j++) {
+        struct ir_instr *term =
+            list_last_entry(&v->blocks[j]->instrs, struct ir_instr, it);
+
+        if (!term || (term->op != OP_BRANCH && term->op != OP_BRANCH_COND)) {
+          continue;
+        }
+
+        for (int k = 0; k < 2; k++) {
+          struct ir_value *target = term->arg[k];
+
+          if (!target || target->type != VALUE_BLOCK ||
+              target->blk != v->blocks[i]) {
+            continue;
+          }
+
+          for (int l = 0; l < n; l++) {
+            next[l] &= v->dom[j * n + l];
+          }
+
+          num_preds++;
+        }
+      }
+
+      /* leave unreachable blocks dominated by everything */
+      if (!num_preds) {
+        continue;
+      }
+
+      next[i] = 1;
+
+      if (memcmp(dom, next, n)) {
+        memcpy(dom, next, n);
+        changed = 1;
+      }
+    }
+  }
+}
+
+static int ir_verify_types(struct ir_verifier *v, struct ir_instr *instr) {
+  struct ir_value **arg = instr->arg;
+  struct ir_value *result = instr->result;
+
+  switch (instr->op) {
+    case OP_LOAD_HOST:
+    case OP_STORE_HOST:
+      VERIFY(v, arg[0]->type == VALUE_I64, "expected i64 address");
+      break;
+
+    case OP_LOAD_GUEST:
+    case OP_STORE_GUEST:
+    case OP_LOAD_FAST:
+    case OP_STORE_FAST:
+      VERIFY(v, arg[0]->type == VALUE_I32, "expected i32 address");
+      break;
+
+    case OP_LOAD_CONTEXT:
+    case OP_STORE_CONTEXT: {
+      struct ir_value *data = result ? result : arg[1];
+      VERIFY(v, ir_is_constant(arg[0]), "expected constant offset");
+      VERIFY(v, arg[0]->i32 + ir_type_size(data->type) <= IR_MAX_CONTEXT,
+             "offset %d out of bounds", arg[0]->i32);
+    } break;
+
+    case OP_LOAD_LOCAL:
+    case OP_STORE_LOCAL:
+      VERIFY(v, ir_is_constant(arg[0]), "expected constant offset");
+      break;
+
+    case OP_FTOI:
+      VERIFY(v, ir_is_float(arg[0]->type) && ir_is_int(result->type),
+             "expected float to int");
+      break;
+
+    case OP_ITOF:
+      VERIFY(v, ir_is_int(arg[0]->type) && ir_is_float(result->type),
+             "expected int to float");
+      break;
+
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_TRUNC:
+      VERIFY(v, ir_is_int(arg[0]->type) && ir_is_int(result->type),
+             "expected int to int");
+      break;
+
+    case OP_FEXT:
+      VERIFY(v, arg[0]->type == VALUE_F32 && result->type == VALUE_F64,
+             "expected f32 to f64");
+      break;
+
+    case OP_FTRUNC:
+      VERIFY(v, arg[0]->type == VALUE_F64 && result->type == VALUE_F32,
+             "expected f64 to f32");
+      break;
+
+    case OP_SELECT:
+      VERIFY(v, arg[0]->type == result->type && arg[1]->type == result->type,
+             "mismatched operand types");
+      VERIFY(v, ir_is_int(arg[2]->type), "expected int condition");
+      break;
+
+    case OP_CMP:
+    case OP_FCMP:
+      VERIFY(v, arg[0]->type == arg[1]->type, "mismatched operand types");
+      VERIFY(v, instr->op == OP_CMP ? ir_is_int(arg[0]->type)
+                                    : ir_is_float(arg[0]->type),
+             "unexpected operand type");
+      VERIFY(v, ir_is_constant(arg[2]), "expected constant comparison");
+      VERIFY(v, result->type == VALUE_I8, "expected i8 result");
+      break;
+
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_DIV:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+      VERIFY(v, arg[0]->type == result->type && arg[1]->type == result->type,
+             "mismatched operand types");
+      break;
+
+    case OP_NEG:
+    case OP_ABS:
+    case OP_NOT:
+    case OP_FNEG:
+    case OP_FABS:
+    case OP_SQRT:
+    case OP_COPY:
+      VERIFY(v, arg[0]->type == result->type, "mismatched operand types");
+      break;
+
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+    case OP_ASHD:
+    case OP_LSHD:
+      VERIFY(v, ir_is_int(arg[0]->type) && arg[0]->type == result->type,
+             "mismatched operand types");
+      VERIFY(v, arg[1]->type == VALUE_I32, "expected i32 shift");
+      break;
+
+    case OP_VSPLAT:
+      VERIFY(v, ir_is_vector(arg[0]->type) && arg[0]->type == result->type,
+             "mismatched operand types");
+      VERIFY(v, ir_is_constant(arg[1]) && arg[1]->i32 >= 0 && arg[1]->i32 < 4,
+             "expected constant lane");
+      break;
+
+    case OP_VMADD:
+      VERIFY(v, ir_is_vector(result->type) && arg[0]->type == result->type &&
+                    arg[1]->type == result->type &&
+                    arg[2]->type == result->type,
+             "mismatched operand types");
+      break;
+
+    case OP_BRANCH:
+    case OP_BRANCH_COND:
+      for (int i = 0; i < (instr->op == OP_BRANCH ? 1 : 2); i++) {
+        VERIFY(v, arg[i]->type == VALUE_I32 || arg[i]->type == VALUE_BLOCK,
+               "expected i32 or block destination");
+        VERIFY(v, arg[i]->type != VALUE_BLOCK ||
+                      ir_verify_block_idx(v, arg[i]->blk) >= 0,
+               "destination block isn't in the ir");
+      }
+      if (instr->op == OP_BRANCH_COND) {
+        VERIFY(v, ir_is_int(arg[2]->type), "expected int condition");
+      }
+      break;
+
+    default:
+      break;
+  }
+
+  return 1;
+}
+
+static int ir_verify_uses(struct ir_verifier *v, struct ir_instr *instr) {
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    struct ir_value *arg = instr->arg[i];
+    struct ir_use *use = &instr->used[i];
+
+    if (!arg) {
+      continue;
+    }
+
+    VERIFY(v, use->instr == instr && use->parg == &instr->arg[i],
+           "arg %d use doesn't refer to its instruction", i);
+
+    int found = 0;
+    list_for_each_entry(other, &arg->uses, struct ir_use, it) {
+      found |= other == use;
+    }
+    VERIFY(v, found, "arg %d missing from its value's use list", i);
+  }
+
+  if (instr->result) {
+    VERIFY(v, instr->result->def == instr, "result not defined by instr");
+
+    list_for_each_entry(use, &instr->result->uses, struct ir_use, it) {
+      VERIFY(v, *use->parg == instr->result,
+             "result use list contains a stale use");
+      VERIFY(v, use->instr->block &&
+                    ir_verify_block_idx(v, use->instr->block) >= 0,
+             "result used by an instruction not in the ir");
+    }
+  }
+
+  return 1;
+}
+
+static int ir_verify_dominance(struct ir_verifier *v, struct ir_instr *instr) {
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    struct ir_value *arg = instr->arg[i];
+
+    if (!arg || ir_is_constant(arg)) {
+      continue;
+    }
+
+    struct ir_instr *def = arg->def;
+
+    if (def->block == instr->block) {
+      /* instrs are numbered in order through the tag */
+      VERIFY(v, def->tag < instr->tag, "arg %d used before its def", i);
+    } else {
+      int def_idx = ir_verify_block_idx(v, def->block);
+      VERIFY(v, def_idx >= 0, "arg %d defined outside of the ir", i);
+      VERIFY(v, v->dom[v->block_idx * v->num_blocks + def_idx],
+             "arg %d def doesn't dominate its use", i);
+    }
+  }
+
+  return 1;
+}
+
+static int ir_verify_instrs(struct ir_verifier *v) {
+  v->block_idx = 0;
+
+  list_for_each_entry(block, &v->ir->blocks, struct ir_block, it) {
+    struct ir_instr *last_instr =
+        list_last_entry(&block->instrs, struct ir_instr, it);
+
+    v->instr_idx = 0;
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      v->instr = instr;
+
+      VERIFY(v, instr->block == block, "instr doesn't refer to its block");
+      VERIFY(v, instr == last_instr ||
+                    (instr->op != OP_BRANCH && instr->op != OP_BRANCH_COND),
+             "only the last instruction in the block can branch");
+
+      if (!ir_verify_uses(v, instr) || !ir_verify_types(v, instr) ||
+          !ir_verify_dominance(v, instr)) {
+        return 0;
+      }
+
+      v->instr_idx++;
+    }
+
+    v->block_idx++;
+  }
+
+  return 1;
+}
+
+int ir_verify(struct ir *ir) {
+  struct ir_verifier v = {0};
+  v.ir = ir;
+
+  int num_instrs = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    v.num_blocks++;
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ((void)instr);
+      num_instrs++;
+    }
+  }
+
+  if (!v.num_blocks) {
+    return 1;
+  }
+
+  v.blocks = malloc(v.num_blocks * sizeof(struct ir_block *));
+  v.dom = malloc((v.num_blocks + 1) * v.num_blocks);
+
+  /* the tags may be holding state between passes, number each instruction
+     through its tag and restore them once done */
+  intptr_t *tags = malloc(num_instrs * sizeof(intptr_t));
+  int n = 0;
+  int b = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    v.blocks[b++] = block;
+
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      tags[n] = instr->tag;
+      instr->tag = n++;
+    }
+  }
+
+  ir_verify_dominators(&v);
+
+  int res = ir_verify_instrs(&v);
+
+  n = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      instr->tag = tags[n++];
+    }
+  }
+
+  free(tags);
+  free(v.dom);
+  free(v.blocks);
+
+  return res;
+}
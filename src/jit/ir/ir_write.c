@@ -1,33 +1,63 @@
 #include "core/core.h"
 #include "jit/ir/ir.h"
 
+/* labels are keyed by each block / instruction's address */
+struct ir_label {
+  const void *obj;
+  int label;
+  struct list_node it;
+};
+
 struct ir_writer {
   struct ir *ir;
-  int *labels;
+  DECLARE_HASHTABLE(labels, 10);
 };
 
 static void ir_destroy_writer(struct ir_writer *w) {
-  free(w->labels);
+  for (int i = 0; i < (int)HASH_SIZE(w->labels); i++) {
+    list_for_each_entry_safe(entry, &w->labels[i], struct ir_label, it) {
+      free(entry);
+    }
+  }
+}
+
+static void ir_insert_label(struct ir_writer *w, const void *obj, int label) {
+  struct ir_label *entry = malloc(sizeof(struct ir_label));
+  entry->obj = obj;
+  entry->label = label;
+  hash_add(hash_bkt(w->labels, obj), &entry->it);
+}
+
+static int ir_get_label(struct ir_writer *w, const void *obj) {
+  struct list *bkt = hash_bkt(w->labels, obj);
+
+  hash_bkt_for_each_entry(entry, bkt, struct ir_label, it) {
+    if (entry->obj == obj) {
+      return entry->label;
+    }
+  }
+
+  return -1;
 }
 
 static void ir_insert_block_label(struct ir_writer *w,
                                   const struct ir_block *block, int label) {
-  w->labels[(uint8_t *)block - w->ir->buffer] = label;
+  ir_insert_label(w, block, label);
 }
 
 static void ir_insert_instr_label(struct ir_writer *w,
                                   const struct ir_instr *instr, int label) {
-  w->labels[(uint8_t *)instr - w->ir->buffer] = label;
+  ir_insert_label(w, instr, label);
 }
 
 static int ir_get_block_label(struct ir_writer *w,
                               const struct ir_block *block) {
-  return w->labels[(uint8_t *)block - w->ir->buffer];
+  return ir_get_label(w, block);
 }
 
 static int ir_get_instr_label(struct ir_writer *w,
                               const struct ir_instr *instr) {
-  return w->labels[(uint8_t *)instr - w->ir->buffer];
+  return ir_get_label(w, instr);
 }
 
 static void ir_write_type(struct ir_writer *w, enum ir_type type,
@@ -218,8 +248,6 @@ static void ir_write_block(struct ir_writer *w, const struct ir_block *block,
 static void ir_assign_labels(struct ir_writer *w) {
   int label = 0;
 
-  w->labels = malloc(sizeof(int) * w->ir->capacity);
-
   list_for_each_entry(block, &w->ir->blocks, struct ir_block, it) {
     ir_insert_block_label(w, block, label++);
 
@@ -2,99 +2,123 @@
 #include "core/core.h"
 #include "core/exception_handler.h"
 #include "core/filesystem.h"
+#include "core/memory.h"
+#include "core/thread.h"
 #include "jit/ir/ir.h"
+#include "jit/ir/ir_arena.h"
 #include "jit/jit_backend.h"
+#include "jit/jit_cache.h"
 #include "jit/jit_frontend.h"
-#include "jit/passes/constant_propagation_pass.h"
-#include "jit/passes/control_flow_analysis_pass.h"
-#include "jit/passes/dead_code_elimination_pass.h"
-#include "jit/passes/expression_simplification_pass.h"
-#include "jit/passes/load_store_elimination_pass.h"
-#include "jit/passes/register_allocation_pass.h"
+#include "jit/jit_guest.h"
+#include "jit/jit_pass_manager.h"
+#include "jit/jit_perf.h"
+#include "jit/jit_profile.h"
 #include "options.h"
 
 #if PLATFORM_DARWIN || PLATFORM_LINUX
 #include <unistd.h>
 #endif
 
-static int block_map_cmp(const struct rb_node *rb_lhs,
-                         const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, it);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, it);
-
-  if (lhs->guest_addr < rhs->guest_addr) {
-    return -1;
-  } else if (lhs->guest_addr > rhs->guest_addr) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
+/* the memory watch pool is shared with the rest of the emulator, leave room
+   for the other users */
+#define JIT_MAX_CODE_PAGES 4096
+
+/* number of times a page may invalidate its blocks before it's no longer
+   watched. pages mixing code with frequently written data would otherwise
+   have their blocks recompiled on nearly every write */
+#define JIT_MAX_PAGE_WRITES 16
+
+/* an instruction which faulted when using fastmem. the first two bytes of the
+   instruction are recorded, as entries loaded from disk may be from different
+   code than what's currently at the address */
+struct jit_slowmem {
+  uint32_t addr;
+  uint16_t data;
+  struct list_node it;
+};
 
-static int reverse_block_map_cmp(const struct rb_node *rb_lhs,
-                                 const struct rb_node *rb_rhs) {
-  const struct jit_block *lhs =
-      container_of(rb_lhs, const struct jit_block, rit);
-  const struct jit_block *rhs =
-      container_of(rb_rhs, const struct jit_block, rit);
+/* pages are kept around after their watch fires in order to track how often
+   they're written. watch is NULL while the page isn't being watched */
+struct jit_code_page {
+  struct jit *jit;
+  struct memory_watch *watch;
+  int num_writes;
+  struct interval_node it;
+};
 
-  if (lhs->host_addr < rhs->host_addr) {
-    return -1;
-  } else if (lhs->host_addr > rhs->host_addr) {
-    return 1;
-  } else {
-    return 0;
-  }
-}
+/* number of executions before a block is recompiled as a superblock */
+#define JIT_HOT_THRESHOLD 1024
 
-static struct rb_callbacks block_map_cb = {
-    &block_map_cmp, NULL, NULL,
-};
+/* max number of guest blocks stitched together into a superblock, and the max
+   span of guest code they may cover */
+#define JIT_MAX_REGION_BLOCKS 8
+#define JIT_MAX_REGION_SIZE 4096
 
-static struct rb_callbacks reverse_block_map_cb = {
-    &reverse_block_map_cmp, NULL, NULL,
-};
+/* max number of blocks waiting on the worker thread, past this blocks are
+   optimized synchronously */
+#define JIT_MAX_JOBS 64
 
-static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
-  struct jit_block search;
-  search.guest_addr = guest_addr;
+struct jit_job {
+  /* block to be replaced with the optimized code. cleared if the block is
+     invalidated before the job is published */
+  struct jit_block *block;
+  struct jit_block *opt;
 
-  return rb_find_entry(&jit->blocks, &search, struct jit_block, it,
-                       &block_map_cb);
-}
+  /* persistent cache key */
+  uint32_t guest_addr;
+  char key[JIT_CACHE_KEY_SIZE];
 
-static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
-                                                  void *host_addr) {
-  struct jit_block search;
-  search.host_addr = host_addr;
+  struct ir ir;
+  struct ir_arena *arena;
+  struct list_node it;
+};
 
-  struct rb_node *first = rb_first(&jit->reverse_blocks);
-  struct rb_node *last = rb_last(&jit->reverse_blocks);
-  struct rb_node *rit =
-      rb_upper_bound(&jit->reverse_blocks, &search.rit, &reverse_block_map_cb);
+struct jit_worker {
+  struct jit *jit;
 
-  if (rit == first) {
-    return NULL;
-  }
+  thread_t thread;
+  mutex_t mutex;
+  cond_t cond;
+  int shutdown;
 
-  rit = rit ? rb_prev(rit) : last;
+  /* jobs are only ever created and freed on the emulation thread */
+  int num_jobs;
+  struct list pending_jobs;
+  struct list finished_jobs;
 
-  struct jit_block *block = container_of(rit, struct jit_block, rit);
-  if ((uint8_t *)host_addr < (uint8_t *)block->host_addr ||
-      (uint8_t *)host_addr >=
-          ((uint8_t *)block->host_addr + block->host_size)) {
-    return NULL;
-  }
+  /* arenas released by freed jobs, reused by the next jobs created */
+  struct ir_arena *free_arenas[JIT_MAX_JOBS];
+  int num_free_arenas;
 
-  return block;
+  /* the worker thread has its own instance of each optimization pass. it only
+     ever touches these and the ir of the job it's processing, everything
+     depending on shared state is done on the emulation thread once the job is
+     published */
+  struct jit_pass_manager *opt;
+};
+
+static struct jit_block *jit_get_block(struct jit *jit, uint32_t guest_addr) {
+  return jit_block_map_find(&jit->blocks, guest_addr);
+}
+
+static struct jit_block *jit_lookup_block_reverse(struct jit *jit,
+                                                  void *host_addr) {
+  return jit_reverse_block_map_find(&jit->reverse_blocks, host_addr);
 }
 
 static int jit_is_stale(struct jit *jit, struct jit_block *block) {
   return block->state != JIT_STATE_VALID;
 }
 
+static void jit_init_ir(struct jit *jit, struct ir *ir,
+                        struct ir_arena *arena) {
+  /* release everything allocated by the previous unit using the arena */
+  ir_arena_reset(arena);
+
+  memset(ir, 0, sizeof(*ir));
+  ir->arena = arena;
+}
+
 static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
   /* patch incoming edges to this block to directly jump to it instead of
      going through dispatch */
@@ -102,7 +126,7 @@ static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
     if (!edge->patched) {
       edge->patched = 1;
       jit->backend->patch_edge(jit->backend, edge->branch,
-                               edge->dst->host_addr);
+                               edge->dst->host_addr, edge->dst->guest_addr);
     }
   }
 
@@ -111,7 +135,7 @@ static void jit_patch_edges(struct jit *jit, struct jit_block *block) {
     if (!edge->patched) {
       edge->patched = 1;
       jit->backend->patch_edge(jit->backend, edge->branch,
-                               edge->dst->host_addr);
+                               edge->dst->host_addr, edge->dst->guest_addr);
     }
   }
 }
@@ -127,12 +151,22 @@ static void jit_restore_edges(struct jit *jit, struct jit_block *block) {
   }
 }
 
+static void jit_cancel_job(struct jit *jit, struct jit_block *block) {
+  /* the job is still processed by the worker, but discarded once finished */
+  if (block->job) {
+    block->job->block = NULL;
+    block->job = NULL;
+  }
+}
+
 static void jit_invalidate_block(struct jit *jit, struct jit_block *block,
                                  int fastmem) {
   /* blocks that are invalidated due to a fastmem exception aren't invalid at
      the guest level, they just need to be recompiled with different options */
   block->state = fastmem ? JIT_STATE_RECOMPILE : JIT_STATE_INVALID;
 
+  jit_cancel_job(jit, block);
+
   jit->backend->invalidate_code(jit->backend, block->guest_addr);
 
   jit_restore_edges(jit, block);
@@ -150,6 +184,141 @@ static void jit_invalidate_block(struct jit *jit, struct jit_block *block,
   }
 }
 
+static void jit_free_page(struct jit *jit, struct jit_code_page *page) {
+  interval_tree_remove(&jit->code_pages, &page->it);
+  free(page);
+}
+
+static struct jit_code_page *jit_find_page(struct jit *jit, uintptr_t addr) {
+  struct interval_node *n = interval_tree_find(&jit->code_pages, addr, addr);
+
+  if (!n) {
+    return NULL;
+  }
+
+  return container_of(n, struct jit_code_page, it);
+}
+
+#ifdef HAVE_FASTMEM
+static void jit_page_written(const struct exception_state *ex, void *data) {
+  struct jit_code_page *page = data;
+  struct jit *jit = page->jit;
+
+  /* only invalidate the blocks overlapping the written page, the rest of the
+     code cache is left intact */
+  struct interval_tree_it it;
+  struct interval_node *n = interval_tree_iter_first(
+      &jit->code_blocks, page->it.low, page->it.high, &it);
+
+  while (n) {
+    struct jit_block *block = container_of(n, struct jit_block, page_it);
+    jit_invalidate_block(jit, block, 0);
+    n = interval_tree_iter_next(&it);
+  }
+
+  /* the watcher restores write access and removes the watch itself once this
+     callback returns */
+  page->watch = NULL;
+  page->num_writes++;
+  jit->num_code_pages--;
+
+  if (page->num_writes == JIT_MAX_PAGE_WRITES) {
+    LOG_INFO("page 0x%" PRIxPTR " written %d times, no longer watching it",
+             page->it.low, page->num_writes);
+  }
+}
+#endif
+
+static void jit_unwatch_pages(struct jit *jit) {
+  size_t page_size = get_page_size();
+  struct rb_node *it = rb_first(&jit->code_pages);
+
+  while (it) {
+    struct rb_node *next = rb_next(it);
+
+    struct jit_code_page *page = container_of(it, struct jit_code_page, it.rb);
+    if (page->watch) {
+      CHECK(protect_pages((void *)page->it.low, page_size, ACC_READWRITE));
+      remove_memory_watch(page->watch);
+      jit->num_code_pages--;
+    }
+    jit_free_page(jit, page);
+
+    it = next;
+  }
+
+  CHECK_EQ(jit->num_code_pages, 0);
+  jit->code_pages_full = 0;
+}
+
+static void jit_watch_block(struct jit *jit, struct jit_block *block) {
+#ifdef HAVE_FASTMEM
+  struct jit_guest *guest = jit->frontend->guest;
+
+  if (!guest->membase) {
+    return;
+  }
+
+  /* only code backed directly by host memory can be modified by fastmem
+     stores. note, only the mirror the block was compiled from is watched,
+     stores through other mirrors or through the slow path still rely on the
+     guest explicitly flushing its caches */
+  uint8_t *ptr = NULL;
+  guest->lookup(guest->mem, block->guest_addr, NULL, &ptr, NULL, NULL);
+
+  if (!ptr) {
+    return;
+  }
+
+  uintptr_t begin = (uintptr_t)guest->membase + block->guest_addr;
+  uintptr_t end = begin + block->guest_size - 1;
+
+  block->page_it.low = begin;
+  block->page_it.high = end;
+  interval_tree_insert(&jit->code_blocks, &block->page_it);
+
+  /* write-protect each page the block spans which isn't already watched */
+  size_t page_size = get_page_size();
+
+  for (uintptr_t addr = ALIGN_DOWN(begin, page_size); addr <= end;
+       addr += page_size) {
+    struct jit_code_page *page = jit_find_page(jit, addr);
+
+    if (page && page->watch) {
+      continue;
+    }
+
+    /* leave frequently written pages unwatched, blocks on them rely on the
+       guest flushing its caches the same as unwatched mirrors */
+    if (page && page->num_writes >= JIT_MAX_PAGE_WRITES) {
+      continue;
+    }
+
+    if (jit->num_code_pages >= JIT_MAX_CODE_PAGES) {
+      if (!jit->code_pages_full) {
+        LOG_WARNING("%s watching max of %d code pages, writes to code on "
+                    "additional pages won't be detected",
+                    jit->tag, JIT_MAX_CODE_PAGES);
+        jit->code_pages_full = 1;
+      }
+      break;
+    }
+
+    if (!page) {
+      page = calloc(1, sizeof(struct jit_code_page));
+      page->jit = jit;
+      page->it.low = addr;
+      page->it.high = addr + page_size - 1;
+      interval_tree_insert(&jit->code_pages, &page->it);
+    }
+
+    page->watch = add_single_write_watch((void *)addr, page_size,
+                                         &jit_page_written, page);
+    jit->num_code_pages++;
+  }
+#endif
+}
+
 static void jit_cache_block(struct jit *jit, struct jit_block *block) {
   jit->backend->cache_code(jit->backend, block->guest_addr, block->host_addr);
 
@@ -157,28 +326,102 @@ static void jit_cache_block(struct jit *jit, struct jit_block *block) {
   CHECK(list_empty(&block->out_edges));
 }
 
+static void jit_destroy_block(struct jit_block *block) {
+  free(block->source_map);
+  free(block->fastmem);
+  free(block);
+}
+
 static void jit_free_block(struct jit *jit, struct jit_block *block) {
   jit_invalidate_block(jit, block, 0);
 
-  free(block->source_map);
-  free(block->fastmem);
+  jit_block_map_remove(&jit->blocks, block);
+  jit_reverse_block_map_remove(&jit->reverse_blocks, block);
 
-  rb_unlink(&jit->blocks, &block->it, &block_map_cb);
-  rb_unlink(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  if (block->page_it.high) {
+    interval_tree_remove(&jit->code_blocks, &block->page_it);
+  }
 
-  free(block);
+  jit_destroy_block(block);
 }
 
 static void jit_finalize_block(struct jit *jit, struct jit_block *block) {
   CHECK(list_empty(&block->in_edges) && list_empty(&block->out_edges),
         "code shouldn't have any existing edges");
-  CHECK(rb_empty_node(&block->it) && rb_empty_node(&block->rit),
+  CHECK(!jit_get_block(jit, block->guest_addr),
         "code was already inserted in lookup tables");
 
   jit_cache_block(jit, block);
 
-  rb_insert(&jit->blocks, &block->it, &block_map_cb);
-  rb_insert(&jit->reverse_blocks, &block->rit, &reverse_block_map_cb);
+  jit_block_map_insert(&jit->blocks, block);
+  jit_reverse_block_map_insert(&jit->reverse_blocks, block);
+
+  jit_watch_block(jit, block);
+}
+
+static struct jit_slowmem *jit_find_slowmem(struct jit *jit, uint32_t addr) {
+  struct list *bkt = hash_bkt(jit->slowmem, addr);
+
+  hash_bkt_for_each_entry(entry, bkt, struct jit_slowmem, it) {
+    if (entry->addr == addr) {
+      return entry;
+    }
+  }
+
+  return NULL;
+}
+
+static void jit_add_slowmem(struct jit *jit, uint32_t addr, uint16_t data) {
+  struct jit_slowmem *entry = jit_find_slowmem(jit, addr);
+
+  if (!entry) {
+    entry = calloc(1, sizeof(struct jit_slowmem));
+    entry->addr = addr;
+    hash_add(hash_bkt(jit->slowmem, addr), &entry->it);
+    jit->num_slowmem++;
+  }
+
+  entry->data = data;
+}
+
+static void jit_load_slowmem(struct jit *jit) {
+  uint32_t *addrs = NULL;
+  uint16_t *data = NULL;
+  int n = jit_cache_load_slowmem(jit->cache, &addrs, &data);
+
+  for (int i = 0; i < n; i++) {
+    jit_add_slowmem(jit, addrs[i], data[i]);
+  }
+
+  free(addrs);
+  free(data);
+}
+
+static void jit_store_slowmem(struct jit *jit) {
+  uint32_t *addrs = malloc(MAX(jit->num_slowmem, 1) * sizeof(uint32_t));
+  uint16_t *data = malloc(MAX(jit->num_slowmem, 1) * sizeof(uint16_t));
+  int n = 0;
+
+  for (int i = 0; i < (int)HASH_SIZE(jit->slowmem); i++) {
+    hash_bkt_for_each_entry(entry, &jit->slowmem[i], struct jit_slowmem, it) {
+      addrs[n] = entry->addr;
+      data[n] = entry->data;
+      n++;
+    }
+  }
+
+  jit_cache_store_slowmem(jit->cache, addrs, data, n);
+
+  free(addrs);
+  free(data);
+}
+
+static void jit_free_slowmem(struct jit *jit) {
+  for (int i = 0; i < (int)HASH_SIZE(jit->slowmem); i++) {
+    list_for_each_entry_safe(entry, &jit->slowmem[i], struct jit_slowmem, it) {
+      free(entry);
+    }
+  }
 }
 
 static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
@@ -188,7 +431,12 @@ static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
   block->guest_addr = guest_addr;
   block->guest_size = guest_size;
 
+  if (jit->profile_code) {
+    block->profile = jit_profile_get(jit->profile, guest_addr, guest_size);
+  }
+
   /* allocate meta data structs for the original guest code */
+  block->num_guest_blocks = 1;
   block->source_map = calloc(block->guest_size, sizeof(void *));
   block->fastmem = calloc(block->guest_size, sizeof(int8_t));
 
@@ -198,25 +446,56 @@ static struct jit_block *jit_alloc_block(struct jit *jit, uint32_t guest_addr,
   for (int i = 0; i < block->guest_size; i++) {
     block->fastmem[i] = 1;
   }
+
+  /* disable it up front for instructions which have previously faulted */
+  if (jit->num_slowmem) {
+    struct jit_guest *guest = jit->frontend->guest;
+
+    for (int i = 0; i < block->guest_size; i++) {
+      uint32_t addr = guest_addr + i;
+      struct jit_slowmem *entry = jit_find_slowmem(jit, addr);
+
+      if (entry && entry->data == guest->r16(guest->mem, addr)) {
+        block->fastmem[i] = 0;
+      }
+    }
+  }
 #endif
 
   return block;
 }
 
+static void jit_evict_region(struct jit *jit) {
+  uint8_t *addr;
+  int size;
+  jit->backend->next_region(jit->backend, &addr, &size);
+
+  /* free only the blocks in the region about to be overwritten. any branches
+     from blocks in the other regions which were patched to jump directly to
+     them are restored to go back through dispatch by jit_invalidate_block,
+     leaving the rest of the working set intact */
+  int num_evicted = 0;
+
+  jit_block_map_for_each(block, &jit->blocks) {
+    if (block->host_addr >= addr && block->host_addr < addr + size) {
+      jit_free_block(jit, block);
+      num_evicted++;
+    }
+  }
+
+  LOG_INFO("code region full, evicted %d blocks", num_evicted);
+}
+
 void jit_free_code(struct jit *jit) {
   /* invalidate code pointers and remove block entries from lookup maps. this
      is only safe to use when no code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
-
-  while (it) {
-    struct rb_node *next = rb_next(it);
-
-    struct jit_block *block = container_of(it, struct jit_block, it);
+  jit_block_map_for_each(block, &jit->blocks) {
     jit_free_block(jit, block);
-
-    it = next;
   }
 
+  /* stop watching for writes to the freed code */
+  jit_unwatch_pages(jit);
+
   /* have the backend reset its code buffers */
   jit->backend->reset(jit->backend);
 }
@@ -224,15 +503,8 @@ void jit_free_code(struct jit *jit) {
 void jit_invalidate_code(struct jit *jit) {
   /* invalidate code pointers, but don't remove block entries from lookup maps.
      this is used when clearing the jit while code is currently executing */
-  struct rb_node *it = rb_first(&jit->blocks);
-
-  while (it) {
-    struct rb_node *next = rb_next(it);
-
-    struct jit_block *block = container_of(it, struct jit_block, it);
+  jit_block_map_for_each(block, &jit->blocks) {
     jit_invalidate_block(jit, block, 0);
-
-    it = next;
   }
 
   /* don't reset backend code buffers, code is still running */
@@ -256,6 +528,15 @@ void jit_link_code(struct jit *jit, void *branch, uint32_t addr) {
   jit_patch_edges(jit, src);
 }
 
+/* bytes of the block executed on its fast path, anything after this is in the
+   cold section */
+static int jit_block_hot_size(struct jit_block *block) {
+  if (!block->cold_addr) {
+    return block->host_size;
+  }
+  return (int)(block->cold_addr - block->host_addr);
+}
+
 static void jit_write_block(struct jit *jit, struct jit_block *block,
                             struct ir *ir, FILE *output) {
   ir_write(ir, output);
@@ -265,6 +546,10 @@ static void jit_write_block(struct jit *jit, struct jit_block *block,
                            output);
   fprintf(output, "\n");
 
+  int hot_size = jit_block_hot_size(block);
+  fprintf(output, "# %d hot bytes, %d cold bytes\n", hot_size,
+          block->host_size - hot_size);
+
   jit->backend->dump_code(jit->backend, block->host_addr, block->host_size,
                           output);
 }
@@ -296,6 +581,40 @@ static void jit_emit_callback(struct jit *jit, int type, uint32_t guest_addr,
     case JIT_EMIT_INSTR:
       block->source_map[guest_addr - block->guest_addr] = host_addr;
       break;
+
+    case JIT_EMIT_COLD:
+      block->cold_addr = host_addr;
+      break;
+  }
+}
+
+static void jit_demote_fastmem(struct jit *jit, struct ir *ir) {
+  struct jit_guest *guest = jit->frontend->guest;
+
+  /* once optimized, many accesses to mmio registers have constant addresses.
+     check these against the guest's page table up front, instead of waiting
+     for each to fault once in order to find out they're not fastmem-able */
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      if (instr->op != OP_LOAD_FAST && instr->op != OP_STORE_FAST) {
+        continue;
+      }
+
+      struct ir_value *addr = instr->arg[0];
+
+      if (!ir_is_constant(addr)) {
+        continue;
+      }
+
+      uint8_t *ptr = NULL;
+      guest->lookup(guest->mem, addr->i32, NULL, &ptr, NULL, NULL);
+
+      if (ptr) {
+        continue;
+      }
+
+      instr->op = instr->op == OP_LOAD_FAST ? OP_LOAD_GUEST : OP_STORE_GUEST;
+    }
   }
 }
 
@@ -318,6 +637,577 @@ static void jit_promote_fastmem(struct jit *jit, struct jit_block *block,
   }
 }
 
+static void jit_inline_mmio(struct jit *jit, struct ir *ir) {
+  struct jit_guest *guest = jit->frontend->guest;
+
+  if (!guest->lookup_reg) {
+    return;
+  }
+
+  /* loads from mmio registers which are plain values in their device's
+     backing store are rewritten to directly load from it, avoiding the call
+     into the mmio callbacks. note, this is done after the ir is written to the
+     persistent cache, as it references host memory. stores always go through
+     the callbacks, as do reads of registers with a read callback */
+  list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &blk->instrs, struct ir_instr, it) {
+      if (instr->op != OP_LOAD_GUEST && instr->op != OP_LOAD_FAST) {
+        continue;
+      }
+
+      struct ir_value *addr = instr->arg[0];
+
+      if (!ir_is_constant(addr) || !ir_is_int(instr->result->type) ||
+          ir_type_size(instr->result->type) > 4) {
+        continue;
+      }
+
+      uint8_t *ptr = guest->lookup_reg(guest->mem, addr->i32);
+
+      if (!ptr) {
+        continue;
+      }
+
+      instr->op = OP_LOAD_HOST;
+      ir_set_arg0(ir, instr, ir_alloc_ptr(ir, ptr));
+    }
+  }
+}
+
+static void jit_mark_hot(struct jit *jit, uint32_t guest_addr) {
+  /* called from compiled code, the actual recompile is deferred until no code
+     is executing */
+  if (jit->num_hot_blocks < JIT_MAX_HOT_BLOCKS) {
+    jit->hot_blocks[jit->num_hot_blocks++] = guest_addr;
+  }
+}
+
+static void jit_profile_block(struct jit *jit, struct jit_block *block,
+                              struct ir *ir) {
+  /* increment the block's execution count on entry. this is added after the
+     ir is written to the persistent cache, as it references the block itself */
+  struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+  struct ir_insert_point original = ir_get_insert_point(ir);
+  ir_set_current_block(ir, head);
+
+  struct ir_value *ptr = ir_alloc_ptr(ir, &block->num_execs);
+  struct ir_value *num_execs = ir_load_host(ir, ptr, VALUE_I32);
+  num_execs = ir_add(ir, num_execs, ir_alloc_i32(ir, 1));
+  ir_store_host(ir, ptr, num_execs);
+
+  /* superblocks aren't extended any further */
+  if (block->num_guest_blocks == 1) {
+    struct ir_value *hot =
+        ir_cmp_eq(ir, num_execs, ir_alloc_i32(ir, JIT_HOT_THRESHOLD));
+    ir_call_cond_2(ir, hot, ir_alloc_ptr(ir, &jit_mark_hot),
+                   ir_alloc_ptr(ir, jit), ir_alloc_i32(ir, block->guest_addr));
+  }
+
+  /* tag each ir block with the profile entry for the backend to update from
+     its prolog */
+  if (block->profile) {
+    list_for_each_entry(blk, &ir->blocks, struct ir_block, it) {
+      ir_set_meta(ir, blk, IR_META_PROFILE, ir_alloc_ptr(ir, block->profile));
+    }
+  }
+
+  ir_set_insert_point(ir, &original);
+}
+
+static void jit_assemble_block(struct jit *jit, struct jit_block *block,
+                               struct ir *ir) {
+  jit->curr_block = block;
+  block->cold_addr = NULL;
+
+  /* assemble the ir into native code */
+  int res = jit->backend->assemble_code(jit->backend, ir, &block->host_addr,
+                                        &block->host_size,
+                                        (jit_emit_cb)jit_emit_callback, jit);
+
+  if (!res) {
+    /* the current code region filled up, evict the oldest region and try
+       again */
+    jit_evict_region(jit);
+
+    res = jit->backend->assemble_code(jit->backend, ir, &block->host_addr,
+                                      &block->host_size,
+                                      (jit_emit_cb)jit_emit_callback, jit);
+  }
+
+  if (!res) {
+    /* if the block doesn't fit in an entire region, completely free the cache
+       and let dispatch try to compile again */
+    LOG_INFO("backend overflow, resetting code cache");
+    jit_cancel_job(jit, block);
+    jit_destroy_block(block);
+    jit_free_code(jit);
+    return;
+  }
+
+  /* finish by adding code to caches */
+  jit_finalize_block(jit, block);
+
+  if (block->profile) {
+    block->profile->hot_size = jit_block_hot_size(block);
+    block->profile->cold_size = block->host_size - block->profile->hot_size;
+  }
+
+  /* dump optimized ir */
+  if (jit->dump_code) {
+    jit_dump_block(jit, "opt", block, ir);
+  }
+
+  /* write out to perf map and jitdump if enabled */
+  if (OPTION_perf) {
+    char name[64];
+    snprintf(name, sizeof(name), "%s_0x%08x", jit->tag, block->guest_addr);
+
+    fprintf(jit->perf_map, "%" PRIxPTR " %x %s\n", (uintptr_t)block->host_addr,
+            block->host_size, name);
+
+    jit_perf_load_code(name, block->host_addr, block->host_size,
+                       block->source_map, block->guest_size);
+  }
+}
+
+static void jit_decode_block(struct jit *jit, struct jit_block *block) {
+  /* decode the guest code for backends which execute it directly */
+  int res = jit->backend->decode_code(jit->backend, block->guest_addr,
+                                      block->guest_size, &block->host_addr,
+                                      &block->host_size);
+
+  if (!res) {
+    jit_evict_region(jit);
+
+    res = jit->backend->decode_code(jit->backend, block->guest_addr,
+                                    block->guest_size, &block->host_addr,
+                                    &block->host_size);
+  }
+
+  if (!res) {
+    LOG_INFO("backend overflow, resetting code cache");
+    jit_destroy_block(block);
+    jit_free_code(jit);
+    return;
+  }
+
+  jit_finalize_block(jit, block);
+}
+
+static void jit_free_job(struct jit_worker *worker, struct jit_job *job) {
+  /* keep the arena around for the next job */
+  if (worker->num_free_arenas < JIT_MAX_JOBS) {
+    worker->free_arenas[worker->num_free_arenas++] = job->arena;
+  } else {
+    ir_arena_destroy(job->arena);
+  }
+
+  free(job);
+}
+
+static void *jit_worker_thread(void *data) {
+  struct jit_worker *worker = data;
+  struct jit *jit = worker->jit;
+
+  mutex_lock(worker->mutex);
+
+  while (1) {
+    while (!worker->shutdown && list_empty(&worker->pending_jobs)) {
+      cond_wait(worker->cond, worker->mutex);
+    }
+
+    if (worker->shutdown) {
+      break;
+    }
+
+    struct jit_job *job =
+        list_first_entry(&worker->pending_jobs, struct jit_job, it);
+    list_remove(&worker->pending_jobs, &job->it);
+
+    mutex_unlock(worker->mutex);
+
+    /* run the optimization passes without holding up the emulation thread */
+    struct ir *ir = &job->ir;
+    jit_pass_manager_run(worker->opt, ir);
+
+    mutex_lock(worker->mutex);
+
+    list_add(&worker->finished_jobs, &job->it);
+  }
+
+  mutex_unlock(worker->mutex);
+
+  return NULL;
+}
+
+static void jit_queue_code(struct jit *jit, struct jit_block *block,
+                           const char *key) {
+  struct jit_worker *worker = jit->worker;
+  struct jit_job *job = calloc(1, sizeof(struct jit_job));
+
+  job->block = block;
+  job->guest_addr = block->guest_addr;
+
+  /* allocate the block being compiled up front, the generated code references
+     its execution count */
+  job->opt = jit_alloc_block(jit, block->guest_addr, block->guest_size);
+  memcpy(job->opt->fastmem, block->fastmem,
+         block->guest_size * sizeof(int8_t));
+  strncpy(job->key, key, sizeof(job->key));
+  block->job = job;
+
+  /* translate a separate copy of the ir for the worker to optimize, the guest
+     state it depends on may change once emulation resumes */
+  if (worker->num_free_arenas) {
+    job->arena = worker->free_arenas[--worker->num_free_arenas];
+  } else {
+    job->arena = ir_arena_create();
+  }
+  jit_init_ir(jit, &job->ir, job->arena);
+  jit->frontend->translate_code(jit->frontend, block->guest_addr,
+                                block->guest_size, &job->ir);
+  jit_promote_fastmem(jit, block, &job->ir);
+
+  worker->num_jobs++;
+
+  mutex_lock(worker->mutex);
+  list_add(&worker->pending_jobs, &job->it);
+  cond_signal(worker->cond);
+  mutex_unlock(worker->mutex);
+}
+
+static void jit_publish_code(struct jit *jit) {
+  struct jit_worker *worker = jit->worker;
+
+  /* replace the quickly compiled blocks with the optimized code produced by
+     the worker thread. this is only safe when no code is currently executing */
+  while (1) {
+    mutex_lock(worker->mutex);
+    struct jit_job *job =
+        list_first_entry(&worker->finished_jobs, struct jit_job, it);
+    if (job) {
+      list_remove(&worker->finished_jobs, &job->it);
+    }
+    mutex_unlock(worker->mutex);
+
+    if (!job) {
+      break;
+    }
+
+    worker->num_jobs--;
+
+    struct jit_block *existing = job->block;
+
+    if (existing) {
+      struct ir *ir = &job->ir;
+
+      existing->job = NULL;
+      jit_free_block(jit, existing);
+
+      jit_demote_fastmem(jit, ir);
+
+      if (jit->cache) {
+        jit_cache_store(jit->cache, job->guest_addr, job->key, ir);
+      }
+
+      jit_inline_mmio(jit, ir);
+      jit_profile_block(jit, job->opt, ir);
+      jit_pass_manager_run(jit->regalloc, ir);
+
+      jit_assemble_block(jit, job->opt, ir);
+    } else {
+      jit_destroy_block(job->opt);
+    }
+
+    jit_free_job(worker, job);
+  }
+}
+
+static void jit_worker_destroy(struct jit_worker *worker) {
+  mutex_lock(worker->mutex);
+  worker->shutdown = 1;
+  cond_signal(worker->cond);
+  mutex_unlock(worker->mutex);
+
+  void *result;
+  thread_join(worker->thread, &result);
+
+  /* detach any outstanding jobs from their blocks before freeing them */
+  list_for_each_entry_safe(job, &worker->pending_jobs, struct jit_job, it) {
+    if (job->block) {
+      job->block->job = NULL;
+    }
+    jit_destroy_block(job->opt);
+    jit_free_job(worker, job);
+  }
+
+  list_for_each_entry_safe(job, &worker->finished_jobs, struct jit_job, it) {
+    if (job->block) {
+      job->block->job = NULL;
+    }
+    jit_destroy_block(job->opt);
+    jit_free_job(worker, job);
+  }
+
+  for (int i = 0; i < worker->num_free_arenas; i++) {
+    ir_arena_destroy(worker->free_arenas[i]);
+  }
+
+  jit_pass_manager_destroy(worker->opt);
+
+  cond_destroy(worker->cond);
+  mutex_destroy(worker->mutex);
+
+  free(worker);
+}
+
+static struct jit_worker *jit_worker_create(struct jit *jit,
+                                            const char *passes) {
+  struct jit_worker *worker = calloc(1, sizeof(struct jit_worker));
+
+  worker->jit = jit;
+  worker->mutex = mutex_create();
+  worker->cond = cond_create();
+
+  /* time the worker's passes separately from the emulation thread's */
+  char tag[64];
+  snprintf(tag, sizeof(tag), "%s-async", jit->tag);
+  worker->opt = jit_pass_manager_create(tag, jit->backend, passes);
+
+  worker->thread = thread_create(&jit_worker_thread, "jit", worker);
+  CHECK_NOTNULL(worker->thread);
+
+  return worker;
+}
+
+static int jit_region_has_calls(struct ir_block *first, struct ir_block *last) {
+  struct ir_block *block = first;
+
+  while (1) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      const struct ir_opdef *def = &ir_opdefs[instr->op];
+
+      if ((def->flags & IR_FLAG_CALL) && instr->op != OP_LOAD_GUEST &&
+          instr->op != OP_STORE_GUEST) {
+        return 1;
+      }
+    }
+
+    if (block == last) {
+      break;
+    }
+
+    block = list_next_entry(block, struct ir_block, it);
+  }
+
+  return 0;
+}
+
+static int jit_translate_region(struct jit *jit, struct jit_block *head,
+                                struct ir *ir, int *region_size) {
+  uint32_t addrs[JIT_MAX_REGION_BLOCKS];
+  struct ir_block *first[JIT_MAX_REGION_BLOCKS];
+  struct ir_block *last[JIT_MAX_REGION_BLOCKS];
+  int num_blocks = 0;
+
+  uint32_t begin = head->guest_addr;
+  uint32_t end = begin;
+
+  addrs[num_blocks++] = begin;
+
+  /* translate the hot block, followed by each of its hot static successors */
+  for (int i = 0; i < num_blocks; i++) {
+    uint32_t addr = addrs[i];
+    int size;
+
+    jit->frontend->analyze_code(jit->frontend, addr, &size);
+
+    if (i) {
+      struct ir_block *tail =
+          list_last_entry(&ir->blocks, struct ir_block, it);
+      ir_set_current_block(ir, tail);
+    }
+    jit->frontend->translate_code(jit->frontend, addr, size, ir);
+
+    first[i] = i ? list_next_entry(last[i - 1], struct ir_block, it)
+                 : list_first_entry(&ir->blocks, struct ir_block, it);
+    last[i] = list_last_entry(&ir->blocks, struct ir_block, it);
+    ir_set_meta(ir, first[i], IR_META_ADDR, ir_alloc_i32(ir, addr));
+    end = MAX(end, addr + size);
+
+    /* calls out to the guest may change state the successors would be
+       specialized for, don't extend the region past them */
+    if (jit_region_has_calls(first[i], last[i])) {
+      continue;
+    }
+
+    struct ir_instr *term =
+        list_last_entry(&last[i]->instrs, struct ir_instr, it);
+
+    if (term->op != OP_BRANCH && term->op != OP_BRANCH_COND) {
+      continue;
+    }
+
+    for (int j = 0; j < 2; j++) {
+      struct ir_value *target = term->arg[j];
+
+      if (!target || !ir_is_constant(target) || target->type != VALUE_I32) {
+        continue;
+      }
+
+      uint32_t target_addr = target->i32;
+      int n;
+
+      for (n = 0; n < num_blocks; n++) {
+        if (addrs[n] == target_addr) {
+          break;
+        }
+      }
+
+      if (n < num_blocks) {
+        continue;
+      }
+
+      /* only stitch in successors which are hot themselves */
+      struct jit_block *succ = jit_get_block(jit, target_addr);
+
+      if (!succ || succ->state != JIT_STATE_VALID ||
+          succ->num_execs < JIT_HOT_THRESHOLD / 2 ||
+          num_blocks >= JIT_MAX_REGION_BLOCKS || target_addr < begin ||
+          target_addr + succ->guest_size - begin > JIT_MAX_REGION_SIZE) {
+        continue;
+      }
+
+      addrs[num_blocks++] = target_addr;
+    }
+  }
+
+  /* turn branches between blocks in the region into local branches */
+  for (int i = 0; i < num_blocks; i++) {
+    struct ir_instr *term =
+        list_last_entry(&last[i]->instrs, struct ir_instr, it);
+
+    if (term->op != OP_BRANCH && term->op != OP_BRANCH_COND) {
+      continue;
+    }
+
+    for (int j = 0; j < 2; j++) {
+      struct ir_value *target = term->arg[j];
+
+      if (!target || !ir_is_constant(target) || target->type != VALUE_I32) {
+        continue;
+      }
+
+      for (int n = 0; n < num_blocks; n++) {
+        if (addrs[n] == (uint32_t)target->i32) {
+          ir_set_arg(ir, term, j, ir_alloc_block_ref(ir, first[n]));
+          break;
+        }
+      }
+    }
+  }
+
+  /* merge straight-line successors referenced only by their predecessor into
+     it, extending the scope of the block-local passes */
+  for (int i = 0; i < num_blocks; i++) {
+    struct ir_instr *term =
+        list_last_entry(&last[i]->instrs, struct ir_instr, it);
+
+    if (term->op != OP_BRANCH || term->arg[0]->type != VALUE_BLOCK) {
+      continue;
+    }
+
+    struct ir_block *next = term->arg[0]->blk;
+    int n;
+
+    for (n = 1; n < num_blocks; n++) {
+      if (first[n] == next) {
+        break;
+      }
+    }
+
+    /* never merge the region's entry or blocks with multiple predecessors */
+    if (n == num_blocks || first[n] != last[n]) {
+      continue;
+    }
+
+    int refs = 0;
+    list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+      struct ir_instr *instr =
+          list_last_entry(&block->instrs, struct ir_instr, it);
+
+      for (int j = 0; j < 2; j++) {
+        struct ir_value *target = instr->arg[j];
+        refs += (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) &&
+                target && target->type == VALUE_BLOCK && target->blk == next;
+      }
+    }
+
+    if (refs != 1) {
+      continue;
+    }
+
+    ir_remove_instr(ir, term);
+    ir_merge_blocks(ir, last[i], next);
+
+    /* the merged block now ends the predecessor */
+    first[n] = last[i];
+    last[n] = last[i];
+  }
+
+  *region_size = (int)(end - begin);
+
+  return num_blocks;
+}
+
+static void jit_compile_region(struct jit *jit, struct jit_block *existing) {
+  struct ir ir;
+  jit_init_ir(jit, &ir, jit->arena);
+
+  int region_size;
+  int num_blocks = jit_translate_region(jit, existing, &ir, &region_size);
+
+  /* no hot successors, nothing to gain by recompiling */
+  if (num_blocks < 2) {
+    return;
+  }
+
+  struct jit_block *block =
+      jit_alloc_block(jit, existing->guest_addr, region_size);
+  block->num_guest_blocks = num_blocks;
+  block->num_execs = existing->num_execs;
+
+  /* persist the fastmem state of the head block */
+  memcpy(block->fastmem, existing->fastmem,
+         existing->guest_size * sizeof(int8_t));
+
+  jit_free_block(jit, existing);
+
+  jit_promote_fastmem(jit, block, &ir);
+  jit_pass_manager_run(jit->opt, &ir);
+  jit_demote_fastmem(jit, &ir);
+  jit_inline_mmio(jit, &ir);
+  jit_profile_block(jit, block, &ir);
+  jit_pass_manager_run(jit->regalloc, &ir);
+
+  jit_assemble_block(jit, block, &ir);
+}
+
+static void jit_compile_hot_blocks(struct jit *jit) {
+  for (int i = 0; i < jit->num_hot_blocks; i++) {
+    struct jit_block *block = jit_get_block(jit, jit->hot_blocks[i]);
+
+    if (!block || block->state != JIT_STATE_VALID ||
+        block->num_guest_blocks > 1) {
+      continue;
+    }
+
+    jit_compile_region(jit, block);
+  }
+
+  jit->num_hot_blocks = 0;
+}
+
 void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
 #if 0
   LOG_INFO("jit_compile_block %s 0x%08x", jit->tag, guest_addr);
@@ -338,66 +1228,89 @@ void jit_compile_code(struct jit *jit, uint32_t guest_addr) {
     /* if the block was invalidated due to a fastmem exception, persist its
        fastmem state */
     if (existing->state != JIT_STATE_INVALID) {
-      CHECK_EQ(block->guest_size, existing->guest_size);
-      memcpy(block->fastmem, existing->fastmem,
-             block->guest_size * sizeof(int8_t));
+      /* superblocks start with the same guest block, but extend past it */
+      int size = MIN(block->guest_size, existing->guest_size);
+      memcpy(block->fastmem, existing->fastmem, size * sizeof(int8_t));
     }
 
     jit_free_block(jit, existing);
   }
 
-  /* translate guest code into ir */
-  struct ir ir = {0};
-  ir.buffer = jit->ir_buffer;
-  ir.capacity = sizeof(jit->ir_buffer);
-  jit->frontend->translate_code(jit->frontend, guest_addr, guest_size, &ir);
-
-  /* dump raw ir */
-  if (jit->dump_code) {
-    jit_dump_block(jit, "raw", block, &ir);
+  /* backends without a code generator don't need the code translated to ir */
+  if (jit->backend->decode_code) {
+    jit_decode_block(jit, block);
+    return;
   }
 
-  /* run optimization passes */
-  jit_promote_fastmem(jit, block, &ir);
-  cfa_run(jit->cfa, &ir);
-  lse_run(jit->lse, &ir);
-  cprop_run(jit->cprop, &ir);
-  esimp_run(jit->esimp, &ir);
-  dce_run(jit->dce, &ir);
-  ra_run(jit->ra, &ir);
+  struct ir ir;
+  jit_init_ir(jit, &ir, jit->arena);
 
-  /* assemble the ir into native code */
-  int res = jit->backend->assemble_code(jit->backend, &ir, &block->host_addr,
-                                        &block->host_size,
-                                        (jit_emit_cb)jit_emit_callback, jit);
+  /* try to load the optimized ir from the persistent cache */
+  char key[JIT_CACHE_KEY_SIZE] = {0};
+  int cached = 0;
 
-  if (!res) {
-    /* if the backend overflowed, completely free the cache and let dispatch
-       try to compile again */
-    LOG_INFO("backend overflow, resetting code cache");
-    jit_free_code(jit);
-    return;
-  }
+  if (jit->cache) {
+    uint32_t flags = 0;
+    if (jit->frontend->compile_flags) {
+      flags = jit->frontend->compile_flags(jit->frontend);
+    }
 
-  /* finish by adding code to caches */
-  jit_finalize_block(jit, block);
+    jit_cache_key(jit->cache, guest_addr, guest_size, block->fastmem, flags,
+                  key);
+    cached = jit_cache_load(jit->cache, guest_addr, key, &ir);
 
-  /* dump optimized ir */
-  if (jit->dump_code) {
-    jit_dump_block(jit, "opt", block, &ir);
+    if (!cached) {
+      /* discard anything partially read */
+      jit_init_ir(jit, &ir, jit->arena);
+    }
   }
 
-  /* write out to perf map if enabled */
-  if (OPTION_perf) {
-    fprintf(jit->perf_map, "%" PRIxPTR " %x %s_0x%08x\n",
-            (uintptr_t)block->host_addr, block->host_size, jit->tag,
-            block->guest_addr);
+  if (!cached) {
+    /* translate guest code into ir */
+    jit->frontend->translate_code(jit->frontend, guest_addr, guest_size, &ir);
+
+    /* dump raw ir */
+    if (jit->dump_code) {
+      jit_dump_block(jit, "raw", block, &ir);
+    }
+
+    jit_promote_fastmem(jit, block, &ir);
+
+    if (jit->worker && jit->worker->num_jobs < JIT_MAX_JOBS) {
+      /* emit unoptimized code for now, and let the worker thread replace it
+         with optimized code in the background */
+      jit_queue_code(jit, block, key);
+    } else {
+      /* run optimization passes */
+      jit_pass_manager_run(jit->opt, &ir);
+      jit_demote_fastmem(jit, &ir);
+
+      /* register assignments aren't serialized, cache the ir right before
+         allocation */
+      if (jit->cache) {
+        jit_cache_store(jit->cache, guest_addr, key, &ir);
+      }
+    }
   }
+
+  jit_inline_mmio(jit, &ir);
+  jit_profile_block(jit, block, &ir);
+  jit_pass_manager_run(jit->regalloc, &ir);
+
+  jit_assemble_block(jit, block, &ir);
 }
 
 static int jit_handle_exception(void *data, struct exception_state *ex) {
   struct jit *jit = data;
 
+  /* stores to watched code pages aren't fastmem exceptions, let the memory
+     watcher invalidate the blocks on the page and restore write access */
+  struct jit_code_page *page = jit_find_page(jit, ex->fault_addr);
+
+  if (page && page->watch) {
+    return 0;
+  }
+
   /* see if there is a cached block corresponding to the current pc */
   struct jit_block *block = jit_lookup_block_reverse(jit, (void *)ex->pc);
 
@@ -411,19 +1324,19 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
   }
 
   /* disable fastmem optimizations for it on future compiles */
-  int found = 0;
-  for (int i = 0; i < block->guest_size; i++) {
-    /* ignore empty entries */
-    if (!block->source_map[i]) {
-      continue;
-    }
-    if ((uintptr_t)block->source_map[i] > ex->pc) {
-      break;
-    }
-    found = i;
-  }
+  int found = jit_block_find_source(block, (void *)ex->pc);
   block->fastmem[found] = 0;
 
+  /* remember the instruction for when the block is compiled again, even after
+     the entire cache has been freed */
+  struct jit_guest *guest = jit->frontend->guest;
+  uint32_t addr = block->guest_addr + found;
+  jit_add_slowmem(jit, addr, guest->r16(guest->mem, addr));
+
+  if (block->profile) {
+    block->profile->num_fastmem_faults++;
+  }
+
   /* invalidate the block so it's recompiled on the next access */
   jit_invalidate_block(jit, block, 1);
 
@@ -431,6 +1344,14 @@ static int jit_handle_exception(void *data, struct exception_state *ex) {
 }
 
 void jit_run(struct jit *jit, int cycles) {
+  if (jit->worker) {
+    jit_publish_code(jit);
+  }
+
+  if (jit->num_hot_blocks) {
+    jit_compile_hot_blocks(jit);
+  }
+
   jit->backend->run_code(jit->backend, cycles);
 }
 
@@ -439,30 +1360,42 @@ void jit_destroy(struct jit *jit) {
     if (jit->perf_map) {
       fclose(jit->perf_map);
     }
+
+    jit_perf_close();
+  }
+
+  if (jit->worker) {
+    jit_worker_destroy(jit->worker);
   }
 
   if (jit->backend) {
     jit_free_code(jit);
   }
 
-  if (jit->dce) {
-    dce_destroy(jit->dce);
+  jit_block_map_destroy(&jit->blocks);
+  jit_reverse_block_map_destroy(&jit->reverse_blocks);
+
+  if (jit->cache) {
+    jit_store_slowmem(jit);
+    jit_cache_destroy(jit->cache);
   }
 
-  if (jit->esimp) {
-    esimp_destroy(jit->esimp);
+  jit_free_slowmem(jit);
+
+  if (jit->profile) {
+    jit_profile_destroy(jit->profile);
   }
 
-  if (jit->cprop) {
-    cprop_destroy(jit->cprop);
+  if (jit->regalloc) {
+    jit_pass_manager_destroy(jit->regalloc);
   }
 
-  if (jit->lse) {
-    lse_destroy(jit->lse);
+  if (jit->opt) {
+    jit_pass_manager_destroy(jit->opt);
   }
 
-  if (jit->cfa) {
-    cfa_destroy(jit->cfa);
+  if (jit->arena) {
+    ir_arena_destroy(jit->arena);
   }
 
   if (jit->exc_handler) {
@@ -473,21 +1406,33 @@ void jit_destroy(struct jit *jit) {
 }
 
 struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
-                       struct jit_backend *backend) {
+                       struct jit_backend *backend, const char *passes) {
   struct jit *jit = calloc(1, sizeof(struct jit));
 
   strncpy(jit->tag, tag, sizeof(jit->tag));
   jit->frontend = frontend;
   jit->backend = backend;
+  jit->profile = jit_profile_create(tag);
+  jit->profile_code = OPTION_jit_profile;
+  jit->dump_code = OPTION_jit_dump;
+
+  jit->arena = ir_arena_create();
 
-  /* create optimization passes */
-  jit->cfa = cfa_create();
-  jit->lse = lse_create();
-  jit->cprop = cprop_create();
-  jit->esimp = esimp_create();
-  jit->dce = dce_create();
-  jit->ra = ra_create(jit->backend->registers, jit->backend->num_registers,
-                      jit->backend->emitters, jit->backend->num_emitters);
+  /* create optimization passes. register allocation is kept separate, as the
+     ir is cached and instrumented in between */
+  jit->opt = jit_pass_manager_create(jit->tag, jit->backend, passes);
+  jit->regalloc = jit_pass_manager_create(jit->tag, jit->backend, "ra");
+
+  /* open persistent code cache if enabled */
+  if (OPTION_jit_cache) {
+    jit->cache = jit_cache_create(jit->tag, jit->frontend->guest);
+    jit_load_slowmem(jit);
+  }
+
+  /* start background compilation thread if enabled */
+  if (OPTION_jit_async) {
+    jit->worker = jit_worker_create(jit, passes);
+  }
 
   /* setup exception handler to deal with self-modifying code and fastmem
      related exceptions */
@@ -502,6 +1447,8 @@ struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
     jit->perf_map = fopen(perf_map_path, "a");
     CHECK_NOTNULL(jit->perf_map);
 #endif
+
+    jit_perf_open();
   }
 
   return jit;
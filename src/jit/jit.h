@@ -2,18 +2,26 @@
 #define JIT_H
 
 #include <stdio.h>
+#include "core/hash.h"
+#include "core/interval_tree.h"
 #include "core/list.h"
 #include "core/rb_tree.h"
+#include "jit/jit_block_map.h"
 
 struct address_space;
-struct cfa;
-struct cprop;
-struct dce;
+struct jit_cache;
+struct jit_job;
+struct jit_pass_manager;
+struct jit_profile;
+struct jit_profile_entry;
+struct jit_worker;
 struct ir;
-struct lse;
-struct ra;
+struct ir_arena;
 struct val;
 
+/* max number of hot blocks queued for recompilation between runs */
+#define JIT_MAX_HOT_BLOCKS 64
+
 enum {
   JIT_STATE_VALID,
   JIT_STATE_INVALID,
@@ -33,17 +41,32 @@ struct jit_block {
   /* which guest instructions use fastmem */
   int8_t *fastmem;
 
+  /* number of times the block has been executed */
+  uint32_t num_execs;
+
+  /* number of guest blocks stitched together to form this block */
+  int num_guest_blocks;
+
+  /* execution profile counters, only set when profiling */
+  struct jit_profile_entry *profile;
+
   /* address of compiled block in host memory */
   uint8_t *host_addr;
   int host_size;
 
+  /* start of the cold section holding the block's slow paths, which runs to
+     the end of the compiled block */
+  uint8_t *cold_addr;
+
+  /* pending background compile for the block */
+  struct jit_job *job;
+
   /* edges to other blocks */
   struct list in_edges;
   struct list out_edges;
 
-  /* lookup map iterators */
-  struct rb_node it;
-  struct rb_node rit;
+  /* iterator for the host memory range backing the guest code */
+  struct interval_node page_it;
 };
 
 struct jit_edge {
@@ -68,31 +91,56 @@ struct jit {
   struct jit_backend *backend;
   struct exception_handler *exc_handler;
 
-  /* passes */
-  struct cfa *cfa;
-  struct lse *lse;
-  struct cprop *cprop;
-  struct esimp *esimp;
-  struct dce *dce;
-  struct ra *ra;
+  /* optimization passes run over the guest's ir, followed by register
+     allocation */
+  struct jit_pass_manager *opt;
+  struct jit_pass_manager *regalloc;
 
-  /* scratch compilation buffer */
-  uint8_t ir_buffer[1024 * 1024 * 2];
+  /* backing memory for ir compiled on the emulation thread */
+  struct ir_arena *arena;
 
   /* compiled blocks */
   struct jit_block *curr_block;
-  struct rb_tree blocks;
-  struct rb_tree reverse_blocks;
+  struct jit_block_map blocks;
+  struct jit_reverse_block_map reverse_blocks;
+
+  /* blocks which crossed the hot threshold, recompiled as superblocks before
+     the next run */
+  uint32_t hot_blocks[JIT_MAX_HOT_BLOCKS];
+  int num_hot_blocks;
+
+  /* guest addresses of instructions whose memory accesses faulted when using
+     fastmem, kept across recompiles to avoid each block faulting again */
+  DECLARE_HASHTABLE(slowmem, 10);
+  int num_slowmem;
+
+  /* guest memory pages backing compiled blocks are write-protected in order to
+     detect self-modifying code, see jit_watch_block. num_code_pages is the
+     number of pages currently watched */
+  struct rb_tree code_blocks;
+  struct rb_tree code_pages;
+  int num_code_pages;
+  int code_pages_full;
+
+  /* background compilation thread */
+  struct jit_worker *worker;
+
+  /* persistent code cache */
+  struct jit_cache *cache;
 
   /* compiled block perf map */
   FILE *perf_map;
 
   /* dump ir to application directory as blocks compile */
   int dump_code;
+
+  /* instrument compiled code with execution counters */
+  struct jit_profile *profile;
+  int profile_code;
 };
 
 struct jit *jit_create(const char *tag, struct jit_frontend *frontend,
-                       struct jit_backend *backend);
+                       struct jit_backend *backend, const char *passes);
 void jit_destroy(struct jit *jit);
 
 void jit_run(struct jit *jit, int cycles);
@@ -67,6 +67,9 @@ enum {
 enum {
   JIT_EMIT_BLOCK,
   JIT_EMIT_INSTR,
+  /* start of the cold section, holding slow paths moved out of line. it runs
+     to the end of the assembled code */
+  JIT_EMIT_COLD,
 };
 
 typedef void (*jit_emit_cb)(void *, int, uint32_t, uint8_t *);
@@ -98,17 +101,26 @@ struct jit_backend {
 
   /* compile interface */
   void (*reset)(struct jit_backend *);
+  /* the code buffer is split into regions which are filled in order. once the
+     current region fills up, the backend is advanced to the next region,
+     wrapping around to the first, returning the range of code which is about
+     to be overwritten */
+  void (*next_region)(struct jit_backend *, uint8_t **, int *);
   int (*assemble_code)(struct jit_backend *, struct ir *, uint8_t **, int *,
                        jit_emit_cb, void *);
   void (*dump_code)(struct jit_backend *, const uint8_t *, int, FILE *);
   int (*handle_exception)(struct jit_backend *, struct exception_state *);
+  /* optional, used instead of assemble_code by backends which execute the
+     guest code directly. decodes the guest block at the address with the size
+     into the code buffer, failing like assemble_code once a region fills up */
+  int (*decode_code)(struct jit_backend *, uint32_t, int, uint8_t **, int *);
 
   /* dispatch interface */
   void (*run_code)(struct jit_backend *, int);
   void *(*lookup_code)(struct jit_backend *, uint32_t);
   void (*cache_code)(struct jit_backend *, uint32_t, void *);
   void (*invalidate_code)(struct jit_backend *, uint32_t);
-  void (*patch_edge)(struct jit_backend *, void *, void *);
+  void (*patch_edge)(struct jit_backend *, void *, void *, uint32_t);
   void (*restore_edge)(struct jit_backend *, void *, uint32_t);
 };
 
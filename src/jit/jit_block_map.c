@@ -0,0 +1,288 @@
+#include "jit/jit_block_map.h"
+#include "core/core.h"
+#include "core/hash.h"
+#include "jit/jit.h"
+
+/*
+ * guest address -> block map
+ */
+#define JIT_BLOCK_MAP_MIN_CAPACITY 1024
+
+static void jit_block_map_place(struct jit_block_map *map,
+                                struct jit_block *block) {
+  uint32_t mask = map->capacity - 1;
+  uint32_t i = hash_key(block->guest_addr, ctz32(map->capacity));
+
+  while (map->entries[i] && map->entries[i] != JIT_BLOCK_MAP_TOMBSTONE) {
+    i = (i + 1) & mask;
+  }
+
+  if (map->entries[i] == JIT_BLOCK_MAP_TOMBSTONE) {
+    map->num_tombstones--;
+  }
+
+  map->entries[i] = block;
+  map->num_entries++;
+}
+
+static void jit_block_map_resize(struct jit_block_map *map, int capacity) {
+  struct jit_block **entries = map->entries;
+  int old_capacity = map->capacity;
+
+  map->entries = calloc(capacity, sizeof(struct jit_block *));
+  map->capacity = capacity;
+  map->num_entries = 0;
+  map->num_tombstones = 0;
+
+  for (int i = 0; i < old_capacity; i++) {
+    struct jit_block *block = entries[i];
+
+    if (!block || block == JIT_BLOCK_MAP_TOMBSTONE) {
+      continue;
+    }
+
+    jit_block_map_place(map, block);
+  }
+
+  free(entries);
+}
+
+void jit_block_map_remove(struct jit_block_map *map, struct jit_block *block) {
+  if (!map->capacity) {
+    return;
+  }
+
+  uint32_t mask = map->capacity - 1;
+  uint32_t i = hash_key(block->guest_addr, ctz32(map->capacity));
+
+  while (map->entries[i]) {
+    if (map->entries[i] == block) {
+      map->entries[i] = JIT_BLOCK_MAP_TOMBSTONE;
+      map->num_entries--;
+      map->num_tombstones++;
+      break;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  /* once empty, clear out the tombstones to keep future probes short. this
+     doesn't change the capacity, so it's still safe while iterating */
+  if (!map->num_entries && map->num_tombstones) {
+    memset(map->entries, 0, map->capacity * sizeof(struct jit_block *));
+    map->num_tombstones = 0;
+  }
+}
+
+void jit_block_map_insert(struct jit_block_map *map, struct jit_block *block) {
+  /* keep the load factor, including tombstones, under 3/4. if most of the
+     load is due to tombstones, rehash in place instead of growing */
+  int load = map->num_entries + map->num_tombstones + 1;
+
+  if (load * 4 > map->capacity * 3) {
+    int capacity = MAX(map->capacity, JIT_BLOCK_MAP_MIN_CAPACITY);
+
+    if ((map->num_entries + 1) * 2 > capacity) {
+      capacity *= 2;
+    }
+
+    jit_block_map_resize(map, capacity);
+  }
+
+  jit_block_map_place(map, block);
+}
+
+struct jit_block *jit_block_map_find(struct jit_block_map *map,
+                                     uint32_t guest_addr) {
+  if (!map->capacity) {
+    return NULL;
+  }
+
+  uint32_t mask = map->capacity - 1;
+  uint32_t i = hash_key(guest_addr, ctz32(map->capacity));
+  struct jit_block *block;
+
+  while ((block = map->entries[i])) {
+    if (block != JIT_BLOCK_MAP_TOMBSTONE && block->guest_addr == guest_addr) {
+      return block;
+    }
+
+    i = (i + 1) & mask;
+  }
+
+  return NULL;
+}
+
+void jit_block_map_destroy(struct jit_block_map *map) {
+  free(map->entries);
+  memset(map, 0, sizeof(*map));
+}
+
+/*
+ * host address -> block map
+ */
+static void jit_reverse_block_map_range(struct jit_block *block,
+                                        uintptr_t *first, uintptr_t *last) {
+  uintptr_t begin = (uintptr_t)block->host_addr;
+  uintptr_t end = begin + MAX(block->host_size, 1) - 1;
+  *first = begin >> JIT_REVERSE_PAGE_SHIFT;
+  *last = end >> JIT_REVERSE_PAGE_SHIFT;
+}
+
+static void jit_reverse_block_map_reserve(struct jit_reverse_block_map *map,
+                                          uintptr_t first, uintptr_t last) {
+  if (!map->num_pages) {
+    map->first_page = first;
+    map->num_pages = (int)(last - first + 1);
+    map->pages = calloc(map->num_pages, sizeof(struct jit_reverse_page));
+    return;
+  }
+
+  uintptr_t old_first = map->first_page;
+  uintptr_t old_last = old_first + map->num_pages - 1;
+  uintptr_t new_first = MIN(first, old_first);
+  uintptr_t new_last = MAX(last, old_last);
+
+  if (new_first == old_first && new_last == old_last) {
+    return;
+  }
+
+  /* compiled code comes out of the backend's contiguous code buffer, so the
+     page range stays small and growing it is rare */
+  int num_pages = (int)(new_last - new_first + 1);
+  struct jit_reverse_page *pages =
+      calloc(num_pages, sizeof(struct jit_reverse_page));
+  memcpy(&pages[old_first - new_first], map->pages,
+         map->num_pages * sizeof(struct jit_reverse_page));
+  free(map->pages);
+
+  map->first_page = new_first;
+  map->num_pages = num_pages;
+  map->pages = pages;
+}
+
+/* index of the first block in the page with a host address greater than addr */
+static int jit_reverse_page_upper_bound(struct jit_reverse_page *page,
+                                        uintptr_t addr) {
+  int lo = 0;
+  int hi = page->num_entries;
+
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+
+    if ((uintptr_t)page->entries[mid]->host_addr <= addr) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+void jit_reverse_block_map_remove(struct jit_reverse_block_map *map,
+                                  struct jit_block *block) {
+  uintptr_t first, last;
+  jit_reverse_block_map_range(block, &first, &last);
+
+  for (uintptr_t p = first; p <= last; p++) {
+    if (p < map->first_page || p >= map->first_page + map->num_pages) {
+      continue;
+    }
+
+    struct jit_reverse_page *page = &map->pages[p - map->first_page];
+    int i = jit_reverse_page_upper_bound(page, (uintptr_t)block->host_addr) - 1;
+
+    if (i < 0 || page->entries[i] != block) {
+      continue;
+    }
+
+    memmove(&page->entries[i], &page->entries[i + 1],
+            (page->num_entries - i - 1) * sizeof(struct jit_block *));
+    page->num_entries--;
+  }
+}
+
+void jit_reverse_block_map_insert(struct jit_reverse_block_map *map,
+                                  struct jit_block *block) {
+  uintptr_t first, last;
+  jit_reverse_block_map_range(block, &first, &last);
+  jit_reverse_block_map_reserve(map, first, last);
+
+  for (uintptr_t p = first; p <= last; p++) {
+    struct jit_reverse_page *page = &map->pages[p - map->first_page];
+
+    if (page->num_entries == page->capacity) {
+      page->capacity = MAX(page->capacity * 2, 8);
+      page->entries = realloc(page->entries,
+                              page->capacity * sizeof(struct jit_block *));
+    }
+
+    int i = jit_reverse_page_upper_bound(page, (uintptr_t)block->host_addr);
+    memmove(&page->entries[i + 1], &page->entries[i],
+            (page->num_entries - i) * sizeof(struct jit_block *));
+    page->entries[i] = block;
+    page->num_entries++;
+  }
+}
+
+struct jit_block *jit_reverse_block_map_find(struct jit_reverse_block_map *map,
+                                             const void *host_addr) {
+  uintptr_t addr = (uintptr_t)host_addr;
+  uintptr_t p = addr >> JIT_REVERSE_PAGE_SHIFT;
+
+  if (p < map->first_page || p >= map->first_page + map->num_pages) {
+    return NULL;
+  }
+
+  /* find the last block starting at or before the address */
+  struct jit_reverse_page *page = &map->pages[p - map->first_page];
+  int i = jit_reverse_page_upper_bound(page, addr) - 1;
+
+  if (i < 0) {
+    return NULL;
+  }
+
+  struct jit_block *block = page->entries[i];
+  uintptr_t begin = (uintptr_t)block->host_addr;
+
+  if (addr < begin || addr >= begin + block->host_size) {
+    return NULL;
+  }
+
+  return block;
+}
+
+void jit_reverse_block_map_destroy(struct jit_reverse_block_map *map) {
+  for (int i = 0; i < map->num_pages; i++) {
+    free(map->pages[i].entries);
+  }
+  free(map->pages);
+  memset(map, 0, sizeof(*map));
+}
+
+/*
+ * host address -> guest instruction lookup within a block
+ */
+int jit_block_find_source(const struct jit_block *block,
+                          const void *host_addr) {
+  /* the blocks forming a superblock aren't emitted in guest order, so the
+     entire source map has to be scanned for the closest preceding entry */
+  uintptr_t addr = (uintptr_t)host_addr;
+  uintptr_t found_addr = 0;
+  int found = 0;
+
+  for (int i = 0; i < block->guest_size; i++) {
+    uintptr_t source_addr = (uintptr_t)block->source_map[i];
+
+    /* ignore empty entries */
+    if (!source_addr || source_addr > addr || source_addr < found_addr) {
+      continue;
+    }
+
+    found_addr = source_addr;
+    found = i;
+  }
+
+  return found;
+}
@@ -0,0 +1,67 @@
+#ifndef JIT_BLOCK_MAP_H
+#define JIT_BLOCK_MAP_H
+
+#include <stdint.h>
+
+struct jit_block;
+
+/*
+ * guest address -> block lookup, implemented as an open-addressed hash table
+ * using linear probing. removed entries are replaced with a tombstone, making
+ * it safe to remove entries while iterating
+ */
+#define JIT_BLOCK_MAP_TOMBSTONE ((struct jit_block *)1)
+
+struct jit_block_map {
+  struct jit_block **entries;
+  int capacity;
+  int num_entries;
+  int num_tombstones;
+};
+
+#define jit_block_map_for_each(it, map)                                \
+  for (int it##_i = 0; it##_i < (map)->capacity; it##_i++)             \
+    for (struct jit_block *it = (map)->entries[it##_i];                \
+         it && it != JIT_BLOCK_MAP_TOMBSTONE; it = NULL)
+
+void jit_block_map_destroy(struct jit_block_map *map);
+struct jit_block *jit_block_map_find(struct jit_block_map *map,
+                                     uint32_t guest_addr);
+void jit_block_map_insert(struct jit_block_map *map, struct jit_block *block);
+void jit_block_map_remove(struct jit_block_map *map, struct jit_block *block);
+
+/*
+ * host address -> block lookup. the host address space spanned by the blocks
+ * is split into pages, with each page storing a sorted array of the blocks
+ * overlapping it
+ */
+#define JIT_REVERSE_PAGE_SHIFT 12
+
+struct jit_reverse_page {
+  struct jit_block **entries;
+  int capacity;
+  int num_entries;
+};
+
+struct jit_reverse_block_map {
+  uintptr_t first_page;
+  int num_pages;
+  struct jit_reverse_page *pages;
+};
+
+void jit_reverse_block_map_destroy(struct jit_reverse_block_map *map);
+struct jit_block *jit_reverse_block_map_find(struct jit_reverse_block_map *map,
+                                             const void *host_addr);
+void jit_reverse_block_map_insert(struct jit_reverse_block_map *map,
+                                  struct jit_block *block);
+void jit_reverse_block_map_remove(struct jit_reverse_block_map *map,
+                                  struct jit_block *block);
+
+/*
+ * host address -> guest instruction lookup, returning the offset from the
+ * block's guest address of the instruction whose code contains host_addr
+ */
+int jit_block_find_source(const struct jit_block *block,
+                          const void *host_addr);
+
+#endif
@@ -0,0 +1,374 @@
+#include "jit/jit_cache.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/md5.h"
+#include "jit/ir/ir.h"
+#include "jit/jit_guest.h"
+
+#if PLATFORM_DARWIN || PLATFORM_LINUX
+#include <dlfcn.h>
+#define HAVE_JIT_CACHE 1
+#else
+#define HAVE_JIT_CACHE 0
+#endif
+
+/*
+ * persistent code cache
+ *
+ * the cache stores the optimized ir for each block right before register
+ * allocation, keyed by a hash of the guest code, the fastmem state and any
+ * frontend-specific compile-time state. the ir is written out in the same
+ * text format used for dumping code, prefixed by a relocation table
+ *
+ * the ir references host addresses for fallbacks and guest callbacks. these
+ * are different between runs due to aslr, so each 64-bit constant is written
+ * out either relative to the executable image base, as a reference to one of
+ * the guest's runtime pointers, or as-is. blocks with constants that look like
+ * any other host address (heap allocations, shared libraries) aren't cached,
+ * as they'd be stale once loaded by a later run
+ */
+#define JIT_CACHE_VERSION 1
+
+enum {
+  RELOC_IMAGE,
+  RELOC_GUEST,
+  RELOC_GUEST_CTX,
+  RELOC_GUEST_MEMBASE,
+  RELOC_GUEST_MEM,
+  RELOC_GUEST_DATA,
+  RELOC_NUM_GUEST,
+};
+
+struct jit_cache {
+  struct jit_guest *guest;
+  char path[PATH_MAX];
+
+  /* runtime pointers which constants may be relocated against */
+  uintptr_t guest_ptrs[RELOC_NUM_GUEST];
+  uintptr_t image_base;
+
+  /* offset of a known function in the image, used to detect the image
+     having changed since the cache was written */
+  uintptr_t image_anchor;
+};
+
+static int jit_cache_reloc(struct jit_cache *cache, uintptr_t ptr,
+                           uintptr_t *value) {
+  for (int i = RELOC_GUEST; i < RELOC_NUM_GUEST; i++) {
+    if (ptr && ptr == cache->guest_ptrs[i]) {
+      *value = 0;
+      return i;
+    }
+  }
+
+#if HAVE_JIT_CACHE
+  Dl_info info;
+  if (dladdr((void *)ptr, &info) &&
+      (uintptr_t)info.dli_fbase == cache->image_base) {
+    *value = ptr - cache->image_base;
+    return RELOC_IMAGE;
+  }
+#endif
+
+  return -1;
+}
+
+static int jit_cache_is_host_ptr(struct jit_cache *cache, uintptr_t ptr) {
+#if HAVE_JIT_CACHE
+  /* anything inside of a loaded image */
+  Dl_info info;
+  if (dladdr((void *)ptr, &info)) {
+    return 1;
+  }
+#endif
+
+  /* the guests are 32-bit, treat anything wider which lies in the user address
+     space as a pointer */
+  return ptr > UINT32_MAX && ptr < (1ull << 48);
+}
+
+static int jit_cache_can_store(struct jit_cache *cache, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = instr->arg[i];
+
+        if (!arg || !ir_is_constant(arg) || arg->type != VALUE_I64) {
+          continue;
+        }
+
+        uintptr_t value;
+        int type = jit_cache_reloc(cache, (uintptr_t)arg->i64, &value);
+
+        if (type < 0 && jit_cache_is_host_ptr(cache, (uintptr_t)arg->i64)) {
+          return 0;
+        }
+      }
+    }
+  }
+
+  return 1;
+}
+
+static uintptr_t jit_cache_unreloc(struct jit_cache *cache, int type,
+                                   uintptr_t value) {
+  if (type == RELOC_IMAGE) {
+    return cache->image_base + value;
+  }
+  return cache->guest_ptrs[type];
+}
+
+static void jit_cache_filename(struct jit_cache *cache, uint32_t guest_addr,
+                               const char *key, char *filename, size_t size) {
+  snprintf(filename, size, "%s" PATH_SEPARATOR "0x%08x-%s.ir", cache->path,
+           guest_addr, key);
+}
+
+void jit_cache_store(struct jit_cache *cache, uint32_t guest_addr,
+                     const char *key, struct ir *ir) {
+  if (!HAVE_JIT_CACHE) {
+    return;
+  }
+
+  if (!jit_cache_can_store(cache, ir)) {
+    return;
+  }
+
+  char filename[PATH_MAX];
+  jit_cache_filename(cache, guest_addr, key, filename, sizeof(filename));
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_cache_store failed to open %s", filename);
+    return;
+  }
+
+  fprintf(file, "%d 0x%" PRIxPTR "\n", JIT_CACHE_VERSION, cache->image_anchor);
+
+  /* write out relocations for each 64-bit constant that references a host
+     address, indexed by the order the constants appear in */
+  int index = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = instr->arg[i];
+
+        if (!arg || !ir_is_constant(arg) || arg->type != VALUE_I64) {
+          continue;
+        }
+
+        uintptr_t value;
+        int type = jit_cache_reloc(cache, (uintptr_t)arg->i64, &value);
+
+        if (type >= 0) {
+          fprintf(file, "%d %d 0x%" PRIxPTR "\n", index, type, value);
+        }
+
+        index++;
+      }
+    }
+  }
+
+  fprintf(file, "-1\n");
+
+  ir_write(ir, file);
+
+  fclose(file);
+}
+
+int jit_cache_load(struct jit_cache *cache, uint32_t guest_addr,
+                   const char *key, struct ir *ir) {
+  if (!HAVE_JIT_CACHE) {
+    return 0;
+  }
+
+  char filename[PATH_MAX];
+  jit_cache_filename(cache, guest_addr, key, filename, sizeof(filename));
+
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    return 0;
+  }
+
+  int res = 0;
+  int version;
+  uintptr_t anchor;
+  int num_relocs = 0;
+  int relocs[1024][2];
+  uintptr_t values[1024];
+
+  /* ignore entries written by a different build */
+  if (fscanf(file, "%d 0x%" SCNxPTR "\n", &version, &anchor) != 2 ||
+      version != JIT_CACHE_VERSION || anchor != cache->image_anchor) {
+    goto done;
+  }
+
+  while (1) {
+    int index, type;
+    uintptr_t value;
+
+    if (fscanf(file, "%d", &index) != 1) {
+      goto done;
+    }
+
+    if (index < 0) {
+      break;
+    }
+
+    if (num_relocs >= (int)ARRAY_SIZE(relocs) ||
+        fscanf(file, "%d 0x%" SCNxPTR, &type, &value) != 2 || type < 0 ||
+        type >= RELOC_NUM_GUEST) {
+      goto done;
+    }
+
+    relocs[num_relocs][0] = index;
+    relocs[num_relocs][1] = type;
+    values[num_relocs] = value;
+    num_relocs++;
+  }
+
+  if (!ir_read(file, ir)) {
+    goto done;
+  }
+
+  /* apply relocations, constants are visited in the same order they were
+     written out in */
+  int index = 0;
+  int next = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = instr->arg[i];
+
+        if (!arg || !ir_is_constant(arg) || arg->type != VALUE_I64) {
+          continue;
+        }
+
+        if (next < num_relocs && relocs[next][0] == index) {
+          arg->i64 = (int64_t)jit_cache_unreloc(cache, relocs[next][1],
+                                                values[next]);
+          next++;
+        }
+
+        index++;
+      }
+    }
+  }
+
+  res = next == num_relocs;
+
+done:
+  fclose(file);
+
+  return res;
+}
+
+void jit_cache_store_slowmem(struct jit_cache *cache, const uint32_t *addrs,
+                             const uint16_t *data, int num) {
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "slowmem.txt",
+           cache->path);
+
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_cache_store_slowmem failed to open %s", filename);
+    return;
+  }
+
+  for (int i = 0; i < num; i++) {
+    fprintf(file, "0x%08x 0x%04x\n", addrs[i], data[i]);
+  }
+
+  fclose(file);
+}
+
+int jit_cache_load_slowmem(struct jit_cache *cache, uint32_t **addrs,
+                           uint16_t **data) {
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "slowmem.txt",
+           cache->path);
+
+  *addrs = NULL;
+  *data = NULL;
+
+  FILE *file = fopen(filename, "r");
+  if (!file) {
+    return 0;
+  }
+
+  int num = 0;
+  int capacity = 0;
+  uint32_t addr;
+  unsigned value;
+
+  while (fscanf(file, "0x%08x 0x%04x\n", &addr, &value) == 2) {
+    if (num == capacity) {
+      capacity = MAX(capacity * 2, 64);
+      *addrs = realloc(*addrs, capacity * sizeof(uint32_t));
+      *data = realloc(*data, capacity * sizeof(uint16_t));
+    }
+
+    (*addrs)[num] = addr;
+    (*data)[num] = (uint16_t)value;
+    num++;
+  }
+
+  fclose(file);
+
+  return num;
+}
+
+void jit_cache_key(struct jit_cache *cache, uint32_t guest_addr,
+                   int guest_size, const int8_t *fastmem, uint32_t flags,
+                   char *key) {
+  struct jit_guest *guest = cache->guest;
+
+  MD5_CTX md5;
+  MD5_Init(&md5);
+  MD5_Update(&md5, &guest_size, sizeof(guest_size));
+  MD5_Update(&md5, &flags, sizeof(flags));
+  MD5_Update(&md5, (void *)fastmem, guest_size);
+
+  for (int i = 0; i < guest_size; i++) {
+    uint8_t data = guest->r8(guest->mem, guest_addr + i);
+    MD5_Update(&md5, &data, sizeof(data));
+  }
+
+  unsigned char digest[16];
+  MD5_Final((char *)digest, &md5);
+
+  for (int i = 0; i < 16; i++) {
+    snprintf(&key[i * 2], 3, "%02x", digest[i]);
+  }
+}
+
+void jit_cache_destroy(struct jit_cache *cache) {
+  free(cache);
+}
+
+struct jit_cache *jit_cache_create(const char *tag, struct jit_guest *guest) {
+  struct jit_cache *cache = calloc(1, sizeof(struct jit_cache));
+
+  cache->guest = guest;
+
+  snprintf(cache->path, sizeof(cache->path), "%s" PATH_SEPARATOR "%s-cache",
+           fs_appdir(), tag);
+  CHECK(fs_mkdir(cache->path));
+
+  cache->guest_ptrs[RELOC_GUEST] = (uintptr_t)guest;
+  cache->guest_ptrs[RELOC_GUEST_CTX] = (uintptr_t)guest->ctx;
+  cache->guest_ptrs[RELOC_GUEST_MEMBASE] = (uintptr_t)guest->membase;
+  cache->guest_ptrs[RELOC_GUEST_MEM] = (uintptr_t)guest->mem;
+  cache->guest_ptrs[RELOC_GUEST_DATA] = (uintptr_t)guest->data;
+
+#if HAVE_JIT_CACHE
+  Dl_info info;
+  CHECK(dladdr((void *)&jit_cache_create, &info));
+  cache->image_base = (uintptr_t)info.dli_fbase;
+  cache->image_anchor = (uintptr_t)&jit_cache_create - cache->image_base;
+#endif
+
+  return cache;
+}
@@ -0,0 +1,31 @@
+#ifndef JIT_CACHE_H
+#define JIT_CACHE_H
+
+#include <stdint.h>
+
+struct ir;
+struct jit_cache;
+struct jit_guest;
+
+/* md5 digest of everything compiled code depends on, formatted as hex */
+#define JIT_CACHE_KEY_SIZE 33
+
+struct jit_cache *jit_cache_create(const char *tag, struct jit_guest *guest);
+void jit_cache_destroy(struct jit_cache *cache);
+
+void jit_cache_key(struct jit_cache *cache, uint32_t guest_addr,
+                   int guest_size, const int8_t *fastmem, uint32_t flags,
+                   char *key);
+int jit_cache_load(struct jit_cache *cache, uint32_t guest_addr,
+                   const char *key, struct ir *ir);
+void jit_cache_store(struct jit_cache *cache, uint32_t guest_addr,
+                     const char *key, struct ir *ir);
+
+/* guest addresses of instructions which faulted when using fastmem, along
+   with the first two bytes of each instruction */
+int jit_cache_load_slowmem(struct jit_cache *cache, uint32_t **addrs,
+                           uint16_t **data);
+void jit_cache_store_slowmem(struct jit_cache *cache, const uint32_t *addrs,
+                             const uint16_t *data, int num);
+
+#endif
@@ -30,7 +30,13 @@ struct jit_frontend {
   void (*translate_code)(struct jit_frontend *, uint32_t, int, struct ir *);
   void (*dump_code)(struct jit_frontend *, uint32_t, int, FILE *output);
 
+  /* optional, returns the run-time state translated code is specialized for */
+  uint32_t (*compile_flags)(struct jit_frontend *);
+
   const struct jit_opdef *(*lookup_op)(struct jit_frontend *, const void *);
+
+  /* size in bytes of each guest instruction */
+  int instr_size;
 };
 
 #endif
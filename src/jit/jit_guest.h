@@ -22,6 +22,9 @@ struct jit_guest {
   struct memory *mem;
   void (*lookup)(struct memory *, uint32_t, void **, uint8_t **, mem_read_cb *,
                  mem_write_cb *);
+  /* returns the backing store of mmio registers which can be read directly,
+     without any side effects */
+  uint8_t *(*lookup_reg)(struct memory *, uint32_t);
   uint8_t (*r8)(struct memory *, uint32_t);
   uint16_t (*r16)(struct memory *, uint32_t);
   uint32_t (*r32)(struct memory *, uint32_t);
@@ -0,0 +1,193 @@
+#include "jit/jit_pass_manager.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "jit/ir/ir.h"
+#include "jit/jit_backend.h"
+#include "jit/pass_stats.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "jit/passes/compare_fusion_pass.h"
+#include "jit/passes/constant_propagation_pass.h"
+#include "jit/passes/control_flow_analysis_pass.h"
+#include "jit/passes/dead_code_elimination_pass.h"
+#include "jit/passes/expression_simplification_pass.h"
+#include "jit/passes/load_store_elimination_pass.h"
+#include "jit/passes/loop_invariant_code_motion_pass.h"
+#include "jit/passes/register_allocation_pass.h"
+
+#define JIT_MAX_PASSES 32
+#define JIT_MAX_PASS_NAME 32
+#define JIT_MAX_TIMER_NAME 64
+
+struct jit_pass {
+  const char *name;
+  void *(*create)(struct jit_backend *);
+  void (*destroy)(void *);
+  void (*run)(void *, struct ir *);
+};
+
+struct jit_pass_manager {
+  const struct jit_pass *passes[JIT_MAX_PASSES];
+  void *data[JIT_MAX_PASSES];
+  int num_passes;
+
+  /* each manager times its own passes, keeping the timings for each guest
+     separate and leaving managers on different threads independent */
+  struct pass_timer timers[JIT_MAX_PASSES];
+  char timer_names[JIT_MAX_PASSES][JIT_MAX_TIMER_NAME];
+};
+
+/* adapt each pass' interface to the generic one used by the registry */
+#define DEFINE_JIT_PASS(name)                                    \
+  static void *name##_pass_create(struct jit_backend *backend) { \
+    return name##_create();                                      \
+  }                                                              \
+  static void name##_pass_destroy(void *data) {                  \
+    name##_destroy(data);                                        \
+  }                                                              \
+  static void name##_pass_run(void *data, struct ir *ir) {       \
+    name##_run(data, ir);                                        \
+  }
+
+DEFINE_JIT_PASS(cfa)
+DEFINE_JIT_PASS(lse)
+DEFINE_JIT_PASS(cprop)
+DEFINE_JIT_PASS(esimp)
+DEFINE_JIT_PASS(cse)
+DEFINE_JIT_PASS(licm)
+DEFINE_JIT_PASS(cfuse)
+DEFINE_JIT_PASS(dce)
+
+static void *ra_pass_create(struct jit_backend *backend) {
+  return ra_create(backend->registers, backend->num_registers,
+                   backend->emitters, backend->num_emitters);
+}
+
+static void ra_pass_destroy(void *data) {
+  ra_destroy(data);
+}
+
+static void ra_pass_run(void *data, struct ir *ir) {
+  ra_run(data, ir);
+}
+
+#define JIT_PASS(name) \
+  { #name, &name##_pass_create, &name##_pass_destroy, &name##_pass_run }
+
+/* registry of passes available to pipelines */
+static const struct jit_pass jit_passes[] = {
+    JIT_PASS(cfa),   /* control flow analysis */
+    JIT_PASS(lse),   /* load / store elimination */
+    JIT_PASS(cprop), /* constant propagation */
+    JIT_PASS(esimp), /* expression simplification */
+    JIT_PASS(cse),   /* local common subexpression elimination */
+    JIT_PASS(licm),  /* loop-invariant code motion */
+    JIT_PASS(cfuse), /* compare fusion */
+    JIT_PASS(dce),   /* dead code elimination */
+    JIT_PASS(ra),    /* register allocation */
+};
+
+static const struct jit_pass *jit_pass_lookup(const char *name) {
+  for (int i = 0; i < (int)ARRAY_SIZE(jit_passes); i++) {
+    const struct jit_pass *pass = &jit_passes[i];
+
+    if (!strcmp(pass->name, name)) {
+      return pass;
+    }
+  }
+
+  return NULL;
+}
+
+void jit_pass_manager_run_pass(struct jit_pass_manager *pm, int n,
+                               struct ir *ir) {
+  CHECK(n >= 0 && n < pm->num_passes);
+
+  const struct jit_pass *pass = pm->passes[n];
+  struct pass_timer *timer = &pm->timers[n];
+
+  int64_t start = time_nanoseconds();
+  pass->run(pm->data[n], ir);
+  int64_t end = time_nanoseconds();
+
+  timer->ns += end - start;
+  timer->runs++;
+
+  DCHECK(ir_verify(ir), "ir failed verification after %s", pass->name);
+}
+
+void jit_pass_manager_run(struct jit_pass_manager *pm, struct ir *ir) {
+  for (int i = 0; i < pm->num_passes; i++) {
+    jit_pass_manager_run_pass(pm, i, ir);
+  }
+}
+
+const char *jit_pass_manager_pass_name(struct jit_pass_manager *pm, int n) {
+  CHECK(n >= 0 && n < pm->num_passes);
+  return pm->passes[n]->name;
+}
+
+int jit_pass_manager_num_passes(struct jit_pass_manager *pm) {
+  return pm->num_passes;
+}
+
+void jit_pass_manager_destroy(struct jit_pass_manager *pm) {
+  for (int i = 0; i < pm->num_passes; i++) {
+    pass_stats_unregister_timer(&pm->timers[i]);
+    pm->passes[i]->destroy(pm->data[i]);
+  }
+
+  free(pm);
+}
+
+struct jit_pass_manager *jit_pass_manager_create(const char *tag,
+                                                 struct jit_backend *backend,
+                                                 const char *pipeline) {
+  struct jit_pass_manager *pm = calloc(1, sizeof(struct jit_pass_manager));
+
+  const char *ptr = pipeline;
+
+  while (*ptr) {
+    /* read the next name, ignoring any surrounding whitespace */
+    char name[JIT_MAX_PASS_NAME];
+    int len = 0;
+
+    while (*ptr && *ptr != ',') {
+      if (!isspace((unsigned char)*ptr) && len < (int)sizeof(name) - 1) {
+        name[len++] = *ptr;
+      }
+      ptr++;
+    }
+
+    name[len] = 0;
+
+    if (*ptr) {
+      ptr++;
+    }
+
+    if (!len) {
+      continue;
+    }
+
+    const struct jit_pass *pass = jit_pass_lookup(name);
+
+    if (!pass) {
+      LOG_WARNING("unknown pass %s", name);
+      continue;
+    }
+
+    CHECK_LT(pm->num_passes, JIT_MAX_PASSES);
+
+    int n = pm->num_passes++;
+    pm->passes[n] = pass;
+    pm->data[n] = pass->create(backend);
+
+    /* report the timings under the manager's tag */
+    struct pass_timer *timer = &pm->timers[n];
+    snprintf(pm->timer_names[n], sizeof(pm->timer_names[n]), "%s.%s", tag,
+             pass->name);
+    timer->name = pm->timer_names[n];
+    pass_stats_register_timer(timer);
+  }
+
+  return pm;
+}
@@ -0,0 +1,29 @@
+#ifndef JIT_PASS_MANAGER_H
+#define JIT_PASS_MANAGER_H
+
+struct ir;
+struct jit_backend;
+struct jit_pass_manager;
+
+/*
+ * runs a pipeline of passes over the ir, described by a comma-separated list
+ * of pass names (e.g. "cfa,lse,cprop,dce"). each pass in the pipeline gets
+ * its own instance, making it unsafe to share a manager between threads
+ *
+ * the time spent in each pass is accumulated per manager, and reported by
+ * pass_stats_dump prefixed with the manager's tag. in debug builds, the ir is
+ * verified after each pass
+ */
+struct jit_pass_manager *jit_pass_manager_create(const char *tag,
+                                                 struct jit_backend *backend,
+                                                 const char *pipeline);
+void jit_pass_manager_destroy(struct jit_pass_manager *pm);
+
+int jit_pass_manager_num_passes(struct jit_pass_manager *pm);
+const char *jit_pass_manager_pass_name(struct jit_pass_manager *pm, int n);
+
+void jit_pass_manager_run_pass(struct jit_pass_manager *pm, int n,
+                               struct ir *ir);
+void jit_pass_manager_run(struct jit_pass_manager *pm, struct ir *ir);
+
+#endif
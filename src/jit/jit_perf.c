@@ -0,0 +1,234 @@
+#include "jit/jit_perf.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/time.h"
+
+#if PLATFORM_LINUX
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define HAVE_JITDUMP 1
+#else
+#define HAVE_JITDUMP 0
+#endif
+
+/*
+ * perf jitdump writer
+ *
+ * the perf map only provides symbol names for compiled code. the jitdump
+ * format additionally contains the code itself, along with debug info mapping
+ * each host instruction back to the guest instruction it was generated for.
+ * this lets perf annotate compiled code at the instruction level, and, as
+ * each record is timestamped, correctly attribute samples to code which was
+ * freed and later reused
+ *
+ * to use it, record with a monotonic clock and inject the dump afterwards:
+ * perf record -k 1 ...
+ * perf inject --jit -i perf.data -o perf.jit.data
+ *
+ * the format is documented in linux/tools/perf/Documentation/
+ * jitdump-specification.txt
+ */
+#define JITDUMP_MAGIC 0x4a695444
+#define JITDUMP_VERSION 1
+
+#if ARCH_A64
+#define JITDUMP_ELF_MACH 183 /* EM_AARCH64 */
+#else
+#define JITDUMP_ELF_MACH 62 /* EM_X86_64 */
+#endif
+
+enum {
+  JIT_CODE_LOAD = 0,
+  JIT_CODE_MOVE = 1,
+  JIT_CODE_DEBUG_INFO = 2,
+  JIT_CODE_CLOSE = 3,
+};
+
+struct jitdump_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t total_size;
+  uint32_t elf_mach;
+  uint32_t pad1;
+  uint32_t pid;
+  uint64_t timestamp;
+  uint64_t flags;
+};
+
+struct jitdump_record {
+  uint32_t id;
+  uint32_t total_size;
+  uint64_t timestamp;
+};
+
+/* followed by the null-terminated function name and the code */
+struct jitdump_code_load {
+  struct jitdump_record base;
+  uint32_t pid;
+  uint32_t tid;
+  uint64_t vma;
+  uint64_t code_addr;
+  uint64_t code_size;
+  uint64_t code_index;
+};
+
+/* followed by nr_entry entries */
+struct jitdump_debug_info {
+  struct jitdump_record base;
+  uint64_t code_addr;
+  uint64_t nr_entry;
+};
+
+/* followed by the null-terminated file name */
+struct jitdump_debug_entry {
+  uint64_t code_addr;
+  int32_t line;
+  int32_t discrim;
+};
+
+static struct {
+  int refs;
+  FILE *file;
+  void *marker;
+  size_t marker_size;
+  uint64_t code_index;
+} jitdump;
+
+#if HAVE_JITDUMP
+static uint32_t jit_perf_tid() {
+  return (uint32_t)syscall(SYS_gettid);
+}
+
+static void jit_perf_write_debug_info(const char *name, const uint8_t *code,
+                                      void **source_map, int source_size) {
+  /* each guest instruction becomes a line in a file named after the block,
+     with the line number being the instruction's offset into the block */
+  int num_entries = 0;
+  for (int i = 0; i < source_size; i++) {
+    num_entries += source_map[i] != NULL;
+  }
+
+  if (!num_entries) {
+    return;
+  }
+
+  int name_size = (int)strlen(name) + 1;
+  int entry_size = sizeof(struct jitdump_debug_entry) + name_size;
+
+  struct jitdump_debug_info info = {0};
+  info.base.id = JIT_CODE_DEBUG_INFO;
+  info.base.total_size = sizeof(info) + num_entries * entry_size;
+  info.base.timestamp = time_nanoseconds();
+  info.code_addr = (uint64_t)(uintptr_t)code;
+  info.nr_entry = num_entries;
+  fwrite(&info, sizeof(info), 1, jitdump.file);
+
+  for (int i = 0; i < source_size; i++) {
+    if (!source_map[i]) {
+      continue;
+    }
+
+    struct jitdump_debug_entry entry = {0};
+    entry.code_addr = (uint64_t)(uintptr_t)source_map[i];
+    entry.line = i + 1;
+    fwrite(&entry, sizeof(entry), 1, jitdump.file);
+    fwrite(name, name_size, 1, jitdump.file);
+  }
+}
+#endif
+
+void jit_perf_load_code(const char *name, const uint8_t *code, int code_size,
+                        void **source_map, int source_size) {
+#if HAVE_JITDUMP
+  if (!jitdump.file) {
+    return;
+  }
+
+  /* debug info must precede the code it describes */
+  jit_perf_write_debug_info(name, code, source_map, source_size);
+
+  int name_size = (int)strlen(name) + 1;
+
+  struct jitdump_code_load load = {0};
+  load.base.id = JIT_CODE_LOAD;
+  load.base.total_size = sizeof(load) + name_size + code_size;
+  load.base.timestamp = time_nanoseconds();
+  load.pid = (uint32_t)getpid();
+  load.tid = jit_perf_tid();
+  load.vma = (uint64_t)(uintptr_t)code;
+  load.code_addr = (uint64_t)(uintptr_t)code;
+  load.code_size = code_size;
+  load.code_index = jitdump.code_index++;
+  fwrite(&load, sizeof(load), 1, jitdump.file);
+  fwrite(name, name_size, 1, jitdump.file);
+  fwrite(code, code_size, 1, jitdump.file);
+#endif
+}
+
+void jit_perf_close() {
+#if HAVE_JITDUMP
+  if (--jitdump.refs > 0) {
+    return;
+  }
+
+  if (jitdump.file) {
+    struct jitdump_record close = {0};
+    close.id = JIT_CODE_CLOSE;
+    close.total_size = sizeof(close);
+    close.timestamp = time_nanoseconds();
+    fwrite(&close, sizeof(close), 1, jitdump.file);
+  }
+
+  if (jitdump.marker) {
+    munmap(jitdump.marker, jitdump.marker_size);
+  }
+
+  if (jitdump.file) {
+    fclose(jitdump.file);
+  }
+
+  memset(&jitdump, 0, sizeof(jitdump));
+#endif
+}
+
+int jit_perf_open() {
+#if HAVE_JITDUMP
+  if (jitdump.refs++ > 0) {
+    return jitdump.file != NULL;
+  }
+
+  char filename[PATH_MAX];
+  snprintf(filename, sizeof(filename), "/tmp/jit-%d.dump", getpid());
+
+  jitdump.file = fopen(filename, "w+");
+  if (!jitdump.file) {
+    LOG_WARNING("jit_perf_open failed to open %s", filename);
+    return 0;
+  }
+
+  /* perf finds the dump by looking for an executable mapping of it in the
+     recorded mmap events */
+  jitdump.marker_size = sysconf(_SC_PAGESIZE);
+  jitdump.marker = mmap(NULL, jitdump.marker_size, PROT_READ | PROT_EXEC,
+                        MAP_PRIVATE, fileno(jitdump.file), 0);
+
+  if (jitdump.marker == MAP_FAILED) {
+    LOG_WARNING("jit_perf_open failed to map %s", filename);
+    jitdump.marker = NULL;
+  }
+
+  struct jitdump_header header = {0};
+  header.magic = JITDUMP_MAGIC;
+  header.version = JITDUMP_VERSION;
+  header.total_size = sizeof(header);
+  header.elf_mach = JITDUMP_ELF_MACH;
+  header.pid = (uint32_t)getpid();
+  header.timestamp = time_nanoseconds();
+  fwrite(&header, sizeof(header), 1, jitdump.file);
+
+  return 1;
+#else
+  return 0;
+#endif
+}
@@ -0,0 +1,15 @@
+#ifndef JIT_PERF_H
+#define JIT_PERF_H
+
+#include <stdint.h>
+
+/* writes compiled code out in perf's jitdump format. the dump is shared by
+   every jit in the process, each call to jit_perf_open must be paired with a
+   call to jit_perf_close */
+int jit_perf_open();
+void jit_perf_close();
+
+void jit_perf_load_code(const char *name, const uint8_t *code, int code_size,
+                        void **source_map, int source_size);
+
+#endif
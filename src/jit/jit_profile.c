@@ -0,0 +1,236 @@
+#include "jit/jit_profile.h"
+#include "core/core.h"
+#include "core/filesystem.h"
+#include "core/sort.h"
+#include "imgui.h"
+
+/*
+ * block execution profiler
+ *
+ * when enabled, the jit tags each compiled block with its profile entry and
+ * the backend bumps the entry's execution and guest cycle counters in the
+ * block's prolog. the backend also attributes the host time elapsed between
+ * block entries to the previously entered block, giving an approximation of
+ * where host time is spent without any external tooling
+ */
+#define JIT_PROFILE_MENU_ROWS 64
+
+static const char *jit_profile_sort_names[JIT_PROFILE_NUM_SORTS] = {
+    "host ticks", "guest cycles", "fastmem faults",
+};
+
+static int jit_profile_cmp_ticks(const void *a, const void *b) {
+  const struct jit_profile_entry *lhs = *(const struct jit_profile_entry **)a;
+  const struct jit_profile_entry *rhs = *(const struct jit_profile_entry **)b;
+  return lhs->num_ticks >= rhs->num_ticks;
+}
+
+static int jit_profile_cmp_cycles(const void *a, const void *b) {
+  const struct jit_profile_entry *lhs = *(const struct jit_profile_entry **)a;
+  const struct jit_profile_entry *rhs = *(const struct jit_profile_entry **)b;
+  return lhs->num_cycles >= rhs->num_cycles;
+}
+
+static int jit_profile_cmp_fastmem(const void *a, const void *b) {
+  const struct jit_profile_entry *lhs = *(const struct jit_profile_entry **)a;
+  const struct jit_profile_entry *rhs = *(const struct jit_profile_entry **)b;
+  return lhs->num_fastmem_faults >= rhs->num_fastmem_faults;
+}
+
+static sort_cmp jit_profile_cmps[JIT_PROFILE_NUM_SORTS] = {
+    &jit_profile_cmp_ticks, &jit_profile_cmp_cycles, &jit_profile_cmp_fastmem,
+};
+
+#ifdef HAVE_IMGUI
+void jit_profile_debug_menu(struct jit_profile *profile) {
+  char title[64];
+  snprintf(title, sizeof(title), "%s block profile", profile->tag);
+
+  if (igBegin(title, NULL, 0)) {
+    for (int i = 0; i < JIT_PROFILE_NUM_SORTS; i++) {
+      if (i) {
+        igSameLine(0.0f, -1.0f);
+      }
+      igRadioButton(jit_profile_sort_names[i], &profile->sort, i);
+    }
+
+    if (igButton("reset", (struct ImVec2){0.0f, 0.0f})) {
+      jit_profile_reset(profile);
+    }
+
+    igSameLine(0.0f, -1.0f);
+
+    if (igButton("save csv", (struct ImVec2){0.0f, 0.0f})) {
+      char filename[PATH_MAX];
+      snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s-profile.csv",
+               fs_appdir(), profile->tag);
+      jit_profile_write_csv(profile, profile->sort, filename);
+    }
+
+    struct jit_profile_entry **blocks = NULL;
+    int num_blocks = jit_profile_sorted(profile, profile->sort, &blocks);
+
+    uint64_t total_ticks = 0;
+    for (int i = 0; i < num_blocks; i++) {
+      total_ticks += blocks[i]->num_ticks;
+    }
+
+    igColumns(7, NULL, 0);
+
+    igText("addr");
+    igNextColumn();
+    igText("execs");
+    igNextColumn();
+    igText("guest cycles");
+    igNextColumn();
+    igText("host ticks");
+    igNextColumn();
+    igText("host %%");
+    igNextColumn();
+    igText("fastmem faults");
+    igNextColumn();
+    igText("hot / cold bytes");
+    igNextColumn();
+
+    for (int i = 0; i < MIN(num_blocks, JIT_PROFILE_MENU_ROWS); i++) {
+      struct jit_profile_entry *block = blocks[i];
+      float pct = total_ticks ? block->num_ticks * 100.0f / total_ticks : 0.0f;
+
+      igText("0x%08x", block->guest_addr);
+      igNextColumn();
+      igText("%" PRIu64, block->num_execs);
+      igNextColumn();
+      igText("%" PRIu64, block->num_cycles);
+      igNextColumn();
+      igText("%" PRIu64, block->num_ticks);
+      igNextColumn();
+      igText("%.2f", pct);
+      igNextColumn();
+      igText("%" PRIu64, block->num_fastmem_faults);
+      igNextColumn();
+      igText("%d / %d", block->hot_size, block->cold_size);
+      igNextColumn();
+    }
+
+    igColumns(1, NULL, 0);
+
+    free(blocks);
+
+    igEnd();
+  }
+}
+#endif
+
+int jit_profile_write_csv(struct jit_profile *profile, int sort,
+                          const char *filename) {
+  FILE *file = fopen(filename, "w");
+  if (!file) {
+    LOG_WARNING("jit_profile_write_csv failed to open %s", filename);
+    return 0;
+  }
+
+  struct jit_profile_entry **blocks = NULL;
+  int num_blocks = jit_profile_sorted(profile, sort, &blocks);
+
+  fprintf(file,
+          "addr,size,execs,guest_cycles,host_ticks,fastmem_faults,hot_bytes,"
+          "cold_bytes\n");
+
+  for (int i = 0; i < num_blocks; i++) {
+    struct jit_profile_entry *block = blocks[i];
+    fprintf(file,
+            "0x%08x,%d,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%d,%d\n",
+            block->guest_addr, block->guest_size, block->num_execs,
+            block->num_cycles, block->num_ticks, block->num_fastmem_faults,
+            block->hot_size, block->cold_size);
+  }
+
+  free(blocks);
+  fclose(file);
+
+  LOG_INFO("jit_profile_write_csv wrote %d blocks to %s", num_blocks, filename);
+
+  return 1;
+}
+
+int jit_profile_sorted(struct jit_profile *profile, int sort,
+                       struct jit_profile_entry ***blocks) {
+  CHECK(sort >= 0 && sort < JIT_PROFILE_NUM_SORTS);
+
+  *blocks = malloc(MAX(profile->num_blocks, 1) * sizeof(**blocks));
+
+  int n = 0;
+  for (int i = 0; i < (int)HASH_SIZE(profile->blocks); i++) {
+    hash_bkt_for_each_entry(block, &profile->blocks[i],
+                            struct jit_profile_entry, it) {
+      (*blocks)[n++] = block;
+    }
+  }
+
+  msort(*blocks, n, sizeof(**blocks), jit_profile_cmps[sort]);
+
+  return n;
+}
+
+void jit_profile_reset(struct jit_profile *profile) {
+  /* compiled code references the entries directly, so they're only zeroed
+     out and never freed until the profile is destroyed */
+  for (int i = 0; i < (int)HASH_SIZE(profile->blocks); i++) {
+    hash_bkt_for_each_entry(block, &profile->blocks[i],
+                            struct jit_profile_entry, it) {
+      block->num_execs = 0;
+      block->num_cycles = 0;
+      block->num_ticks = 0;
+      block->num_fastmem_faults = 0;
+    }
+  }
+}
+
+struct jit_profile_entry *jit_profile_get(struct jit_profile *profile,
+                                          uint32_t guest_addr, int guest_size) {
+  struct jit_profile_entry *block = jit_profile_find(profile, guest_addr);
+
+  if (!block) {
+    block = calloc(1, sizeof(struct jit_profile_entry));
+    block->guest_addr = guest_addr;
+    hash_add(hash_bkt(profile->blocks, guest_addr), &block->it);
+    profile->num_blocks++;
+  }
+
+  /* superblocks grow the size of the entry for their head block */
+  block->guest_size = guest_size;
+
+  return block;
+}
+
+struct jit_profile_entry *jit_profile_find(struct jit_profile *profile,
+                                           uint32_t guest_addr) {
+  struct list *bkt = hash_bkt(profile->blocks, guest_addr);
+
+  hash_bkt_for_each_entry(block, bkt, struct jit_profile_entry, it) {
+    if (block->guest_addr == guest_addr) {
+      return block;
+    }
+  }
+
+  return NULL;
+}
+
+void jit_profile_destroy(struct jit_profile *profile) {
+  for (int i = 0; i < (int)HASH_SIZE(profile->blocks); i++) {
+    list_for_each_entry_safe(block, &profile->blocks[i],
+                             struct jit_profile_entry, it) {
+      free(block);
+    }
+  }
+
+  free(profile);
+}
+
+struct jit_profile *jit_profile_create(const char *tag) {
+  struct jit_profile *profile = calloc(1, sizeof(struct jit_profile));
+
+  strncpy(profile->tag, tag, sizeof(profile->tag));
+
+  return profile;
+}
@@ -0,0 +1,68 @@
+#ifndef JIT_PROFILE_H
+#define JIT_PROFILE_H
+
+#include <stdint.h>
+#include "core/hash.h"
+#include "core/list.h"
+
+/* counters for a single guest block. these are keyed by guest address rather
+   than being stored on the jit_block, enabling them to accumulate across the
+   block being invalidated and recompiled */
+struct jit_profile_entry {
+  uint32_t guest_addr;
+  int guest_size;
+
+  /* size of the most recently compiled code for the block, split between the
+     hot code and the cold section of slow paths */
+  int hot_size;
+  int cold_size;
+
+  /* updated by compiled code in each block's prolog */
+  uint64_t num_execs;
+  uint64_t num_cycles;
+  uint64_t num_ticks;
+
+  /* number of fastmem accesses in the block which faulted and fell back to
+     the slow path */
+  uint64_t num_fastmem_faults;
+
+  struct list_node it;
+};
+
+enum {
+  JIT_PROFILE_SORT_TICKS,
+  JIT_PROFILE_SORT_CYCLES,
+  JIT_PROFILE_SORT_FASTMEM,
+  JIT_PROFILE_NUM_SORTS,
+};
+
+struct jit_profile {
+  char tag[32];
+
+  DECLARE_HASHTABLE(blocks, 12);
+  int num_blocks;
+
+  /* debug menu state */
+  int show_menu;
+  int sort;
+};
+
+struct jit_profile *jit_profile_create(const char *tag);
+void jit_profile_destroy(struct jit_profile *profile);
+
+struct jit_profile_entry *jit_profile_find(struct jit_profile *profile,
+                                           uint32_t guest_addr);
+struct jit_profile_entry *jit_profile_get(struct jit_profile *profile,
+                                          uint32_t guest_addr, int guest_size);
+void jit_profile_reset(struct jit_profile *profile);
+
+int jit_profile_sorted(struct jit_profile *profile, int sort,
+                       struct jit_profile_entry ***blocks);
+int jit_profile_write_csv(struct jit_profile *profile, int sort,
+                          const char *filename);
+
+#ifdef HAVE_IMGUI
+void jit_profile_debug_menu(struct jit_profile *profile);
+#endif
+
+#endif
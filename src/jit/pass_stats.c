@@ -2,6 +2,7 @@
 #include "core/core.h"
 
 static struct list stats;
+static struct list timers;
 
 void pass_stats_register(struct pass_stat *stat) {
   list_add(&stats, &stat->it);
@@ -11,6 +12,14 @@ void pass_stats_unregister(struct pass_stat *stat) {
   list_remove(&stats, &stat->it);
 }
 
+void pass_stats_register_timer(struct pass_timer *timer) {
+  list_add(&timers, &timer->it);
+}
+
+void pass_stats_unregister_timer(struct pass_timer *timer) {
+  list_remove(&timers, &timer->it);
+}
+
 void pass_stats_dump() {
   LOG_INFO("===-----------------------------------------------------===");
   LOG_INFO("pass stats");
@@ -27,4 +36,25 @@ void pass_stats_dump() {
   }
 
   LOG_INFO("");
+
+  LOG_INFO("===-----------------------------------------------------===");
+  LOG_INFO("pass timings");
+  LOG_INFO("===-----------------------------------------------------===");
+
+  w = 0;
+  list_for_each_entry(timer, &timers, struct pass_timer, it) {
+    int l = (int)strlen(timer->name);
+    w = MAX(l, w);
+  }
+
+  list_for_each_entry(timer, &timers, struct pass_timer, it) {
+    if (!timer->runs) {
+      continue;
+    }
+
+    LOG_INFO("%-*s  %8d runs  %12" PRId64 " ns  %8" PRId64 " ns / run", w,
+             timer->name, timer->runs, timer->ns, timer->ns / timer->runs);
+  }
+
+  LOG_INFO("");
 }
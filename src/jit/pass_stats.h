@@ -1,6 +1,10 @@
 #ifndef PASS_STATS_H
 #define PASS_STATS_H
 
+#include <stdint.h>
+#if COMPILER_MSVC
+#include <intrin.h>
+#endif
 #include "core/constructor.h"
 #include "core/list.h"
 
@@ -14,6 +18,16 @@
     pass_stats_unregister(&STAT_T_##name);                                  \
   }
 
+/* passes also run on the background compilation thread, stats must be
+   incremented atomically */
+static inline void pass_stat_inc(int *n) {
+#if COMPILER_MSVC
+  _InterlockedIncrement((volatile long *)n);
+#else
+  __atomic_fetch_add(n, 1, __ATOMIC_RELAXED);
+#endif
+}
+
 struct pass_stat {
   const char *name;
   const char *desc;
@@ -21,8 +35,18 @@ struct pass_stat {
   struct list_node it;
 };
 
+/* total time spent running each pass */
+struct pass_timer {
+  const char *name;
+  int64_t ns;
+  int runs;
+  struct list_node it;
+};
+
 void pass_stats_register(struct pass_stat *stat);
 void pass_stats_unregister(struct pass_stat *stat);
+void pass_stats_register_timer(struct pass_timer *timer);
+void pass_stats_unregister_timer(struct pass_timer *timer);
 void pass_stats_dump();
 
 #endif
@@ -0,0 +1,246 @@
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "core/core.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/*
+ * local common subexpression elimination
+ *
+ * pure instructions are hashed by their op, result type and arguments. when
+ * an instruction is found to compute the same value as an earlier instruction
+ * in the same block, its uses are replaced with the earlier result
+ *
+ * the pass is block-local. the register allocator works on a block at a time
+ * and doesn't support values which are live across blocks, so reusing a value
+ * defined in a dominating block isn't possible. superblock formation merges
+ * straight-line blocks, widening the scope of the pass
+ */
+
+DEFINE_PASS_STAT(cse_removed, "redundant instructions eliminated");
+
+#define CSE_HASH_BITS 10
+
+struct cse_entry {
+  struct ir_instr *instr;
+  uint64_t hash;
+  struct list_node it;
+};
+
+struct cse {
+  DECLARE_HASHTABLE(values, CSE_HASH_BITS);
+
+  /* entries are allocated in a stack, which is popped once each block has been
+     fully processed */
+  struct cse_entry *entries;
+  int num_entries;
+  int max_entries;
+};
+
+static int cse_is_pure(const struct ir_instr *instr) {
+  if (!instr->result) {
+    return 0;
+  }
+
+  switch (instr->op) {
+    case OP_FTOI:
+    case OP_ITOF:
+    case OP_TRUNC:
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_FTRUNC:
+    case OP_FEXT:
+    case OP_SELECT:
+    case OP_CMP:
+    case OP_FCMP:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_DIV:
+    case OP_NEG:
+    case OP_ABS:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+    case OP_FNEG:
+    case OP_FABS:
+    case OP_SQRT:
+    case OP_VBROADCAST:
+    case OP_VSPLAT:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_VMADD:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+    case OP_ASHD:
+    case OP_LSHD:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static uint64_t cse_constant_bits(const struct ir_value *v) {
+  switch (v->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+    case VALUE_I64:
+      return ir_zext_constant(v);
+    case VALUE_F32:
+      return (uint32_t)v->i32;
+    case VALUE_F64:
+      return (uint64_t)v->i64;
+    case VALUE_BLOCK:
+      return (uint64_t)(uintptr_t)v->blk;
+    default:
+      LOG_FATAL("unexpected constant type");
+  }
+}
+
+static int cse_same_value(const struct ir_value *a, const struct ir_value *b) {
+  if (a == b) {
+    return 1;
+  }
+
+  if (!a || !b) {
+    return 0;
+  }
+
+  /* constants are allocated for each use, compare them by value */
+  if (!ir_is_constant(a) || !ir_is_constant(b)) {
+    return 0;
+  }
+
+  return a->type == b->type && cse_constant_bits(a) == cse_constant_bits(b);
+}
+
+static uint64_t cse_hash_value(const struct ir_value *v) {
+  if (!v) {
+    return 0;
+  }
+
+  if (ir_is_constant(v)) {
+    return cse_constant_bits(v) ^ ((uint64_t)v->type << 56);
+  }
+
+  return (uint64_t)(uintptr_t)v;
+}
+
+static uint64_t cse_hash_instr(const struct ir_instr *instr) {
+  uint64_t hash = ((uint64_t)instr->op << 8) | instr->result->type;
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    hash = (hash * 31) ^ cse_hash_value(instr->arg[i]);
+  }
+
+  return hash;
+}
+
+static int cse_same_instr(const struct ir_instr *a, const struct ir_instr *b) {
+  if (a->op != b->op || a->result->type != b->result->type) {
+    return 0;
+  }
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (!cse_same_value(a->arg[i], b->arg[i])) {
+      return 0;
+    }
+  }
+
+  return 1;
+}
+
+static struct ir_instr *cse_find(struct cse *cse, struct ir_instr *instr,
+                                 uint64_t hash) {
+  struct list *bkt = hash_bkt(cse->values, hash);
+
+  hash_bkt_for_each_entry(entry, bkt, struct cse_entry, it) {
+    if (entry->hash == hash && cse_same_instr(entry->instr, instr)) {
+      return entry->instr;
+    }
+  }
+
+  return NULL;
+}
+
+static void cse_push(struct cse *cse, struct ir_instr *instr, uint64_t hash) {
+  CHECK_LT(cse->num_entries, cse->max_entries);
+
+  struct cse_entry *entry = &cse->entries[cse->num_entries++];
+  entry->instr = instr;
+  entry->hash = hash;
+  hash_add(hash_bkt(cse->values, hash), &entry->it);
+}
+
+static void cse_pop(struct cse *cse, int num_entries) {
+  while (cse->num_entries > num_entries) {
+    struct cse_entry *entry = &cse->entries[--cse->num_entries];
+    hash_del(hash_bkt(cse->values, entry->hash), &entry->it);
+  }
+}
+
+static void cse_reserve(struct cse *cse, struct ir *ir) {
+  int num_instrs = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      num_instrs++;
+    }
+  }
+
+  if (num_instrs > cse->max_entries) {
+    cse->max_entries = num_instrs;
+    cse->entries =
+        realloc(cse->entries, cse->max_entries * sizeof(struct cse_entry));
+  }
+}
+
+static void cse_run_block(struct cse *cse, struct ir *ir,
+                          struct ir_block *block) {
+  list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
+    if (!cse_is_pure(instr)) {
+      continue;
+    }
+
+    uint64_t hash = cse_hash_instr(instr);
+    struct ir_instr *existing = cse_find(cse, instr, hash);
+
+    if (existing) {
+      ir_replace_uses(instr->result, existing->result);
+      ir_remove_instr(ir, instr);
+
+      pass_stat_inc(&STAT_cse_removed);
+      continue;
+    }
+
+    cse_push(cse, instr, hash);
+  }
+
+  cse_pop(cse, 0);
+}
+
+void cse_run(struct cse *cse, struct ir *ir) {
+  cse_reserve(cse, ir);
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    cse_run_block(cse, ir, block);
+  }
+}
+
+void cse_destroy(struct cse *cse) {
+  free(cse->entries);
+  free(cse);
+}
+
+struct cse *cse_create() {
+  struct cse *cse = calloc(1, sizeof(struct cse));
+  return cse;
+}
@@ -0,0 +1,111 @@
+#include "jit/passes/compare_fusion_pass.h"
+#include "core/core.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/*
+ * compare fusion
+ *
+ * guest code commonly computes a condition into a flag (e.g. the sh4's t bit)
+ * and then branches or selects on it. in the ir this becomes a compare whose
+ * i8 result is zero extended, stored to the context and used as the condition
+ * for a branch_cond / select
+ *
+ * the backends are able to fuse a compare with a branch_cond or select which
+ * immediately follows it, emitting the compare's flags directly into a
+ * conditional jump or move, as long as the compare has no other users. this
+ * pass establishes that form by giving each branch_cond / select its own copy
+ * of the compare feeding it, placed directly before it. the original compare
+ * is left for any other users, and is removed by dead code elimination if the
+ * flag store it fed was eliminated
+ *
+ * this must run after value numbering, which would otherwise merge the copies
+ * back together
+ */
+
+DEFINE_PASS_STAT(compares_fused, "compares fused with their user");
+
+static struct ir_instr *cfuse_get_compare(struct ir_value *cond) {
+  if (ir_is_constant(cond)) {
+    return NULL;
+  }
+
+  struct ir_instr *def = cond->def;
+
+  /* look through the extension used when storing the flag */
+  if (def->op == OP_ZEXT && !ir_is_constant(def->arg[0])) {
+    def = def->arg[0]->def;
+  }
+
+  if (def->op != OP_CMP && def->op != OP_FCMP) {
+    return NULL;
+  }
+
+  return def;
+}
+
+static int cfuse_is_fused(struct ir_instr *cmp, struct ir_instr *user) {
+  /* the compare immediately precedes its only user */
+  struct ir_value *result = cmp->result;
+
+  return user->arg[2] == result &&
+         list_prev_entry(user, struct ir_instr, it) == cmp &&
+         list_first_entry(&result->uses, struct ir_use, it) ==
+             list_last_entry(&result->uses, struct ir_use, it);
+}
+
+static void cfuse_run_block(struct cfuse *cfuse, struct ir *ir,
+                            struct ir_block *block) {
+  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+    if (instr->op != OP_BRANCH_COND && instr->op != OP_SELECT) {
+      continue;
+    }
+
+    struct ir_instr *cmp = cfuse_get_compare(instr->arg[2]);
+
+    if (!cmp || cfuse_is_fused(cmp, instr)) {
+      continue;
+    }
+
+    /* the unordered case for fcmp eq / ne can't be expressed with a single
+       conditional move */
+    enum ir_cmp type = (enum ir_cmp)cmp->arg[2]->i32;
+
+    if (instr->op == OP_SELECT && cmp->op == OP_FCMP &&
+        (type == CMP_EQ || type == CMP_NE)) {
+      continue;
+    }
+
+    /* copy the compare directly before its user. note, the arguments are
+       always defined before the original compare, so the copy is valid
+       anywhere after it */
+    struct ir_instr *prev = list_prev_entry(instr, struct ir_instr, it);
+    CHECK_NOTNULL(prev);
+    ir_set_current_instr(ir, prev);
+
+    struct ir_instr *copy = ir_append_instr(ir, cmp->op, VALUE_I8);
+    ir_set_arg0(ir, copy, cmp->arg[0]);
+    ir_set_arg1(ir, copy, cmp->arg[1]);
+    ir_set_arg2(ir, copy, cmp->arg[2]);
+
+    ir_set_arg2(ir, instr, copy->result);
+
+    pass_stat_inc(&STAT_compares_fused);
+  }
+}
+
+void cfuse_run(struct cfuse *cfuse, struct ir *ir) {
+  struct ir_insert_point original = ir_get_insert_point(ir);
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    cfuse_run_block(cfuse, ir, block);
+  }
+
+  ir_set_insert_point(ir, &original);
+}
+
+void cfuse_destroy(struct cfuse *cfuse) {}
+
+struct cfuse *cfuse_create() {
+  return NULL;
+}
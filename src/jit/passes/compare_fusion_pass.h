@@ -0,0 +1,11 @@
+#ifndef COMPARE_FUSION_PASS_H
+#define COMPARE_FUSION_PASS_H
+
+struct cfuse;
+struct ir;
+
+struct cfuse *cfuse_create();
+void cfuse_destroy(struct cfuse *cfuse);
+void cfuse_run(struct cfuse *cfuse, struct ir *ir);
+
+#endif
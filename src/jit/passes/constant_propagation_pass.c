@@ -1,3 +1,4 @@
+#include <math.h>
 #include "jit/passes/constant_propagation_pass.h"
 #include "jit/ir/ir.h"
 #include "jit/pass_stats.h"
@@ -5,96 +6,486 @@
 DEFINE_PASS_STAT(constants_folded, "const operations folded");
 DEFINE_PASS_STAT(could_optimize_binary_op, "const binary operations possible");
 DEFINE_PASS_STAT(could_optimize_unary_op, "const unary operations possible");
+DEFINE_PASS_STAT(branches_folded, "const branches folded");
+DEFINE_PASS_STAT(blocks_removed, "dead blocks removed");
 
-static void cprop_run_block(struct cprop *cprop, struct ir *ir,
-                            struct ir_block *block) {
-  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-    struct ir_value *arg0 = instr->arg[0];
-    struct ir_value *arg1 = instr->arg[1];
-    struct ir_value *result = instr->result;
-
-    /* fold constant binary ops */
-    if (arg0 && ir_is_constant(arg0) && ir_is_int(arg0->type) && arg1 &&
-        ir_is_constant(arg1) && ir_is_int(arg1->type) && result) {
-      uint64_t lhs = ir_zext_constant(arg0);
-      uint64_t rhs = ir_zext_constant(arg1);
-
-      struct ir_value *folded = NULL;
-      switch (instr->op) {
-        case OP_ADD:
-          folded = ir_alloc_int(ir, lhs + rhs, result->type);
+/* each fold must produce the exact same result as the x64 emitter for the op,
+   including for nans, out of range conversions and oversized shifts */
+
+static int64_t cprop_sext_constant(const struct ir_value *v) {
+  switch (v->type) {
+    case VALUE_I8:
+      return v->i8;
+    case VALUE_I16:
+      return v->i16;
+    case VALUE_I32:
+      return v->i32;
+    case VALUE_I64:
+      return v->i64;
+    default:
+      LOG_FATAL("unexpected value type");
+      break;
+  }
+}
+
+static int cprop_shift_mask(enum ir_type type) {
+  /* x64 masks the shift count to 5 bits, or to 6 bits for 64-bit operands */
+  return type == VALUE_I64 ? 0x3f : 0x1f;
+}
+
+static struct ir_value *cprop_alloc_f32_bits(struct ir *ir, uint32_t bits) {
+  struct ir_value *v = ir_alloc_f32(ir, 0.0f);
+  v->i32 = (int32_t)bits;
+  return v;
+}
+
+static struct ir_value *cprop_alloc_f64_bits(struct ir *ir, uint64_t bits) {
+  struct ir_value *v = ir_alloc_f64(ir, 0.0);
+  v->i64 = (int64_t)bits;
+  return v;
+}
+
+static struct ir_value *cprop_fold_int(struct ir *ir, struct ir_instr *instr) {
+  struct ir_value *arg0 = instr->arg[0];
+  struct ir_value *arg1 = instr->arg[1];
+  struct ir_value *result = instr->result;
+
+  switch (instr->op) {
+    case OP_SEXT:
+      return ir_alloc_int(ir, cprop_sext_constant(arg0), result->type);
+    case OP_ZEXT:
+    case OP_TRUNC:
+      return ir_alloc_int(ir, ir_zext_constant(arg0), result->type);
+    case OP_ITOF:
+      if (result->type == VALUE_F32) {
+        return ir_alloc_f32(ir, (float)arg0->i32);
+      }
+      return ir_alloc_f64(ir, (double)arg0->i64);
+    case OP_NEG:
+      return ir_alloc_int(ir, 0 - ir_zext_constant(arg0), result->type);
+    case OP_NOT:
+      return ir_alloc_int(ir, ~ir_zext_constant(arg0), result->type);
+    case OP_ABS: {
+      int64_t v = cprop_sext_constant(arg0);
+      return ir_alloc_int(ir, v < 0 ? 0 - (uint64_t)v : (uint64_t)v,
+                          result->type);
+    }
+    default:
+      break;
+  }
+
+  if (!arg1) {
+    return NULL;
+  }
+
+  uint64_t lhs = ir_zext_constant(arg0);
+  uint64_t rhs = ir_zext_constant(arg1);
+  int64_t slhs = cprop_sext_constant(arg0);
+  int shift = (int)(rhs & cprop_shift_mask(arg0->type));
+
+  switch (instr->op) {
+    case OP_ADD:
+      return ir_alloc_int(ir, lhs + rhs, result->type);
+    case OP_SUB:
+      return ir_alloc_int(ir, lhs - rhs, result->type);
+    case OP_SMUL:
+    case OP_UMUL:
+      return ir_alloc_int(ir, lhs * rhs, result->type);
+    case OP_DIV:
+      if (!rhs) {
+        return NULL;
+      }
+      return ir_alloc_int(ir, lhs / rhs, result->type);
+    case OP_AND:
+      return ir_alloc_int(ir, lhs & rhs, result->type);
+    case OP_OR:
+      return ir_alloc_int(ir, lhs | rhs, result->type);
+    case OP_XOR:
+      return ir_alloc_int(ir, lhs ^ rhs, result->type);
+    case OP_SHL:
+      return ir_alloc_int(ir, lhs << shift, result->type);
+    case OP_ASHR:
+      return ir_alloc_int(ir, (uint64_t)(slhs >> shift), result->type);
+    case OP_LSHR:
+      return ir_alloc_int(ir, lhs >> shift, result->type);
+    case OP_ASHD:
+    case OP_LSHD: {
+      /* shift left for positive counts, right for negative counts. a negative
+         count with no bits set in the lower 5 shifts out every bit */
+      uint32_t n = (uint32_t)rhs;
+      uint32_t v = (uint32_t)lhs;
+
+      if (!(n & 0x80000000)) {
+        return ir_alloc_int(ir, v << (n & 0x1f), result->type);
+      }
+
+      if (!(n & 0x1f)) {
+        v = instr->op == OP_ASHD ? (uint32_t)((int32_t)v >> 31) : 0;
+        return ir_alloc_int(ir, v, result->type);
+      }
+
+      n = (0 - n) & 0x1f;
+      if (instr->op == OP_ASHD) {
+        return ir_alloc_int(ir, (uint32_t)((int32_t)v >> n), result->type);
+      }
+      return ir_alloc_int(ir, v >> n, result->type);
+    }
+    case OP_CMP: {
+      uint64_t ulhs = lhs;
+      uint64_t urhs = rhs;
+      int64_t srhs = cprop_sext_constant(arg1);
+      int r = 0;
+
+      switch ((enum ir_cmp)instr->arg[2]->i32) {
+        case CMP_EQ:
+          r = ulhs == urhs;
+          break;
+        case CMP_NE:
+          r = ulhs != urhs;
           break;
-        case OP_AND:
-          folded = ir_alloc_int(ir, lhs & rhs, result->type);
+        case CMP_SGE:
+          r = slhs >= srhs;
           break;
-        case OP_DIV:
-          folded = ir_alloc_int(ir, lhs / rhs, result->type);
+        case CMP_SGT:
+          r = slhs > srhs;
           break;
-        case OP_LSHR:
-          folded = ir_alloc_int(ir, lhs >> rhs, result->type);
+        case CMP_UGE:
+          r = ulhs >= urhs;
           break;
-        case OP_OR:
-          folded = ir_alloc_int(ir, lhs | rhs, result->type);
+        case CMP_UGT:
+          r = ulhs > urhs;
           break;
-        case OP_SHL:
-          folded = ir_alloc_int(ir, lhs << rhs, result->type);
+        case CMP_SLE:
+          r = slhs <= srhs;
           break;
-        case OP_SUB:
-          folded = ir_alloc_int(ir, lhs - rhs, result->type);
+        case CMP_SLT:
+          r = slhs < srhs;
           break;
-        case OP_UMUL:
-          folded = ir_alloc_int(ir, lhs * rhs, result->type);
+        case CMP_ULE:
+          r = ulhs <= urhs;
           break;
-        case OP_XOR:
-          folded = ir_alloc_int(ir, lhs ^ rhs, result->type);
+        case CMP_ULT:
+          r = ulhs < urhs;
           break;
         default:
-          STAT_could_optimize_binary_op++;
-          continue;
+          LOG_FATAL("unexpected comparison type");
       }
 
-      if (folded) {
-        ir_replace_uses(result, folded);
-        STAT_constants_folded++;
-      }
+      return ir_alloc_int(ir, r, result->type);
     }
-    /* fold constant unary ops */
-    else if (arg0 && !arg1 && ir_is_constant(arg0) && ir_is_int(arg0->type) &&
-             result) {
-      uint64_t arg = ir_zext_constant(arg0);
-
-      struct ir_value *folded = NULL;
-      switch (instr->op) {
-        case OP_NEG:
-          folded = ir_alloc_int(ir, 0 - arg, result->type);
-          break;
-        case OP_NOT:
-          folded = ir_alloc_int(ir, ~arg, result->type);
-          break;
-        /* filter the load instructions out of the "could optimize" stats */
-        case OP_LOAD_HOST:
-        case OP_LOAD_GUEST:
-        case OP_LOAD_FAST:
-        case OP_LOAD_CONTEXT:
-        case OP_LOAD_LOCAL:
-          break;
-        default:
-          STAT_could_optimize_unary_op++;
-          continue;
+    default:
+      return NULL;
+  }
+}
+
+static struct ir_value *cprop_fold_f32(struct ir *ir, struct ir_instr *instr) {
+  struct ir_value *arg0 = instr->arg[0];
+  struct ir_value *arg1 = instr->arg[1];
+  float lhs = arg0->f32;
+  float rhs = arg1 ? arg1->f32 : 0.0f;
+  uint32_t bits = (uint32_t)arg0->i32;
+
+  switch (instr->op) {
+    case OP_FADD:
+      return ir_alloc_f32(ir, lhs + rhs);
+    case OP_FSUB:
+      return ir_alloc_f32(ir, lhs - rhs);
+    case OP_FMUL:
+      return ir_alloc_f32(ir, lhs * rhs);
+    case OP_FDIV:
+      return ir_alloc_f32(ir, lhs / rhs);
+    case OP_FNEG:
+      return cprop_alloc_f32_bits(ir, bits ^ 0x80000000);
+    case OP_FABS:
+      return cprop_alloc_f32_bits(ir, bits & 0x7fffffff);
+    case OP_SQRT:
+      return ir_alloc_f32(ir, sqrtf(lhs));
+    case OP_FEXT:
+      return ir_alloc_f64(ir, (double)lhs);
+    default:
+      return NULL;
+  }
+}
+
+static struct ir_value *cprop_fold_f64(struct ir *ir, struct ir_instr *instr) {
+  struct ir_value *arg0 = instr->arg[0];
+  struct ir_value *arg1 = instr->arg[1];
+  double lhs = arg0->f64;
+  double rhs = arg1 ? arg1->f64 : 0.0;
+  uint64_t bits = (uint64_t)arg0->i64;
+
+  switch (instr->op) {
+    case OP_FADD:
+      return ir_alloc_f64(ir, lhs + rhs);
+    case OP_FSUB:
+      return ir_alloc_f64(ir, lhs - rhs);
+    case OP_FMUL:
+      return ir_alloc_f64(ir, lhs * rhs);
+    case OP_FDIV:
+      return ir_alloc_f64(ir, lhs / rhs);
+    case OP_FNEG:
+      return cprop_alloc_f64_bits(ir, bits ^ UINT64_C(0x8000000000000000));
+    case OP_FABS:
+      return cprop_alloc_f64_bits(ir, bits & UINT64_C(0x7fffffffffffffff));
+    case OP_SQRT:
+      return ir_alloc_f64(ir, sqrt(lhs));
+    case OP_FTRUNC:
+      return ir_alloc_f32(ir, (float)lhs);
+    default:
+      return NULL;
+  }
+}
+
+static struct ir_value *cprop_fold_float(struct ir *ir,
+                                         struct ir_instr *instr) {
+  struct ir_value *arg0 = instr->arg[0];
+  struct ir_value *result = instr->result;
+
+  if (instr->op == OP_FTOI) {
+    /* out of range values saturate, nans convert to INT32_MIN */
+    double v = arg0->type == VALUE_F32 ? (double)arg0->f32 : arg0->f64;
+    int32_t r;
+
+    if (isnan(v) || v <= (double)INT32_MIN) {
+      r = INT32_MIN;
+    } else if (v >= (double)INT32_MAX) {
+      r = INT32_MAX;
+    } else {
+      r = (int32_t)v;
+    }
+
+    return ir_alloc_int(ir, r, result->type);
+  }
+
+  if (instr->op == OP_FCMP) {
+    double lhs = arg0->type == VALUE_F32 ? (double)arg0->f32 : arg0->f64;
+    double rhs = instr->arg[1]->type == VALUE_F32 ? (double)instr->arg[1]->f32
+                                                   : instr->arg[1]->f64;
+    int unordered = isnan(lhs) || isnan(rhs);
+    int r = 0;
+
+    /* unordered comparisons follow the flags set by ucomiss */
+    switch ((enum ir_cmp)instr->arg[2]->i32) {
+      case CMP_EQ:
+        r = !unordered && lhs == rhs;
+        break;
+      case CMP_NE:
+        r = unordered || lhs != rhs;
+        break;
+      case CMP_SGE:
+        r = !unordered && lhs >= rhs;
+        break;
+      case CMP_SGT:
+        r = !unordered && lhs > rhs;
+        break;
+      case CMP_SLE:
+        r = unordered || lhs <= rhs;
+        break;
+      case CMP_SLT:
+        r = unordered || lhs < rhs;
+        break;
+      default:
+        LOG_FATAL("unexpected comparison type");
+    }
+
+    return ir_alloc_int(ir, r, result->type);
+  }
+
+  if (arg0->type == VALUE_F32) {
+    return cprop_fold_f32(ir, instr);
+  }
+
+  return cprop_fold_f64(ir, instr);
+}
+
+static struct ir_value *cprop_fold(struct ir *ir, struct ir_instr *instr) {
+  struct ir_value *arg0 = instr->arg[0];
+  struct ir_value *result = instr->result;
+
+  if (!result || !arg0) {
+    return NULL;
+  }
+
+  /* a select with a constant condition doesn't need constant operands */
+  if (instr->op == OP_SELECT) {
+    struct ir_value *cond = instr->arg[2];
+
+    if (!ir_is_constant(cond)) {
+      return NULL;
+    }
+
+    return ir_zext_constant(cond) ? instr->arg[0] : instr->arg[1];
+  }
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    if (instr->arg[i] && !ir_is_constant(instr->arg[i])) {
+      return NULL;
+    }
+  }
+
+  switch (instr->op) {
+    /* loads with constant addresses aren't foldable */
+    case OP_LOAD_HOST:
+    case OP_LOAD_GUEST:
+    case OP_LOAD_FAST:
+    case OP_LOAD_CONTEXT:
+    case OP_LOAD_LOCAL:
+      return NULL;
+    /* there are no vector constants to fold to */
+    case OP_VBROADCAST:
+    case OP_VSPLAT:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_VMADD:
+      if (instr->arg[1]) {
+        pass_stat_inc(&STAT_could_optimize_binary_op);
+      } else {
+        pass_stat_inc(&STAT_could_optimize_unary_op);
       }
+      return NULL;
+    default:
+      break;
+  }
 
-      if (folded) {
-        ir_replace_uses(result, folded);
-        STAT_constants_folded++;
+  if (ir_is_int(arg0->type)) {
+    return cprop_fold_int(ir, instr);
+  }
+
+  if (ir_is_float(arg0->type)) {
+    return cprop_fold_float(ir, instr);
+  }
+
+  return NULL;
+}
+
+static void cprop_run_block(struct cprop *cprop, struct ir *ir,
+                            struct ir_block *block) {
+  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+    struct ir_value *folded = cprop_fold(ir, instr);
+
+    if (folded && folded != instr->result) {
+      ir_replace_uses(instr->result, folded);
+      pass_stat_inc(&STAT_constants_folded);
+    }
+  }
+}
+
+static int cprop_num_refs(struct ir *ir, struct ir_block *target) {
+  int refs = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    struct ir_instr *term =
+        list_last_entry(&block->instrs, struct ir_instr, it);
+
+    if (!term || (term->op != OP_BRANCH && term->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *arg = term->arg[i];
+      refs += arg && arg->type == VALUE_BLOCK && arg->blk == target;
+    }
+  }
+
+  return refs;
+}
+
+static int cprop_has_block(struct ir *ir, struct ir_block *target) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    if (block == target) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void cprop_remove_dead_block(struct cprop *cprop, struct ir *ir,
+                                    struct ir_block *block) {
+  struct ir_block *head = list_first_entry(&ir->blocks, struct ir_block, it);
+
+  /* the block may have already been removed while removing one of its
+     predecessors' other successors */
+  if (block == head || !cprop_has_block(ir, block) ||
+      cprop_num_refs(ir, block)) {
+    return;
+  }
+
+  /* grab the successors before the terminator is removed */
+  struct ir_block *succs[2] = {0};
+  struct ir_instr *term = list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (term && (term->op == OP_BRANCH || term->op == OP_BRANCH_COND)) {
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *arg = term->arg[i];
+
+      if (arg && arg->type == VALUE_BLOCK && arg->blk != block) {
+        succs[i] = arg->blk;
       }
     }
   }
+
+  ir_remove_block(ir, block);
+  pass_stat_inc(&STAT_blocks_removed);
+
+  /* successors may have only been reachable through this block */
+  for (int i = 0; i < 2; i++) {
+    if (succs[i] && (!i || succs[i] != succs[0])) {
+      cprop_remove_dead_block(cprop, ir, succs[i]);
+    }
+  }
+}
+
+static int cprop_fold_branch(struct cprop *cprop, struct ir *ir,
+                             struct ir_block *block) {
+  struct ir_instr *term = list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (!term || term->op != OP_BRANCH_COND || !ir_is_constant(term->arg[2])) {
+    return 0;
+  }
+
+  int taken = ir_zext_constant(term->arg[2]) ? 0 : 1;
+  struct ir_value *dst = term->arg[taken];
+  struct ir_value *dead = term->arg[taken ^ 1];
+
+  /* rewrite as an unconditional branch to the taken target */
+  term->op = OP_BRANCH;
+  ir_set_arg0(ir, term, dst);
+  ir_set_arg1(ir, term, NULL);
+  ir_set_arg2(ir, term, NULL);
+
+  pass_stat_inc(&STAT_branches_folded);
+
+  if (dead->type == VALUE_BLOCK &&
+      (dst->type != VALUE_BLOCK || dst->blk != dead->blk)) {
+    ir_remove_edge(ir, block, dead->blk);
+    cprop_remove_dead_block(cprop, ir, dead->blk);
+  }
+
+  return 1;
 }
 
 void cprop_run(struct cprop *cprop, struct ir *ir) {
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     cprop_run_block(cprop, ir, block);
   }
+
+  /* fold conditional branches on constants, removing the blocks that become
+     unreachable. the scan restarts after each fold, as any of the remaining
+     blocks may have been removed */
+  int changed = 1;
+
+  while (changed) {
+    changed = 0;
+
+    list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+      if (cprop_fold_branch(cprop, ir, block)) {
+        changed = 1;
+        break;
+      }
+    }
+  }
 }
 
 void cprop_destroy(struct cprop *cprop) {}
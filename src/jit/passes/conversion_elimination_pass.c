@@ -42,11 +42,11 @@ static void cve_run_block(struct ir *ir, struct ir_block *block) {
       if (same_type && all_sext) {
         /* TODO implement */
 
-        STAT_sext_removed++;
+        pass_stat_inc(&STAT_sext_removed);
       } else if (same_type && all_zext) {
         /* TODO implement */
 
-        STAT_zext_removed++;
+        pass_stat_inc(&STAT_zext_removed);
       }
     } else if (instr->op == OP_STORE_HOST || instr->op == OP_STORE_GUEST ||
                instr->op == OP_STORE_FAST || instr->op == OP_STORE_CONTEXT) {
@@ -57,7 +57,7 @@ static void cve_run_block(struct ir *ir, struct ir_block *block) {
 
         /* note, don't actually remove the truncation as other values may
            reference it. let DCE clean it up */
-        STAT_trunc_removed++;
+        pass_stat_inc(&STAT_trunc_removed);
       }
     }
   }
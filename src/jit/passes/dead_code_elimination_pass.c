@@ -18,7 +18,7 @@ static void dce_run_block(struct dce *dce, struct ir *ir,
     if (list_empty(&result->uses)) {
       ir_remove_instr(ir, instr);
 
-      STAT_dead_removed++;
+      pass_stat_inc(&STAT_dead_removed);
     }
   }
 }
@@ -6,62 +6,695 @@ DEFINE_PASS_STAT(bitwise_identities_removed, "bitwise identities removed");
 DEFINE_PASS_STAT(zero_properties_removed, "zero properties removed");
 DEFINE_PASS_STAT(zero_identities_removed, "zero identities removed");
 DEFINE_PASS_STAT(one_identities_removed, "one identities removed");
+DEFINE_PASS_STAT(constants_reassociated, "constant chains reassociated");
+DEFINE_PASS_STAT(shifts_fused, "shifts and masks fused");
+DEFINE_PASS_STAT(strength_reduced, "multiplies / divides strength reduced");
+DEFINE_PASS_STAT(extensions_removed, "extensions simplified");
+DEFINE_PASS_STAT(negations_removed, "negations simplified");
+DEFINE_PASS_STAT(compares_removed, "compares of compares simplified");
+
+/*
+ * expression simplification
+ *
+ * each rule in the table below matches a single op and returns the value the
+ * instruction simplifies to, or NULL if the rule doesn't apply. rules may
+ * emit new instructions, which are inserted directly before the instruction
+ * being simplified. as instructions are visited in order, the new
+ * instructions feed into the rules for any later users, e.g. a chain of adds
+ * is collapsed one link at a time
+ *
+ * binary ops involving constants are expected to have the constant as the
+ * second argument, which the frontends and the rules themselves maintain
+ */
+
+typedef struct ir_value *(*esimp_rewrite_cb)(struct ir *, struct ir_instr *);
+
+struct esimp_rule {
+  enum ir_op op;
+  esimp_rewrite_cb rewrite;
+  int *stat;
+};
+
+static int esimp_type_bits(enum ir_type type) {
+  return ir_type_size(type) * 8;
+}
+
+static uint64_t esimp_type_mask(enum ir_type type) {
+  int bits = esimp_type_bits(type);
+  return bits == 64 ? ~UINT64_C(0) : (UINT64_C(1) << bits) - 1;
+}
+
+static int esimp_const(const struct ir_value *v, uint64_t *c) {
+  if (!v || !ir_is_constant(v) || !ir_is_int(v->type)) {
+    return 0;
+  }
+  *c = ir_zext_constant(v);
+  return 1;
+}
+
+static int esimp_pow2(uint64_t c) {
+  if (!c || (c & (c - 1))) {
+    return -1;
+  }
+  return ctz64(c);
+}
+
+/* returns the instruction defining v if it's the given op */
+static struct ir_instr *esimp_def(const struct ir_value *v, enum ir_op op) {
+  if (!v || ir_is_constant(v) || v->def->op != op) {
+    return NULL;
+  }
+  return v->def;
+}
+
+static void esimp_insert_before(struct ir *ir, struct ir_instr *instr) {
+  struct ir_instr *prev = list_prev_entry(instr, struct ir_instr, it);
+
+  if (prev) {
+    ir_set_current_instr(ir, prev);
+  } else {
+    ir_set_current_block(ir, instr->block);
+  }
+}
+
+static struct ir_value *esimp_binary(struct ir *ir, enum ir_op op,
+                                     struct ir_value *a, struct ir_value *b) {
+  switch (op) {
+    case OP_ADD:
+      return ir_add(ir, a, b);
+    case OP_SUB:
+      return ir_sub(ir, a, b);
+    case OP_SMUL:
+      return ir_smul(ir, a, b);
+    case OP_UMUL:
+      return ir_umul(ir, a, b);
+    case OP_AND:
+      return ir_and(ir, a, b);
+    case OP_OR:
+      return ir_or(ir, a, b);
+    case OP_XOR:
+      return ir_xor(ir, a, b);
+    case OP_SHL:
+      return ir_shl(ir, a, b);
+    case OP_ASHR:
+      return ir_ashr(ir, a, b);
+    case OP_LSHR:
+      return ir_lshr(ir, a, b);
+    default:
+      LOG_FATAL("unexpected op %s", ir_opdefs[op].name);
+  }
+}
+
+static struct ir_value *esimp_cmp(struct ir *ir, enum ir_op op,
+                                  struct ir_value *a, struct ir_value *b,
+                                  enum ir_cmp cmp) {
+  if (op == OP_FCMP) {
+    switch (cmp) {
+      case CMP_EQ:
+        return ir_fcmp_eq(ir, a, b);
+      case CMP_NE:
+        return ir_fcmp_ne(ir, a, b);
+      case CMP_SGE:
+        return ir_fcmp_ge(ir, a, b);
+      case CMP_SGT:
+        return ir_fcmp_gt(ir, a, b);
+      case CMP_SLE:
+        return ir_fcmp_le(ir, a, b);
+      case CMP_SLT:
+        return ir_fcmp_lt(ir, a, b);
+      default:
+        LOG_FATAL("unexpected comparison type");
+    }
+  }
+
+  switch (cmp) {
+    case CMP_EQ:
+      return ir_cmp_eq(ir, a, b);
+    case CMP_NE:
+      return ir_cmp_ne(ir, a, b);
+    case CMP_SGE:
+      return ir_cmp_sge(ir, a, b);
+    case CMP_SGT:
+      return ir_cmp_sgt(ir, a, b);
+    case CMP_UGE:
+      return ir_cmp_uge(ir, a, b);
+    case CMP_UGT:
+      return ir_cmp_ugt(ir, a, b);
+    case CMP_SLE:
+      return ir_cmp_sle(ir, a, b);
+    case CMP_SLT:
+      return ir_cmp_slt(ir, a, b);
+    case CMP_ULE:
+      return ir_cmp_ule(ir, a, b);
+    case CMP_ULT:
+      return ir_cmp_ult(ir, a, b);
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+static enum ir_cmp esimp_invert_cmp(enum ir_cmp cmp) {
+  /* note, these are exact inverses for fcmp as well, as the backend returns
+     true for unordered operands on exactly one of each pair */
+  switch (cmp) {
+    case CMP_EQ:
+      return CMP_NE;
+    case CMP_NE:
+      return CMP_EQ;
+    case CMP_SGE:
+      return CMP_SLT;
+    case CMP_SGT:
+      return CMP_SLE;
+    case CMP_UGE:
+      return CMP_ULT;
+    case CMP_UGT:
+      return CMP_ULE;
+    case CMP_SLE:
+      return CMP_SGT;
+    case CMP_SLT:
+      return CMP_SGE;
+    case CMP_ULE:
+      return CMP_UGT;
+    case CMP_ULT:
+      return CMP_UGE;
+    default:
+      LOG_FATAL("unexpected comparison type");
+  }
+}
+
+/*
+ * identities
+ */
+static struct ir_value *esimp_same_args(struct ir *ir, struct ir_instr *instr) {
+  /* simplify bitwise identities with identical inputs */
+  if (instr->arg[0] != instr->arg[1]) {
+    return NULL;
+  }
+
+  if (instr->op == OP_XOR) {
+    return ir_alloc_int(ir, 0, instr->result->type);
+  }
+
+  return instr->arg[0];
+}
+
+static struct ir_value *esimp_zero_property(struct ir *ir,
+                                            struct ir_instr *instr) {
+  /* simplify binary ops where an argument of 0 always results in 0 */
+  uint64_t rhs;
+
+  if (!esimp_const(instr->arg[1], &rhs) || rhs) {
+    return NULL;
+  }
+
+  return ir_alloc_int(ir, 0, instr->result->type);
+}
+
+static struct ir_value *esimp_zero_identity(struct ir *ir,
+                                            struct ir_instr *instr) {
+  /* simplify binary ops where 0 is an identity */
+  uint64_t rhs;
+
+  if (!esimp_const(instr->arg[1], &rhs) || rhs) {
+    return NULL;
+  }
+
+  return instr->arg[0];
+}
+
+static struct ir_value *esimp_one_identity(struct ir *ir,
+                                           struct ir_instr *instr) {
+  /* simplify binary ops where 1 is an identity */
+  uint64_t rhs;
+
+  if (!esimp_const(instr->arg[1], &rhs) || rhs != 1) {
+    return NULL;
+  }
+
+  return instr->arg[0];
+}
+
+static struct ir_value *esimp_and_mask(struct ir *ir, struct ir_instr *instr) {
+  /* and with every bit set is an identity */
+  uint64_t rhs;
+  enum ir_type type = instr->result->type;
+
+  if (!esimp_const(instr->arg[1], &rhs) || rhs != esimp_type_mask(type)) {
+    return NULL;
+  }
+
+  return instr->arg[0];
+}
+
+/*
+ * reassociation of constant chains
+ */
+static struct ir_value *esimp_reassociate(struct ir *ir,
+                                          struct ir_instr *instr) {
+  /* (x op c1) op c2 -> x op (c1 op c2) for associative ops */
+  struct ir_instr *inner = esimp_def(instr->arg[0], instr->op);
+  uint64_t c1, c2;
+
+  if (!inner || !esimp_const(inner->arg[1], &c1) ||
+      !esimp_const(instr->arg[1], &c2)) {
+    return NULL;
+  }
+
+  uint64_t c;
+  switch (instr->op) {
+    case OP_AND:
+      c = c1 & c2;
+      break;
+    case OP_OR:
+      c = c1 | c2;
+      break;
+    case OP_XOR:
+      c = c1 ^ c2;
+      break;
+    case OP_SMUL:
+    case OP_UMUL:
+      c = c1 * c2;
+      break;
+    default:
+      LOG_FATAL("unexpected op %s", ir_opdefs[instr->op].name);
+  }
+
+  enum ir_type type = instr->result->type;
+  esimp_insert_before(ir, instr);
+  return esimp_binary(ir, instr->op, inner->arg[0], ir_alloc_int(ir, c, type));
+}
+
+static struct ir_value *esimp_reassociate_add(struct ir *ir,
+                                              struct ir_instr *instr) {
+  /* (x +/- c1) +/- c2 -> x + c, treating subtraction as adding the negated
+     constant */
+  struct ir_instr *inner = esimp_def(instr->arg[0], OP_ADD);
+  if (!inner) {
+    inner = esimp_def(instr->arg[0], OP_SUB);
+  }
+
+  uint64_t c1, c2;
+
+  if (!inner || !esimp_const(inner->arg[1], &c1) ||
+      !esimp_const(instr->arg[1], &c2)) {
+    return NULL;
+  }
+
+  uint64_t c = (inner->op == OP_ADD ? c1 : 0 - c1) +
+               (instr->op == OP_ADD ? c2 : 0 - c2);
+
+  enum ir_type type = instr->result->type;
+  esimp_insert_before(ir, instr);
+  return ir_add(ir, inner->arg[0], ir_alloc_int(ir, c, type));
+}
+
+/*
+ * shift / mask fusion
+ */
+static struct ir_value *esimp_fuse_shifts(struct ir *ir,
+                                          struct ir_instr *instr) {
+  /* (x >> a) >> b -> x >> (a + b), (x << a) << b -> x << (a + b) */
+  struct ir_instr *inner = esimp_def(instr->arg[0], instr->op);
+  uint64_t a, b;
+
+  if (!inner || !esimp_const(inner->arg[1], &a) ||
+      !esimp_const(instr->arg[1], &b)) {
+    return NULL;
+  }
+
+  enum ir_type type = instr->result->type;
+  int bits = esimp_type_bits(type);
+
+  if (a >= (uint64_t)bits || b >= (uint64_t)bits) {
+    return NULL;
+  }
+
+  uint64_t n = a + b;
+
+  if (n >= (uint64_t)bits) {
+    /* every bit is shifted out, except for the sign of arithmetic shifts */
+    if (instr->op != OP_ASHR) {
+      return ir_alloc_int(ir, 0, type);
+    }
+    n = bits - 1;
+  }
+
+  esimp_insert_before(ir, instr);
+  return esimp_binary(ir, instr->op, inner->arg[0], ir_alloc_i32(ir, (int)n));
+}
+
+static struct ir_value *esimp_fuse_shift_pair(struct ir *ir,
+                                              struct ir_instr *instr) {
+  /* (x << a) >> b and (x >> a) << b both clear the bits shifted out by the
+     first shift, and shift the remaining bits by the difference */
+  enum ir_op inner_op = instr->op == OP_LSHR ? OP_SHL : OP_LSHR;
+  struct ir_instr *inner = esimp_def(instr->arg[0], inner_op);
+  uint64_t a, b;
+
+  if (!inner || !esimp_const(inner->arg[1], &a) ||
+      !esimp_const(instr->arg[1], &b)) {
+    return NULL;
+  }
+
+  enum ir_type type = instr->result->type;
+  int bits = esimp_type_bits(type);
+  uint64_t type_mask = esimp_type_mask(type);
+
+  if (a >= (uint64_t)bits || b >= (uint64_t)bits) {
+    return NULL;
+  }
+
+  uint64_t mask = inner_op == OP_SHL ? (type_mask >> a) : (type_mask << a);
+  mask &= type_mask;
+
+  esimp_insert_before(ir, instr);
+  struct ir_value *v =
+      ir_and(ir, inner->arg[0], ir_alloc_int(ir, mask, type));
+
+  /* the net shift is in the direction of the larger of the two */
+  if (inner_op == OP_SHL) {
+    if (a > b) {
+      v = ir_shli(ir, v, (int)(a - b));
+    } else if (b > a) {
+      v = ir_lshri(ir, v, (int)(b - a));
+    }
+  } else {
+    if (a > b) {
+      v = ir_lshri(ir, v, (int)(a - b));
+    } else if (b > a) {
+      v = ir_shli(ir, v, (int)(b - a));
+    }
+  }
+
+  return v;
+}
+
+static struct ir_value *esimp_fuse_shift_mask(struct ir *ir,
+                                              struct ir_instr *instr) {
+  /* (x >> a) & m -> 0 when the mask only covers bits shifted in as zero */
+  struct ir_instr *inner = esimp_def(instr->arg[0], OP_LSHR);
+  uint64_t a, m;
+
+  if (!inner || !esimp_const(inner->arg[1], &a) ||
+      !esimp_const(instr->arg[1], &m)) {
+    return NULL;
+  }
+
+  enum ir_type type = instr->result->type;
+
+  if (a >= (uint64_t)esimp_type_bits(type)) {
+    return NULL;
+  }
+
+  if (m & (esimp_type_mask(type) >> a)) {
+    return NULL;
+  }
+
+  return ir_alloc_int(ir, 0, type);
+}
+
+/*
+ * strength reduction
+ */
+static struct ir_value *esimp_mul_pow2(struct ir *ir, struct ir_instr *instr) {
+  /* x * 2^n -> x << n. the low bits are the same for signed and unsigned
+     multiplies */
+  uint64_t rhs;
+
+  if (!esimp_const(instr->arg[1], &rhs)) {
+    return NULL;
+  }
+
+  int n = esimp_pow2(rhs);
+
+  if (n <= 0) {
+    return NULL;
+  }
+
+  esimp_insert_before(ir, instr);
+  return ir_shli(ir, instr->arg[0], n);
+}
+
+static struct ir_value *esimp_div_pow2(struct ir *ir, struct ir_instr *instr) {
+  /* x / 2^n -> x >> n. division is unsigned, matching constant propagation */
+  uint64_t rhs;
+
+  if (!esimp_const(instr->arg[1], &rhs)) {
+    return NULL;
+  }
+
+  int n = esimp_pow2(rhs);
+
+  if (n <= 0) {
+    return NULL;
+  }
+
+  esimp_insert_before(ir, instr);
+  return ir_lshri(ir, instr->arg[0], n);
+}
+
+/*
+ * extensions
+ */
+static struct ir_value *esimp_ext_constant(struct ir *ir,
+                                           struct ir_instr *instr) {
+  uint64_t c;
+
+  if (!esimp_const(instr->arg[0], &c)) {
+    return NULL;
+  }
+
+  if (instr->op == OP_SEXT) {
+    int shift = 64 - esimp_type_bits(instr->arg[0]->type);
+    c = (uint64_t)((int64_t)(c << shift) >> shift);
+  }
+
+  return ir_alloc_int(ir, c, instr->result->type);
+}
+
+static struct ir_value *esimp_ext_ext(struct ir *ir, struct ir_instr *instr) {
+  /* zext(zext(x)) -> zext(x), sext(sext(x)) -> sext(x) */
+  struct ir_instr *inner = esimp_def(instr->arg[0], instr->op);
+
+  if (!inner) {
+    return NULL;
+  }
+
+  esimp_insert_before(ir, instr);
+
+  if (instr->op == OP_ZEXT) {
+    return ir_zext(ir, inner->arg[0], instr->result->type);
+  }
+
+  return ir_sext(ir, inner->arg[0], instr->result->type);
+}
+
+static struct ir_value *esimp_zext_trunc(struct ir *ir,
+                                         struct ir_instr *instr) {
+  /* zext(trunc(x)) -> x & mask, when x is the same type as the result */
+  struct ir_instr *inner = esimp_def(instr->arg[0], OP_TRUNC);
+  enum ir_type type = instr->result->type;
+
+  if (!inner || inner->arg[0]->type != type) {
+    return NULL;
+  }
+
+  uint64_t mask = esimp_type_mask(inner->result->type);
+
+  esimp_insert_before(ir, instr);
+  return ir_and(ir, inner->arg[0], ir_alloc_int(ir, mask, type));
+}
+
+/*
+ * negations
+ */
+static struct ir_value *esimp_double_negation(struct ir *ir,
+                                              struct ir_instr *instr) {
+  /* neg(neg(x)) -> x, not(not(x)) -> x, fneg(fneg(x)) -> x */
+  struct ir_instr *inner = esimp_def(instr->arg[0], instr->op);
+
+  if (!inner) {
+    return NULL;
+  }
+
+  return inner->arg[0];
+}
+
+static struct ir_value *esimp_not_xor(struct ir *ir, struct ir_instr *instr) {
+  /* not(x ^ c) -> x ^ ~c */
+  struct ir_instr *inner = esimp_def(instr->arg[0], OP_XOR);
+  uint64_t c;
+
+  if (!inner || !esimp_const(inner->arg[1], &c)) {
+    return NULL;
+  }
+
+  enum ir_type type = instr->result->type;
+  esimp_insert_before(ir, instr);
+  return ir_xor(ir, inner->arg[0], ir_alloc_int(ir, ~c, type));
+}
+
+static struct ir_value *esimp_xor_not(struct ir *ir, struct ir_instr *instr) {
+  /* not(x) ^ c -> x ^ ~c */
+  struct ir_instr *inner = esimp_def(instr->arg[0], OP_NOT);
+  uint64_t c;
+
+  if (!inner || !esimp_const(instr->arg[1], &c)) {
+    return NULL;
+  }
+
+  enum ir_type type = instr->result->type;
+  esimp_insert_before(ir, instr);
+  return ir_xor(ir, inner->arg[0], ir_alloc_int(ir, ~c, type));
+}
+
+static struct ir_value *esimp_xor_ones(struct ir *ir, struct ir_instr *instr) {
+  /* x ^ ~0 -> not(x) */
+  uint64_t c;
+  enum ir_type type = instr->result->type;
+
+  if (!esimp_const(instr->arg[1], &c) || c != esimp_type_mask(type)) {
+    return NULL;
+  }
+
+  esimp_insert_before(ir, instr);
+  return ir_not(ir, instr->arg[0]);
+}
+
+/*
+ * compares of compares
+ */
+static struct ir_value *esimp_cmp_cmp(struct ir *ir, struct ir_instr *instr) {
+  /* comparing the boolean result of a compare (optionally zero extended)
+     against 0 or 1 for equality is either the compare, or its inverse */
+  enum ir_cmp cmp = (enum ir_cmp)instr->arg[2]->i32;
+  uint64_t rhs;
+
+  if ((cmp != CMP_EQ && cmp != CMP_NE) || !esimp_const(instr->arg[1], &rhs) ||
+      rhs > 1) {
+    return NULL;
+  }
+
+  struct ir_value *v = instr->arg[0];
+  struct ir_instr *ext = esimp_def(v, OP_ZEXT);
+
+  if (ext) {
+    v = ext->arg[0];
+  }
+
+  struct ir_instr *inner = esimp_def(v, OP_CMP);
+  if (!inner) {
+    inner = esimp_def(v, OP_FCMP);
+  }
+
+  if (!inner) {
+    return NULL;
+  }
+
+  /* cmp == 1 and cmp != 0 are the compare itself */
+  int same = (cmp == CMP_EQ) == (rhs == 1);
+
+  if (same) {
+    return inner->result;
+  }
+
+  enum ir_cmp inner_cmp = (enum ir_cmp)inner->arg[2]->i32;
+
+  esimp_insert_before(ir, instr);
+  return esimp_cmp(ir, inner->op, inner->arg[0], inner->arg[1],
+                   esimp_invert_cmp(inner_cmp));
+}
+
+static const struct esimp_rule esimp_rules[] = {
+    /* identities */
+    {OP_XOR, &esimp_same_args, &STAT_bitwise_identities_removed},
+    {OP_AND, &esimp_same_args, &STAT_bitwise_identities_removed},
+    {OP_OR, &esimp_same_args, &STAT_bitwise_identities_removed},
+    {OP_AND, &esimp_zero_property, &STAT_zero_properties_removed},
+    {OP_SMUL, &esimp_zero_property, &STAT_zero_properties_removed},
+    {OP_UMUL, &esimp_zero_property, &STAT_zero_properties_removed},
+    {OP_ADD, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_SUB, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_OR, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_XOR, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_SHL, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_LSHR, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_ASHR, &esimp_zero_identity, &STAT_zero_identities_removed},
+    {OP_UMUL, &esimp_one_identity, &STAT_one_identities_removed},
+    {OP_SMUL, &esimp_one_identity, &STAT_one_identities_removed},
+    {OP_DIV, &esimp_one_identity, &STAT_one_identities_removed},
+    {OP_AND, &esimp_and_mask, &STAT_bitwise_identities_removed},
+    /* reassociation */
+    {OP_ADD, &esimp_reassociate_add, &STAT_constants_reassociated},
+    {OP_SUB, &esimp_reassociate_add, &STAT_constants_reassociated},
+    {OP_AND, &esimp_reassociate, &STAT_constants_reassociated},
+    {OP_OR, &esimp_reassociate, &STAT_constants_reassociated},
+    {OP_XOR, &esimp_reassociate, &STAT_constants_reassociated},
+    {OP_SMUL, &esimp_reassociate, &STAT_constants_reassociated},
+    {OP_UMUL, &esimp_reassociate, &STAT_constants_reassociated},
+    /* shift / mask fusion */
+    {OP_SHL, &esimp_fuse_shifts, &STAT_shifts_fused},
+    {OP_LSHR, &esimp_fuse_shifts, &STAT_shifts_fused},
+    {OP_ASHR, &esimp_fuse_shifts, &STAT_shifts_fused},
+    {OP_SHL, &esimp_fuse_shift_pair, &STAT_shifts_fused},
+    {OP_LSHR, &esimp_fuse_shift_pair, &STAT_shifts_fused},
+    {OP_AND, &esimp_fuse_shift_mask, &STAT_shifts_fused},
+    /* strength reduction */
+    {OP_SMUL, &esimp_mul_pow2, &STAT_strength_reduced},
+    {OP_UMUL, &esimp_mul_pow2, &STAT_strength_reduced},
+    {OP_DIV, &esimp_div_pow2, &STAT_strength_reduced},
+    /* extensions */
+    {OP_SEXT, &esimp_ext_constant, &STAT_extensions_removed},
+    {OP_ZEXT, &esimp_ext_constant, &STAT_extensions_removed},
+    {OP_SEXT, &esimp_ext_ext, &STAT_extensions_removed},
+    {OP_ZEXT, &esimp_ext_ext, &STAT_extensions_removed},
+    {OP_ZEXT, &esimp_zext_trunc, &STAT_extensions_removed},
+    /* negations */
+    {OP_NEG, &esimp_double_negation, &STAT_negations_removed},
+    {OP_NOT, &esimp_double_negation, &STAT_negations_removed},
+    {OP_FNEG, &esimp_double_negation, &STAT_negations_removed},
+    {OP_NOT, &esimp_not_xor, &STAT_negations_removed},
+    {OP_XOR, &esimp_xor_not, &STAT_negations_removed},
+    {OP_XOR, &esimp_xor_ones, &STAT_negations_removed},
+    /* compares */
+    {OP_CMP, &esimp_cmp_cmp, &STAT_compares_removed},
+};
 
 static void esimp_run_block(struct esimp *esimp, struct ir *ir,
                             struct ir_block *block) {
   list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
-    /* simplify bitwise identities with identical inputs */
-    if (instr->op == OP_XOR && instr->arg[0] == instr->arg[1]) {
-      struct ir_value *zero = ir_alloc_int(ir, 0, instr->result->type);
-      ir_replace_uses(instr->result, zero);
-      STAT_bitwise_identities_removed++;
-    } else if ((instr->op == OP_AND || instr->op == OP_OR) &&
-               instr->arg[0] == instr->arg[1]) {
-      ir_replace_uses(instr->result, instr->arg[0]);
-      STAT_bitwise_identities_removed++;
+    if (!instr->result) {
+      continue;
     }
 
-    /* binary ops involving constants normally have the constant
-       argument as the second argument */
-    if (instr->arg[1] && ir_is_constant(instr->arg[1]) &&
-        ir_is_int(instr->arg[1]->type)) {
-      uint64_t rhs = ir_zext_constant(instr->arg[1]);
-      struct ir_value *lhs = instr->arg[0];
-
-      /* simplify binary ops where an argument of 0 always results in 0 */
-      if ((instr->op == OP_AND || instr->op == OP_SMUL ||
-           instr->op == OP_UMUL) &&
-          rhs == 0) {
-        struct ir_value *zero = ir_alloc_int(ir, 0, instr->result->type);
-        ir_replace_uses(instr->result, zero);
-        STAT_zero_properties_removed++;
-      }
+    for (int i = 0; i < (int)ARRAY_SIZE(esimp_rules); i++) {
+      const struct esimp_rule *rule = &esimp_rules[i];
 
-      /* simplify binary ops where 0 is an identity */
-      else if ((instr->op == OP_ADD || instr->op == OP_SUB ||
-                instr->op == OP_OR || instr->op == OP_XOR ||
-                instr->op == OP_SHL || instr->op == OP_LSHR ||
-                instr->op == OP_ASHR) &&
-               rhs == 0) {
-        ir_replace_uses(instr->result, lhs);
-        STAT_zero_identities_removed++;
+      if (rule->op != instr->op) {
+        continue;
       }
 
-      /* simplify binary ops where 1 is an identity */
-      else if ((instr->op == OP_UMUL || instr->op == OP_SMUL ||
-                instr->op == OP_DIV) &&
-               rhs == 1) {
-        ir_replace_uses(instr->result, lhs);
-        STAT_one_identities_removed++;
+      struct ir_value *v = rule->rewrite(ir, instr);
+
+      if (!v || v == instr->result) {
+        continue;
       }
+
+      ir_replace_uses(instr->result, v);
+      pass_stat_inc(rule->stat);
+      break;
     }
   }
 }
 
 void esimp_run(struct esimp *esimp, struct ir *ir) {
+  struct ir_insert_point original = ir_get_insert_point(ir);
+
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     esimp_run_block(esimp, ir, block);
   }
+
+  ir_set_insert_point(ir, &original);
 }
 
 void esimp_destroy(struct esimp *esimp) {}
@@ -13,11 +13,23 @@ struct lse_entry {
   struct ir_value *value;
 };
 
+/* state at a block boundary. an entry is valid if its value is non-NULL */
+struct lse_state {
+  struct lse_entry entries[IR_MAX_CONTEXT];
+};
+
 struct lse {
   /* current cache token */
   uint64_t token;
 
   struct lse_entry available[IR_MAX_CONTEXT];
+
+  /* per-block state at the end of each block when eliminating loads, and at
+     the start of each block when eliminating stores */
+  struct lse_state *states;
+  int max_states;
+
+  struct lse_state scratch;
 };
 
 static void lse_clear_available(struct lse *lse) {
@@ -99,14 +111,181 @@ static int lse_test_available(struct lse *lse, int offset, int size) {
   return 1;
 }
 
-static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
-                                struct ir_block *block) {
+static int lse_is_barrier(const struct ir_instr *instr) {
+  /* calls out of the ir may read or write any part of the context */
+  return instr->op == OP_FALLBACK || instr->op == OP_CALL ||
+         instr->op == OP_CALL_COND;
+}
+
+static int lse_same_constant(const struct ir_value *a,
+                             const struct ir_value *b) {
+  if (!a || !b || !ir_is_constant(a) || !ir_is_constant(b) ||
+      a->type != b->type) {
+    return 0;
+  }
+
+  switch (a->type) {
+    case VALUE_I8:
+    case VALUE_I16:
+    case VALUE_I32:
+    case VALUE_I64:
+      return ir_zext_constant(a) == ir_zext_constant(b);
+    case VALUE_F32:
+      return a->i32 == b->i32;
+    case VALUE_F64:
+      return a->i64 == b->i64;
+    default:
+      return 0;
+  }
+}
+
+static struct lse_state *lse_get_state(struct lse *lse,
+                                       struct ir_block *block) {
+  return &lse->states[block->tag];
+}
+
+static void lse_seed_available(struct lse *lse, const struct lse_state *state) {
   lse_clear_available(lse);
 
+  for (int i = 0; i < IR_MAX_CONTEXT; i++) {
+    const struct lse_entry *src = &state->entries[i];
+
+    if (!src->value) {
+      continue;
+    }
+
+    struct lse_entry *entry = &lse->available[i];
+    entry->token = lse->token;
+    entry->offset = src->offset;
+    entry->value = src->value;
+  }
+}
+
+static int lse_save_available(struct lse *lse, struct lse_state *state,
+                              int constants_only) {
+  int changed = 0;
+
+  for (int i = 0; i < IR_MAX_CONTEXT; i++) {
+    const struct lse_entry *entry = &lse->available[i];
+    struct lse_entry *dst = &state->entries[i];
+    struct ir_value *value = entry->token == lse->token ? entry->value : NULL;
+    int offset = value ? entry->offset : 0;
+
+    if (value && constants_only && !ir_is_constant(value)) {
+      value = NULL;
+      offset = 0;
+    }
+
+    changed |= dst->value != value || dst->offset != offset;
+    dst->token = 0;
+    dst->offset = offset;
+    dst->value = value;
+  }
+
+  return changed;
+}
+
+static void lse_meet_preds(struct lse *lse, struct ir *ir,
+                           struct ir_block *block, struct lse_state *in) {
+  memset(in, 0, sizeof(*in));
+
+  /* the first block is entered from the dispatcher with nothing available */
+  if (block == list_first_entry(&ir->blocks, struct ir_block, it)) {
+    return;
+  }
+
+  int first = 1;
+
+  list_for_each_entry(edge, &block->incoming, struct ir_edge, it) {
+    struct lse_state *out = lse_get_state(lse, edge->src);
+
+    if (first) {
+      *in = *out;
+      first = 0;
+      continue;
+    }
+
+    /* values are only available if each predecessor has the same constant.
+       non-constant values are never carried across blocks, as the register
+       allocator doesn't support values live across block boundaries */
+    for (int i = 0; i < IR_MAX_CONTEXT; i++) {
+      struct lse_entry *a = &in->entries[i];
+      struct lse_entry *b = &out->entries[i];
+
+      if (a->offset != b->offset || !lse_same_constant(a->value, b->value)) {
+        a->offset = 0;
+        a->value = NULL;
+      }
+    }
+  }
+}
+
+static int lse_exits_ir(struct ir *ir, struct ir_block *block) {
+  struct ir_instr *term = list_last_entry(&block->instrs, struct ir_instr, it);
+
+  if (!term || (term->op != OP_BRANCH && term->op != OP_BRANCH_COND)) {
+    return 1;
+  }
+
+  for (int i = 0; i < 2; i++) {
+    struct ir_value *target = term->arg[i];
+
+    if (!target && i) {
+      continue;
+    }
+
+    if (!target || target->type != VALUE_BLOCK) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static void lse_meet_succs(struct lse *lse, struct ir *ir,
+                           struct ir_block *block, struct lse_state *out) {
+  memset(out, 0, sizeof(*out));
+
+  /* the context is observable once control leaves the ir, or when entering a
+     block where the backend may yield */
+  if (lse_exits_ir(ir, block) || list_empty(&block->outgoing)) {
+    return;
+  }
+
+  list_for_each_entry(edge, &block->outgoing, struct ir_edge, it) {
+    if (ir_is_yield_point(ir, edge->dst)) {
+      return;
+    }
+  }
+
+  int first = 1;
+
+  list_for_each_entry(edge, &block->outgoing, struct ir_edge, it) {
+    struct lse_state *in = lse_get_state(lse, edge->dst);
+
+    if (first) {
+      *out = *in;
+      first = 0;
+      continue;
+    }
+
+    /* only ranges overwritten along every path are dead */
+    for (int i = 0; i < IR_MAX_CONTEXT; i++) {
+      if (!in->entries[i].value) {
+        out->entries[i].offset = 0;
+        out->entries[i].value = NULL;
+      }
+    }
+  }
+}
+
+static int lse_eliminate_loads(struct lse *lse, struct ir *ir,
+                               struct ir_block *block, int transform) {
+  lse_meet_preds(lse, ir, block, &lse->scratch);
+  lse_seed_available(lse, &lse->scratch);
+
   list_for_each_entry_safe(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
-      lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
+    if (lse_is_barrier(instr)) {
       lse_clear_available(lse);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       /* if there is already a value available for this offset, reuse it and
@@ -115,10 +294,12 @@ static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
       struct ir_value *existing = lse_get_available(lse, offset);
 
       if (existing && existing->type == instr->result->type) {
-        ir_replace_uses(instr->result, existing);
-        ir_remove_instr(ir, instr);
+        if (transform) {
+          ir_replace_uses(instr->result, existing);
+          ir_remove_instr(ir, instr);
 
-        STAT_loads_removed++;
+          pass_stat_inc(&STAT_loads_removed);
+        }
 
         continue;
       }
@@ -131,16 +312,17 @@ static void lse_eliminate_loads(struct lse *lse, struct ir *ir,
       lse_set_available(lse, offset, instr->arg[1]);
     }
   }
+
+  return lse_save_available(lse, lse_get_state(lse, block), 1);
 }
 
-static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
-                                 struct ir_block *block) {
-  lse_clear_available(lse);
+static int lse_eliminate_stores(struct lse *lse, struct ir *ir,
+                                struct ir_block *block, int transform) {
+  lse_meet_succs(lse, ir, block, &lse->scratch);
+  lse_seed_available(lse, &lse->scratch);
 
   list_for_each_entry_safe_reverse(instr, &block->instrs, struct ir_instr, it) {
-    if (instr->op == OP_FALLBACK || instr->op == OP_CALL) {
-      lse_clear_available(lse);
-    } else if (instr->op == OP_BRANCH || instr->op == OP_BRANCH_COND) {
+    if (lse_is_barrier(instr)) {
       lse_clear_available(lse);
     } else if (instr->op == OP_LOAD_CONTEXT) {
       int offset = instr->arg[0]->i32;
@@ -154,27 +336,72 @@ static void lse_eliminate_stores(struct lse *lse, struct ir *ir,
       int overwritten = lse_test_available(lse, offset, size);
 
       if (overwritten) {
-        ir_remove_instr(ir, instr);
-        STAT_stores_removed++;
+        if (transform) {
+          ir_remove_instr(ir, instr);
+          pass_stat_inc(&STAT_stores_removed);
+        }
         continue;
       }
 
       lse_set_available(lse, offset, instr->arg[1]);
     }
   }
+
+  return lse_save_available(lse, lse_get_state(lse, block), 0);
 }
 
-void lse_run(struct lse *lse, struct ir *ir) {
+static void lse_reset_states(struct lse *lse, struct ir *ir) {
+  int num_blocks = 0;
+
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    lse_eliminate_loads(lse, ir, block);
+    block->tag = num_blocks++;
+  }
+
+  if (num_blocks > lse->max_states) {
+    lse->max_states = num_blocks;
+    lse->states =
+        realloc(lse->states, lse->max_states * sizeof(struct lse_state));
+  }
+
+  memset(lse->states, 0, num_blocks * sizeof(struct lse_state));
+}
+
+void lse_run(struct lse *lse, struct ir *ir) {
+  /* availability is propagated forward along the edges added by the control
+     flow analysis pass, and stores which are overwritten are propagated
+     backward. each block's state starts out empty and only grows, meaning
+     the states are conservative at each iteration */
+  lse_reset_states(lse, ir);
+
+  int changed = 1;
+  while (changed) {
+    changed = 0;
+    list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+      changed |= lse_eliminate_loads(lse, ir, block, 0);
+    }
   }
 
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
-    lse_eliminate_stores(lse, ir, block);
+    lse_eliminate_loads(lse, ir, block, 1);
+  }
+
+  lse_reset_states(lse, ir);
+
+  changed = 1;
+  while (changed) {
+    changed = 0;
+    list_for_each_entry_reverse(block, &ir->blocks, struct ir_block, it) {
+      changed |= lse_eliminate_stores(lse, ir, block, 0);
+    }
+  }
+
+  list_for_each_entry_reverse(block, &ir->blocks, struct ir_block, it) {
+    lse_eliminate_stores(lse, ir, block, 1);
   }
 }
 
 void lse_destroy(struct lse *lse) {
+  free(lse->states);
   free(lse);
 }
 
@@ -0,0 +1,335 @@
+#include "jit/passes/loop_invariant_code_motion_pass.h"
+#include "core/core.h"
+#include "jit/ir/ir.h"
+#include "jit/pass_stats.h"
+
+/*
+ * loop-invariant code motion
+ *
+ * frontends emit a guest block which branches back to its own start as a loop,
+ * entered through a preheader which unconditionally branches to the loop's
+ * header. this pass finds these single block loops, and moves the code in
+ * them which computes the same thing on every iteration into the preheader
+ *
+ * the register allocator is block-local, meaning no value may be live across
+ * the edge from the preheader into the loop. trees of invariant instructions
+ * which aren't consumed by the rest of the loop, e.g. the context load and
+ * assert verifying the fpscr state the sh4 frontend specialized the block for,
+ * are hoisted as is. invariant trees whose result is used by the loop body are
+ * hoisted as well, with the result being stored to a local in the preheader
+ * and loaded back from it at the start of the loop. a lone load or constant
+ * operation is left in place, as reloading it from a local saves nothing
+ *
+ * stores are never hoisted. the header is a yield point, and a hoisted store
+ * would be visible outside of the ir before the iteration performing it had
+ * run
+ */
+
+DEFINE_PASS_STAT(instrs_hoisted, "loop-invariant instrs hoisted");
+DEFINE_PASS_STAT(live_ins_added, "loop live-ins added");
+
+/* max number of hoisted values carried into a loop through locals */
+#define LICM_MAX_LIVE_INS 8
+
+enum {
+  LICM_VARIANT,
+  LICM_INVARIANT,
+  LICM_HOISTED,
+};
+
+#define licm_get_state(i) ((int)(i)->tag)
+#define licm_set_state(i, s) (i)->tag = (intptr_t)(s)
+
+static int licm_is_barrier(const struct ir_instr *instr) {
+  /* calls out of the ir may read or write any part of the context */
+  return instr->op == OP_FALLBACK || instr->op == OP_CALL ||
+         instr->op == OP_CALL_COND;
+}
+
+static int licm_is_pure(const struct ir_instr *instr) {
+  /* instructions whose result depends only on their arguments. note, division
+     isn't included, hoisting it could fault on a path which never divides */
+  switch (instr->op) {
+    case OP_FTOI:
+    case OP_ITOF:
+    case OP_TRUNC:
+    case OP_SEXT:
+    case OP_ZEXT:
+    case OP_FTRUNC:
+    case OP_FEXT:
+    case OP_SELECT:
+    case OP_CMP:
+    case OP_FCMP:
+    case OP_ADD:
+    case OP_SUB:
+    case OP_SMUL:
+    case OP_UMUL:
+    case OP_NEG:
+    case OP_ABS:
+    case OP_FADD:
+    case OP_FSUB:
+    case OP_FMUL:
+    case OP_FDIV:
+    case OP_FNEG:
+    case OP_FABS:
+    case OP_SQRT:
+    case OP_VBROADCAST:
+    case OP_VSPLAT:
+    case OP_VADD:
+    case OP_VDOT:
+    case OP_VMUL:
+    case OP_VMADD:
+    case OP_AND:
+    case OP_OR:
+    case OP_XOR:
+    case OP_NOT:
+    case OP_SHL:
+    case OP_ASHR:
+    case OP_LSHR:
+    case OP_ASHD:
+    case OP_LSHD:
+    case OP_COPY:
+      return 1;
+    default:
+      return 0;
+  }
+}
+
+static int licm_is_assert(const struct ir_instr *instr) {
+  return instr->op == OP_ASSERT_EQ || instr->op == OP_ASSERT_LT;
+}
+
+static struct ir_block *licm_get_preheader(struct ir *ir,
+                                           struct ir_block *header) {
+  struct ir_block *preheader = NULL;
+  int back_edge = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    struct ir_instr *term =
+        list_last_entry(&block->instrs, struct ir_instr, it);
+
+    if (!term || (term->op != OP_BRANCH && term->op != OP_BRANCH_COND)) {
+      continue;
+    }
+
+    for (int i = 0; i < 2; i++) {
+      struct ir_value *target = term->arg[i];
+
+      if (!target || target->type != VALUE_BLOCK || target->blk != header) {
+        continue;
+      }
+
+      if (block == header) {
+        back_edge = 1;
+        continue;
+      }
+
+      /* hoisted code must only run when the loop is entered, require a single
+         unconditional branch into the header */
+      if (preheader || term->op != OP_BRANCH) {
+        return NULL;
+      }
+
+      preheader = block;
+    }
+  }
+
+  return back_edge ? preheader : NULL;
+}
+
+static int licm_is_live_in(const struct ir_instr *instr,
+                           const struct ir_block *header) {
+  if (!instr->result) {
+    return 0;
+  }
+
+  list_for_each_entry(use, &instr->result->uses, struct ir_use, it) {
+    if (use->instr->block == header &&
+        licm_get_state(use->instr) != LICM_HOISTED) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static int licm_select(struct ir_block *header, int live_ins) {
+  /* start off selecting each invariant instruction, then deselect those with
+     an argument which isn't hoisted, or a result which is unused. if values
+     may be carried into the loop, results used by the loop body are allowed
+     when they're the root of a hoisted tree and fit in a scalar local. if not,
+     results used by the loop body are deselected as well. repeat until the
+     selection no longer changes */
+  list_for_each_entry(instr, &header->instrs, struct ir_instr, it) {
+    if (licm_get_state(instr) != LICM_VARIANT) {
+      licm_set_state(instr, LICM_HOISTED);
+    }
+  }
+
+  int changed = 1;
+
+  while (changed) {
+    changed = 0;
+
+    list_for_each_entry(instr, &header->instrs, struct ir_instr, it) {
+      if (licm_get_state(instr) != LICM_HOISTED) {
+        continue;
+      }
+
+      int hoist = 1;
+      int tree = 0;
+
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = instr->arg[i];
+
+        if (!arg || ir_is_constant(arg) || arg->def->block != header) {
+          continue;
+        }
+
+        hoist &= licm_get_state(arg->def) == LICM_HOISTED;
+        tree = 1;
+      }
+
+      if (instr->result) {
+        hoist &= !list_empty(&instr->result->uses);
+
+        if (licm_is_live_in(instr, header)) {
+          hoist &= live_ins && tree && !ir_is_vector(instr->result->type);
+        }
+      }
+
+      if (!hoist) {
+        licm_set_state(instr, LICM_INVARIANT);
+        changed = 1;
+      }
+    }
+  }
+
+  int num_live_ins = 0;
+
+  list_for_each_entry(instr, &header->instrs, struct ir_instr, it) {
+    if (licm_get_state(instr) == LICM_HOISTED) {
+      num_live_ins += licm_is_live_in(instr, header);
+    }
+  }
+
+  return num_live_ins;
+}
+
+static void licm_run_loop(struct licm *licm, struct ir *ir,
+                          struct ir_block *preheader, struct ir_block *header) {
+  uint8_t stored[IR_MAX_CONTEXT] = {0};
+  int barrier = 0;
+
+  /* find the parts of the context modified by the loop */
+  list_for_each_entry(instr, &header->instrs, struct ir_instr, it) {
+    barrier |= licm_is_barrier(instr);
+
+    if (instr->op == OP_STORE_CONTEXT) {
+      int offset = instr->arg[0]->i32;
+      int size = ir_type_size(instr->arg[1]->type);
+      CHECK_LE(offset + size, IR_MAX_CONTEXT);
+      memset(&stored[offset], 1, size);
+    }
+  }
+
+  /* find the instructions which compute the same result on each iteration */
+  list_for_each_entry(instr, &header->instrs, struct ir_instr, it) {
+    int invariant = 0;
+
+    if (instr->op == OP_LOAD_CONTEXT) {
+      int offset = instr->arg[0]->i32;
+      int size = ir_type_size(instr->result->type);
+      CHECK_LE(offset + size, IR_MAX_CONTEXT);
+      invariant = !barrier && !memchr(&stored[offset], 1, size);
+    } else if (licm_is_pure(instr) || licm_is_assert(instr)) {
+      invariant = 1;
+
+      for (int i = 0; i < IR_MAX_ARGS; i++) {
+        struct ir_value *arg = instr->arg[i];
+
+        if (!arg || ir_is_constant(arg) || arg->def->block != header) {
+          continue;
+        }
+
+        invariant &= licm_get_state(arg->def) != LICM_VARIANT;
+      }
+    }
+
+    licm_set_state(instr, invariant ? LICM_INVARIANT : LICM_VARIANT);
+  }
+
+  /* select the instructions to hoist, falling back to only those trees not
+     consumed by the loop body if too many values would be carried into it */
+  if (licm_select(header, 1) > LICM_MAX_LIVE_INS) {
+    licm_select(header, 0);
+  }
+
+  /* move the selected instructions to the end of the preheader, right before
+     its branch into the loop */
+  struct ir_instr *term =
+      list_last_entry(&preheader->instrs, struct ir_instr, it);
+  struct ir_instr *after = list_prev_entry(term, struct ir_instr, it);
+
+  list_for_each_entry_safe(instr, &header->instrs, struct ir_instr, it) {
+    if (licm_get_state(instr) != LICM_HOISTED) {
+      continue;
+    }
+
+    ir_move_instr(ir, instr, preheader, after);
+    after = instr;
+
+    pass_stat_inc(&STAT_instrs_hoisted);
+  }
+
+  /* carry the hoisted values still used by the loop body into it, storing
+     them right before the branch into the loop and loading them back at the
+     start of the loop */
+  struct ir_instr *load_after = NULL;
+
+  list_for_each_entry(instr, &preheader->instrs, struct ir_instr, it) {
+    if (!licm_is_live_in(instr, header)) {
+      continue;
+    }
+
+    struct ir_local *local = ir_alloc_local(ir, instr->result->type);
+
+    ir_set_current_instr(ir, after);
+    ir_store_local(ir, local, instr->result);
+    after = ir->cursor.instr;
+
+    if (load_after) {
+      ir_set_current_instr(ir, load_after);
+    } else {
+      ir_set_current_block(ir, header);
+    }
+    struct ir_value *v = ir_load_local(ir, local);
+    load_after = ir->cursor.instr;
+
+    list_for_each_entry_safe(use, &instr->result->uses, struct ir_use, it) {
+      if (use->instr->block == header) {
+        ir_replace_use(use, v);
+      }
+    }
+
+    pass_stat_inc(&STAT_live_ins_added);
+  }
+}
+
+void licm_run(struct licm *licm, struct ir *ir) {
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    struct ir_block *preheader = licm_get_preheader(ir, block);
+
+    if (!preheader) {
+      continue;
+    }
+
+    licm_run_loop(licm, ir, preheader, block);
+  }
+}
+
+void licm_destroy(struct licm *licm) {}
+
+struct licm *licm_create() {
+  return NULL;
+}
@@ -1,4 +1,4 @@
-#include <limits.h>
+#include <float.h>
 #include "jit/passes/register_allocation_pass.h"
 #include "core/core.h"
 #include "core/list.h"
@@ -12,6 +12,8 @@
 
 DEFINE_PASS_STAT(gprs_spilled, "gprs spilled");
 DEFINE_PASS_STAT(fprs_spilled, "fprs spilled");
+DEFINE_PASS_STAT(ranges_split, "ranges split into callee-saved registers");
+DEFINE_PASS_STAT(slots_reused, "stack slots reused");
 
 struct ra_tmp;
 
@@ -37,12 +39,13 @@ struct ra_bin {
 
    before the temporary's next use, a fill back from the stack is inserted,
    producing a new non-NULL value to allocate for, but not touching the stack
-   slot. slots are not reused by different temporaries, so once it has spilled
-   once, it should not be spilled again */
+   slot. the slot is held until the temporary's last use, so once it has
+   spilled once, it doesn't need to be stored again */
 struct ra_tmp {
   int first_use_idx;
   int last_use_idx;
   int next_use_idx;
+  int num_uses;
 
   /* current location of temporary */
   struct ir_value *value;
@@ -54,10 +57,22 @@ struct ra_use {
   /* ordinal of instruction using the temporary */
   int ordinal;
 
+  /* number of uses of the temporary up to and including this one */
+  int count;
+
   /* next use index */
   int next_idx;
 };
 
+/* slots represent a stack location temporaries are spilled to. once the last
+   use of the temporary occupying a slot has been allocated for, the slot is
+   free to be reused by another temporary of the same size */
+struct ra_slot {
+  struct ir_value *offset;
+  int size;
+  int free;
+};
+
 struct ra {
   const struct jit_register *registers;
   int num_registers;
@@ -71,6 +86,14 @@ struct ra {
   struct ra_use *uses;
   int num_uses;
   int max_uses;
+  struct ra_slot *slots;
+  int num_slots;
+  int max_slots;
+
+  /* ordinals of each call in the current block */
+  int *calls;
+  int num_calls;
+  int max_calls;
 };
 
 #define NO_REGISTER -1
@@ -117,6 +140,7 @@ static void ra_add_use(struct ra *ra, struct ra_tmp *tmp, int ordinal) {
 
   struct ra_use *use = &ra->uses[ra->num_uses];
   use->ordinal = ordinal;
+  use->count = ++tmp->num_uses;
   use->next_idx = NO_USE;
 
   /* append use to temporary's list of uses */
@@ -152,6 +176,7 @@ static struct ra_tmp *ra_create_tmp(struct ra *ra, struct ir_value *value) {
   tmp->first_use_idx = NO_USE;
   tmp->last_use_idx = NO_USE;
   tmp->next_use_idx = NO_USE;
+  tmp->num_uses = 0;
   tmp->value = NULL;
   tmp->slot = NULL;
 
@@ -255,6 +280,86 @@ static void ra_validate(struct ra *ra, struct ir *ir, struct ir_block *block) {
   }
 }
 
+static int ra_spans_call(struct ra *ra, struct ra_tmp *tmp) {
+  /* check if any call lies between the temporary's current value and its last
+     use */
+  int begin = ra_get_ordinal(tmp->value->def);
+  int end = ra->uses[tmp->last_use_idx].ordinal;
+
+  for (int i = 0; i < ra->num_calls; i++) {
+    if (ra->calls[i] > begin && ra->calls[i] < end) {
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+static double ra_spill_weight(struct ra *ra, struct ra_tmp *tmp, int ordinal) {
+  /* the cost of evicting a temporary is a fill before its next use, plus a
+     store the first time it's spilled. this is scaled by the density of its
+     remaining uses, and divided by the distance to the next one, with the
+     cheapest temporary to evict being one used sparsely and not for a while */
+  struct ra_use *next_use = &ra->uses[tmp->next_use_idx];
+  struct ra_use *last_use = &ra->uses[tmp->last_use_idx];
+
+  int cost = tmp->slot ? 1 : 2;
+  int remaining = tmp->num_uses - next_use->count + 1;
+  int length = MAX(last_use->ordinal - ordinal, 1);
+  int distance = MAX(next_use->ordinal - ordinal, 1);
+
+  return ((double)cost * remaining / length) / distance;
+}
+
+static struct ir_local *ra_alloc_slot(struct ra *ra, struct ir *ir,
+                                      enum ir_type type) {
+  int size = ir_type_size(type);
+
+  /* reuse a slot released by a temporary which is no longer live */
+  for (int i = 0; i < ra->num_slots; i++) {
+    struct ra_slot *slot = &ra->slots[i];
+
+    if (slot->free && slot->size == size) {
+      slot->free = 0;
+      pass_stat_inc(&STAT_slots_reused);
+      return ir_reuse_local(ir, slot->offset, type);
+    }
+  }
+
+  if (ra->num_slots >= ra->max_slots) {
+    /* grow array */
+    int old_max = ra->max_slots;
+    ra->max_slots = MAX(32, ra->max_slots * 2);
+    ra->slots = realloc(ra->slots, ra->max_slots * sizeof(struct ra_slot));
+
+    /* initialize the new entries */
+    memset(ra->slots + old_max, 0,
+           (ra->max_slots - old_max) * sizeof(struct ra_slot));
+  }
+
+  struct ir_local *local = ir_alloc_local(ir, type);
+
+  struct ra_slot *slot = &ra->slots[ra->num_slots++];
+  slot->offset = local->offset;
+  slot->size = size;
+  slot->free = 0;
+
+  return local;
+}
+
+static void ra_free_slot(struct ra *ra, struct ir_local *local) {
+  for (int i = 0; i < ra->num_slots; i++) {
+    struct ra_slot *slot = &ra->slots[i];
+
+    if (slot->offset == local->offset) {
+      slot->free = 1;
+      return;
+    }
+  }
+
+  LOG_FATAL("failed to find stack slot");
+}
+
 static void ra_pack_bin(struct ra *ra, struct ra_bin *bin,
                         struct ra_tmp *new_tmp) {
   struct ra_tmp *old_tmp = ra_get_packed(bin);
@@ -280,20 +385,62 @@ static void ra_spill_tmp(struct ra *ra, struct ir *ir, struct ra_tmp *tmp,
     struct ir_insert_point point = {before->block, after};
     ir_set_insert_point(ir, &point);
 
-    tmp->slot = ir_alloc_local(ir, tmp->value->type);
+    tmp->slot = ra_alloc_slot(ra, ir, tmp->value->type);
     ir_store_local(ir, tmp->slot, tmp->value);
 
     /* track spill stats */
     if (ir_is_int(tmp->value->type)) {
-      STAT_gprs_spilled++;
+      pass_stat_inc(&STAT_gprs_spilled);
     } else {
-      STAT_fprs_spilled++;
+      pass_stat_inc(&STAT_fprs_spilled);
     }
   }
 
   tmp->value = NULL;
 }
 
+static int ra_split_tmp(struct ra *ra, struct ir *ir, struct ra_tmp *tmp,
+                        struct ir_instr *before) {
+  /* find a free callee-saved register to move the temporary to */
+  struct ra_bin *split_bin = NULL;
+
+  for (int i = 0; i < ra->num_registers; i++) {
+    struct ra_bin *bin = ra_get_bin(i);
+
+    if (ra_get_packed(bin) || (bin->reg->flags & JIT_CALLER_SAVE)) {
+      continue;
+    }
+
+    if (!ra_reg_can_store(bin->reg, tmp->value)) {
+      continue;
+    }
+
+    split_bin = bin;
+    break;
+  }
+
+  if (!split_bin) {
+    return 0;
+  }
+
+  /* copy the temporary's current value to the register, continuing the rest
+     of its range from there */
+  struct ir_instr *after = list_prev_entry(before, struct ir_instr, it);
+  struct ir_insert_point point = {before->block, after};
+  ir_set_insert_point(ir, &point);
+
+  struct ir_value *copy = ir_copy(ir, tmp->value);
+  ra_set_ordinal(copy->def, ra_get_ordinal(before));
+  copy->tag = tmp->value->tag;
+  tmp->value = copy;
+
+  ra_pack_bin(ra, split_bin, tmp);
+
+  pass_stat_inc(&STAT_ranges_split);
+
+  return 1;
+}
+
 static void ra_spill_tmps(struct ra *ra, struct ir *ir,
                           struct ir_instr *instr) {
   const struct ir_opdef *def = &ir_opdefs[instr->op];
@@ -335,6 +482,14 @@ static void ra_spill_tmps(struct ra *ra, struct ir *ir,
       continue;
     }
 
+    /* rather than storing the temporary to the stack, split its range at the
+       call if a callee-saved register is free. once it has a stack slot,
+       spilling is free until its next use */
+    if (!tmp->slot && ra_split_tmp(ra, ir, tmp, instr)) {
+      bin->tmp_idx = NO_TMP;
+      continue;
+    }
+
     /* spill before current instr */
     ra_spill_tmp(ra, ir, tmp, instr);
 
@@ -345,9 +500,10 @@ static void ra_spill_tmps(struct ra *ra, struct ir *ir,
 
 static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
                                 struct ra_tmp *tmp) {
-  /* find the register who's next use is furthest away */
+  /* find the register whose temporary is the cheapest to evict */
+  int ordinal = ra_get_ordinal(tmp->value->def);
   struct ra_bin *spill_bin = NULL;
-  int furthest_use = INT_MIN;
+  double min_weight = DBL_MAX;
 
   for (int i = 0; i < ra->num_registers; i++) {
     struct ra_bin *bin = ra_get_bin(i);
@@ -361,10 +517,10 @@ static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
       continue;
     }
 
-    struct ra_use *next_use = &ra->uses[packed->next_use_idx];
+    double weight = ra_spill_weight(ra, packed, ordinal);
 
-    if (next_use->ordinal > furthest_use) {
-      furthest_use = next_use->ordinal;
+    if (weight < min_weight) {
+      min_weight = weight;
       spill_bin = bin;
     }
   }
@@ -384,7 +540,11 @@ static int ra_alloc_blocked_reg(struct ra *ra, struct ir *ir,
 }
 
 static int ra_alloc_free_reg(struct ra *ra, struct ir *ir, struct ra_tmp *tmp) {
-  /* find the first free register which can store the tmp's value */
+  /* find a free register which can store the tmp's value. temporaries live
+     across a call prefer callee-saved registers, avoiding being spilled at the
+     call, while the rest prefer caller-saved registers, leaving the
+     callee-saved ones free for those which are */
+  int spans_call = ra_spans_call(ra, tmp);
   struct ra_bin *alloc_bin = NULL;
 
   for (int i = 0; i < ra->num_registers; i++) {
@@ -399,8 +559,16 @@ static int ra_alloc_free_reg(struct ra *ra, struct ir *ir, struct ra_tmp *tmp) {
       continue;
     }
 
-    alloc_bin = bin;
-    break;
+    int callee_save = !(bin->reg->flags & JIT_CALLER_SAVE);
+
+    if (!alloc_bin) {
+      alloc_bin = bin;
+    }
+
+    if (callee_save == spans_call) {
+      alloc_bin = bin;
+      break;
+    }
   }
 
   if (!alloc_bin) {
@@ -500,6 +668,16 @@ static void ra_rewrite_arg(struct ra *ra, struct ir *ir, struct ir_instr *instr,
 
     struct ir_value *fill = ir_load_local(ir, tmp->slot);
     int ordinal = ra_get_ordinal(instr);
+
+    /* uses aren't advanced past while the temporary is spilled, catch up to
+       the current one */
+    struct ra_use *next_use = &ra->uses[tmp->next_use_idx];
+
+    while (next_use->ordinal < ordinal && next_use->next_idx != NO_USE) {
+      tmp->next_use_idx = next_use->next_idx;
+      next_use = &ra->uses[tmp->next_use_idx];
+    }
+
     ra_set_ordinal(fill->def, ordinal - IR_MAX_ARGS + arg);
     fill->tag = value->tag;
     tmp->value = fill;
@@ -544,6 +722,26 @@ static void ra_expire_tmps(struct ra *ra, struct ir *ir,
   }
 }
 
+static void ra_free_slots(struct ra *ra, struct ir_instr *instr) {
+  int ordinal = ra_get_ordinal(instr);
+
+  for (int i = 0; i < IR_MAX_ARGS; i++) {
+    struct ir_value *arg = instr->arg[i];
+
+    if (!arg || ir_is_constant(arg)) {
+      continue;
+    }
+
+    struct ra_tmp *tmp = ra_get_tmp(arg);
+    struct ra_use *last_use = &ra->uses[tmp->last_use_idx];
+
+    if (tmp->slot && last_use->ordinal == ordinal) {
+      ra_free_slot(ra, tmp->slot);
+      tmp->slot = NULL;
+    }
+  }
+}
+
 static void ra_alloc_bins(struct ra *ra, struct ir *ir,
                           struct ir_block *block) {
   /* use safe iterator to avoid iterating over fills inserted
@@ -558,6 +756,11 @@ static void ra_alloc_bins(struct ra *ra, struct ir *ir,
       ra_rewrite_arg(ra, ir, instr, i);
     }
 
+    /* release the stack slots of temporaries which are no longer used. any
+       fill from them has been inserted before this instruction, so the slots
+       are safe to reuse for spills inserted from here on */
+    ra_free_slots(ra, instr);
+
     /* allocate a bin for the result */
     ra_alloc(ra, ir, instr->result);
 
@@ -597,11 +800,25 @@ static void ra_assign_ordinals(struct ra *ra, struct ir *ir,
                                struct ir_block *block) {
   int ordinal = 0;
 
+  ra->num_calls = 0;
+
   /* assign each instruction an ordinal. these ordinals are used to describe
      the live range of a particular value */
   list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
     ra_set_ordinal(instr, ordinal);
 
+    /* keep track of calls, for checking if a live range spans one */
+    const struct ir_opdef *def = &ir_opdefs[instr->op];
+
+    if (def->flags & IR_FLAG_CALL) {
+      if (ra->num_calls >= ra->max_calls) {
+        ra->max_calls = MAX(32, ra->max_calls * 2);
+        ra->calls = realloc(ra->calls, ra->max_calls * sizeof(int));
+      }
+
+      ra->calls[ra->num_calls++] = ordinal;
+    }
+
     /* each instruction could fill up to IR_MAX_ARGS, space out ordinals
        enough to allow for this */
     ordinal += 1 + IR_MAX_ARGS;
@@ -663,6 +880,12 @@ static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *block) {
   ra->num_tmps = 0;
   ra->num_uses = 0;
 
+  /* values are never live across blocks, every stack slot is free again */
+  for (int i = 0; i < ra->num_slots; i++) {
+    struct ra_slot *slot = &ra->slots[i];
+    slot->free = 1;
+  }
+
   /* reset register state */
   list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
     if (instr->result) {
@@ -672,6 +895,8 @@ static void ra_reset(struct ra *ra, struct ir *ir, struct ir_block *block) {
 }
 
 void ra_run(struct ra *ra, struct ir *ir) {
+  ra->num_slots = 0;
+
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     ra_reset(ra, ir, block);
     ra_legalize_args(ra, ir, block);
@@ -685,6 +910,8 @@ void ra_run(struct ra *ra, struct ir *ir) {
 }
 
 void ra_destroy(struct ra *ra) {
+  free(ra->calls);
+  free(ra->slots);
   free(ra->uses);
   free(ra->tmps);
   free(ra->bins);
@@ -109,6 +109,13 @@ DEFINE_PERSISTENT_OPTION_STRING(broadcast, "ntsc",            "System broadcast
 
 /* jit */
 DEFINE_OPTION_INT(perf,                    0,                 "Create maps for compiled code for use with perf")
+DEFINE_OPTION_INT(jit_cache,               0,                 "Cache compiled code on disk between sessions")
+DEFINE_OPTION_INT(jit_async,               0,                 "Optimize compiled code on a background thread")
+DEFINE_OPTION_INT(jit_profile,             0,                 "Instrument compiled code with block execution counters")
+DEFINE_OPTION_INT(jit_dump,                0,                 "Dump the ir of each compiled block to the app directory")
+DEFINE_OPTION_INT(jit_interp,              0,                 "Interpret guest code instead of compiling it, for comparing against the compiled output")
+DEFINE_OPTION_STRING(jit_sh4_passes,       "cfa,lse,cprop,esimp,cse,licm,cfuse,dce", "Comma-separated list of passes run on sh4 code")
+DEFINE_OPTION_STRING(jit_arm7_passes,      "cfa,lse,cprop,esimp,cse,cfuse,dce", "Comma-separated list of passes run on arm7 code")
 
 /* ui */
 DEFINE_PERSISTENT_OPTION_STRING(gamedir,   "",                "Directories to scan for games")
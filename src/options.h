@@ -70,6 +70,13 @@ DECLARE_OPTION_STRING(broadcast)
 
 /* jit */
 DECLARE_OPTION_INT(perf)
+DECLARE_OPTION_INT(jit_cache)
+DECLARE_OPTION_INT(jit_async)
+DECLARE_OPTION_INT(jit_profile)
+DECLARE_OPTION_INT(jit_dump)
+DECLARE_OPTION_INT(jit_interp)
+DECLARE_OPTION_STRING(jit_sh4_passes)
+DECLARE_OPTION_STRING(jit_arm7_passes)
 
 /* ui */
 DECLARE_OPTION_STRING(gamedir)
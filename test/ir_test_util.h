@@ -0,0 +1,58 @@
+#ifndef IR_TEST_UTIL_H
+#define IR_TEST_UTIL_H
+
+#include "jit/ir/ir.h"
+#include "jit/ir/ir_arena.h"
+
+/* fixtures shared by the tests which build ir by hand */
+
+/* starts a new ir, inserting into an empty entry block. the arena backing it
+   is reused between calls, invalidating the previous ir */
+static inline void init_ir(struct ir *ir) {
+  static struct ir_arena *arena;
+
+  if (!arena) {
+    arena = ir_arena_create();
+  }
+  ir_arena_reset(arena);
+
+  memset(ir, 0, sizeof(*ir));
+  ir->arena = arena;
+  ir_set_current_block(ir, ir_append_block(ir));
+}
+
+/* ir_branch only accepts guest addresses, swap in the block reference after
+   the fact like the jit does when linking superblocks */
+static inline void branch_to(struct ir *ir, struct ir_block *dst) {
+  ir_branch(ir, ir_alloc_i32(ir, 0));
+  ir_set_arg0(ir, ir->cursor.instr, ir_alloc_block_ref(ir, dst));
+}
+
+static inline int count_block_ops(struct ir_block *block, enum ir_op op) {
+  int n = 0;
+  list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+    n += instr->op == op;
+  }
+  return n;
+}
+
+static inline int count_ops(struct ir *ir, enum ir_op op) {
+  int n = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    n += count_block_ops(block, op);
+  }
+  return n;
+}
+
+static inline int count_instrs(struct ir *ir) {
+  int n = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      ((void)instr);
+      n++;
+    }
+  }
+  return n;
+}
+
+#endif
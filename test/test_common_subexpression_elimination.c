@@ -0,0 +1,78 @@
+#include "ir_test_util.h"
+#include "jit/passes/control_flow_analysis_pass.h"
+#include "jit/passes/common_subexpression_elimination_pass.h"
+#include "retest.h"
+
+static void run_cse(struct ir *ir) {
+  struct cfa *cfa = cfa_create();
+  cfa_run(cfa, ir);
+  cfa_destroy(cfa);
+
+  struct cse *cse = cse_create();
+  cse_run(cse, ir);
+  cse_destroy(cse);
+}
+
+TEST(common_subexpression_elimination_same_block) {
+  struct ir ir;
+  init_ir(&ir);
+
+  /* extract the same field twice, as the sh4 frontend does for sr */
+  struct ir_value *sr = ir_load_context(&ir, 0x0, VALUE_I32);
+  struct ir_value *a =
+      ir_and(&ir, ir_lshri(&ir, sr, 4), ir_alloc_i32(&ir, 0xf));
+  struct ir_value *b =
+      ir_and(&ir, ir_lshri(&ir, sr, 4), ir_alloc_i32(&ir, 0xf));
+  ir_store_context(&ir, 0x4, a);
+  ir_store_context(&ir, 0x8, b);
+
+  /* different constants must not be merged */
+  struct ir_value *c = ir_and(&ir, sr, ir_alloc_i32(&ir, 0x1));
+  struct ir_value *d = ir_and(&ir, sr, ir_alloc_i32(&ir, 0x2));
+  ir_store_context(&ir, 0xc, c);
+  ir_store_context(&ir, 0x10, d);
+
+  run_cse(&ir);
+
+  CHECK_EQ(count_ops(&ir, OP_LSHR), 1);
+  CHECK_EQ(count_ops(&ir, OP_AND), 3);
+  CHECK_EQ(count_ops(&ir, OP_LOAD_CONTEXT), 1);
+}
+
+TEST(common_subexpression_elimination_across_blocks) {
+  struct ir ir;
+  init_ir(&ir);
+
+  struct ir_block *entry = ir.cursor.block;
+  struct ir_block *then = ir_append_block(&ir);
+  struct ir_block *other = ir_append_block(&ir);
+  struct ir_block *join = ir_append_block(&ir);
+
+  ir_set_current_block(&ir, entry);
+  struct ir_value *x = ir_load_context(&ir, 0x0, VALUE_I32);
+  struct ir_value *y = ir_load_context(&ir, 0x4, VALUE_I32);
+  struct ir_value *sum = ir_add(&ir, x, y);
+  ir_store_context(&ir, 0x8, sum);
+  ir_branch_cond(&ir, ir_cmp_eq(&ir, x, y), ir_alloc_block_ref(&ir, then),
+                 ir_alloc_block_ref(&ir, other));
+
+  /* although dominated by entry, values can't be reused across blocks as the
+     register allocator only works on a block at a time */
+  ir_set_current_block(&ir, then);
+  ir_store_context(&ir, 0xc, ir_add(&ir, x, y));
+  ir_store_context(&ir, 0x10, ir_sub(&ir, x, y));
+  ir_store_context(&ir, 0x14, ir_sub(&ir, x, y));
+  branch_to(&ir, join);
+
+  ir_set_current_block(&ir, other);
+  branch_to(&ir, join);
+
+  ir_set_current_block(&ir, join);
+  ir_store_context(&ir, 0x18, ir_sub(&ir, x, y));
+  ir_store_context(&ir, 0x1c, ir_add(&ir, x, y));
+
+  run_cse(&ir);
+
+  CHECK_EQ(count_ops(&ir, OP_SUB), 2);
+  CHECK_EQ(count_ops(&ir, OP_ADD), 3);
+}
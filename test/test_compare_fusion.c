@@ -0,0 +1,97 @@
+#include "ir_test_util.h"
+#include "jit/passes/compare_fusion_pass.h"
+#include "jit/passes/dead_code_elimination_pass.h"
+#include "retest.h"
+
+static void run_cfuse(struct ir *ir) {
+  struct cfuse *cfuse = cfuse_create();
+  cfuse_run(cfuse, ir);
+  cfuse_destroy(cfuse);
+
+  struct dce *dce = dce_create();
+  dce_run(dce, ir);
+  dce_destroy(dce);
+}
+
+static int is_fused(struct ir_instr *instr) {
+  struct ir_value *cond = instr->arg[2];
+  struct ir_instr *prev = list_prev_entry(instr, struct ir_instr, it);
+
+  return !ir_is_constant(cond) && cond->def == prev &&
+         (prev->op == OP_CMP || prev->op == OP_FCMP) &&
+         list_first_entry(&cond->uses, struct ir_use, it) ==
+             list_last_entry(&cond->uses, struct ir_use, it);
+}
+
+TEST(compare_fusion_branch) {
+  struct ir ir;
+  init_ir(&ir);
+
+  /* cmp/eq r0, r1 followed by bt, with the t bit still being stored */
+  struct ir_value *a = ir_load_context(&ir, 0x0, VALUE_I32);
+  struct ir_value *b = ir_load_context(&ir, 0x4, VALUE_I32);
+  struct ir_value *t = ir_zext(&ir, ir_cmp_eq(&ir, a, b), VALUE_I32);
+  ir_store_context(&ir, 0x8, t);
+  ir_source_info(&ir, 0x8c000002, 1);
+  ir_branch_cond(&ir, t, ir_alloc_i32(&ir, 0x8c000010),
+                 ir_alloc_i32(&ir, 0x8c000004));
+  struct ir_instr *branch = ir.cursor.instr;
+
+  run_cfuse(&ir);
+
+  CHECK(is_fused(branch));
+  CHECK_EQ(count_ops(&ir, OP_CMP), 2);
+}
+
+TEST(compare_fusion_dead_flag) {
+  struct ir ir;
+  init_ir(&ir);
+
+  /* when nothing else uses the flag, the original compare is removed */
+  struct ir_value *a = ir_load_context(&ir, 0x0, VALUE_F32);
+  struct ir_value *b = ir_load_context(&ir, 0x4, VALUE_F32);
+  struct ir_value *t = ir_zext(&ir, ir_fcmp_lt(&ir, a, b), VALUE_I32);
+  ir_source_info(&ir, 0x8c000002, 1);
+  ir_branch_cond(&ir, t, ir_alloc_i32(&ir, 0x8c000010),
+                 ir_alloc_i32(&ir, 0x8c000004));
+  struct ir_instr *branch = ir.cursor.instr;
+
+  run_cfuse(&ir);
+
+  CHECK(is_fused(branch));
+  CHECK_EQ(count_ops(&ir, OP_FCMP), 1);
+  CHECK_EQ(count_ops(&ir, OP_ZEXT), 0);
+}
+
+TEST(compare_fusion_select) {
+  struct ir ir;
+  struct ir_value *a, *b, *c;
+  init_ir(&ir);
+
+  a = ir_load_context(&ir, 0x0, VALUE_I32);
+  b = ir_load_context(&ir, 0x4, VALUE_I32);
+  c = ir_cmp_ult(&ir, a, b);
+  ir_store_context(&ir, 0xc, a);
+  ir_store_context(&ir, 0x8, ir_select(&ir, c, a, b));
+  struct ir_instr *select = ir.cursor.instr->arg[1]->def;
+
+  run_cfuse(&ir);
+
+  CHECK(is_fused(select));
+
+  /* unordered fcmp eq / ne can't be fused with a select */
+  init_ir(&ir);
+
+  a = ir_load_context(&ir, 0x0, VALUE_F32);
+  b = ir_load_context(&ir, 0x4, VALUE_F32);
+  c = ir_fcmp_eq(&ir, a, b);
+  ir_store_context(&ir, 0x8, ir_zext(&ir, c, VALUE_I32));
+  ir_store_context(&ir, 0xc, ir_select(&ir, c, ir_alloc_i32(&ir, 1),
+                                       ir_alloc_i32(&ir, 2)));
+  select = ir.cursor.instr->arg[1]->def;
+
+  run_cfuse(&ir);
+
+  CHECK(!is_fused(select));
+  CHECK_EQ(count_ops(&ir, OP_FCMP), 1);
+}
@@ -0,0 +1,129 @@
+#include <math.h>
+#include "ir_test_util.h"
+#include "jit/passes/constant_propagation_pass.h"
+#include "jit/passes/control_flow_analysis_pass.h"
+#include "retest.h"
+
+static struct ir_value *fold(struct ir *ir, struct ir_value *v) {
+  /* store the value off so the folded result can be read back */
+  ir_store_context(ir, 0x0, v);
+
+  struct cprop *cprop = cprop_create();
+  cprop_run(cprop, ir);
+  cprop_destroy(cprop);
+
+  struct ir_instr *store = ir->cursor.instr;
+  return store->arg[1];
+}
+
+static int num_blocks(struct ir *ir) {
+  int n = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    n++;
+  }
+  return n;
+}
+
+TEST(constant_propagation_int) {
+  struct ir ir;
+  struct ir_value *v;
+
+  init_ir(&ir);
+  v = fold(&ir, ir_sext(&ir, ir_alloc_i8(&ir, -2), VALUE_I32));
+  CHECK(ir_is_constant(v));
+  CHECK_EQ(v->i32, -2);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_ashr(&ir, ir_alloc_i32(&ir, 0x80000000),
+                        ir_alloc_i32(&ir, 4)));
+  CHECK_EQ((uint32_t)v->i32, 0xf8000000u);
+
+  /* negative counts shift right, shifting out every bit when the lower five
+     bits are clear */
+  init_ir(&ir);
+  v = fold(&ir, ir_ashd(&ir, ir_alloc_i32(&ir, 0x80000000),
+                        ir_alloc_i32(&ir, -4)));
+  CHECK_EQ((uint32_t)v->i32, 0xf8000000u);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_lshd(&ir, ir_alloc_i32(&ir, 0x80000000),
+                        ir_alloc_i32(&ir, -32)));
+  CHECK_EQ(v->i32, 0);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_cmp_slt(&ir, ir_alloc_i32(&ir, -1), ir_alloc_i32(&ir, 1)));
+  CHECK_EQ(v->i8, 1);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_cmp_ult(&ir, ir_alloc_i32(&ir, -1), ir_alloc_i32(&ir, 1)));
+  CHECK_EQ(v->i8, 0);
+}
+
+TEST(constant_propagation_float) {
+  struct ir ir;
+  struct ir_value *v;
+
+  init_ir(&ir);
+  v = fold(&ir, ir_fmul(&ir, ir_alloc_f32(&ir, 1.5f), ir_alloc_f32(&ir, 2.0f)));
+  CHECK(v->f32 == 3.0f);
+
+  /* out of range conversions saturate, nans convert to INT32_MIN */
+  init_ir(&ir);
+  v = fold(&ir, ir_ftoi(&ir, ir_alloc_f32(&ir, 1e10f), VALUE_I32));
+  CHECK_EQ(v->i32, INT32_MAX);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_ftoi(&ir, ir_alloc_f32(&ir, NAN), VALUE_I32));
+  CHECK_EQ(v->i32, INT32_MIN);
+
+  /* unordered comparisons match ucomiss */
+  init_ir(&ir);
+  v = fold(&ir, ir_fcmp_gt(&ir, ir_alloc_f32(&ir, NAN), ir_alloc_f32(&ir, 0)));
+  CHECK_EQ(v->i8, 0);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_fcmp_lt(&ir, ir_alloc_f32(&ir, NAN), ir_alloc_f32(&ir, 0)));
+  CHECK_EQ(v->i8, 1);
+
+  init_ir(&ir);
+  v = fold(&ir, ir_fneg(&ir, ir_alloc_f32(&ir, 0.0f)));
+  CHECK_EQ((uint32_t)v->i32, 0x80000000u);
+}
+
+TEST(constant_propagation_branch) {
+  struct ir ir;
+  init_ir(&ir);
+
+  struct ir_block *entry = ir.cursor.block;
+  struct ir_block *then = ir_append_block(&ir);
+  struct ir_block *other = ir_append_block(&ir);
+
+  ir_set_current_block(&ir, entry);
+  struct ir_value *cond =
+      ir_cmp_eq(&ir, ir_alloc_i32(&ir, 1), ir_alloc_i32(&ir, 2));
+  ir_branch_cond(&ir, cond, ir_alloc_block_ref(&ir, then),
+                 ir_alloc_block_ref(&ir, other));
+
+  ir_set_current_block(&ir, then);
+  ir_store_context(&ir, 0x0, ir_alloc_i32(&ir, 1));
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x8c000000));
+
+  ir_set_current_block(&ir, other);
+  ir_store_context(&ir, 0x0, ir_alloc_i32(&ir, 2));
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x8c000100));
+
+  struct cfa *cfa = cfa_create();
+  cfa_run(cfa, &ir);
+  cfa_destroy(cfa);
+
+  struct cprop *cprop = cprop_create();
+  cprop_run(cprop, &ir);
+  cprop_destroy(cprop);
+
+  CHECK_EQ(num_blocks(&ir), 2);
+  CHECK(list_empty(&then->incoming));
+
+  struct ir_instr *term = list_last_entry(&entry->instrs, struct ir_instr, it);
+  CHECK_EQ(term->op, OP_BRANCH);
+  CHECK_EQ(term->arg[0]->blk, other);
+}
@@ -1,8 +1,8 @@
 #include "jit/ir/ir.h"
+#include "jit/ir/ir_arena.h"
 #include "jit/passes/dead_code_elimination_pass.h"
 #include "retest.h"
 
-static uint8_t ir_buffer[1024 * 1024];
 static char scratch_buffer[1024 * 1024];
 
 /*TEST(dead_code_elimination) {
@@ -55,8 +55,7 @@ static char scratch_buffer[1024 * 1024];
       "store_context i32 0x30, i32 0x8c000940\n";
 
   struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+  ir.arena = ir_arena_create();
 
   FILE *input = tmpfile();
   fwrite(input_str, 1, sizeof(input_str) - 1, input);
@@ -77,4 +76,6 @@ static char scratch_buffer[1024 * 1024];
   CHECK_NE(n, 0u);
 
   CHECK_STREQ(scratch_buffer, output_str);
+
+  ir_arena_destroy(ir.arena);
 }*/
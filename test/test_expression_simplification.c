@@ -0,0 +1,124 @@
+#include "ir_test_util.h"
+#include "jit/passes/expression_simplification_pass.h"
+#include "retest.h"
+
+static struct ir_value *simplify(struct ir *ir, struct ir_value *v) {
+  /* store the value off so the simplified result can be read back */
+  ir_store_context(ir, 0x0, v);
+
+  struct esimp *esimp = esimp_create();
+  esimp_run(esimp, ir);
+  esimp_destroy(esimp);
+
+  struct ir_instr *store = ir->cursor.instr;
+  return store->arg[1];
+}
+
+static int is_op(struct ir_value *v, enum ir_op op, struct ir_value *arg0,
+                 uint64_t arg1) {
+  if (ir_is_constant(v) || v->def->op != op || v->def->arg[0] != arg0) {
+    return 0;
+  }
+  return ir_is_constant(v->def->arg[1]) &&
+         ir_zext_constant(v->def->arg[1]) == arg1;
+}
+
+TEST(expression_simplification_reassociate) {
+  struct ir ir;
+  struct ir_value *x, *v;
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = ir_add(&ir, x, ir_alloc_i32(&ir, 8));
+  v = ir_sub(&ir, v, ir_alloc_i32(&ir, 2));
+  v = ir_add(&ir, v, ir_alloc_i32(&ir, 4));
+  v = simplify(&ir, v);
+  CHECK(is_op(v, OP_ADD, x, 10));
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = ir_and(&ir, x, ir_alloc_i32(&ir, 0xff00));
+  v = ir_and(&ir, v, ir_alloc_i32(&ir, 0x0ff0));
+  v = simplify(&ir, v);
+  CHECK(is_op(v, OP_AND, x, 0x0f00));
+}
+
+TEST(expression_simplification_shifts) {
+  struct ir ir;
+  struct ir_value *x, *v;
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = ir_lshri(&ir, ir_lshri(&ir, x, 3), 5);
+  v = simplify(&ir, v);
+  CHECK(is_op(v, OP_LSHR, x, 8));
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = ir_shli(&ir, ir_shli(&ir, x, 16), 16);
+  v = simplify(&ir, v);
+  CHECK(ir_is_constant(v));
+  CHECK_EQ(v->i32, 0);
+
+  /* (x << 24) >> 24 clears the upper bits */
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = ir_lshri(&ir, ir_shli(&ir, x, 24), 24);
+  v = simplify(&ir, v);
+  CHECK(is_op(v, OP_AND, x, 0xff));
+}
+
+TEST(expression_simplification_strength_reduction) {
+  struct ir ir;
+  struct ir_value *x, *v;
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = simplify(&ir, ir_umul(&ir, x, ir_alloc_i32(&ir, 16)));
+  CHECK(is_op(v, OP_SHL, x, 4));
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = simplify(&ir, ir_smul(&ir, x, ir_alloc_i32(&ir, 12)));
+  CHECK_EQ(v->def->op, OP_SMUL);
+}
+
+TEST(expression_simplification_negations) {
+  struct ir ir;
+  struct ir_value *x, *v;
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = simplify(&ir, ir_not(&ir, ir_not(&ir, x)));
+  CHECK_EQ(v, x);
+
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  v = simplify(&ir, ir_xor(&ir, x, ir_alloc_i32(&ir, 0xffffffff)));
+  CHECK_EQ(v->def->op, OP_NOT);
+  CHECK_EQ(v->def->arg[0], x);
+}
+
+TEST(expression_simplification_compares) {
+  struct ir ir;
+  struct ir_value *x, *y, *c, *v;
+
+  /* zext(x < y) == 0 is x >= y */
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  y = ir_load_context(&ir, 0x8, VALUE_I32);
+  c = ir_zext(&ir, ir_cmp_slt(&ir, x, y), VALUE_I32);
+  v = simplify(&ir, ir_cmp_eq(&ir, c, ir_alloc_i32(&ir, 0)));
+  CHECK_EQ(v->def->op, OP_CMP);
+  CHECK_EQ(v->def->arg[0], x);
+  CHECK_EQ(v->def->arg[1], y);
+  CHECK_EQ(v->def->arg[2]->i32, CMP_SGE);
+
+  /* (x < y) != 0 is the compare itself */
+  init_ir(&ir);
+  x = ir_load_context(&ir, 0x4, VALUE_I32);
+  y = ir_load_context(&ir, 0x8, VALUE_I32);
+  c = ir_cmp_slt(&ir, x, y);
+  v = simplify(&ir, ir_cmp_ne(&ir, c, ir_alloc_i8(&ir, 0)));
+  CHECK_EQ(v, c);
+}
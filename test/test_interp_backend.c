@@ -0,0 +1,206 @@
+#include "core/core.h"
+#include "jit/backend/interp/interp_backend.h"
+#include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
+#include "retest.h"
+
+/* a toy guest, each instruction is a 4 byte word with the op in the top byte
+   and an immediate in the rest */
+enum {
+  TOY_ADD,
+  TOY_JMP,
+  TOY_SKIP,
+  TOY_INTR,
+};
+
+#define INSTR(op, imm) (((op) << 24) | (imm))
+
+struct toy_context {
+  uint32_t pc;
+  int32_t run_cycles;
+  int32_t ran_instrs;
+  uint64_t interrupts;
+  uint32_t acc;
+  int num_compiles;
+  int num_interrupts;
+};
+
+static struct toy_context ctx;
+static uint32_t mem[64];
+static struct jit_guest guest;
+static struct jit_frontend frontend;
+static struct jit_backend *backend;
+
+#define TOY_CTX ((struct toy_context *)guest->ctx)
+
+static void toy_add(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->acc += data & 0xffffff;
+  TOY_CTX->pc = addr + 4;
+}
+
+static void toy_jmp(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->pc = data & 0xffffff;
+}
+
+/* skips over the next instruction without ending the block, as an exception
+   raised mid-block would */
+static void toy_skip(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->pc = addr + 8;
+}
+
+static void toy_intr(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->interrupts = 1;
+  TOY_CTX->pc = addr + 4;
+}
+
+static const struct jit_opdef toy_opdefs[] = {
+    {TOY_ADD, "add", NULL, NULL, 1, 0, &toy_add},
+    {TOY_JMP, "jmp", NULL, NULL, 2, 0, &toy_jmp},
+    {TOY_SKIP, "skip", NULL, NULL, 1, 0, &toy_skip},
+    {TOY_INTR, "intr", NULL, NULL, 1, 0, &toy_intr},
+};
+
+static const struct jit_opdef *toy_lookup_op(struct jit_frontend *frontend,
+                                             const void *instr) {
+  return &toy_opdefs[*(const uint32_t *)instr >> 24];
+}
+
+static uint32_t toy_r32(struct memory *m, uint32_t addr) {
+  return mem[addr >> 2];
+}
+
+static void toy_lookup(struct memory *m, uint32_t addr, void **userdata,
+                       uint8_t **ptr, mem_read_cb *read, mem_write_cb *write) {
+  *ptr = (uint8_t *)mem + addr;
+}
+
+static void toy_compile_code(void *data, uint32_t addr) {
+  /* blocks run up to and including the next jmp */
+  int size = 0;
+  while ((mem[(addr + size) >> 2] >> 24) != TOY_JMP) {
+    size += 4;
+  }
+  size += 4;
+
+  uint8_t *code;
+  int code_size;
+  int res = backend->decode_code(backend, addr, size, &code, &code_size);
+  CHECK(res);
+  backend->cache_code(backend, addr, code);
+
+  ctx.num_compiles++;
+}
+
+static void toy_check_interrupts(void *data) {
+  ctx.interrupts = 0;
+  ctx.num_interrupts++;
+}
+
+static void init_toy() {
+  memset(&ctx, 0, sizeof(ctx));
+  memset(mem, 0, sizeof(mem));
+
+  guest.addr_mask = 0xfc;
+  guest.ctx = &ctx;
+  guest.lookup = &toy_lookup;
+  guest.r32 = &toy_r32;
+  guest.offset_pc = offsetof(struct toy_context, pc);
+  guest.offset_cycles = offsetof(struct toy_context, run_cycles);
+  guest.offset_instrs = offsetof(struct toy_context, ran_instrs);
+  guest.offset_interrupts = offsetof(struct toy_context, interrupts);
+  guest.compile_code = &toy_compile_code;
+  guest.check_interrupts = &toy_check_interrupts;
+
+  frontend.guest = &guest;
+  frontend.lookup_op = &toy_lookup_op;
+  frontend.instr_size = 4;
+
+  backend = interp_backend_create(&guest, &frontend);
+}
+
+TEST(interp_backend_cache) {
+  init_toy();
+  mem[0] = INSTR(TOY_ADD, 1);
+  mem[1] = INSTR(TOY_ADD, 2);
+  mem[2] = INSTR(TOY_JMP, 0);
+
+  /* the block costs 4 cycles, and is entered with 10, 6 and 2 cycles left */
+  backend->run_code(backend, 10);
+  CHECK_EQ(ctx.acc, 3 * 3);
+  CHECK_EQ(ctx.ran_instrs, 3 * 3);
+  CHECK_EQ(ctx.num_compiles, 1);
+
+  /* writes to the guest code cause the block to be decoded again */
+  mem[1] = INSTR(TOY_ADD, 5);
+  ctx.acc = 0;
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.acc, 6);
+  CHECK_EQ(ctx.num_compiles, 2);
+
+  ctx.acc = 0;
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.acc, 6);
+  CHECK_EQ(ctx.num_compiles, 2);
+
+  backend->invalidate_code(backend, 0);
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.num_compiles, 3);
+
+  backend->destroy(backend);
+}
+
+TEST(interp_backend_cache_no_lookup) {
+  /* code not backed by host memory is read back through the guest */
+  init_toy();
+  guest.lookup = NULL;
+  mem[0] = INSTR(TOY_ADD, 1);
+  mem[1] = INSTR(TOY_JMP, 0);
+
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.acc, 1);
+  CHECK_EQ(ctx.num_compiles, 1);
+
+  mem[0] = INSTR(TOY_ADD, 7);
+  ctx.acc = 0;
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.acc, 7);
+  CHECK_EQ(ctx.num_compiles, 2);
+
+  backend->destroy(backend);
+}
+
+TEST(interp_backend_early_exit) {
+  init_toy();
+  mem[0] = INSTR(TOY_SKIP, 0);
+  mem[1] = INSTR(TOY_ADD, 1);
+  mem[2] = INSTR(TOY_ADD, 2);
+  mem[3] = INSTR(TOY_JMP, 0x10);
+  mem[4] = INSTR(TOY_JMP, 0x10);
+
+  /* the skipped instruction isn't executed, leaving the block to be looked
+     up again at the new pc */
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.acc, 0);
+  CHECK_EQ(ctx.pc, 8);
+
+  backend->run_code(backend, 0);
+  CHECK_EQ(ctx.acc, 2);
+  CHECK_EQ(ctx.pc, 0x10);
+  CHECK_EQ(ctx.num_compiles, 2);
+
+  backend->destroy(backend);
+}
+
+TEST(interp_backend_interrupts) {
+  init_toy();
+  mem[0] = INSTR(TOY_INTR, 0);
+  mem[1] = INSTR(TOY_JMP, 0x8);
+  mem[2] = INSTR(TOY_JMP, 0x8);
+
+  /* interrupts are serviced on entering the next block */
+  backend->run_code(backend, 3);
+  CHECK_EQ(ctx.num_interrupts, 1);
+  CHECK_EQ(ctx.pc, 0x8);
+
+  backend->destroy(backend);
+}
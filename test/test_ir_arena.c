@@ -0,0 +1,82 @@
+#include "jit/ir/ir.h"
+#include "jit/ir/ir_arena.h"
+#include "retest.h"
+
+TEST(ir_arena_reuse) {
+  struct ir_arena *arena = ir_arena_create();
+  struct ir_arena_stats stats;
+
+  /* freed objects are handed back out for allocations of the same size */
+  void *a = ir_arena_alloc(arena, sizeof(struct ir_instr));
+  void *b = ir_arena_alloc(arena, sizeof(struct ir_value));
+  ir_arena_free(arena, a, sizeof(struct ir_instr));
+  void *c = ir_arena_alloc(arena, sizeof(struct ir_value));
+  void *d = ir_arena_alloc(arena, sizeof(struct ir_instr));
+  CHECK_NE(b, c);
+  CHECK_EQ(a, d);
+
+  ir_arena_stats(arena, &stats);
+  CHECK_EQ(stats.reused, 1);
+  CHECK_EQ(stats.used, stats.peak);
+
+  ir_arena_destroy(arena);
+}
+
+TEST(ir_arena_reset) {
+  struct ir_arena *arena = ir_arena_create();
+  struct ir_arena_stats stats;
+
+  /* fill more than a single chunk */
+  void *first = ir_arena_alloc(arena, 64);
+  for (int i = 0; i < 4096; i++) {
+    ir_arena_alloc(arena, 64);
+  }
+
+  ir_arena_stats(arena, &stats);
+  CHECK_EQ(stats.used, 4097 * 64);
+  CHECK_EQ(stats.peak, 4097 * 64);
+  int reserved = stats.reserved;
+
+  /* resetting releases every allocation, but keeps the chunks */
+  ir_arena_reset(arena);
+  ir_arena_stats(arena, &stats);
+  CHECK_EQ(stats.used, 0);
+  CHECK_EQ(stats.peak, 0);
+  CHECK_EQ(stats.reserved, reserved);
+
+  CHECK_EQ(ir_arena_alloc(arena, 64), first);
+  for (int i = 0; i < 4096; i++) {
+    ir_arena_alloc(arena, 64);
+  }
+
+  ir_arena_stats(arena, &stats);
+  CHECK_EQ(stats.reserved, reserved);
+
+  ir_arena_destroy(arena);
+}
+
+TEST(ir_arena_remove_instr) {
+  struct ir_arena *arena = ir_arena_create();
+  struct ir_arena_stats stats;
+
+  struct ir ir = {0};
+  ir.arena = arena;
+  ir_set_current_block(&ir, ir_append_block(&ir));
+
+  struct ir_value *x = ir_load_context(&ir, 0x0, VALUE_I32);
+  ir_store_context(&ir, 0x4, x);
+
+  ir_arena_stats(arena, &stats);
+  int used = stats.used;
+
+  /* removing an instruction releases it along with its unused result */
+  struct ir_instr *store = ir.cursor.instr;
+  ir_remove_instr(&ir, store);
+  ir_remove_instr(&ir, x->def);
+
+  ir_arena_stats(arena, &stats);
+  CHECK_LT(stats.used, used);
+  CHECK_EQ(stats.peak, used);
+
+  ir_arena_destroy(arena);
+}
@@ -0,0 +1,94 @@
+#include "ir_test_util.h"
+#include "retest.h"
+
+/* emits a block branching to one of two successors, each of which exit the
+   ir. values defined in the entry block are available to both successors,
+   values defined in either successor aren't available to the other */
+static void emit_diamond(struct ir *ir, struct ir_block **t,
+                         struct ir_block **f) {
+  struct ir_insert_point entry = ir_get_insert_point(ir);
+  *t = ir_append_block(ir);
+  *f = ir_append_block(ir);
+
+  ir_set_insert_point(ir, &entry);
+  struct ir_value *cond = ir_load_context(ir, 0x0, VALUE_I32);
+  ir_branch_cond(ir, cond, ir_alloc_block_ref(ir, *t),
+                 ir_alloc_block_ref(ir, *f));
+}
+
+TEST(ir_verify_valid) {
+  struct ir ir;
+  struct ir_block *t, *f;
+  init_ir(&ir);
+
+  struct ir_value *a = ir_load_context(&ir, 0x4, VALUE_I32);
+  emit_diamond(&ir, &t, &f);
+
+  ir_set_current_block(&ir, t);
+  ir_store_context(&ir, 0x8, ir_add(&ir, a, ir_alloc_i32(&ir, 1)));
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x8c000000));
+
+  ir_set_current_block(&ir, f);
+  ir_store_context(&ir, 0x8, a);
+
+  /* tags may hold pass state, and are left untouched */
+  struct ir_instr *load = a->def;
+  load->tag = 1234;
+
+  CHECK(ir_verify(&ir));
+  CHECK_EQ(load->tag, 1234);
+}
+
+TEST(ir_verify_dominance) {
+  struct ir ir;
+  struct ir_block *t, *f;
+
+  /* used before being defined in the same block */
+  init_ir(&ir);
+  ir_store_context(&ir, 0x8, ir_alloc_i32(&ir, 0));
+  struct ir_instr *store = ir.cursor.instr;
+  struct ir_value *a = ir_load_context(&ir, 0x4, VALUE_I32);
+  ir_set_arg1(&ir, store, a);
+
+  CHECK(!ir_verify(&ir));
+
+  /* defined in a block not dominating the use */
+  init_ir(&ir);
+  emit_diamond(&ir, &t, &f);
+
+  ir_set_current_block(&ir, t);
+  a = ir_load_context(&ir, 0x4, VALUE_I32);
+
+  ir_set_current_block(&ir, f);
+  ir_store_context(&ir, 0x8, a);
+
+  CHECK(!ir_verify(&ir));
+}
+
+TEST(ir_verify_malformed) {
+  struct ir ir;
+
+  /* mismatched operand types */
+  init_ir(&ir);
+  struct ir_value *a = ir_load_context(&ir, 0x0, VALUE_I32);
+  struct ir_value *b = ir_add(&ir, a, a);
+  ir_store_context(&ir, 0x4, b);
+  ir_set_arg1(&ir, b->def, ir_alloc_i64(&ir, 1));
+
+  CHECK(!ir_verify(&ir));
+
+  /* branch in the middle of a block */
+  init_ir(&ir);
+  ir_branch(&ir, ir_alloc_i32(&ir, 0x8c000000));
+  ir_store_context(&ir, 0x0, ir_alloc_i32(&ir, 0));
+
+  CHECK(!ir_verify(&ir));
+
+  /* argument missing from its value's use list */
+  init_ir(&ir);
+  a = ir_load_context(&ir, 0x0, VALUE_I32);
+  ir_store_context(&ir, 0x4, a);
+  list_remove(&a->uses, &ir.cursor.instr->used[1].it);
+
+  CHECK(!ir_verify(&ir));
+}
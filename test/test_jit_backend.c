@@ -0,0 +1,288 @@
+#include "core/core.h"
+#include "ir_test_util.h"
+#include "jit/backend/interp/interp_backend.h"
+#include "jit/jit_backend.h"
+#include "jit/jit_frontend.h"
+#include "jit/jit_guest.h"
+#include "jit/passes/register_allocation_pass.h"
+#include "retest.h"
+
+#if ARCH_X64
+#include "jit/backend/x64/x64_backend.h"
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
+#endif
+
+/* runs a toy guest through both the host backend and the interpreter,
+   checking that the compiled code leaves the context exactly as interpreting
+   the same guest code does */
+
+#if ARCH_X64 || ARCH_A64
+
+/* each instruction is a 4 byte word with the op in the top byte and an
+   immediate in the rest */
+enum {
+  TOY_SET,
+  TOY_ADD,
+  TOY_SHL,
+  TOY_MUL,
+  TOY_DJNZ,
+  TOY_JMP,
+};
+
+#define INSTR(op, imm) (((op) << 24) | (imm))
+
+struct toy_context {
+  uint32_t pc;
+  int32_t run_cycles;
+  int32_t ran_instrs;
+  uint64_t interrupts;
+  uint32_t acc;
+  uint32_t cnt;
+};
+
+struct toy {
+  struct toy_context ctx;
+  struct jit_guest guest;
+  struct jit_frontend frontend;
+  struct jit_backend *backend;
+  struct ra *ra;
+};
+
+DEFINE_JIT_CODE_BUFFER(toy_code);
+static uint32_t mem[64];
+static struct toy native;
+static struct toy interp;
+
+#define TOY_CTX ((struct toy_context *)guest->ctx)
+
+static void toy_set(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->cnt = data & 0xffffff;
+  TOY_CTX->pc = addr + 4;
+}
+
+static void toy_add(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->acc += data & 0xffffff;
+  TOY_CTX->pc = addr + 4;
+}
+
+static void toy_shl(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->acc <<= data & 0x1f;
+  TOY_CTX->pc = addr + 4;
+}
+
+static void toy_mul(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->acc *= data & 0xffffff;
+  TOY_CTX->pc = addr + 4;
+}
+
+static void toy_djnz(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->cnt -= 1;
+  TOY_CTX->pc = TOY_CTX->cnt ? (data & 0xffffff) : addr + 4;
+}
+
+static void toy_jmp(struct jit_guest *guest, uint32_t addr, uint32_t data) {
+  TOY_CTX->pc = data & 0xffffff;
+}
+
+static const struct jit_opdef toy_opdefs[] = {
+    {TOY_SET, "set", NULL, NULL, 1, 0, &toy_set},
+    {TOY_ADD, "add", NULL, NULL, 1, 0, &toy_add},
+    {TOY_SHL, "shl", NULL, NULL, 1, 0, &toy_shl},
+    {TOY_MUL, "mul", NULL, NULL, 3, 0, &toy_mul},
+    {TOY_DJNZ, "djnz", NULL, NULL, 2, 0, &toy_djnz},
+    {TOY_JMP, "jmp", NULL, NULL, 2, 0, &toy_jmp},
+};
+
+static const struct jit_opdef *toy_lookup_op(struct jit_frontend *frontend,
+                                             const void *instr) {
+  return &toy_opdefs[*(const uint32_t *)instr >> 24];
+}
+
+static uint32_t toy_r32(struct memory *m, uint32_t addr) {
+  return mem[addr >> 2];
+}
+
+static void toy_lookup(struct memory *m, uint32_t addr, void **userdata,
+                       uint8_t **ptr, mem_read_cb *read, mem_write_cb *write) {
+  *ptr = (uint8_t *)mem + addr;
+}
+
+static int toy_block_size(uint32_t addr) {
+  /* blocks run up to and including the next branch */
+  int size = 0;
+
+  while (1) {
+    int op = mem[(addr + size) >> 2] >> 24;
+    size += 4;
+
+    if (op == TOY_DJNZ || op == TOY_JMP) {
+      return size;
+    }
+  }
+}
+
+static struct ir_value *toy_load(struct ir *ir, int offset) {
+  return ir_load_context(ir, offset, VALUE_I32);
+}
+
+static void toy_translate(struct ir *ir, uint32_t addr, int size) {
+  for (uint32_t end = addr + size; addr < end; addr += 4) {
+    uint32_t data = mem[addr >> 2];
+    const struct jit_opdef *def = &toy_opdefs[data >> 24];
+    struct ir_value *imm = ir_alloc_i32(ir, data & 0xffffff);
+    int acc = offsetof(struct toy_context, acc);
+    int cnt = offsetof(struct toy_context, cnt);
+
+    ir_source_info(ir, addr, def->cycles);
+
+    switch (def->op) {
+      case TOY_SET:
+        ir_store_context(ir, cnt, imm);
+        break;
+      case TOY_ADD:
+        ir_store_context(ir, acc, ir_add(ir, toy_load(ir, acc), imm));
+        break;
+      case TOY_SHL:
+        ir_store_context(ir, acc, ir_shl(ir, toy_load(ir, acc), imm));
+        break;
+      case TOY_MUL:
+        /* exercise calling out of the compiled code */
+        ir_fallback(ir, def->fallback, addr, data);
+        break;
+      case TOY_DJNZ: {
+        struct ir_value *v = ir_sub(ir, toy_load(ir, cnt), ir_alloc_i32(ir, 1));
+        ir_store_context(ir, cnt, v);
+        ir_branch_cond(ir, ir_cmp_ne(ir, v, ir_alloc_i32(ir, 0)), imm,
+                       ir_alloc_i32(ir, addr + 4));
+      } break;
+      case TOY_JMP:
+        ir_branch(ir, imm);
+        break;
+    }
+  }
+}
+
+static void toy_compile_native(void *data, uint32_t addr) {
+  struct ir ir;
+  init_ir(&ir);
+
+  toy_translate(&ir, addr, toy_block_size(addr));
+  ra_run(native.ra, &ir);
+
+  uint8_t *code;
+  int code_size;
+  int res = native.backend->assemble_code(native.backend, &ir, &code,
+                                          &code_size, NULL, NULL);
+  CHECK(res);
+  native.backend->cache_code(native.backend, addr, code);
+}
+
+static void toy_compile_interp(void *data, uint32_t addr) {
+  uint8_t *code;
+  int code_size;
+  int res = interp.backend->decode_code(interp.backend, addr,
+                                        toy_block_size(addr), &code,
+                                        &code_size);
+  CHECK(res);
+  interp.backend->cache_code(interp.backend, addr, code);
+}
+
+static void toy_link_code(void *data, uint32_t addr) {}
+
+static void toy_check_interrupts(void *data) {}
+
+static void init_guest(struct toy *toy, jit_compile_cb compile_code) {
+  memset(toy, 0, sizeof(*toy));
+
+  struct jit_guest *guest = &toy->guest;
+  guest->addr_mask = 0xfc;
+  guest->ctx = &toy->ctx;
+  guest->lookup = &toy_lookup;
+  guest->r32 = &toy_r32;
+  guest->offset_pc = offsetof(struct toy_context, pc);
+  guest->offset_cycles = offsetof(struct toy_context, run_cycles);
+  guest->offset_instrs = offsetof(struct toy_context, ran_instrs);
+  guest->offset_interrupts = offsetof(struct toy_context, interrupts);
+  guest->compile_code = compile_code;
+  guest->link_code = &toy_link_code;
+  guest->check_interrupts = &toy_check_interrupts;
+
+  toy->frontend.guest = guest;
+  toy->frontend.lookup_op = &toy_lookup_op;
+  toy->frontend.instr_size = 4;
+}
+
+static void init_toys() {
+  init_guest(&native, &toy_compile_native);
+#if ARCH_X64
+  native.backend =
+      x64_backend_create(&native.guest, toy_code, sizeof(toy_code));
+#else
+  native.backend =
+      a64_backend_create(&native.guest, toy_code, sizeof(toy_code));
+#endif
+  struct jit_backend *b = native.backend;
+  native.ra = ra_create(b->registers, b->num_registers, b->emitters,
+                        b->num_emitters);
+
+  init_guest(&interp, &toy_compile_interp);
+  interp.backend = interp_backend_create(&interp.guest, &interp.frontend);
+}
+
+static void destroy_toys() {
+  ra_destroy(native.ra);
+  native.backend->destroy(native.backend);
+  interp.backend->destroy(interp.backend);
+}
+
+/* runs each backend from the start of the program with the same number of
+   cycles, returning the context left by the host backend */
+static struct toy_context *run_toys(int cycles) {
+  native.ctx.pc = interp.ctx.pc = 0;
+  native.ctx.acc = interp.ctx.acc = 0;
+  native.ctx.cnt = interp.ctx.cnt = 0;
+
+  native.backend->run_code(native.backend, cycles);
+  interp.backend->run_code(interp.backend, cycles);
+
+  CHECK_EQ(native.ctx.pc, interp.ctx.pc);
+  CHECK_EQ(native.ctx.run_cycles, interp.ctx.run_cycles);
+  CHECK_EQ(native.ctx.ran_instrs, interp.ctx.ran_instrs);
+  CHECK_EQ(native.ctx.acc, interp.ctx.acc);
+  CHECK_EQ(native.ctx.cnt, interp.ctx.cnt);
+
+  return &native.ctx;
+}
+
+TEST(jit_backend_matches_interp) {
+  init_toys();
+
+  memset(mem, 0, sizeof(mem));
+  mem[0] = INSTR(TOY_SET, 10);
+  mem[1] = INSTR(TOY_ADD, 3);
+  mem[2] = INSTR(TOY_SHL, 1);
+  mem[3] = INSTR(TOY_MUL, 3);
+  mem[4] = INSTR(TOY_DJNZ, 0x4);
+  mem[5] = INSTR(TOY_JMP, 0x14);
+
+  /* stop at every point a block may yield at, from exiting before the first
+     block is entered up to spinning on the final jmp */
+  for (int cycles = -1; cycles < 100; cycles++) {
+    run_toys(cycles);
+  }
+
+  uint32_t acc = 0;
+  for (int i = 0; i < 10; i++) {
+    acc = ((acc + 3) << 1) * 3;
+  }
+
+  struct toy_context *ctx = run_toys(100);
+  CHECK_EQ(ctx->pc, 0x14);
+  CHECK_EQ(ctx->acc, acc);
+  CHECK_EQ(ctx->cnt, 0);
+
+  destroy_toys();
+}
+
+#endif
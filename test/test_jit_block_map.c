@@ -0,0 +1,230 @@
+#include "retest.h"
+#include "core/core.h"
+#include "core/time.h"
+#include "jit/jit.h"
+
+#define MAX_BLOCKS 0x4000
+#define NUM_LOOKUPS 0x100000
+static struct jit_block blocks[MAX_BLOCKS];
+static uint8_t code[MAX_BLOCKS * 64];
+
+/* rb_tree-based maps the flat maps replaced, kept around as a baseline for
+   the lookup benchmarks */
+struct rb_block {
+  struct jit_block *block;
+  struct rb_node it;
+  struct rb_node rit;
+};
+
+static struct rb_block rb_blocks[MAX_BLOCKS];
+
+static int rb_block_cmp(const struct rb_node *rb_lhs,
+                        const struct rb_node *rb_rhs) {
+  const struct rb_block *lhs = container_of(rb_lhs, const struct rb_block, it);
+  const struct rb_block *rhs = container_of(rb_rhs, const struct rb_block, it);
+  return (int)(lhs->block->guest_addr > rhs->block->guest_addr) -
+         (int)(lhs->block->guest_addr < rhs->block->guest_addr);
+}
+
+static int rb_block_reverse_cmp(const struct rb_node *rb_lhs,
+                                const struct rb_node *rb_rhs) {
+  const struct rb_block *lhs = container_of(rb_lhs, const struct rb_block, rit);
+  const struct rb_block *rhs = container_of(rb_rhs, const struct rb_block, rit);
+  return (int)(lhs->block->host_addr > rhs->block->host_addr) -
+         (int)(lhs->block->host_addr < rhs->block->host_addr);
+}
+
+static struct rb_callbacks rb_block_cb = {
+    &rb_block_cmp, NULL, NULL,
+};
+
+static struct rb_callbacks rb_block_reverse_cb = {
+    &rb_block_reverse_cmp, NULL, NULL,
+};
+
+static void init_blocks() {
+  /* lay blocks out like the backend would, back to back with varying sizes,
+     and give them sparse guest addresses */
+  uint8_t *host_addr = code;
+
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    struct jit_block *block = &blocks[i];
+    memset(block, 0, sizeof(*block));
+    block->guest_addr = 0x8c010000 + i * 0x20;
+    block->guest_size = 0x20;
+    block->host_addr = host_addr;
+    block->host_size = 16 + (rand() % 48);
+    host_addr += block->host_size;
+
+    rb_blocks[i].block = block;
+  }
+}
+
+static void init_maps(struct jit_block_map *map,
+                      struct jit_reverse_block_map *rmap) {
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    jit_block_map_insert(map, &blocks[i]);
+    jit_reverse_block_map_insert(rmap, &blocks[i]);
+  }
+}
+
+TEST(jit_block_map_find) {
+  struct jit_block_map map = {0};
+  struct jit_reverse_block_map rmap = {0};
+  init_blocks();
+  init_maps(&map, &rmap);
+
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    struct jit_block *block = &blocks[i];
+    CHECK_EQ(jit_block_map_find(&map, block->guest_addr), block);
+    CHECK_EQ(jit_reverse_block_map_find(&rmap, block->host_addr), block);
+    CHECK_EQ(jit_reverse_block_map_find(
+                 &rmap, block->host_addr + block->host_size - 1),
+             block);
+  }
+
+  /* addresses outside of any block */
+  CHECK_EQ(jit_block_map_find(&map, 0x8c010001), NULL);
+  CHECK_EQ(jit_reverse_block_map_find(&rmap, code - 1), NULL);
+  struct jit_block *last = &blocks[MAX_BLOCKS - 1];
+  CHECK_EQ(jit_reverse_block_map_find(&rmap, last->host_addr + last->host_size),
+           NULL);
+
+  jit_block_map_destroy(&map);
+  jit_reverse_block_map_destroy(&rmap);
+}
+
+TEST(jit_block_map_remove) {
+  struct jit_block_map map = {0};
+  struct jit_reverse_block_map rmap = {0};
+  init_blocks();
+  init_maps(&map, &rmap);
+
+  /* remove every other block while iterating */
+  int num_blocks = 0;
+
+  jit_block_map_for_each(block, &map) {
+    if ((block - blocks) % 2) {
+      jit_block_map_remove(&map, block);
+      jit_reverse_block_map_remove(&rmap, block);
+    }
+    num_blocks++;
+  }
+
+  CHECK_EQ(num_blocks, MAX_BLOCKS);
+  CHECK_EQ(map.num_entries, MAX_BLOCKS / 2);
+
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    struct jit_block *block = &blocks[i];
+    struct jit_block *expected = (i % 2) ? NULL : block;
+    CHECK_EQ(jit_block_map_find(&map, block->guest_addr), expected);
+    CHECK_EQ(jit_reverse_block_map_find(&rmap, block->host_addr), expected);
+  }
+
+  /* removed entries can be reinserted */
+  for (int i = 1; i < MAX_BLOCKS; i += 2) {
+    jit_block_map_insert(&map, &blocks[i]);
+  }
+
+  CHECK_EQ(map.num_entries, MAX_BLOCKS);
+  CHECK_EQ(jit_block_map_find(&map, blocks[1].guest_addr), &blocks[1]);
+
+  jit_block_map_destroy(&map);
+  jit_reverse_block_map_destroy(&rmap);
+}
+
+TEST(jit_block_find_source) {
+  /* a superblock whose entry block at 0x0 ends in a conditional branch, with
+     the taken successor at 0xc emitted ahead of the fallthrough at 0x4 */
+  void *source_map[0x10] = {0};
+  struct jit_block block = {0};
+  block.guest_size = 0x10;
+  block.source_map = source_map;
+  block.host_addr = code;
+
+  source_map[0x0] = code;
+  source_map[0x2] = code + 0x8;
+  source_map[0xc] = code + 0x10;
+  source_map[0xe] = code + 0x18;
+  source_map[0x4] = code + 0x20;
+  source_map[0x6] = code + 0x28;
+
+  CHECK_EQ(jit_block_find_source(&block, code + 0x4), 0x0);
+  CHECK_EQ(jit_block_find_source(&block, code + 0x8), 0x2);
+
+  /* faults in the taken successor resolve to it, not to the entry block */
+  CHECK_EQ(jit_block_find_source(&block, code + 0x14), 0xc);
+  CHECK_EQ(jit_block_find_source(&block, code + 0x1c), 0xe);
+
+  CHECK_EQ(jit_block_find_source(&block, code + 0x24), 0x4);
+  CHECK_EQ(jit_block_find_source(&block, code + 0x30), 0x6);
+}
+
+TEST(jit_block_map_benchmark) {
+  struct jit_block_map map = {0};
+  struct jit_reverse_block_map rmap = {0};
+  struct rb_tree tree = {0};
+  struct rb_tree rtree = {0};
+  init_blocks();
+  init_maps(&map, &rmap);
+
+  for (int i = 0; i < MAX_BLOCKS; i++) {
+    rb_insert(&tree, &rb_blocks[i].it, &rb_block_cb);
+    rb_insert(&rtree, &rb_blocks[i].rit, &rb_block_reverse_cb);
+  }
+
+  /* lookups are done in a random order to avoid measuring the cache behavior
+     of walking the blocks sequentially */
+  static int order[NUM_LOOKUPS];
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    order[i] = rand() % MAX_BLOCKS;
+  }
+
+  int64_t start, flat_ns, rb_ns, flat_reverse_ns, rb_reverse_ns;
+  int found = 0;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    found += jit_block_map_find(&map, blocks[order[i]].guest_addr) != NULL;
+  }
+  flat_ns = time_nanoseconds() - start;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    struct rb_block search;
+    search.block = &blocks[order[i]];
+    found += rb_find(&tree, &search.it, &rb_block_cb) != NULL;
+  }
+  rb_ns = time_nanoseconds() - start;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    struct jit_block *block = &blocks[order[i]];
+    found += jit_reverse_block_map_find(&rmap, block->host_addr + 1) != NULL;
+  }
+  flat_reverse_ns = time_nanoseconds() - start;
+
+  start = time_nanoseconds();
+  for (int i = 0; i < NUM_LOOKUPS; i++) {
+    struct jit_block search_block;
+    struct rb_block search;
+    search_block.host_addr = blocks[order[i]].host_addr + 1;
+    search.block = &search_block;
+    struct rb_node *rit =
+        rb_upper_bound(&rtree, &search.rit, &rb_block_reverse_cb);
+    rit = rit ? rb_prev(rit) : rb_last(&rtree);
+    found += rit != NULL;
+  }
+  rb_reverse_ns = time_nanoseconds() - start;
+
+  CHECK_EQ(found, NUM_LOOKUPS * 4);
+
+  LOG_INFO("guest lookup: flat %.2f ns, rb_tree %.2f ns",
+           flat_ns / (double)NUM_LOOKUPS, rb_ns / (double)NUM_LOOKUPS);
+  LOG_INFO("host lookup: flat %.2f ns, rb_tree %.2f ns",
+           flat_reverse_ns / (double)NUM_LOOKUPS,
+           rb_reverse_ns / (double)NUM_LOOKUPS);
+
+  jit_block_map_destroy(&map);
+  jit_reverse_block_map_destroy(&rmap);
+}
@@ -0,0 +1,29 @@
+#include "ir_test_util.h"
+#include "jit/jit_pass_manager.h"
+#include "retest.h"
+
+TEST(jit_pass_manager_pipeline) {
+  /* unknown passes and whitespace are skipped */
+  struct jit_pass_manager *pm =
+      jit_pass_manager_create("test", NULL, "cfa, cprop,,unknown ,dce");
+
+  CHECK_EQ(jit_pass_manager_num_passes(pm), 3);
+  CHECK_STREQ(jit_pass_manager_pass_name(pm, 0), "cfa");
+  CHECK_STREQ(jit_pass_manager_pass_name(pm, 1), "cprop");
+  CHECK_STREQ(jit_pass_manager_pass_name(pm, 2), "dce");
+
+  /* the constant add is folded into the store, then removed */
+  struct ir ir;
+  init_ir(&ir);
+  struct ir_value *a = ir_add(&ir, ir_alloc_i32(&ir, 1), ir_alloc_i32(&ir, 2));
+  ir_store_context(&ir, 0x0, a);
+  struct ir_instr *store = ir.cursor.instr;
+
+  jit_pass_manager_run(pm, &ir);
+
+  CHECK_EQ(count_instrs(&ir), 1);
+  CHECK(ir_is_constant(store->arg[1]));
+  CHECK_EQ(store->arg[1]->i32, 3);
+
+  jit_pass_manager_destroy(pm);
+}
@@ -1,8 +1,8 @@
-#include "jit/ir/ir.h"
+#include "ir_test_util.h"
+#include "jit/passes/control_flow_analysis_pass.h"
 #include "jit/passes/load_store_elimination_pass.h"
 #include "retest.h"
 
-static uint8_t ir_buffer[1024 * 1024];
 static char scratch_buffer[1024 * 1024];
 
 /*TEST(load_store_elimination) {
@@ -56,8 +56,7 @@ static char scratch_buffer[1024 * 1024];
       "store_context i32 0x20, i32 %5\n";
 
   struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+  ir.arena = ir_arena_create();
 
   FILE *input = tmpfile();
   fwrite(input_str, 1, sizeof(input_str) - 1, input);
@@ -78,4 +77,69 @@ static char scratch_buffer[1024 * 1024];
   CHECK_NE(n, 0u);
 
   CHECK_STREQ(scratch_buffer, output_str);
+
+  ir_arena_destroy(ir.arena);
 }*/
+
+static int count_context_ops(struct ir *ir, enum ir_op op, int offset) {
+  int n = 0;
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      n += instr->op == op && instr->arg[0]->i32 == offset;
+    }
+  }
+  return n;
+}
+
+TEST(load_store_elimination_cross_block) {
+  struct ir ir;
+  init_ir(&ir);
+
+  struct ir_block *entry = ir.cursor.block;
+  struct ir_block *then = ir_append_block(&ir);
+  struct ir_block *other = ir_append_block(&ir);
+  struct ir_block *join = ir_append_block(&ir);
+
+  ir_set_current_block(&ir, entry);
+  struct ir_value *x = ir_load_context(&ir, 0x0, VALUE_I32);
+  ir_store_context(&ir, 0x10, ir_alloc_i32(&ir, 5));
+  ir_store_context(&ir, 0x20, x);
+  ir_store_context(&ir, 0x40, ir_alloc_i32(&ir, 1));
+  ir_store_context(&ir, 0x50, ir_alloc_i32(&ir, 1));
+  ir_branch_cond(&ir, ir_cmp_eq(&ir, x, ir_alloc_i32(&ir, 0)),
+                 ir_alloc_block_ref(&ir, then),
+                 ir_alloc_block_ref(&ir, other));
+
+  /* constants are forwarded across blocks, other values aren't as they'd be
+     live across the block boundary */
+  ir_set_current_block(&ir, then);
+  ir_store_context(&ir, 0x30, ir_load_context(&ir, 0x10, VALUE_I32));
+  ir_store_context(&ir, 0x34, ir_load_context(&ir, 0x20, VALUE_I32));
+  ir_store_context(&ir, 0x40, ir_alloc_i32(&ir, 2));
+  ir_store_context(&ir, 0x50, ir_alloc_i32(&ir, 2));
+  branch_to(&ir, join);
+
+  ir_set_current_block(&ir, other);
+  ir_store_context(&ir, 0x10, ir_alloc_i32(&ir, 5));
+  ir_store_context(&ir, 0x40, ir_alloc_i32(&ir, 3));
+  branch_to(&ir, join);
+
+  /* 0x10 holds the same constant along both paths */
+  ir_set_current_block(&ir, join);
+  ir_store_context(&ir, 0x38, ir_load_context(&ir, 0x10, VALUE_I32));
+
+  struct cfa *cfa = cfa_create();
+  cfa_run(cfa, &ir);
+  cfa_destroy(cfa);
+
+  struct lse *lse = lse_create();
+  lse_run(lse, &ir);
+  lse_destroy(lse);
+
+  CHECK_EQ(count_context_ops(&ir, OP_LOAD_CONTEXT, 0x10), 0);
+  CHECK_EQ(count_context_ops(&ir, OP_LOAD_CONTEXT, 0x20), 1);
+
+  /* 0x40 is overwritten along every path, 0x50 only along one */
+  CHECK_EQ(count_context_ops(&ir, OP_STORE_CONTEXT, 0x40), 2);
+  CHECK_EQ(count_context_ops(&ir, OP_STORE_CONTEXT, 0x50), 2);
+}
@@ -0,0 +1,142 @@
+#include "ir_test_util.h"
+#include "jit/passes/loop_invariant_code_motion_pass.h"
+#include "retest.h"
+
+static void run_licm(struct ir *ir) {
+  struct licm *licm = licm_create();
+  licm_run(licm, ir);
+  licm_destroy(licm);
+}
+
+/* branches from the entry block, acting as the preheader, to a header which
+   loops back on itself while r0 != 0 */
+static struct ir_block *emit_loop(struct ir *ir, struct ir_block **preheader) {
+  *preheader = ir->cursor.block;
+  struct ir_block *header = ir_append_block(ir);
+
+  ir_set_current_block(ir, *preheader);
+  ir_branch(ir, ir_alloc_block_ref(ir, header));
+
+  ir_set_current_block(ir, header);
+  ir_source_info(ir, 0x8c000000, 1);
+
+  return header;
+}
+
+static void emit_latch(struct ir *ir, struct ir_block *header) {
+  struct ir_value *r0 = ir_load_context(ir, 0x0, VALUE_I32);
+  r0 = ir_sub(ir, r0, ir_alloc_i32(ir, 1));
+  ir_store_context(ir, 0x0, r0);
+  ir_branch_cond(ir, ir_cmp_ne(ir, r0, ir_alloc_i32(ir, 0)),
+                 ir_alloc_block_ref(ir, header), ir_alloc_i32(ir, 0x8c000004));
+}
+
+static void emit_fpscr_check(struct ir *ir) {
+  struct ir_value *fpscr = ir_load_context(ir, 0x40, VALUE_I32);
+  fpscr = ir_and(ir, fpscr, ir_alloc_i32(ir, 0x180000));
+  ir_assert_eq(ir, fpscr, ir_alloc_i32(ir, 0x80000));
+}
+
+TEST(loop_invariant_code_motion_assert) {
+  struct ir ir;
+  struct ir_block *preheader, *header;
+  init_ir(&ir);
+
+  header = emit_loop(&ir, &preheader);
+  emit_fpscr_check(&ir);
+  emit_latch(&ir, header);
+
+  run_licm(&ir);
+
+  /* the check is hoisted, ahead of the branch into the loop */
+  CHECK_EQ(count_block_ops(preheader, OP_ASSERT_EQ), 1);
+  CHECK_EQ(count_block_ops(preheader, OP_LOAD_CONTEXT), 1);
+  CHECK_EQ(count_block_ops(preheader, OP_AND), 1);
+  CHECK_EQ(list_last_entry(&preheader->instrs, struct ir_instr, it)->op,
+           OP_BRANCH);
+
+  /* the loop counter changes on every iteration */
+  CHECK_EQ(count_block_ops(header, OP_ASSERT_EQ), 0);
+  CHECK_EQ(count_block_ops(header, OP_LOAD_CONTEXT), 1);
+  CHECK_EQ(count_block_ops(header, OP_STORE_CONTEXT), 1);
+}
+
+TEST(loop_invariant_code_motion_variant) {
+  struct ir ir;
+  struct ir_block *preheader, *header;
+
+  /* fpscr is written by the loop */
+  init_ir(&ir);
+  header = emit_loop(&ir, &preheader);
+  emit_fpscr_check(&ir);
+  ir_store_context(&ir, 0x42, ir_alloc_i16(&ir, 0));
+  emit_latch(&ir, header);
+
+  run_licm(&ir);
+  CHECK_EQ(count_block_ops(preheader, OP_ASSERT_EQ), 0);
+
+  /* the loop calls out, which may write to fpscr */
+  init_ir(&ir);
+  header = emit_loop(&ir, &preheader);
+  emit_fpscr_check(&ir);
+  ir_call(&ir, ir_alloc_ptr(&ir, NULL));
+  emit_latch(&ir, header);
+
+  run_licm(&ir);
+  CHECK_EQ(count_block_ops(preheader, OP_ASSERT_EQ), 0);
+
+  /* the invariant load is also used by the loop body. carrying it into the
+     loop would only replace it with a load from a local, so neither it nor
+     the assert using it are hoisted */
+  init_ir(&ir);
+  header = emit_loop(&ir, &preheader);
+  struct ir_value *r1 = ir_load_context(&ir, 0x4, VALUE_I32);
+  ir_assert_lt(&ir, r1, ir_alloc_i32(&ir, 16));
+  ir_store_context(&ir, 0x8, r1);
+  emit_latch(&ir, header);
+
+  run_licm(&ir);
+  CHECK_EQ(count_block_ops(preheader, OP_ASSERT_LT), 0);
+  CHECK_EQ(count_block_ops(preheader, OP_LOAD_CONTEXT), 0);
+  CHECK_EQ(count_block_ops(header, OP_LOAD_CONTEXT), 2);
+}
+
+TEST(loop_invariant_code_motion_live_in) {
+  struct ir ir;
+  struct ir_block *preheader, *header;
+  init_ir(&ir);
+
+  /* an invariant tree whose result is used by the loop body */
+  header = emit_loop(&ir, &preheader);
+  struct ir_value *r1 = ir_load_context(&ir, 0x4, VALUE_I32);
+  r1 = ir_shl(&ir, r1, ir_alloc_i32(&ir, 2));
+  r1 = ir_add(&ir, r1, ir_alloc_i32(&ir, 0x8c000000));
+  ir_store_context(&ir, 0x8, r1);
+  emit_latch(&ir, header);
+
+  run_licm(&ir);
+
+  /* the tree is hoisted and its result stored to a local before the branch
+     into the loop */
+  CHECK_EQ(count_block_ops(preheader, OP_LOAD_CONTEXT), 1);
+  CHECK_EQ(count_block_ops(preheader, OP_SHL), 1);
+  CHECK_EQ(count_block_ops(preheader, OP_ADD), 1);
+  CHECK_EQ(count_block_ops(preheader, OP_STORE_LOCAL), 1);
+  CHECK_EQ(list_last_entry(&preheader->instrs, struct ir_instr, it)->op,
+           OP_BRANCH);
+
+  /* the loop body uses the result loaded back from the local */
+  struct ir_instr *load = list_first_entry(&header->instrs, struct ir_instr, it);
+  CHECK_EQ(load->op, OP_LOAD_LOCAL);
+  CHECK_EQ(count_block_ops(header, OP_LOAD_LOCAL), 1);
+  CHECK_EQ(count_block_ops(header, OP_SHL), 0);
+  CHECK_EQ(count_block_ops(header, OP_ADD), 0);
+
+  list_for_each_entry(instr, &header->instrs, struct ir_instr, it) {
+    if (instr->op == OP_STORE_CONTEXT && instr->arg[0]->i32 == 0x8) {
+      CHECK_EQ(instr->arg[1], load->result);
+    }
+  }
+
+  CHECK_EQ(ir.locals_size, 4);
+}
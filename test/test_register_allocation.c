@@ -0,0 +1,97 @@
+#include "ir_test_util.h"
+#include "jit/jit_backend.h"
+#include "jit/passes/register_allocation_pass.h"
+#include "retest.h"
+
+#define REG_CALLER (JIT_ALLOCATE | JIT_CALLER_SAVE | JIT_REG_I64)
+#define REG_CALLEE (JIT_ALLOCATE | JIT_CALLEE_SAVE | JIT_REG_I64)
+
+static const struct jit_register caller_registers[] = {
+    {"r0", REG_CALLER, NULL},
+};
+
+static const struct jit_register mixed_registers[] = {
+    {"r0", REG_CALLER, NULL},
+    {"r1", REG_CALLER, NULL},
+    {"r2", REG_CALLEE, NULL},
+};
+
+static struct jit_emitter emitters[IR_NUM_OPS];
+
+static void run_ra(struct ir *ir, const struct jit_register *registers,
+                   int num_registers) {
+  /* every op accepts any register or immediate */
+  for (int i = 0; i < IR_NUM_OPS; i++) {
+    struct jit_emitter *emitter = &emitters[i];
+    emitter->res_flags = JIT_REG_I64 | JIT_OPTIONAL;
+
+    for (int j = 0; j < IR_MAX_ARGS; j++) {
+      emitter->arg_flags[j] =
+          JIT_REG_I64 | JIT_IMM_I64 | JIT_IMM_BLK | JIT_OPTIONAL;
+    }
+  }
+
+  struct ra *ra = ra_create(registers, num_registers, emitters, IR_NUM_OPS);
+  ra_run(ra, ir);
+  ra_destroy(ra);
+}
+
+TEST(register_allocation_split_at_call) {
+  struct ir ir;
+  init_ir(&ir);
+
+  /* x reuses the caller-saved register a was allocated, and is live across
+     the call. with a callee-saved register free, it's moved there instead of
+     being spilled */
+  struct ir_value *a = ir_load_context(&ir, 0x0, VALUE_I32);
+  struct ir_value *x = ir_add(&ir, a, ir_alloc_i32(&ir, 1));
+  ir_call(&ir, ir_alloc_ptr(&ir, NULL));
+  ir_store_context(&ir, 0x4, x);
+  struct ir_instr *store = ir.cursor.instr;
+
+  run_ra(&ir, mixed_registers, ARRAY_SIZE(mixed_registers));
+
+  CHECK_EQ(count_ops(&ir, OP_STORE_LOCAL), 0);
+  CHECK_EQ(count_ops(&ir, OP_COPY), 1);
+  CHECK_EQ(store->arg[1]->def->op, OP_COPY);
+  CHECK_EQ(store->arg[1]->reg, 2);
+}
+
+TEST(register_allocation_prefer_callee_saved) {
+  struct ir ir;
+  init_ir(&ir);
+
+  /* a is only used before the call, x is live across it */
+  struct ir_value *a = ir_load_context(&ir, 0x0, VALUE_I32);
+  struct ir_value *x = ir_load_context(&ir, 0x4, VALUE_I32);
+  ir_store_context(&ir, 0x8, a);
+  ir_call(&ir, ir_alloc_ptr(&ir, NULL));
+  ir_store_context(&ir, 0xc, x);
+
+  run_ra(&ir, mixed_registers, ARRAY_SIZE(mixed_registers));
+
+  CHECK_EQ(count_ops(&ir, OP_STORE_LOCAL), 0);
+  CHECK_EQ(count_ops(&ir, OP_COPY), 0);
+  CHECK_EQ(a->reg, 0);
+  CHECK_EQ(x->reg, 2);
+}
+
+TEST(register_allocation_reuse_slots) {
+  struct ir ir;
+  init_ir(&ir);
+
+  /* with only a caller-saved register, both values are spilled at their
+     calls. their ranges don't overlap, so they share a stack slot */
+  struct ir_value *a = ir_load_context(&ir, 0x0, VALUE_I32);
+  ir_call(&ir, ir_alloc_ptr(&ir, NULL));
+  ir_store_context(&ir, 0x4, a);
+  struct ir_value *b = ir_load_context(&ir, 0x8, VALUE_I32);
+  ir_call(&ir, ir_alloc_ptr(&ir, NULL));
+  ir_store_context(&ir, 0xc, b);
+
+  run_ra(&ir, caller_registers, ARRAY_SIZE(caller_registers));
+
+  CHECK_EQ(count_ops(&ir, OP_STORE_LOCAL), 2);
+  CHECK_EQ(count_ops(&ir, OP_LOAD_LOCAL), 2);
+  CHECK_EQ(ir.locals_size, 4);
+}
@@ -1,26 +1,62 @@
 #include "core/core.h"
 #include "core/filesystem.h"
 #include "core/option.h"
-#include "jit/backend/x64/x64_backend.h"
+#include "core/time.h"
 #include "jit/ir/ir.h"
+#include "jit/ir/ir_arena.h"
 #include "jit/jit.h"
 #include "jit/jit_guest.h"
+#include "jit/jit_pass_manager.h"
 #include "jit/pass_stats.h"
-#include "jit/passes/constant_propagation_pass.h"
-#include "jit/passes/control_flow_analysis_pass.h"
-#include "jit/passes/dead_code_elimination_pass.h"
-#include "jit/passes/expression_simplification_pass.h"
-#include "jit/passes/load_store_elimination_pass.h"
-#include "jit/passes/register_allocation_pass.h"
-
-DEFINE_OPTION_STRING(pass, "cfa,lse,cprop,esimp,dce,ra",
+
+#if ARCH_X64
+#include "jit/backend/x64/x64_backend.h"
+#define HOST_ARCH "x64"
+#define host_backend_create x64_backend_create
+#elif ARCH_A64
+#include "jit/backend/a64/a64_backend.h"
+#define HOST_ARCH "a64"
+#define host_backend_create a64_backend_create
+#endif
+
+DEFINE_OPTION_STRING(pass, "cfa,lse,cprop,esimp,cse,licm,cfuse,dce,ra",
                      "Comma-separated list of passes to run");
+DEFINE_OPTION_INT(bench, 0,
+                  "Compile the input this many times, reporting throughput");
+DEFINE_OPTION_STRING(baseline, "",
+                     "Baseline results to compare the benchmark against");
+DEFINE_OPTION_INT(update_baseline, 0,
+                  "Write the benchmark results to the baseline instead");
+DEFINE_OPTION_INT(tolerance, 10,
+                  "Allowed throughput regression from the baseline, in percent");
 
 DEFINE_PASS_STAT(ir_instrs_total, "total ir instructions");
 DEFINE_PASS_STAT(ir_instrs_removed, "removed ir instructions");
+DEFINE_PASS_STAT(ir_peak_bytes, "max ir bytes allocated for a file");
+DEFINE_PASS_STAT(ir_reserved_bytes, "ir bytes reserved");
+DEFINE_PASS_STAT(code_hot_bytes, "host code bytes in hot paths");
+DEFINE_PASS_STAT(code_cold_bytes, "host code bytes in cold paths");
 
 DEFINE_JIT_CODE_BUFFER(code);
-static uint8_t ir_buffer[1024 * 1024];
+
+/* totals accumulated over every compiled file */
+static struct {
+  int64_t ns;
+  int64_t blocks;
+  int64_t instrs;
+  int64_t code_size;
+  int64_t spills;
+} totals;
+
+/* results of a benchmark run, normalized to a single pass over the corpus */
+struct bench_results {
+  double blocks;
+  double instrs;
+  double blocks_per_sec;
+  double instrs_per_sec;
+  double code_size;
+  double spills;
+};
 
 static int get_num_instrs(const struct ir *ir) {
   int n = 0;
@@ -35,6 +71,25 @@ static int get_num_instrs(const struct ir *ir) {
   return n;
 }
 
+static int get_num_spills(const struct ir *ir) {
+  int n = 0;
+
+  list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
+    list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
+      n += instr->op == OP_STORE_LOCAL;
+    }
+  }
+
+  return n;
+}
+
+static void emit_callback(uint8_t **cold_addr, int type, uint32_t guest_addr,
+                          uint8_t *host_addr) {
+  if (type == JIT_EMIT_COLD) {
+    *cold_addr = host_addr;
+  }
+}
+
 static void sanitize_ir(struct ir *ir) {
   list_for_each_entry(block, &ir->blocks, struct ir_block, it) {
     list_for_each_entry(instr, &block->instrs, struct ir_instr, it) {
@@ -50,11 +105,13 @@ static void sanitize_ir(struct ir *ir) {
   }
 }
 
-static void process_file(struct jit_backend *backend, const char *filename,
-                         int disable_dumps) {
+static void process_file(struct jit_backend *backend,
+                         struct jit_pass_manager *pm, struct ir_arena *arena,
+                         const char *filename, int disable_dumps) {
+  ir_arena_reset(arena);
+
   struct ir ir = {0};
-  ir.buffer = ir_buffer;
-  ir.capacity = sizeof(ir_buffer);
+  ir.arena = arena;
 
   /* read in the input ir */
   FILE *input = fopen(filename, "r");
@@ -67,78 +124,72 @@ static void process_file(struct jit_backend *backend, const char *filename,
   sanitize_ir(&ir);
 
   /* run optimization passes */
-  char passes[OPTION_MAX_LENGTH];
-  strncpy(passes, OPTION_pass, sizeof(passes));
-
   int num_instrs_before = get_num_instrs(&ir);
+  int64_t start = time_nanoseconds();
 
-  char *name = strtok(passes, ",");
-  while (name) {
-    if (!strcmp(name, "cfa")) {
-      struct cfa *cfa = cfa_create();
-      cfa_run(cfa, &ir);
-      cfa_destroy(cfa);
-    } else if (!strcmp(name, "lse")) {
-      struct lse *lse = lse_create();
-      lse_run(lse, &ir);
-      lse_destroy(lse);
-    } else if (!strcmp(name, "cprop")) {
-      struct cprop *cprop = cprop_create();
-      cprop_run(cprop, &ir);
-      cprop_destroy(cprop);
-    } else if (!strcmp(name, "dce")) {
-      struct dce *dce = dce_create();
-      dce_run(dce, &ir);
-      dce_destroy(dce);
-    } else if (!strcmp(name, "esimp")) {
-      struct esimp *esimp = esimp_create();
-      esimp_run(esimp, &ir);
-      esimp_destroy(esimp);
-    } else if (!strcmp(name, "ra")) {
-      struct ra *ra = ra_create(backend->registers, backend->num_registers,
-                                backend->emitters, backend->num_emitters);
-      ra_run(ra, &ir);
-      ra_destroy(ra);
-    } else {
-      LOG_WARNING("unknown pass %s", name);
-    }
+  for (int i = 0; i < jit_pass_manager_num_passes(pm); i++) {
+    jit_pass_manager_run_pass(pm, i, &ir);
 
     /* print ir after each pass if requested */
     if (!disable_dumps) {
       LOG_INFO("===-----------------------------------------------------===");
-      LOG_INFO("ir after %s", name);
+      LOG_INFO("ir after %s", jit_pass_manager_pass_name(pm, i));
       LOG_INFO("===-----------------------------------------------------===");
       ir_write(&ir, stdout);
       LOG_INFO("");
     }
-
-    name = strtok(NULL, ",");
   }
 
-  int num_instrs_after = get_num_instrs(&ir);
-
   /* assemble backend code */
   backend->reset(backend);
   uint8_t *host_addr = NULL;
   int host_size = 0;
-  int res =
-      backend->assemble_code(backend, &ir, &host_addr, &host_size, NULL, NULL);
+  uint8_t *cold_addr = NULL;
+  int res = backend->assemble_code(backend, &ir, &host_addr, &host_size,
+                                   (jit_emit_cb)emit_callback, &cold_addr);
   CHECK(res);
 
+  int hot_size = cold_addr ? (int)(cold_addr - host_addr) : host_size;
+
+  int64_t end = time_nanoseconds();
+  int num_instrs_after = get_num_instrs(&ir);
+
   if (!disable_dumps) {
     LOG_INFO("===-----------------------------------------------------===");
-    LOG_INFO("x64 code");
+    LOG_INFO(HOST_ARCH " code");
     LOG_INFO("===-----------------------------------------------------===");
     backend->dump_code(backend, host_addr, host_size, stdout);
+    LOG_INFO("%d hot bytes, %d cold bytes", hot_size, host_size - hot_size);
+    LOG_INFO("");
+  }
+
+  struct ir_arena_stats arena_stats;
+  ir_arena_stats(arena, &arena_stats);
+
+  if (!disable_dumps) {
+    LOG_INFO("ir peak %d bytes, %d reused allocations", arena_stats.peak,
+             arena_stats.reused);
     LOG_INFO("");
   }
 
   /* update stats */
   STAT_ir_instrs_total += num_instrs_before;
   STAT_ir_instrs_removed += num_instrs_before - num_instrs_after;
+  STAT_ir_peak_bytes = MAX(STAT_ir_peak_bytes, arena_stats.peak);
+  STAT_ir_reserved_bytes = arena_stats.reserved;
+  STAT_code_hot_bytes += hot_size;
+  STAT_code_cold_bytes += host_size - hot_size;
+
+  totals.ns += end - start;
+  totals.blocks++;
+  totals.instrs += num_instrs_before;
+  totals.code_size += host_size;
+  totals.spills += get_num_spills(&ir);
 }
 
-static void process_dir(struct jit_backend *backend, const char *path) {
+static void process_dir(struct jit_backend *backend,
+                        struct jit_pass_manager *pm, struct ir_arena *arena,
+                        const char *path) {
   DIR *dir = opendir(path);
 
   if (!dir) {
@@ -157,14 +208,136 @@ static void process_dir(struct jit_backend *backend, const char *path) {
     snprintf(filename, sizeof(filename), "%s" PATH_SEPARATOR "%s", path,
              ent->d_name);
 
-    LOG_INFO("processing %s", filename);
+    if (!OPTION_bench) {
+      LOG_INFO("processing %s", filename);
+    }
 
-    process_file(backend, filename, 1);
+    process_file(backend, pm, arena, filename, 1);
   }
 
   closedir(dir);
 }
 
+static void bench_collect(struct bench_results *res, int iterations) {
+  double secs = (double)totals.ns / NS_PER_SEC;
+
+  res->blocks = (double)totals.blocks / iterations;
+  res->instrs = (double)totals.instrs / iterations;
+  res->blocks_per_sec = secs ? totals.blocks / secs : 0.0;
+  res->instrs_per_sec = secs ? totals.instrs / secs : 0.0;
+  res->code_size = (double)totals.code_size / iterations;
+  res->spills = (double)totals.spills / iterations;
+}
+
+static int bench_write(const struct bench_results *res, const char *filename) {
+  FILE *file = fopen(filename, "w");
+
+  if (!file) {
+    LOG_WARNING("failed to open %s", filename);
+    return 0;
+  }
+
+  fprintf(file, "{\n");
+  fprintf(file, "  \"passes\": \"%s\",\n", OPTION_pass);
+  fprintf(file, "  \"blocks\": %.0f,\n", res->blocks);
+  fprintf(file, "  \"instrs\": %.0f,\n", res->instrs);
+  fprintf(file, "  \"blocks_per_sec\": %.2f,\n", res->blocks_per_sec);
+  fprintf(file, "  \"instrs_per_sec\": %.2f,\n", res->instrs_per_sec);
+  fprintf(file, "  \"code_size\": %.0f,\n", res->code_size);
+  fprintf(file, "  \"spills\": %.0f\n", res->spills);
+  fprintf(file, "}\n");
+  fclose(file);
+
+  return 1;
+}
+
+/* the baseline is the flat object written by bench_write, only the numeric
+   members are read back */
+static int bench_read_member(const char *json, const char *name,
+                             double *value) {
+  char key[64];
+  snprintf(key, sizeof(key), "\"%s\"", name);
+
+  const char *ptr = strstr(json, key);
+
+  if (!ptr) {
+    return 0;
+  }
+
+  ptr = strchr(ptr + strlen(key), ':');
+
+  if (!ptr) {
+    return 0;
+  }
+
+  char *end = NULL;
+  *value = strtod(ptr + 1, &end);
+  return end != ptr + 1;
+}
+
+static int bench_read(struct bench_results *res, const char *filename) {
+  FILE *file = fopen(filename, "r");
+
+  if (!file) {
+    LOG_WARNING("failed to open %s", filename);
+    return 0;
+  }
+
+  char json[4096];
+  int n = (int)fread(json, 1, sizeof(json) - 1, file);
+  json[n] = 0;
+  fclose(file);
+
+  if (!bench_read_member(json, "blocks", &res->blocks) ||
+      !bench_read_member(json, "instrs", &res->instrs) ||
+      !bench_read_member(json, "blocks_per_sec", &res->blocks_per_sec) ||
+      !bench_read_member(json, "instrs_per_sec", &res->instrs_per_sec) ||
+      !bench_read_member(json, "code_size", &res->code_size) ||
+      !bench_read_member(json, "spills", &res->spills)) {
+    LOG_WARNING("failed to parse %s", filename);
+    return 0;
+  }
+
+  return 1;
+}
+
+static int bench_check(const char *name, double base, double curr,
+                       int higher_is_better, double tolerance) {
+  double delta = base ? (curr - base) / base : 0.0;
+  int regressed = higher_is_better ? delta < -tolerance : delta > tolerance;
+
+  LOG_INFO("%-16s %14.2f %14.2f %+8.2f%%%s", name, base, curr, delta * 100.0,
+           regressed ? "  REGRESSED" : "");
+
+  return !regressed;
+}
+
+static int bench_compare(const struct bench_results *base,
+                         const struct bench_results *curr) {
+  /* numbers from different inputs can't be compared */
+  if (base->blocks != curr->blocks || base->instrs != curr->instrs) {
+    LOG_WARNING("input doesn't match the baseline, expected %.0f blocks and "
+                "%.0f instrs, found %.0f blocks and %.0f instrs",
+                base->blocks, base->instrs, curr->blocks, curr->instrs);
+    return 0;
+  }
+
+  /* throughput is noisy and given some leeway, the emitted code is
+     deterministic and must not grow at all */
+  double tolerance = OPTION_tolerance / 100.0;
+  int pass = 1;
+
+  LOG_INFO("%-16s %14s %14s %9s", "", "baseline", "current", "delta");
+  pass &= bench_check("blocks / s", base->blocks_per_sec, curr->blocks_per_sec,
+                      1, tolerance);
+  pass &= bench_check("instrs / s", base->instrs_per_sec, curr->instrs_per_sec,
+                      1, tolerance);
+  pass &= bench_check("code size", base->code_size, curr->code_size, 0, 0.0);
+  pass &= bench_check("spills", base->spills, curr->spills, 0, 0.0);
+
+  return pass;
+}
+
 int main(int argc, char **argv) {
   if (!options_parse(&argc, &argv)) {
     return EXIT_FAILURE;
@@ -175,18 +348,54 @@ int main(int argc, char **argv) {
   struct jit_guest guest = {0};
   guest.addr_mask = 0xff;
 
-  struct jit_backend *backend = x64_backend_create(&guest, code, sizeof(code));
+  struct jit_backend *backend = host_backend_create(&guest, code, sizeof(code));
+  struct jit_pass_manager *pm =
+      jit_pass_manager_create("recc", backend, OPTION_pass);
+  struct ir_arena *arena = ir_arena_create();
+
+  int iterations = MAX(OPTION_bench, 1);
 
-  if (fs_isfile(path)) {
-    process_file(backend, path, 0);
-  } else {
-    process_dir(backend, path);
+  for (int i = 0; i < iterations; i++) {
+    if (fs_isfile(path)) {
+      process_file(backend, pm, arena, path, OPTION_bench);
+    } else {
+      process_dir(backend, pm, arena, path);
+    }
   }
 
   LOG_INFO("");
   pass_stats_dump();
 
+  int success = 1;
+
+  if (OPTION_bench) {
+    struct bench_results res;
+    bench_collect(&res, iterations);
+
+    LOG_INFO("===-----------------------------------------------------===");
+    LOG_INFO("benchmark, %d iterations", iterations);
+    LOG_INFO("===-----------------------------------------------------===");
+    LOG_INFO("%.0f blocks, %.0f instrs", res.blocks, res.instrs);
+    LOG_INFO("%.2f blocks / s, %.2f instrs / s", res.blocks_per_sec,
+             res.instrs_per_sec);
+    LOG_INFO("%.0f bytes of code, %.0f spills", res.code_size, res.spills);
+    LOG_INFO("");
+
+    if (OPTION_baseline[0]) {
+      struct bench_results base;
+
+      if (OPTION_update_baseline) {
+        success = bench_write(&res, OPTION_baseline);
+      } else {
+        success = bench_read(&base, OPTION_baseline) &&
+                  bench_compare(&base, &res);
+      }
+    }
+  }
+
+  ir_arena_destroy(arena);
+  jit_pass_manager_destroy(pm);
   backend->destroy(backend);
 
-  return EXIT_SUCCESS;
+  return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
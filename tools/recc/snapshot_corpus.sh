@@ -0,0 +1,51 @@
+#!/bin/sh
+#
+# snapshots the raw ir compiled while running a game into a corpus directory,
+# for use with recc's benchmark mode
+#
+# usage: snapshot_corpus.sh <redream> <game> <corpus dir> [seconds] [guest]
+#
+# the game is run for the given number of seconds (default 60) with the code
+# cache disabled, so every block is translated and dumped. when no display is
+# available, redream is run under xvfb-run, rendering through mesa's software
+# rasterizer
+#
+
+set -e
+
+if [ $# -lt 3 ]; then
+  echo "usage: $0 <redream> <game> <corpus dir> [seconds] [guest]"
+  exit 1
+fi
+
+redream=$1
+game=$2
+corpus=$3
+seconds=${4:-60}
+guest=${5:-sh4}
+
+appdir="$HOME/.redream"
+irdir="$appdir/$guest-raw-ir"
+
+# start from a clean dump
+rm -rf "$irdir"
+
+wrapper=
+if [ -z "$DISPLAY" ] && command -v xvfb-run > /dev/null; then
+  wrapper="xvfb-run -a"
+  export LIBGL_ALWAYS_SOFTWARE=1
+fi
+
+# redream runs until killed, a timeout is expected
+$wrapper timeout "$seconds" "$redream" --jit_dump=1 --jit_cache=0 \
+  --jit_async=0 "$game" || true
+
+if [ ! -d "$irdir" ]; then
+  echo "no ir was dumped to $irdir"
+  exit 1
+fi
+
+mkdir -p "$corpus"
+cp "$irdir"/*.ir "$corpus"/
+
+echo "copied $(ls "$irdir" | wc -l) blocks to $corpus"